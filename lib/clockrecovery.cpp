@@ -0,0 +1,130 @@
+/*!
+ \file    clockrecovery.cpp
+ \brief   Source file of the class ClockRecovery.
+ */
+
+#include "clockrecovery.h"
+#include <cmath>
+
+
+ClockRecovery::ClockRecovery(int64_t window_ns) : window(window_ns) {
+    reset();
+}
+
+void ClockRecovery::reset() {
+    started = false;
+    baseIndex = 0;
+    baseTime = 0;
+    windowStart = 0;
+    windows = 0;
+    windowValid = false;
+    windowX = windowY = windowResidual = 0.0;
+    delaySum = delaySquares = 0.0;
+    delayCount = 0;
+    points = 0;
+    nextPoint = 0;
+    fitted = 0;
+    intercept = 0.0;
+    period = 0.0;
+    jitter = 0.0;
+    residual = 0.0;
+    lastIndex = 0;
+    lastEstimate = 0;
+}
+
+/*!
+     \brief Account for a frame
+            Within a window the frame with the lowest residual (arrival time minus the time the current
+            line expects) waited least in the adapter and the driver; on ties (frames read in the same
+            chunk) the newest one. The first window only gives a rough period to rank residuals, every
+            later one adds its least delayed frame to the fit.
+     \param index : index of the frame in the device's stream, counting the frames lost on the link
+     \param host_ns : time the frame was read, timeOut::now_ns
+     \return the estimated sampling time of the frame, host_ns until ready()
+  */
+int64_t ClockRecovery::add(uint64_t index, int64_t host_ns) {
+    if (!started) {
+        started = true;
+        baseIndex = index;
+        baseTime = host_ns;
+        windowStart = host_ns;
+    }
+    double x = (double)(int64_t)(index - baseIndex);
+    double y = (double)(host_ns - baseTime);
+    double delay = y - (intercept + x * period);
+    if (!windowValid || delay <= windowResidual) {
+        windowValid = true;
+        windowX = x;
+        windowY = y;
+        windowResidual = delay;
+    }
+    if (fitted > 0) {
+        delaySum += delay;
+        delaySquares += delay * delay;
+        delayCount++;
+    }
+
+    if (host_ns - windowStart >= window) {
+        if (windows == 0) {
+            if (x > 0.0) period = y / x;
+        } else {
+            pointX[nextPoint] = windowX;
+            pointY[nextPoint] = windowY;
+            nextPoint = (nextPoint + 1) % CLOCK_RECOVERY_WINDOWS;
+            if (points < CLOCK_RECOVERY_WINDOWS) points++;
+            fit();
+        }
+        if (delayCount > 1) {
+            double mean = delaySum / delayCount;
+            double variance = delaySquares / delayCount - mean * mean;
+            jitter = variance > 0.0 ? std::sqrt(variance) : 0.0;
+        }
+        delaySum = delaySquares = 0.0;
+        delayCount = 0;
+        windows++;
+        windowStart = host_ns;
+        windowValid = false;
+    }
+
+    if (!ready()) return host_ns;
+    int64_t estimate = timeOf(index);
+    if (index > lastIndex && estimate <= lastEstimate) estimate = lastEstimate + 1;
+    lastIndex = index;
+    lastEstimate = estimate;
+    return estimate;
+}
+
+// Least-squares line through the least delayed frames of the last windows
+void ClockRecovery::fit() {
+    double meanX = 0.0, meanY = 0.0;
+    for (int i = 0; i < points; ++i) {
+        meanX += pointX[i];
+        meanY += pointY[i];
+    }
+    meanX /= points;
+    meanY /= points;
+    double sxx = 0.0, sxy = 0.0;
+    for (int i = 0; i < points; ++i) {
+        sxx += (pointX[i] - meanX) * (pointX[i] - meanX);
+        sxy += (pointX[i] - meanX) * (pointY[i] - meanY);
+    }
+    // A single point (or frames lost for a whole window) keeps the previous period
+    if (sxx > 0.0) period = sxy / sxx;
+    intercept = meanY - period * meanX;
+
+    double squares = 0.0;
+    for (int i = 0; i < points; ++i) {
+        double e = pointY[i] - (intercept + pointX[i] * period);
+        squares += e * e;
+    }
+    residual = points > 2 ? std::sqrt(squares / points) : 0.0;
+    fitted++;
+}
+
+int64_t ClockRecovery::timeOf(uint64_t index) const {
+    return baseTime + (int64_t)std::llround(intercept + (double)(int64_t)(index - baseIndex) * period);
+}
+
+double ClockRecovery::offset_ns() const {
+    return (double)baseTime + intercept - (double)baseIndex * period;
+}
@@ -0,0 +1,89 @@
+/*!
+\file    clockrecovery.h
+\brief   Recovery of a device's sample clock from the host times its frames arrived at.
+
+A USB serial adapter hands the bytes over in batches: the host reads a frame 0 to several
+milliseconds after the device sampled it, and every frame of a batch at the same time. The device
+itself samples at a steady rate, so frame k was sampled at offset + k * period on the host clock, and
+arrived at that time plus a delay that is never negative. ClockRecovery keeps, for each window of host
+time, the frame that waited least, and fits a line through the last of those frames by least squares:
+the line gives every frame a timestamp free of the transport jitter, follows the drift between the
+two crystals, and is known after a few windows.
+*/
+
+
+#ifndef CLOCKRECOVERY_H
+#define CLOCKRECOVERY_H
+
+#include <cstdint>
+
+/*! Windows of host time kept by the fit */
+#define CLOCK_RECOVERY_WINDOWS 32
+
+/*!  \class     ClockRecovery
+     \brief     Sliding-window regression of the device's frame times on the host monotonic clock.
+*/
+class ClockRecovery {
+public:
+    // Windows of window_ns of host time, the fit spans the last CLOCK_RECOVERY_WINDOWS of them
+    explicit ClockRecovery(int64_t window_ns = 500000000LL);
+
+    // Forget everything, for a device whose stream restarts
+    void reset();
+
+    // Account for the frame index received at host_ns, returns its estimated sampling time
+    // (host_ns until the clock is ready)
+    int64_t add(uint64_t index, int64_t host_ns);
+
+    // True once enough windows were fitted for the estimates to hold
+    bool ready() const { return fitted >= 3; }
+
+    // Estimated host time of any frame index, undefined until ready()
+    int64_t timeOf(uint64_t index) const;
+
+    // The device sampled its k-th frame at offset_ns() + k * period_ns()
+    double offset_ns() const;
+    double period_ns() const { return period; }
+
+    // Standard deviation of the arrival delays over the last window: the jitter that was removed
+    double jitter_ns() const { return jitter; }
+
+    // RMS distance of the least delayed frames to the fitted line: the error left in the timestamps
+    double residual_ns() const { return residual; }
+
+private:
+    void fit();
+
+    int64_t  window;
+    bool     started;
+    // Frames and times are stored relative to the first frame, to keep the fit precise in doubles
+    uint64_t baseIndex;
+    int64_t  baseTime;
+    int64_t  windowStart;
+    int      windows;
+    // Least delayed frame of the current window
+    bool     windowValid;
+    double   windowX;
+    double   windowY;
+    double   windowResidual;
+    // Arrival delays of the current window around the estimate
+    double   delaySum;
+    double   delaySquares;
+    uint32_t delayCount;
+    // Least delayed frame of each of the last windows, ring of fitted points
+    double   pointX[CLOCK_RECOVERY_WINDOWS];
+    double   pointY[CLOCK_RECOVERY_WINDOWS];
+    int      points;
+    int      nextPoint;
+    int      fitted;
+    // Fitted line: time = intercept + (index - baseIndex) * period, relative to baseTime
+    double   intercept;
+    double   period;
+    double   jitter;
+    double   residual;
+    // Last estimate, timestamps never go backwards when the line is refitted
+    uint64_t lastIndex;
+    int64_t  lastEstimate;
+};
+
+#endif // CLOCKRECOVERY_H
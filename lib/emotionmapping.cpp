@@ -0,0 +1,300 @@
+/*!
+ \file    emotionmapping.cpp
+ \brief   Source file of the class EmotionMapping.
+ */
+
+#include "emotionmapping.h"
+#include "simdlanes.h"
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+
+// Mapping of the original installation, also in config/emotion_mapping.txt
+static const char *BUILTIN_MAPPING = R"map(
+threshold 0
+rule density   none   0.1  0      0      -inf  inf
+rule density   left   0.1  0      0      -inf  inf
+rule density   right  0.1  0      19.9   0.1   20
+rule density   both   0.1  -0.05  -0.05  0.1   20
+rule noise     none   1    0      0      -inf  inf
+rule noise     left   1    -23    0      -22   22
+rule noise     right  1    0      0      -inf  inf
+rule noise     both   1    10.5   10.5   -22   22
+rule swirl     none   0    0      0      -inf  inf
+rule swirl     left   0    200    0      -inf  inf
+rule swirl     right  0    0      0      -inf  inf
+rule swirl     both   0    100    100    -inf  inf
+rule timeScale none   1    0      0      -inf  inf
+rule timeScale left   1    -1     0      0.1   1
+rule timeScale right  1    0      4      1     5
+rule timeScale both   1    -1     4      0.1   5
+)map";
+
+static const char *REGION_NAMES[EMOTION_REGIONS] = {"none", "left", "right", "both"};
+
+// Coefficients of a rule as laid out for the kernel: constant, left, right, min, max
+enum { COEFFICIENT_CONSTANT, COEFFICIENT_LEFT, COEFFICIENT_RIGHT, COEFFICIENT_MIN, COEFFICIENT_MAX, COEFFICIENTS };
+
+// Copies of each coefficient for the kernel, a whole vector of them
+static const uint32_t COPIES = 4;
+
+
+EmotionMapping::EmotionMapping() : threshold(0.0f), table(0) {
+    parse(BUILTIN_MAPPING, "built-in mapping");
+}
+
+bool EmotionMapping::load(const char *path) {
+    std::ifstream file(path);
+    if (!file.is_open()) {
+        std::cerr << "Cannot open the mapping " << path << std::endl;
+        return false;
+    }
+    std::stringstream buffer;
+    buffer << file.rdbuf();
+    return parse(buffer.str(), path);
+}
+
+bool EmotionMapping::parse(const std::string &text, const char *source) {
+    // Read into a copy without rules, which replaces this one once every line is valid
+    EmotionMapping parsed(*this);
+    parsed.names.clear();
+    parsed.curved.clear();
+    for (std::vector<float> *coefficients : {&parsed.constant, &parsed.leftGain, &parsed.rightGain, &parsed.minimum,
+                                             &parsed.maximum, &parsed.leftPower, &parsed.rightPower, &parsed.lanes})
+        coefficients->clear();
+    parsed.setThreshold(0.0f);
+
+    std::istringstream lines(text);
+    std::string line;
+    int number = 0;
+    while (std::getline(lines, line)) {
+        number++;
+        size_t comment = line.find('#');
+        if (comment != std::string::npos) line.erase(comment);
+        std::istringstream words(line);
+        std::string keyword;
+        if (!(words >> keyword)) continue;
+
+        // Numbers through strtof, which reads inf and -inf
+        std::vector<float> numbers;
+        std::string name, region, word;
+        if (keyword == "rule") words >> name >> region;
+        bool valid = keyword == "threshold" || keyword == "rule";
+        while (valid && words >> word) {
+            char *end;
+            numbers.push_back(strtof(word.c_str(), &end));
+            valid = *end == '\0';
+        }
+
+        if (valid && keyword == "threshold" && numbers.size() == 1 && numbers[0] >= 0.0f && numbers[0] < 1.0f) {
+            parsed.setThreshold(numbers[0]);
+            continue;
+        }
+        int r = 0;
+        while (r < EMOTION_REGIONS && region != REGION_NAMES[r]) r++;
+        if (valid && keyword == "rule" && r < EMOTION_REGIONS && (numbers.size() == 5 || numbers.size() == 7)) {
+            EmotionRule rule;
+            rule.constant = numbers[0];
+            rule.left = numbers[1];
+            rule.right = numbers[2];
+            rule.min = numbers[3];
+            rule.max = numbers[4];
+            if (numbers.size() == 7) {
+                rule.leftPower = numbers[5];
+                rule.rightPower = numbers[6];
+            }
+            parsed.setRule(parsed.addParameter(name), (EmotionRegion)r, rule);
+            continue;
+        }
+        std::cerr << source << ":" << number << ": cannot read \"" << line << "\"" << std::endl;
+        return false;
+    }
+    *this = parsed;
+    bakeTables(table);
+    return true;
+}
+
+int EmotionMapping::parameter(const std::string &name) const {
+    for (size_t p = 0; p < names.size(); ++p)
+        if (names[p] == name) return (int)p;
+    return -1;
+}
+
+uint32_t EmotionMapping::addParameter(const std::string &name) {
+    int existing = parameter(name);
+    if (existing >= 0) return (uint32_t)existing;
+    names.push_back(name);
+    curved.push_back(0);
+    size_t coefficients = names.size() * EMOTION_REGIONS;
+    constant.resize(coefficients, 0.0f);
+    leftGain.resize(coefficients, 0.0f);
+    rightGain.resize(coefficients, 0.0f);
+    minimum.resize(coefficients, -INFINITY);
+    maximum.resize(coefficients, INFINITY);
+    leftPower.resize(coefficients, 1.0f);
+    rightPower.resize(coefficients, 1.0f);
+    lanes.resize(coefficients * COEFFICIENTS * COPIES, 0.0f);
+    for (uint32_t r = EMOTION_NONE; r < EMOTION_REGIONS; ++r)
+        setRule((uint32_t)names.size() - 1, (EmotionRegion)r, EmotionRule());
+    return (uint32_t)names.size() - 1;
+}
+
+void EmotionMapping::setRule(uint32_t parameter, EmotionRegion region, const EmotionRule &rule) {
+    if (parameter >= names.size() || region >= EMOTION_REGIONS) return;
+    size_t i = (size_t)parameter * EMOTION_REGIONS + region;
+    constant[i] = rule.constant;
+    leftGain[i] = rule.left;
+    rightGain[i] = rule.right;
+    minimum[i] = rule.min;
+    maximum[i] = rule.max;
+    leftPower[i] = rule.leftPower;
+    rightPower[i] = rule.rightPower;
+    const float coefficients[COEFFICIENTS] = {rule.constant, rule.left, rule.right, rule.min, rule.max};
+    for (uint32_t k = 0; k < COEFFICIENTS; ++k)
+        for (uint32_t copy = 0; copy < COPIES; ++copy)
+            lanes[(i * COEFFICIENTS + k) * COPIES + copy] = coefficients[k];
+    size_t first = (size_t)parameter * EMOTION_REGIONS;
+    curved[parameter] = 0;
+    for (size_t r = first; r < first + EMOTION_REGIONS; ++r)
+        if (leftPower[r] != 1.0f || rightPower[r] != 1.0f) curved[parameter] = 1;
+}
+
+void EmotionMapping::setThreshold(float value) {
+    threshold = value < 0.0f ? 0.0f : (value > 0.99f ? 0.99f : value);
+}
+
+// One rule on one zone, for the tables
+float EmotionMapping::evaluateRule(uint32_t p, EmotionRegion region, float left, float right) const {
+    size_t i = (size_t)p * EMOTION_REGIONS + region;
+    float l = leftPower[i] == 1.0f ? left : std::pow(left > 0.0f ? left : 0.0f, leftPower[i]);
+    float r = rightPower[i] == 1.0f ? right : std::pow(right > 0.0f ? right : 0.0f, rightPower[i]);
+    float y = constant[i] + leftGain[i] * l + rightGain[i] * r;
+    return y < minimum[i] ? minimum[i] : (y > maximum[i] ? maximum[i] : y);
+}
+
+/*!
+     \brief Sample the rules for evaluate(): point 0 of each axis is the inactive input, points 1 .. size-1
+            run from the threshold to 1
+     \param size : points per axis, at least 3, 0 to drop the tables
+  */
+void EmotionMapping::bakeTables(uint32_t size) {
+    table = size == 0 ? 0 : (size < 3 ? 3 : size);
+    tables.assign((size_t)table * table * names.size(), 0.0f);
+    if (!table) return;
+    for (uint32_t p = 0; p < names.size(); ++p) {
+        float *samples = &tables[(size_t)p * table * table];
+        for (uint32_t i = 0; i < table; ++i) {
+            float l = i ? threshold + (1.0f - threshold) * (i - 1) / (table - 2) : 0.0f;
+            for (uint32_t j = 0; j < table; ++j) {
+                float r = j ? threshold + (1.0f - threshold) * (j - 1) / (table - 2) : 0.0f;
+                EmotionRegion region = i ? (j ? EMOTION_BOTH : EMOTION_LEFT) : (j ? EMOTION_RIGHT : EMOTION_NONE);
+                samples[(size_t)i * table + j] = evaluateRule(p, region, l, r);
+            }
+        }
+    }
+}
+
+void EmotionMapping::evaluate(const float *left, const float *right, uint32_t zones, float *out, size_t stride) {
+    if (table) {
+        evaluateTables(left, right, zones, out, stride);
+        return;
+    }
+#if defined (SIMD_LANES_VECTOR)
+    // The zones after the last whole group, padded to one
+    const uint32_t width = VectorLanes::width;
+    const uint32_t whole = zones - zones % width;
+    float tailLeft[width] = {}, tailRight[width] = {}, tail[width];
+    for (uint32_t i = 0; i < width; ++i) {
+        tailLeft[i] = whole + i < zones ? left[whole + i] : 0.0f;
+        tailRight[i] = whole + i < zones ? right[whole + i] : 0.0f;
+    }
+#endif
+    for (uint32_t p = 0; p < names.size(); ++p) {
+        float *values = out + p * stride;
+        uint32_t z = 0;
+#if defined (SIMD_LANES_VECTOR)
+        if (!curved[p]) {
+            z = evaluateLanes<VectorLanes>(p, left, right, z, whole, values);
+            if (whole < zones) {
+                evaluateLanes<VectorLanes>(p, tailLeft, tailRight, 0, width, tail);
+                for (uint32_t i = 0; i < width; ++i)
+                    if (whole + i < zones) values[whole + i] = tail[i];
+                z = zones;
+            }
+        }
+#endif
+        evaluateLanes<ScalarLanes>(p, left, right, z, zones, values);
+    }
+}
+
+/*!
+     \brief Parameter p of Lanes::width zones at a time, from zone z while a whole group fits before zones:
+            the rules of the four regions on every zone, then the one of its region. The powers are
+            applied one zone at a time
+     \return the first zone left
+  */
+template <typename L>
+uint32_t EmotionMapping::evaluateLanes(uint32_t p, const float *left, const float *right, uint32_t z, uint32_t zones, float *out) const {
+    typedef typename L::V V;
+    typedef typename L::M M;
+    const V zero = L::set(0.0f);
+    const V limit = L::set(threshold);
+    // Coefficient k of region r
+    const float *k = &lanes[(size_t)p * EMOTION_REGIONS * COEFFICIENTS * COPIES];
+    auto coefficient = [k](uint32_t r, uint32_t c) { return L::load(k + (r * COEFFICIENTS + c) * COPIES); };
+
+    for (; z + L::width <= zones; z += L::width) {
+        // Inputs under 0 (and NaN) read as 0
+        V l = L::max(L::load(left + z), zero);
+        V r = L::max(L::load(right + z), zero);
+        M activeLeft = L::gt(l, limit);
+        M activeRight = L::gt(r, limit);
+        if constexpr (L::width == 1) {
+            if (curved[p]) {
+                EmotionRegion region = activeLeft ? (activeRight ? EMOTION_BOTH : EMOTION_LEFT) : (activeRight ? EMOTION_RIGHT : EMOTION_NONE);
+                out[z] = evaluateRule(p, region, l, r);
+                continue;
+            }
+        }
+        auto rule = [&](uint32_t g) {
+            V sum = L::add(coefficient(g, COEFFICIENT_CONSTANT),
+                           L::add(L::mul(coefficient(g, COEFFICIENT_LEFT), l), L::mul(coefficient(g, COEFFICIENT_RIGHT), r)));
+            return L::min(L::max(sum, coefficient(g, COEFFICIENT_MIN)), coefficient(g, COEFFICIENT_MAX));
+        };
+        L::store(out + z, L::select(activeLeft, L::select(activeRight, rule(EMOTION_BOTH), rule(EMOTION_LEFT)),
+                                                L::select(activeRight, rule(EMOTION_RIGHT), rule(EMOTION_NONE))));
+    }
+    return z;
+}
+
+// Bilinear interpolation in the tables, the cells of the zones found once for every parameter
+void EmotionMapping::evaluateTables(const float *left, const float *right, uint32_t zones, float *out, size_t stride) {
+    cells.resize(zones);
+    cellLeft.resize(zones);
+    cellRight.resize(zones);
+    const float scale = (table - 2) / (1.0f - threshold);
+    const float last = (float)(table - 1);
+    for (uint32_t z = 0; z < zones; ++z) {
+        // Position on each axis: 0 when inactive (NaN included), 1 .. table-1 from the threshold to 1
+        float l = left[z] > threshold ? 1.0f + (left[z] - threshold) * scale : 0.0f;
+        float r = right[z] > threshold ? 1.0f + (right[z] - threshold) * scale : 0.0f;
+        l = l < last ? l : last;
+        r = r < last ? r : last;
+        uint32_t i = (uint32_t)l < table - 2 ? (uint32_t)l : table - 2;
+        uint32_t j = (uint32_t)r < table - 2 ? (uint32_t)r : table - 2;
+        cells[z] = i * table + j;
+        cellLeft[z] = l - i;
+        cellRight[z] = r - j;
+    }
+    for (uint32_t p = 0; p < names.size(); ++p) {
+        const float *samples = &tables[(size_t)p * table * table];
+        float *values = out + p * stride;
+        for (uint32_t z = 0; z < zones; ++z) {
+            const float *s = samples + cells[z];
+            float top = s[0] + (s[1] - s[0]) * cellRight[z];
+            float bottom = s[table] + (s[table + 1] - s[table]) * cellRight[z];
+            values[z] = top + (bottom - top) * cellLeft[z];
+        }
+    }
+}
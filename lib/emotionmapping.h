@@ -0,0 +1,119 @@
+/*!
+\file    emotionmapping.h
+\brief   Mapping of the two inputs of every zone, melancholy (left) and happiness (right), to the
+         parameters of its shader, as set by a mapping file.
+
+An input is active above the threshold, which puts a zone in one of four regions: none, left
+(melancholy alone), right (happiness alone) or both. In each region a parameter follows a rule
+    clamp(constant + left * leftN^leftPower + right * rightN^rightPower, min, max)
+A mapping file lists the threshold and the rules, one per line, '#' starting a comment:
+
+    threshold 0
+    #     parameter  region  constant  left  right  min  max  [leftPower rightPower]
+    rule  swirl      left    0         200   0      0    inf
+
+min and max take inf and -inf. A parameter takes constant 0 in the regions it has no rule for.
+The inputs are expected in 0..1, as calibrated: an input under 0 reads as 0.
+*/
+
+
+#ifndef EMOTIONMAPPING_H
+#define EMOTIONMAPPING_H
+
+#include <cmath>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/**
+ * regions of the inputs of a zone
+ */
+enum EmotionRegion {
+    EMOTION_NONE, /**< no input active */
+    EMOTION_LEFT, /**< melancholy alone */
+    EMOTION_RIGHT, /**< happiness alone */
+    EMOTION_BOTH, /**< both inputs active */
+    EMOTION_REGIONS
+};
+
+/*!  \struct    EmotionRule
+     \brief     Value of a parameter in one region
+*/
+struct EmotionRule {
+    float constant = 0.0f;
+    float left = 0.0f;
+    float right = 0.0f;
+    float min = -INFINITY;
+    float max = INFINITY;
+    float leftPower = 1.0f;
+    float rightPower = 1.0f;
+};
+
+/*!  \class     EmotionMapping
+     \brief     The rules of every parameter, stored as one array per coefficient and region so that
+                evaluate() computes a parameter for four zones per instruction (simdlanes.h): the region
+                masks of the zones select the coefficients, then one multiply-add and a clamp, with no
+                branch whatever the region of each zone.
+                Rules with powers other than 1 need a pow per zone; bakeTables() samples every rule
+                on a grid over (leftN, rightN) instead, evaluated with bilinear interpolation in the same
+                time whatever the rules.
+                Constructed with the built-in mapping, the one of the original installation.
+*/
+class EmotionMapping {
+public:
+    EmotionMapping();
+
+    // Replace the rules with those of a mapping file (or text), returns false and keeps the
+    // previous ones on an error, reported on std::cerr
+    bool load(const char *path);
+    bool parse(const std::string &text, const char *source = "mapping");
+
+    // Parameter of that name, -1 if there is none
+    int parameter(const std::string &name) const;
+    const std::string &parameterName(uint32_t index) const { return names[index]; }
+    uint32_t parameterCount() const { return (uint32_t)names.size(); }
+
+    // Add a parameter (constant 0 in every region), returns its index, the existing one if it exists
+    uint32_t addParameter(const std::string &name);
+
+    void setRule(uint32_t parameter, EmotionRegion region, const EmotionRule &rule);
+    void setThreshold(float value);
+
+    // Sample every rule on size x size points for evaluate(), 0 to evaluate the rules themselves.
+    // Exact where the rules are linear between two points; an inactive input reads as 0 in a table, and
+    // an input past 1 as 1
+    void bakeTables(uint32_t size);
+    uint32_t tableSize() const { return table; }
+
+    // Parameters of zones 0 .. zones-1 from their inputs, parameter p of zone z in out[p * stride + z]
+    void evaluate(const float *left, const float *right, uint32_t zones, float *out, size_t stride);
+
+private:
+    template <typename Lanes>
+    uint32_t evaluateLanes(uint32_t p, const float *left, const float *right, uint32_t z, uint32_t zones, float *out) const;
+    void evaluateTables(const float *left, const float *right, uint32_t zones, float *out, size_t stride);
+    float evaluateRule(uint32_t p, EmotionRegion region, float left, float right) const;
+
+    float threshold;
+    std::vector<std::string> names;
+    // Coefficient of parameter p in region r at [p * EMOTION_REGIONS + r]
+    std::vector<float> constant;
+    std::vector<float> leftGain;
+    std::vector<float> rightGain;
+    std::vector<float> minimum;
+    std::vector<float> maximum;
+    std::vector<float> leftPower;
+    std::vector<float> rightPower;
+    // constant, left, right, min and max of each rule, each repeated over a vector, for evaluateLanes
+    std::vector<float> lanes;
+    // Parameters with a power other than 1 in some region
+    std::vector<uint8_t> curved;
+    // table x table samples per parameter, leftN along the rows, and room for the cells of the zones
+    uint32_t table;
+    std::vector<float> tables;
+    std::vector<uint32_t> cells;
+    std::vector<float> cellLeft;
+    std::vector<float> cellRight;
+};
+
+#endif // EMOTIONMAPPING_H
@@ -0,0 +1,1049 @@
+/*!
+ \file    sensoracquisition.cpp
+ \brief   Source file of the class SensorAcquisition.
+ */
+
+#include "sensoracquisition.h"
+#include "clockrecovery.h"
+#include "sensorcalibration.h"
+#include "sensorcapture.h"
+#include "sensorfilter.h"
+#include "serialdiscovery.h"
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <future>
+#include <iostream>
+
+#if defined (__linux__)
+    #include <sys/epoll.h>
+    #include <sys/inotify.h>
+#endif
+
+// Most bytes read from one device in one wake-up, about 5 s of data at 115200 baud
+static const size_t DRAIN_BUFFER_BYTES = 64 * 1024;
+
+// Upper bound on how long stop() waits for the thread to notice it
+static const int WAIT_TIMEOUT_MS = 100;
+
+// Most readiness events handled per wake-up
+static const int MAX_EVENTS = 16;
+
+// Delay between two reconnection attempts, shorter while device nodes are still settling after a hot-plug event
+static const int64_t RETRY_INTERVAL_NS = 1000000000LL;
+static const int64_t RETRY_AFTER_HOTPLUG_NS = 100000000LL;
+static const int64_t HOTPLUG_SETTLE_NS = 2000000000LL;
+
+// Bare frames with padding bits set in a row that mean the frames are misaligned, not corrupted
+static const uint32_t RAW_RESYNC_FRAMES = 2;
+
+// Pause of a replay as fast as possible while the history queue is full
+static const int64_t REPLAY_BACKOFF_NS = 100000LL;
+
+// epoll tags of the descriptors that are not devices
+static const uint64_t WAKE_TAG = ~0ULL;
+static const uint64_t HOTPLUG_TAG = ~0ULL - 1;
+
+
+/*!  \struct    SensorDevice
+     \brief     One serial device of SensorAcquisition and its decoding state
+*/
+struct SensorDevice {
+    // Open port, null or closed while disconnected
+    std::unique_ptr<serialib> serial;
+    // Port given to addDevice, empty to take any port streaming sensor frames
+    std::string       path;
+    // Port in use, or last used
+    std::string       currentPath;
+    unsigned int      bauds = 0;
+    unsigned int      openOptions = 0;
+    SensorWireFormat  format = SENSOR_WIRE_RAW16;
+    uint32_t          channelOffset = 0;
+    uint32_t          channelCount = 0;
+    // Channels carried by the previous frame, to clear the ones a shorter frame leaves out
+    uint32_t          lastCount = 0;
+    bool              open = false;
+    // Also waiting for room in the output queue of the port
+    bool              watchingOutput = false;
+    SensorFrameParser parser;
+    uint8_t           rawCarry[SENSOR_RAW16_FRAME_BYTES];
+    size_t            rawCarryLength = 0;
+    // Bare frames rejected in a row, and the counters of the bare formats
+    uint32_t          rawInvalid = 0;
+    // Bytes to drop before the next bare frame, when a replay starts mid-frame
+    size_t            rawSkip = 0;
+    SensorLinkStats   rawStats;
+    // Index of the next frame, counting the ones lost on the link when the format tells
+    uint64_t          frameIndex = 0;
+    int               lastSequence = -1;
+    uint64_t          frames = 0;
+    ClockRecovery     clock;
+    // Frame period seen by the filter, measured between the frames whose timestamp advanced
+    float             filterPeriod_s = 1e-3f;
+    int64_t           filterTime_ns = 0;
+    uint64_t          filterIndex = 0;
+    // Time the device node (re)appeared, 0 if unknown
+    int64_t           replugTime_ns = 0;
+    // Connected in the background, the first frame reports the time since replugTime_ns
+    bool              awaitingFirstFrame = false;
+
+    // Copies for other threads
+    std::atomic<bool>     connected{false};
+    // SerialOpenOptions the driver accepted, rewritten by every reconnection
+    std::atomic<unsigned int> accepted{0};
+    std::atomic<uint64_t> reconnectCount{0};
+    std::atomic<int64_t>  replugLatency{0};
+    std::atomic<uint64_t> framesCount{0};
+    std::atomic<uint64_t> linkFrames{0};
+    std::atomic<uint64_t> corruptCount{0};
+    std::atomic<uint64_t> droppedCount{0};
+    std::atomic<uint64_t> skippedCount{0};
+    std::atomic<int64_t>  clockOffset{0};
+    std::atomic<int64_t>  framePeriod{0};
+    std::atomic<int64_t>  clockJitter{0};
+    std::atomic<int64_t>  clockResidual{0};
+};
+
+
+/*!  \struct    ReconnectTask
+     \brief     Background attempt to open the disconnected devices, so the acquisition thread never waits
+                for open() or for a probe
+*/
+struct ReconnectTask {
+    struct Result {
+        size_t      index;
+        SerialProbe probe;
+    };
+    std::future<std::vector<Result>> results;
+    // Start of the attempt, stands for the replug time when no hot-plug event told it
+    int64_t                          started_ns = 0;
+};
+
+
+SensorAcquisition::SensorAcquisition()
+    : running(false), decoded(0), nextChannel(0), pollFd(-1), wakeRead(-1), wakeWrite(-1),
+      hotplugFd(-1), byIdWatch(-1), hotplugPending(false), lastHotplug_ns(0), nextRetry_ns(0),
+      drainBuffer(DRAIN_BUFFER_BYTES), chunkFrames(0), chunkTimestamp(0), replaySpeed(1.0), seekRequest(-1),
+      coalescedCount(0), historyOverflowCount(0) {}
+
+SensorAcquisition::~SensorAcquisition() {
+    stop();
+}
+
+/*!
+     \brief Open a sensor device, its frames feed the next channels of the shared frame
+     \param device : port name passed to serialib::openDevice
+     \param bauds : baud rate passed to serialib::openDevice
+     \param format : byte format sent by the board
+     \param openOptions : SerialOpenOptions requested from the driver, see acceptedOptions()
+     \param channels : channels reserved for the device, extra channels it sends are ignored
+            The channels stay reserved when the device fails to open, so the layout of the frame
+            does not depend on which boards are plugged in. Must be called before start()
+            A device that fails to open, or is unplugged later, is reopened in the background
+     \return the serialib::openDevice code, 1 on success, 0 when device is empty: the first port
+             streaming sensor frames is then searched in the background once started
+  */
+char SensorAcquisition::addDevice(const char *device, unsigned int bauds, SensorWireFormat format,
+                                   unsigned int openOptions, uint32_t channels) {
+    if (channels > SENSOR_MAX_CHANNELS - nextChannel) channels = SENSOR_MAX_CHANNELS - nextChannel;
+    std::unique_ptr<SensorDevice> dev(new SensorDevice);
+    dev->path = device ? device : "";
+    dev->currentPath = dev->path;
+    dev->bauds = bauds;
+    dev->openOptions = openOptions;
+    dev->format = format;
+    dev->channelOffset = nextChannel;
+    dev->channelCount = channels;
+    nextChannel += channels;
+    commandSequence.push_back(0);
+
+    char err = 0;
+    if (!dev->path.empty()) {
+        dev->serial.reset(new serialib);
+        unsigned int accepted = 0;
+        err = dev->serial->openDevice(device, bauds, openOptions, &accepted);
+        dev->accepted.store(accepted, std::memory_order_relaxed);
+    }
+    dev->open = err == 1;
+    dev->connected.store(dev->open, std::memory_order_relaxed);
+    devices.push_back(std::move(dev));
+    return err;
+}
+
+/*!
+     \brief Start reading the devices added with addDevice() on a background thread
+            Devices that are not open yet are opened in the background as soon as they show up
+     \return false if no device was added or epoll cannot be created (the thread is not started)
+  */
+bool SensorAcquisition::start() {
+    if (worker.joinable()) return true;
+    if (devices.empty()) return false;
+
+#if defined (__linux__)
+    pollFd = epoll_create1(EPOLL_CLOEXEC);
+    if (pollFd < 0) return false;
+#endif
+    // After the last step that can fail, so that a failed start() leaves no descriptor open
+#if defined (__linux__) || defined(__APPLE__)
+    int wake[2];
+    if (pipe(wake) == 0) {
+        wakeRead = wake[0];
+        wakeWrite = wake[1];
+        fcntl(wakeRead, F_SETFL, O_NONBLOCK);
+        fcntl(wakeWrite, F_SETFL, O_NONBLOCK);
+    }
+#endif
+#if defined (__linux__)
+    for (size_t i = 0; i < devices.size(); ++i)
+        if (devices[i]->open) watchDevice(i);
+    watchDescriptor(wakeRead, WAKE_TAG);
+    // Device nodes appearing and disappearing in /dev
+    hotplugFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (hotplugFd >= 0) {
+        inotify_add_watch(hotplugFd, "/dev", IN_CREATE | IN_ATTRIB | IN_DELETE);
+        byIdWatch = inotify_add_watch(hotplugFd, "/dev/serial/by-id", IN_CREATE | IN_DELETE);
+        watchDescriptor(hotplugFd, HOTPLUG_TAG);
+    }
+#endif
+    hotplugPending = false;
+    nextRetry_ns = timeOut::now_ns();
+
+    running.store(true, std::memory_order_release);
+    worker = std::thread(&SensorAcquisition::run, this);
+    return true;
+}
+
+/*!
+     \brief Open a single serial device and start reading it on a background thread
+     \param device : port name passed to serialib::openDevice
+     \param bauds : baud rate passed to serialib::openDevice
+     \param format : byte format sent by the board
+     \param openOptions : SerialOpenOptions requested from the driver, see acceptedOptions()
+     \return the serialib::openDevice code, 1 on success (the thread is only started on success),
+             -2 if the device opened but the thread could not be started
+  */
+char SensorAcquisition::start(const char *device, unsigned int bauds, SensorWireFormat format,
+                               unsigned int openOptions) {
+    stop();
+    // A framed board sends as many channels as it likes
+    char err = addDevice(device, bauds, format, openOptions,
+                         format == SENSOR_WIRE_FRAMED ? SENSOR_MAX_CHANNELS : SENSOR_CHANNELS);
+    if (err != 1) return err;
+    if (!start()) {
+        stop();
+        return -2;
+    }
+    return err;
+}
+
+void SensorAcquisition::stop() {
+    running.store(false, std::memory_order_release);
+    if (worker.joinable()) worker.join();
+    // Waits for a probe in progress, its ports are closed with it
+    reconnect.reset();
+    // Writes the index of the capture
+    capture.reset();
+    replay.reset();
+    for (auto &dev : devices) closeDevice(*dev);
+    devices.clear();
+    commandSequence.clear();
+    writer.clear();
+    nextChannel = 0;
+    composite.channelCount = 0;
+#if defined (__linux__) || defined(__APPLE__)
+    for (int *fd : {&pollFd, &wakeRead, &wakeWrite, &hotplugFd}) {
+        if (*fd >= 0) close(*fd);
+        *fd = -1;
+    }
+#endif
+    byIdWatch = -1;
+}
+
+bool SensorAcquisition::isRunning() const {
+    return running.load(std::memory_order_acquire);
+}
+
+size_t SensorAcquisition::deviceCount() const {
+    return devices.size();
+}
+
+SensorDeviceStatus SensorAcquisition::deviceStatus(size_t index) const {
+    SensorDeviceStatus status;
+    if (index >= devices.size()) return status;
+    const SensorDevice &dev = *devices[index];
+    status.channelOffset     = dev.channelOffset;
+    status.channelCount      = dev.channelCount;
+    status.connected         = dev.connected.load(std::memory_order_relaxed);
+    status.frames            = dev.framesCount.load(std::memory_order_relaxed);
+    status.link.frames       = dev.linkFrames.load(std::memory_order_relaxed);
+    status.link.corrupt      = dev.corruptCount.load(std::memory_order_relaxed);
+    status.link.dropped      = dev.droppedCount.load(std::memory_order_relaxed);
+    status.link.skippedBytes = dev.skippedCount.load(std::memory_order_relaxed);
+    status.clockOffset_ns    = dev.clockOffset.load(std::memory_order_relaxed);
+    status.framePeriod_ns    = dev.framePeriod.load(std::memory_order_relaxed);
+    status.clockJitter_ns    = dev.clockJitter.load(std::memory_order_relaxed);
+    status.clockResidual_ns  = dev.clockResidual.load(std::memory_order_relaxed);
+    status.reconnects        = dev.reconnectCount.load(std::memory_order_relaxed);
+    status.replugToFrame_ns  = dev.replugLatency.load(std::memory_order_relaxed);
+    return status;
+}
+
+unsigned int SensorAcquisition::acceptedOptions(size_t index) const {
+    return index < devices.size() ? devices[index]->accepted.load(std::memory_order_relaxed) : 0;
+}
+
+/*!
+     \brief Fetch the newest frame published by the acquisition thread, never blocks
+     \param frame : receives the frame, left untouched when nothing new arrived
+     \return true if a frame newer than the previous call was copied
+  */
+bool SensorAcquisition::latest(SensorFrame &frame) {
+    if (!frames.update()) return false;
+    frame = frames.readBuffer();
+    return true;
+}
+
+SensorLinkStats SensorAcquisition::linkStats() const {
+    SensorLinkStats stats;
+    for (const auto &dev : devices) {
+        stats.frames       += dev->linkFrames.load(std::memory_order_relaxed);
+        stats.corrupt      += dev->corruptCount.load(std::memory_order_relaxed);
+        stats.dropped      += dev->droppedCount.load(std::memory_order_relaxed);
+        stats.skippedBytes += dev->skippedCount.load(std::memory_order_relaxed);
+    }
+    return stats;
+}
+
+void SensorAcquisition::setFilter(uint32_t first, uint32_t count, const SensorChannelFilter &settings) {
+    if (!filter) filter.reset(new SensorFilter());
+    filter->configure(first, count, settings);
+}
+
+void SensorAcquisition::setCalibration(uint32_t first, uint32_t count, const SensorChannelCalibration &settings) {
+    if (!calibration) calibration.reset(new SensorCalibration());
+    calibration->configure(first, count, settings);
+}
+
+bool SensorAcquisition::loadCalibration(const char *path) {
+    return calibration && calibration->load(path);
+}
+
+bool SensorAcquisition::saveCalibration(const char *path) const {
+    return calibration && calibration->save(path);
+}
+
+/*!
+     \brief Also queue every decoded frame, not only the newest one, for a consumer of the whole history
+     \param capacity : number of frames the queue holds, 0 to disable it
+            Must be called before start()
+  */
+void SensorAcquisition::enableHistory(size_t capacity) {
+    if (capacity == 0) history.reset();
+    else history.reset(new SpscQueue<SensorFrame>(capacity));
+}
+
+/*!
+     \brief Take the oldest queued frame of the history, never blocks
+     \return false if the history is disabled or empty
+  */
+bool SensorAcquisition::nextHistory(SensorFrame &frame) {
+    return history && history->pop(frame);
+}
+
+uint64_t SensorAcquisition::coalescedFrames() const {
+    return coalescedCount.load(std::memory_order_relaxed);
+}
+
+uint64_t SensorAcquisition::historyOverflows() const {
+    return historyOverflowCount.load(std::memory_order_relaxed);
+}
+
+/*!
+     \brief Queue a command frame for a device, written by the acquisition thread as soon as the port
+            takes it. A command of the same format still waiting for the port is replaced, so a slow
+            board always receives the newest state. Commands for a disconnected device are sent
+            when it comes back. Must always be called from the same thread
+     \param device : index of the device, in the order of addDevice()
+     \param format : command carried by the frame
+     \param payload : bytes of the command
+     \param length : at most SERIAL_COMMAND_MAX_BYTES - SENSOR_HEADER_BYTES - SENSOR_CRC_BYTES
+     \return false if the command was dropped (unknown device, too long or queue full)
+  */
+bool SensorAcquisition::send(size_t device, SensorCommandFormat format, const void *payload, uint8_t length) {
+    if (device >= commandSequence.size()) return false;
+    uint8_t frame[SENSOR_HEADER_BYTES + SENSOR_MAX_PAYLOAD + SENSOR_CRC_BYTES];
+    size_t size = encodeSensorFrame(frame, (uint8_t)format, commandSequence[device]++, (const uint8_t *)payload, length);
+    if (!writer.enqueue((uint32_t)device, (uint8_t)format, frame, size)) return false;
+#if defined (__linux__) || defined(__APPLE__)
+    if (writer.requestWake() && wakeWrite >= 0) {
+        char byte = 0;
+        if (write(wakeWrite, &byte, 1) < 0) { /* pipe full: a wake-up is pending anyway */ }
+    }
+#endif
+    return true;
+}
+
+SerialWriteStats SensorAcquisition::writeStats() const {
+    return writer.stats();
+}
+
+/*!
+     \brief Record every chunk read from the devices, with the time it was read, to a capture file
+            The recording ends with stop(). Must be called after addDevice() and before start()
+     \param path : capture file, replaced if it exists
+     \return false if the file cannot be created or the thread is already running
+  */
+bool SensorAcquisition::startCapture(const char *path) {
+    if (worker.joinable()) return false;
+    std::vector<SensorCaptureDevice> settings;
+    for (const auto &dev : devices) {
+        SensorCaptureDevice device;
+        device.format = dev->format;
+        device.channelOffset = dev->channelOffset;
+        device.channelCount = dev->channelCount;
+        device.path = dev->path;
+        settings.push_back(device);
+    }
+    capturePhases.assign(devices.size(), 0);
+    capture.reset(new SensorCaptureWriter);
+    if (!capture->open(path, settings, timeOut::now_ns())) {
+        capture.reset();
+        return false;
+    }
+    return true;
+}
+
+/*!
+     \brief Stop, then feed a capture to the decoders in place of the devices it recorded
+            The devices, their channels and their chunks of bytes are the recorded ones, so the
+            frames are decoded as they were during the recording. The thread stops at the end of
+            the capture (isRunning() turns false)
+     \param speed : 1 replays at the recorded pace, 2 twice as fast, and so on. 0 replays as fast as
+            possible with the recorded timestamps, and waits for room in the history queue instead
+            of dropping frames
+     \return false if path is not a capture
+  */
+bool SensorAcquisition::startReplay(const char *path, double speed) {
+    stop();
+    std::unique_ptr<SensorCaptureReader> reader(new SensorCaptureReader);
+    if (!reader->open(path)) return false;
+    for (const SensorCaptureDevice &settings : reader->devices()) {
+        std::unique_ptr<SensorDevice> dev(new SensorDevice);
+        dev->path = settings.path;
+        dev->currentPath = settings.path;
+        dev->format = settings.format;
+        dev->channelOffset = std::min<uint32_t>(settings.channelOffset, SENSOR_MAX_CHANNELS);
+        dev->channelCount = std::min<uint32_t>(settings.channelCount, SENSOR_MAX_CHANNELS - dev->channelOffset);
+        dev->connected.store(true, std::memory_order_relaxed);
+        nextChannel = std::max(nextChannel, dev->channelOffset + dev->channelCount);
+        commandSequence.push_back(0);
+        devices.push_back(std::move(dev));
+    }
+    replay = std::move(reader);
+    replaySpeed = speed > 0.0 ? speed : 0.0;
+    seekRequest.store(-1, std::memory_order_relaxed);
+
+    running.store(true, std::memory_order_release);
+    worker = std::thread(&SensorAcquisition::runReplay, this);
+    return true;
+}
+
+/*!
+     \brief Continue the replay from position_ns after the start of the capture
+            Decoding restarts at the keyframe preceding the position, the chunks up to the position
+            are decoded without waiting
+  */
+void SensorAcquisition::seekReplay(int64_t position_ns) {
+    seekRequest.store(position_ns > 0 ? position_ns : 0, std::memory_order_release);
+}
+
+int64_t SensorAcquisition::replayDuration_ns() const {
+    return replay ? replay->duration_ns() : 0;
+}
+
+// Acquisition thread: each wake-up drains the readable devices, decodes every complete frame and publishes the newest
+void SensorAcquisition::run() {
+    std::vector<size_t> ready;
+    while (running.load(std::memory_order_acquire)) {
+        if (waitDevices(ready) < 0) {
+            std::cerr << "Serial wait error: " << strerror(errno) << std::endl;
+            break;
+        }
+
+        chunkFrames = 0;
+        uint64_t updated = 0;
+        for (size_t index : ready) {
+            uint64_t before = chunkFrames;
+            if (!serviceDevice(index)) disconnectDevice(index);
+            if (chunkFrames > before) updated++;
+        }
+        publish(updated);
+
+        flushOutput();
+        maintainConnections();
+    }
+    running.store(false, std::memory_order_release);
+}
+
+// Replay thread: feeds the chunks of the capture to the decoders, at the recorded pace scaled by replaySpeed
+void SensorAcquisition::runReplay() {
+    SensorCaptureChunk chunk;
+    // The chunk recorded at recorded_ns is played at origin_ns
+    int64_t origin_ns = timeOut::now_ns();
+    int64_t recorded_ns = replay->startTime_ns();
+    while (running.load(std::memory_order_acquire)) {
+        int64_t position = seekRequest.exchange(-1, std::memory_order_acq_rel);
+        if (position >= 0) {
+            replay->seek(position);
+            // The keyframe cuts the bare streams anywhere: skip to the boundaries the recording decoded
+            const std::vector<uint32_t> &phases = replay->phases();
+            for (size_t i = 0; i < devices.size(); ++i) {
+                SensorDevice &dev = *devices[i];
+                resetDecoder(dev);
+                size_t frameBytes = sensorRawFrameBytes(dev.format);
+                if (i < phases.size() && phases[i] > 0 && phases[i] < frameBytes) dev.rawSkip = frameBytes - phases[i];
+            }
+            origin_ns = timeOut::now_ns();
+            recorded_ns = replay->startTime_ns() + position;
+        }
+        if (!replay->next(chunk)) break;
+        if (chunk.device >= devices.size()) continue;
+
+        if (replaySpeed > 0.0) {
+            // Chunks before a seek position are late already and decoded at once
+            int64_t due = origin_ns + (int64_t)((double)(chunk.timestamp_ns - recorded_ns) / replaySpeed);
+            if (!waitReplay(due)) continue;
+            chunkTimestamp = due;
+        } else {
+            chunkTimestamp = chunk.timestamp_ns;
+        }
+        chunkFrames = 0;
+        ingest(*devices[chunk.device], chunk.data, chunk.length);
+        publish(chunkFrames > 0 ? 1 : 0);
+    }
+    running.store(false, std::memory_order_release);
+}
+
+/*!
+     \brief Sleep until due_ns, in steps of at most WAIT_TIMEOUT_MS
+     \return false if stop() or seekReplay() was called meanwhile
+  */
+bool SensorAcquisition::waitReplay(int64_t due_ns) {
+    for (;;) {
+        if (!running.load(std::memory_order_acquire) || seekRequest.load(std::memory_order_acquire) >= 0)
+            return false;
+        int64_t left = due_ns - timeOut::now_ns();
+        if (left <= 0) return true;
+        std::this_thread::sleep_for(std::chrono::nanoseconds(std::min<int64_t>(left, WAIT_TIMEOUT_MS * 1000000LL)));
+    }
+}
+
+// Hand the composite frame to the renderer if the wake-up decoded anything, updated devices had new frames
+void SensorAcquisition::publish(uint64_t updated) {
+    if (chunkFrames == 0) return;
+    // Only the newest frame of each device reaches the renderer, older ones only go to the history
+    frames.writeBuffer() = composite;
+    frames.publish();
+    coalescedCount.fetch_add(chunkFrames - updated, std::memory_order_relaxed);
+}
+
+/*!
+     \brief Sleep until at least one device is readable, at most WAIT_TIMEOUT_MS
+     \param ready : receives the indices of the devices to read, empty on timeout
+            Devices that hung up without pending data are closed
+     \return the number of devices to read, -1 on error
+  */
+int SensorAcquisition::waitDevices(std::vector<size_t> &ready) {
+    ready.clear();
+#if defined (__linux__)
+    struct epoll_event events[MAX_EVENTS];
+    int n = epoll_wait(pollFd, events, MAX_EVENTS, WAIT_TIMEOUT_MS);
+    if (n < 0) return errno == EINTR ? 0 : -1;
+    for (int i = 0; i < n; ++i) {
+        uint64_t tag = events[i].data.u64;
+        if (tag == WAKE_TAG) drainWakeups();
+        else if (tag == HOTPLUG_TAG) handleHotplug();
+        else if (events[i].events & EPOLLIN) ready.push_back((size_t)tag);
+        else if (events[i].events & (EPOLLHUP | EPOLLERR)) disconnectDevice((size_t)tag);
+        // EPOLLOUT alone: flushOutput() writes on every wake-up
+    }
+#elif defined (__APPLE__)
+    std::vector<struct pollfd> fds;
+    std::vector<size_t> indices;
+    for (size_t i = 0; i <= devices.size(); ++i) {
+        // The wake-up pipe last
+        int fd = i < devices.size() ? (devices[i]->open ? devices[i]->serial->fileDescriptor() : -1) : wakeRead;
+        if (fd < 0) continue;
+        struct pollfd pfd;
+        pfd.fd = fd;
+        pfd.events = POLLIN;
+        if (i < devices.size() && devices[i]->watchingOutput) pfd.events |= POLLOUT;
+        pfd.revents = 0;
+        fds.push_back(pfd);
+        indices.push_back(i);
+    }
+    int n = poll(fds.data(), (nfds_t)fds.size(), WAIT_TIMEOUT_MS);
+    if (n < 0) return errno == EINTR ? 0 : -1;
+    for (size_t i = 0; i < fds.size(); ++i) {
+        if (indices[i] == devices.size()) {
+            if (fds[i].revents) drainWakeups();
+        } else if (fds[i].revents & POLLIN) {
+            ready.push_back(indices[i]);
+        } else if (fds[i].revents & (POLLHUP | POLLERR | POLLNVAL)) {
+            disconnectDevice(indices[i]);
+        }
+    }
+#else
+    // No readiness API on serial handles: visit every device once per millisecond
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    for (size_t i = 0; i < devices.size(); ++i)
+        if (devices[i]->open) ready.push_back(i);
+#endif
+    return (int)ready.size();
+}
+
+/*!
+     \brief Read everything a device has pending, record it and decode it
+     \return false if the device reported an error
+  */
+bool SensorAcquisition::serviceDevice(size_t index) {
+    SensorDevice &dev = *devices[index];
+    if (!dev.open) return true;
+    int n = dev.serial->readAvailable(drainBuffer.data(), (unsigned int)drainBuffer.size());
+    if (n < 0) return false;
+    if (n == 0) return true;
+
+    // Every frame of the chunk shares the time the chunk was read
+    chunkTimestamp = timeOut::now_ns();
+    if (capture) capture->append((uint32_t)index, chunkTimestamp, drainBuffer.data(), n, capturePhases.data());
+    ingest(dev, drainBuffer.data(), n);
+    if (capture) capturePhases[index] = (uint32_t)dev.rawCarryLength;
+    return true;
+}
+
+// Decode a chunk of bytes of a device read at chunkTimestamp, read live or replayed
+void SensorAcquisition::ingest(SensorDevice &dev, const uint8_t *data, size_t length) {
+    if (dev.format == SENSOR_WIRE_FRAMED)
+        dev.parser.feed(data, length, [this, &dev](const SensorPacket &packet) { decodePacket(dev, packet); });
+    else
+        decodeRaw(dev, data, length);
+
+    const SensorLinkStats &stats = dev.format == SENSOR_WIRE_FRAMED ? dev.parser.stats() : dev.rawStats;
+    dev.framesCount.store(dev.frames, std::memory_order_relaxed);
+    dev.linkFrames.store(stats.frames, std::memory_order_relaxed);
+    dev.corruptCount.store(stats.corrupt, std::memory_order_relaxed);
+    dev.droppedCount.store(stats.dropped, std::memory_order_relaxed);
+    dev.skippedCount.store(stats.skippedBytes, std::memory_order_relaxed);
+    if (dev.clock.ready()) {
+        dev.clockOffset.store((int64_t)dev.clock.offset_ns(), std::memory_order_relaxed);
+        dev.framePeriod.store((int64_t)dev.clock.period_ns(), std::memory_order_relaxed);
+        dev.clockJitter.store((int64_t)dev.clock.jitter_ns(), std::memory_order_relaxed);
+        dev.clockResidual.store((int64_t)dev.clock.residual_ns(), std::memory_order_relaxed);
+    }
+}
+
+// Stop waiting on a device and close it, its channels keep their last values
+void SensorAcquisition::closeDevice(SensorDevice &dev) {
+    if (!dev.open) return;
+#if defined (__linux__)
+    if (pollFd >= 0) epoll_ctl(pollFd, EPOLL_CTL_DEL, dev.serial->fileDescriptor(), NULL);
+#endif
+    dev.serial->closeDevice();
+    dev.open = false;
+    dev.watchingOutput = false;
+    dev.connected.store(false, std::memory_order_relaxed);
+}
+
+// Close a device that failed or was unplugged, it is reopened in the background when it comes back
+void SensorAcquisition::disconnectDevice(size_t index) {
+    SensorDevice &dev = *devices[index];
+    if (!dev.open) return;
+    std::cerr << "Sensor device " << index << " (" << dev.currentPath << ") disconnected" << std::endl;
+    closeDevice(dev);
+    writer.resetDevice((uint32_t)index);
+    dev.replugTime_ns = 0;
+    nextRetry_ns = timeOut::now_ns();
+}
+
+// Add a descriptor to the epoll set (Linux only, the poll fallback builds its set on every wait)
+void SensorAcquisition::watchDescriptor(int fd, uint64_t tag) {
+#if defined (__linux__)
+    if (fd < 0) return;
+    struct epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.u64 = tag;
+    epoll_ctl(pollFd, EPOLL_CTL_ADD, fd, &ev);
+#else
+    UNUSED(fd);
+    UNUSED(tag);
+#endif
+}
+
+// Start waiting on an open device
+void SensorAcquisition::watchDevice(size_t index) {
+    watchDescriptor(devices[index]->serial->fileDescriptor(), index);
+}
+
+// Also wake up when the output queue of a device has room again, or stop doing so
+void SensorAcquisition::watchOutput(size_t index, bool enable) {
+    SensorDevice &dev = *devices[index];
+    if (dev.watchingOutput == enable) return;
+    dev.watchingOutput = enable;
+#if defined (__linux__)
+    struct epoll_event ev;
+    ev.events = enable ? EPOLLIN | EPOLLOUT : EPOLLIN;
+    ev.data.u64 = index;
+    epoll_ctl(pollFd, EPOLL_CTL_MOD, dev.serial->fileDescriptor(), &ev);
+#endif
+}
+
+/*!
+     \brief Write the commands queued by send() to the open devices, one gathered write per device
+            A device whose output queue is full is watched for writability until it took everything
+  */
+void SensorAcquisition::flushOutput() {
+    writer.clearWake();
+    writer.collect();
+    for (size_t i = 0; i < devices.size(); ++i) {
+        SensorDevice &dev = *devices[i];
+        if (!dev.open || !writer.hasOutput((uint32_t)i)) continue;
+        int status = writer.flush((uint32_t)i, *dev.serial);
+        if (status < 0) disconnectDevice(i);
+        else watchOutput(i, status > 0);
+    }
+}
+
+void SensorAcquisition::drainWakeups() {
+#if defined (__linux__) || defined(__APPLE__)
+    char bytes[64];
+    while (read(wakeRead, bytes, sizeof(bytes)) > 0) {}
+#endif
+}
+
+/*!
+     \brief Read the inotify events of /dev: a removed node closes the device using it, a new or
+            newly accessible serial node triggers a reconnection attempt
+  */
+void SensorAcquisition::handleHotplug() {
+#if defined (__linux__)
+    alignas(struct inotify_event) char buffer[4096];
+    int64_t now = timeOut::now_ns();
+    ssize_t n;
+    while ((n = read(hotplugFd, buffer, sizeof(buffer))) > 0) {
+        for (ssize_t pos = 0; pos < n; ) {
+            const struct inotify_event *event = (const struct inotify_event *)(buffer + pos);
+            pos += sizeof(struct inotify_event) + event->len;
+            if (event->mask & IN_IGNORED) {
+                // /dev/serial/by-id goes away with the last adapter
+                if (event->wd == byIdWatch) byIdWatch = -1;
+                continue;
+            }
+            if (event->len == 0) continue;
+            bool byId = event->wd == byIdWatch;
+            if (!byId && !isSerialCandidateName(event->name)) continue;
+
+            if (event->mask & IN_DELETE) {
+                for (size_t i = 0; i < devices.size(); ++i) {
+                    const std::string &path = devices[i]->currentPath;
+                    size_t slash = path.rfind('/');
+                    if (devices[i]->open && path.compare(slash + 1, std::string::npos, event->name) == 0)
+                        disconnectDevice(i);
+                }
+                continue;
+            }
+            hotplugPending = true;
+            lastHotplug_ns = now;
+            for (auto &dev : devices)
+                if (!dev->open && dev->replugTime_ns == 0) dev->replugTime_ns = now;
+        }
+    }
+    if (byIdWatch < 0) byIdWatch = inotify_add_watch(hotplugFd, "/dev/serial/by-id", IN_CREATE | IN_DELETE);
+#endif
+}
+
+/*!
+     \brief Collect a finished reconnection attempt and start a new one when a device is missing,
+            right after a hot-plug event or every RETRY_INTERVAL_NS otherwise
+  */
+void SensorAcquisition::maintainConnections() {
+    int64_t now = timeOut::now_ns();
+    if (reconnect) {
+        if (reconnect->results.wait_for(std::chrono::seconds(0)) != std::future_status::ready) return;
+        std::vector<ReconnectTask::Result> results = reconnect->results.get();
+        for (auto &result : results) installDevice(result.index, result.probe, reconnect->started_ns);
+        reconnect.reset();
+        bool settling = now - lastHotplug_ns < HOTPLUG_SETTLE_NS;
+        nextRetry_ns = now + (settling ? RETRY_AFTER_HOTPLUG_NS : RETRY_INTERVAL_NS);
+    }
+
+    bool missing = false;
+    for (auto &dev : devices) missing |= !dev->open;
+    if (!missing || (!hotplugPending && now < nextRetry_ns)) return;
+    hotplugPending = false;
+    startReconnect();
+}
+
+/*!
+     \brief Open the missing devices on a background task: devices with a path are opened as is,
+            the others take the ports streaming sensor frames, probed in parallel with the
+            settings of the first of them
+  */
+void SensorAcquisition::startReconnect() {
+    struct Request {
+        size_t           index;
+        std::string      path;
+        unsigned int     bauds;
+        unsigned int     openOptions;
+        SensorWireFormat format;
+    };
+    std::vector<Request> requests;
+    std::vector<std::string> inUse;
+    for (size_t i = 0; i < devices.size(); ++i) {
+        SensorDevice &dev = *devices[i];
+        if (dev.open) {
+            inUse.push_back(serialCanonicalPath(dev.currentPath));
+        } else {
+            requests.push_back({i, dev.path, dev.bauds, dev.openOptions, dev.format});
+            if (!dev.path.empty()) inUse.push_back(serialCanonicalPath(dev.path));
+        }
+    }
+
+    int wakeFd = wakeWrite;
+    reconnect.reset(new ReconnectTask);
+    reconnect->started_ns = timeOut::now_ns();
+    reconnect->results = std::async(std::launch::async, [requests, inUse, wakeFd]() {
+        std::vector<ReconnectTask::Result> results;
+        std::vector<size_t> searching;
+        for (const Request &request : requests) {
+            if (request.path.empty()) {
+                searching.push_back(results.size());
+                results.push_back({request.index, SerialProbe()});
+                continue;
+            }
+            SerialProbe probe;
+            probe.path = request.path;
+            probe.serial = probeSensorPort(request.path, request.bauds, request.format, request.openOptions,
+                                           &probe.acceptedOptions, 0);
+            results.push_back({request.index, std::move(probe)});
+        }
+        if (!searching.empty()) {
+            std::vector<std::string> candidates;
+            for (const std::string &path : listSerialCandidates())
+                if (std::find(inUse.begin(), inUse.end(), serialCanonicalPath(path)) == inUse.end())
+                    candidates.push_back(path);
+            const Request *settings = &requests[0];
+            while (!settings->path.empty()) settings++;
+            std::vector<SerialProbe> found = probeSensorPorts(candidates, settings->bauds, settings->format,
+                                                              settings->openOptions, SERIAL_PROBE_TIMEOUT_US,
+                                                              searching.size());
+            for (size_t i = 0; i < searching.size() && i < found.size(); ++i)
+                results[searching[i]].probe = std::move(found[i]);
+        }
+#if defined (__linux__) || defined(__APPLE__)
+        if (wakeFd >= 0) {
+            char byte = 0;
+            if (write(wakeFd, &byte, 1) < 0) { /* pipe full: a wake-up is pending anyway */ }
+        }
+#else
+        UNUSED(wakeFd);
+#endif
+        return results;
+    });
+}
+
+// Take over a port opened by a reconnection attempt started at started_ns
+void SensorAcquisition::installDevice(size_t index, SerialProbe &probe, int64_t started_ns) {
+    SensorDevice &dev = *devices[index];
+    if (dev.open || !probe.serial) return;
+    if (dev.replugTime_ns == 0) dev.replugTime_ns = started_ns;
+    dev.awaitingFirstFrame = true;
+    dev.serial = std::move(probe.serial);
+    dev.currentPath = probe.path;
+    dev.accepted.store(probe.acceptedOptions, std::memory_order_relaxed);
+    // The board restarted: forget the partial frames and the clock of the previous connection
+    resetDecoder(dev);
+    dev.open = true;
+    dev.connected.store(true, std::memory_order_relaxed);
+    watchDevice(index);
+    std::cout << "Sensor device " << index << " connected on " << dev.currentPath << std::endl;
+}
+
+// Forget the partial frames and the clock of a device whose stream restarts
+void SensorAcquisition::resetDecoder(SensorDevice &dev) {
+    dev.parser.resync();
+    dev.rawCarryLength = 0;
+    dev.rawInvalid = 0;
+    dev.rawSkip = 0;
+    dev.lastSequence = -1;
+    dev.frameIndex = 0;
+    dev.clock.reset();
+    dev.filterTime_ns = 0;
+    if (filter) filter->reset(dev.channelOffset, dev.channelCount);
+    if (calibration) calibration->restart(dev.channelOffset, dev.channelCount);
+}
+
+/*!
+     \brief Normalise, filter and calibrate the channels of a device in the shared frame, queue it to the history and account for it
+     \param channelCount : channels carried by the frame, at most the ones reserved for the device
+     \param frameIndex : index of the frame in the device's stream, for the clock estimator
+  */
+void SensorAcquisition::acceptFrame(SensorDevice &dev, uint32_t channelCount, uint64_t frameIndex) {
+    uint16_t *raw = composite.raw + dev.channelOffset;
+    float *value = composite.value + dev.channelOffset;
+    const float scale = 1.0f / SENSOR_ADC_MAX;
+    for (uint32_t c = 0; c < channelCount; ++c)
+        value[c] = raw[c] * scale;
+    // Channels missing from this frame read as 0
+    for (uint32_t c = channelCount; c < dev.lastCount; ++c) {
+        raw[c] = 0;
+        value[c] = 0.0f;
+    }
+    dev.lastCount = channelCount;
+    if (dev.channelOffset + channelCount > composite.channelCount)
+        composite.channelCount = dev.channelOffset + channelCount;
+
+    composite.timestamp_ns = dev.clock.add(frameIndex, chunkTimestamp);
+    if (filter) {
+        // Frames read in one chunk share their timestamp until the clock is estimated: they
+        // take the period averaged up to the next frame whose timestamp advanced
+        if (dev.filterTime_ns == 0) {
+            dev.filterTime_ns = composite.timestamp_ns;
+            dev.filterIndex = frameIndex;
+        } else if (composite.timestamp_ns > dev.filterTime_ns && frameIndex > dev.filterIndex) {
+            dev.filterPeriod_s = (float)((composite.timestamp_ns - dev.filterTime_ns) * 1e-9 / (double)(frameIndex - dev.filterIndex));
+            dev.filterTime_ns = composite.timestamp_ns;
+            dev.filterIndex = frameIndex;
+        }
+        filter->process(value, dev.channelOffset, channelCount, dev.filterPeriod_s);
+    }
+    if (calibration) calibration->process(value, dev.channelOffset, channelCount);
+    if (dev.awaitingFirstFrame) {
+        int64_t latency = chunkTimestamp - dev.replugTime_ns;
+        dev.awaitingFirstFrame = false;
+        dev.replugTime_ns = 0;
+        dev.reconnectCount.fetch_add(1, std::memory_order_relaxed);
+        dev.replugLatency.store(latency, std::memory_order_relaxed);
+        std::cout << "Sensor device on " << dev.currentPath << ": first frame " << latency / 1000000.0
+                  << " ms after replug" << std::endl;
+    }
+    composite.sequence = ++decoded;
+    dev.frames++;
+    chunkFrames++;
+    if (history && !history->push(composite)) {
+        if (replay && replaySpeed == 0.0) {
+            // Replaying as fast as possible: the history consumer sets the pace
+            while (!history->push(composite) && running.load(std::memory_order_acquire))
+                std::this_thread::sleep_for(std::chrono::nanoseconds(REPLAY_BACKOFF_NS));
+        } else {
+            historyOverflowCount.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+}
+
+/*!
+     \brief Drop a bare frame whose padding bits are set
+            One such frame is taken for corruption on the link. A second one in a row means the
+            frames are misaligned, most likely after a byte lost on the link: the boundary moves one
+            byte back, the next frame starting at the last byte of this one.
+     \return true if the last byte of the frame starts the next one
+  */
+bool SensorAcquisition::rejectRawFrame(SensorDevice &dev) {
+    dev.rawStats.corrupt++;
+    if (++dev.rawInvalid < RAW_RESYNC_FRAMES) return false;
+    dev.rawInvalid = 0;
+    dev.rawStats.skippedBytes += sensorRawFrameBytes(dev.format) - 1;
+    return true;
+}
+
+// Split the bare stream in fixed-size frames, carrying an incomplete one over to the next chunk
+void SensorAcquisition::decodeRaw(SensorDevice &dev, const uint8_t *data, size_t length) {
+    size_t frameBytes = sensorRawFrameBytes(dev.format);
+    size_t pos = std::min(dev.rawSkip, length);
+    dev.rawSkip -= pos;
+    while (dev.rawCarryLength > 0) {
+        size_t take = frameBytes - dev.rawCarryLength;
+        if (take > length - pos) take = length - pos;
+        memcpy(dev.rawCarry + dev.rawCarryLength, data + pos, take);
+        dev.rawCarryLength += take;
+        pos += take;
+        if (dev.rawCarryLength < frameBytes) return;
+        dev.rawCarryLength = 0;
+        if (sensorRawFrameValid(dev.rawCarry, dev.format)) {
+            dev.rawInvalid = 0;
+            dev.rawStats.frames++;
+            decodeRawFrames(dev, dev.rawCarry, 1);
+        } else if (rejectRawFrame(dev)) {
+            dev.rawCarry[0] = dev.rawCarry[frameBytes - 1];
+            dev.rawCarryLength = 1;
+        }
+    }
+    while (length - pos >= frameBytes) {
+        // Decode the run of valid frames at once
+        size_t count = 0;
+        while (pos + (count + 1) * frameBytes <= length && sensorRawFrameValid(data + pos + count * frameBytes, dev.format))
+            count++;
+        if (count > 0) {
+            dev.rawInvalid = 0;
+            dev.rawStats.frames += count;
+            decodeRawFrames(dev, data + pos, count);
+            pos += count * frameBytes;
+        } else {
+            pos += rejectRawFrame(dev) ? frameBytes - 1 : frameBytes;
+        }
+    }
+    dev.rawCarryLength = length - pos;
+    memcpy(dev.rawCarry, data + pos, dev.rawCarryLength);
+}
+
+// Decode count consecutive bare frames
+void SensorAcquisition::decodeRawFrames(SensorDevice &dev, const uint8_t *data, size_t count) {
+    if (count == 0) return;
+    size_t frameBytes = sensorRawFrameBytes(dev.format);
+    if (!history && !filter && !calibration && count > 1) {
+        // Nobody sees the older frames: account for them and only decode the newest
+        decoded += count - 1;
+        chunkFrames += count - 1;
+        dev.frames += count - 1;
+        dev.frameIndex += count - 1;
+        data += (count - 1) * frameBytes;
+        count = 1;
+    }
+    if (dev.format != SENSOR_WIRE_PACKED10) {
+        for (size_t f = 0; f < count; ++f) decodeU16(dev, data + f * frameBytes, SENSOR_CHANNELS);
+        return;
+    }
+    // Packed backlog for the history: unpack the whole burst at once
+    uint32_t channels = dev.channelCount < SENSOR_CHANNELS ? dev.channelCount : SENSOR_CHANNELS;
+    burstValues.resize(count * SENSOR_CHANNELS);
+    unpackSensor10Frames(data, count, burstValues.data());
+    for (size_t f = 0; f < count; ++f) {
+        memcpy(composite.raw + dev.channelOffset, &burstValues[f * SENSOR_CHANNELS], channels * sizeof(uint16_t));
+        acceptFrame(dev, channels, dev.frameIndex++);
+    }
+}
+
+void SensorAcquisition::decodePacket(SensorDevice &dev, const SensorPacket &packet) {
+    // Frames lost on the link still advance the device's clock
+    if (dev.lastSequence >= 0) dev.frameIndex += (uint8_t)(packet.sequence - dev.lastSequence - 1);
+    dev.lastSequence = packet.sequence;
+
+    if (packet.format == SENSOR_PAYLOAD_U16LE) {
+        decodeU16(dev, packet.payload, packet.length / 2);
+    } else if (packet.format == SENSOR_PAYLOAD_PACKED10) {
+        uint32_t count = packet.length * 8 / 10;
+        if (count > dev.channelCount) count = dev.channelCount;
+        unpackSensor10(packet.payload, (int)count, composite.raw + dev.channelOffset);
+        acceptFrame(dev, count, dev.frameIndex++);
+    } else {
+        dev.frameIndex++;
+    }
+}
+
+// Little-endian 16-bit values into the device's channels, the frame carries as many channels as the payload
+void SensorAcquisition::decodeU16(SensorDevice &dev, const uint8_t *payload, int count) {
+    if (count > (int)dev.channelCount) count = (int)dev.channelCount;
+    uint16_t *raw = composite.raw + dev.channelOffset;
+    for (int c = 0; c < count; ++c)
+        raw[c] = (uint16_t)(payload[2 * c] | (payload[2 * c + 1] << 8));
+    acceptFrame(dev, (uint32_t)count, dev.frameIndex++);
+}
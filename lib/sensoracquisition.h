@@ -0,0 +1,226 @@
+/*!
+\file    sensoracquisition.h
+\brief   Background thread reading the sensor devices and publishing the latest frame to the render loop.
+*/
+
+
+#ifndef SENSORACQUISITION_H
+#define SENSORACQUISITION_H
+
+#include "serialib.h"
+#include "sensorframe.h"
+#include "sensorprotocol.h"
+#include "serialwriter.h"
+#include "spscqueue.h"
+#include "triplebuffer.h"
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <vector>
+
+/*!  \struct    SensorDeviceStatus
+     \brief     Counters and clock estimate of one device, see SensorAcquisition::deviceStatus()
+*/
+struct SensorDeviceStatus {
+    // First channel of the shared frame fed by the device, and number of channels reserved for it
+    uint32_t        channelOffset = 0;
+    uint32_t        channelCount = 0;
+    // False once the device reported an error or was unplugged
+    bool            connected = false;
+    // Frames decoded from the device
+    uint64_t        frames = 0;
+    // Frame counters of the link; for the bare formats, frames with padding bits set count as corrupt
+    // and the bytes given up to realign as skipped
+    SensorLinkStats link;
+    // The device sampled its k-th frame at clockOffset_ns + k * framePeriod_ns on the host clock
+    // (timeOut::now_ns), both 0 until enough frames arrived to estimate them
+    int64_t         clockOffset_ns = 0;
+    int64_t         framePeriod_ns = 0;
+    // Standard deviation of the delays between sampling and reading, removed from the timestamps,
+    // and RMS error left in the timestamps, 0 until the clock is estimated
+    int64_t         clockJitter_ns = 0;
+    int64_t         clockResidual_ns = 0;
+    // Connections made in the background, and time from the device node appearing to the first frame of the last one
+    uint64_t        reconnects = 0;
+    int64_t         replugToFrame_ns = 0;
+};
+
+struct SensorDevice;
+struct ReconnectTask;
+struct SerialProbe;
+class SensorCaptureWriter;
+class SensorCaptureReader;
+class SensorFilter;
+struct SensorChannelFilter;
+class SensorCalibration;
+struct SensorChannelCalibration;
+
+/*!  \class     SensorAcquisition
+     \brief     Owns the sensor devices and decodes them on a single dedicated thread.
+                Every device feeds its own range of channels of one shared frame. The thread
+                sleeps in epoll (poll on macOS) on all of them at once; every wake-up drains the
+                devices that are readable and publishes only the newest frame, so the renderer
+                never lags behind a fast sensor board and a saturated device does not delay the
+                others. Neither latest() nor the optional queue of every frame (nextHistory())
+                ever block the render loop.
+                Unplugged devices are reopened by a background task when they come back, woken
+                up by inotify on /dev (Linux) or every second.
+                Commands to the boards (send()) are queued without blocking and written by the
+                same thread, when the device can take them.
+                The bytes read can be recorded to a capture, and a capture replayed in place of
+                the devices through the same decoders.
+                The normalised values can be filtered per channel, on every frame decoded.
+*/
+class SensorAcquisition {
+public:
+    SensorAcquisition();
+    ~SensorAcquisition();
+
+    SensorAcquisition(const SensorAcquisition&) = delete;
+    SensorAcquisition& operator=(const SensorAcquisition&) = delete;
+
+    // Open a device feeding the next channels of the frame (call before start), returns the serialib::openDevice code
+    char addDevice(const char *device, unsigned int bauds, SensorWireFormat format = SENSOR_WIRE_RAW16,
+                   unsigned int openOptions = 0, uint32_t channels = SENSOR_CHANNELS);
+
+    // Start the acquisition thread on the devices added, returns false if there are none or it cannot wait on them
+    bool start();
+
+    // Open a single device and start the acquisition thread, returns the serialib::openDevice code
+    char start(const char *device, unsigned int bauds, SensorWireFormat format = SENSOR_WIRE_RAW16,
+               unsigned int openOptions = 0);
+
+    // Stop the thread and close the devices
+    void stop();
+
+    // True while the acquisition thread is running
+    bool isRunning() const;
+
+    // Number of devices added since the last stop()
+    size_t deviceCount() const;
+
+    // Counters and clock estimate of a device, safe to call from any thread
+    SensorDeviceStatus deviceStatus(size_t index) const;
+
+    // SerialOpenOptions the driver accepted when the device was opened
+    unsigned int acceptedOptions(size_t index = 0) const;
+
+    // Copy the newest frame into frame, returns false if nothing new was published since the last call
+    bool latest(SensorFrame &frame);
+
+    // Frame counters of the links summed over the devices, safe to call from any thread
+    SensorLinkStats linkStats() const;
+
+    // Filter channels first .. first+count-1 of every frame (call before start), raw keeps the unfiltered samples
+    void setFilter(uint32_t first, uint32_t count, const SensorChannelFilter &settings);
+
+    // Calibrate channels first .. first+count-1 of every frame after the filter (call before start),
+    // see sensorcalibration.h: value then runs 0..1 over the travel each channel covers
+    void setCalibration(uint32_t first, uint32_t count, const SensorChannelCalibration &settings);
+
+    // Start from the calibration of a previous run (call after setCalibration, before start),
+    // returns false if the file cannot be read
+    bool loadCalibration(const char *path);
+
+    // Keep the calibration for the next run (call after stop), returns false if it cannot be written
+    bool saveCalibration(const char *path) const;
+
+    // Keep every decoded frame in a queue of the given capacity (call before start, 0 disables)
+    void enableHistory(size_t capacity);
+
+    // Pop the oldest frame of the history queue, returns false if empty or disabled
+    bool nextHistory(SensorFrame &frame);
+
+    // Frames decoded but superseded by a newer one before reaching latest()
+    uint64_t coalescedFrames() const;
+
+    // Frames lost because the history queue was full
+    uint64_t historyOverflows() const;
+
+    // Queue a command frame for a device, never blocks (one producer thread only), returns false if dropped
+    bool send(size_t device, SensorCommandFormat format, const void *payload, uint8_t length);
+
+    // Counters of the command queue, safe to call from any thread
+    SerialWriteStats writeStats() const;
+
+    // Record every byte read to a capture file (call after addDevice and before start), returns false if it cannot be created
+    bool startCapture(const char *path);
+
+    // Replay a capture instead of reading devices, speed 1 is real time and 0 as fast as possible,
+    // returns false if path is not a capture
+    bool startReplay(const char *path, double speed = 1.0);
+
+    // Jump to position_ns from the start of the replayed capture, safe to call from any thread
+    void seekReplay(int64_t position_ns);
+
+    // Length of the replayed capture, 0 when not replaying
+    int64_t replayDuration_ns() const;
+
+private:
+    void run();
+    void runReplay();
+    int  waitDevices(std::vector<size_t> &ready);
+    bool waitReplay(int64_t due_ns);
+    bool serviceDevice(size_t index);
+    void ingest(SensorDevice &device, const uint8_t *data, size_t length);
+    void publish(uint64_t updated);
+    void resetDecoder(SensorDevice &device);
+    void closeDevice(SensorDevice &device);
+    void disconnectDevice(size_t index);
+    void watchDescriptor(int fd, uint64_t tag);
+    void watchDevice(size_t index);
+    void watchOutput(size_t index, bool enable);
+    void flushOutput();
+    void drainWakeups();
+    void handleHotplug();
+    void maintainConnections();
+    void startReconnect();
+    void installDevice(size_t index, SerialProbe &probe, int64_t started_ns);
+    void decodeRaw(SensorDevice &device, const uint8_t *data, size_t length);
+    bool rejectRawFrame(SensorDevice &device);
+    void decodeRawFrames(SensorDevice &device, const uint8_t *data, size_t count);
+    void decodePacket(SensorDevice &device, const SensorPacket &packet);
+    void decodeU16(SensorDevice &device, const uint8_t *payload, int count);
+    void acceptFrame(SensorDevice &device, uint32_t channelCount, uint64_t frameIndex);
+
+    // Only touched by the acquisition thread once start() has returned
+    std::vector<std::unique_ptr<SensorDevice>> devices;
+    std::thread              worker;
+    std::atomic<bool>        running;
+    TripleBuffer<SensorFrame> frames;
+    // Latest values of every device, copied to the triple buffer once per wake-up
+    SensorFrame              composite;
+    uint64_t                 decoded;
+    uint32_t                 nextChannel;
+    int                      pollFd;
+    int                      wakeRead;
+    int                      wakeWrite;
+    int                      hotplugFd;
+    int                      byIdWatch;
+    bool                     hotplugPending;
+    int64_t                  lastHotplug_ns;
+    int64_t                  nextRetry_ns;
+    std::unique_ptr<ReconnectTask> reconnect;
+    std::vector<uint8_t>     drainBuffer;
+    std::vector<uint16_t>    burstValues;
+    uint64_t                 chunkFrames;
+    int64_t                  chunkTimestamp;
+    std::unique_ptr<SpscQueue<SensorFrame>> history;
+    std::unique_ptr<SensorFilter> filter;
+    std::unique_ptr<SensorCalibration> calibration;
+    SerialWriter             writer;
+    // Sequence numbers of the command frames, only touched by the thread calling send()
+    std::vector<uint8_t>     commandSequence;
+    std::unique_ptr<SensorCaptureWriter> capture;
+    // Per device, bytes of an incomplete bare frame carried by its decoder, recorded in the keyframes
+    std::vector<uint32_t>    capturePhases;
+    std::unique_ptr<SensorCaptureReader> replay;
+    double                   replaySpeed;
+    // Position requested by seekReplay(), -1 if none
+    std::atomic<int64_t>     seekRequest;
+
+    std::atomic<uint64_t>    coalescedCount;
+    std::atomic<uint64_t>    historyOverflowCount;
+};
+
+#endif // SENSORACQUISITION_H
@@ -0,0 +1,172 @@
+/*!
+ \file    sensorcalibration.cpp
+ \brief   Source file of the class SensorCalibration.
+ */
+
+#include "sensorcalibration.h"
+#include "simdlanes.h"
+#include <cfloat>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+
+// Second differences of white noise of deviation s have a deviation of sqrt(6) s
+static const float SECOND_DIFFERENCE_POWER = 6.0f;
+
+// Second differences are clipped at this many of their deviations, and never under one ADC step
+static const float CLIP_DEVIATIONS = 3.0f;
+static const float CLIP_FLOOR = 1.0f / SENSOR_ADC_MAX;
+
+// A sample moves the extremes only once the values settled: within this many noise deviations of the two
+// previous ones, and never under a few ADC steps, so that a glitch on the link does not stretch the range
+static const float SETTLE_DEVIATIONS = 6.0f;
+static const float SETTLE_FLOOR = 4.0f / SENSOR_ADC_MAX;
+
+// Smallest noise power kept: the estimate of a constant channel would otherwise decay into denormals, slow to compute
+static const float POWER_FLOOR = 1e-12f;
+
+// First line of a calibration file
+static const char *FILE_HEADER = "# sinestesia calibration: channel lowest highest noise";
+
+
+SensorCalibration::SensorCalibration() {
+    configure(0, SENSOR_MAX_CHANNELS, SensorChannelCalibration());
+    clear();
+}
+
+void SensorCalibration::configure(uint32_t first, uint32_t count, const SensorChannelCalibration &settings) {
+    if (first >= SENSOR_MAX_CHANNELS) return;
+    if (count > SENSOR_MAX_CHANNELS - first) count = SENSOR_MAX_CHANNELS - first;
+    for (uint32_t c = first; c < first + count; ++c) {
+        minSpan[c] = settings.minSpan;
+        noiseDeadZone[c] = settings.noiseDeadZone;
+        minDeadZone[c] = settings.minDeadZone;
+        noiseWeight[c] = settings.noiseWeight;
+    }
+}
+
+void SensorCalibration::clear(uint32_t first, uint32_t count) {
+    if (first >= SENSOR_MAX_CHANNELS) return;
+    if (count > SENSOR_MAX_CHANNELS - first) count = SENSOR_MAX_CHANNELS - first;
+    for (uint32_t c = first; c < first + count; ++c) {
+        lowest[c] = FLT_MAX;
+        highest[c] = -FLT_MAX;
+        noisePower[c] = 0.0f;
+    }
+    restart(first, count);
+}
+
+void SensorCalibration::restart(uint32_t first, uint32_t count) {
+    if (first >= SENSOR_MAX_CHANNELS) return;
+    if (count > SENSOR_MAX_CHANNELS - first) count = SENSOR_MAX_CHANNELS - first;
+    for (uint32_t c = first; c < first + count; ++c) fresh[c] = 1.0f;
+}
+
+/*!
+     \brief Learn from the values of a range of channels and replace them with their calibrated values
+     \param values : normalised values of channels first .. first+count-1
+  */
+void SensorCalibration::process(float *values, uint32_t first, uint32_t count) {
+    if (first >= SENSOR_MAX_CHANNELS) return;
+    if (count > SENSOR_MAX_CHANNELS - first) count = SENSOR_MAX_CHANNELS - first;
+    uint32_t end = first + count;
+    uint32_t c = first;
+#if defined (SIMD_LANES_VECTOR)
+    c = processLanes<VectorLanes>(values - first, c, end);
+#endif
+    processLanes<ScalarLanes>(values - first, c, end);
+}
+
+/*!
+     \brief Update and apply the calibration of Lanes::width channels at a time, from channel c while a
+            whole group fits before end; values is indexed by channel
+     \return the first channel left
+  */
+template <typename L>
+uint32_t SensorCalibration::processLanes(float *values, uint32_t c, uint32_t end) {
+    typedef typename L::V V;
+    typedef typename L::M M;
+    const V zero = L::set(0.0f);
+    const V one = L::set(1.0f);
+    const V two = L::set(2.0f);
+    const V clipDeviations = L::set(CLIP_DEVIATIONS);
+    const V clipFloor = L::set(CLIP_FLOOR);
+    const V toDeviation = L::set(1.0f / SECOND_DIFFERENCE_POWER);
+    const V powerFloor = L::set(POWER_FLOOR);
+    const V tiny = L::set(1e-6f);
+    const V settleDeviations = L::set(SETTLE_DEVIATIONS);
+    const V settleFloor = L::set(SETTLE_FLOOR);
+    const V unsettled = L::set(FLT_MAX);
+
+    for (; c + L::width <= end; c += L::width) {
+        V x = L::load(values + c);
+
+        // The first sample after a restart only fills the history
+        M first = L::gt(L::load(fresh + c), zero);
+        V p1 = L::select(first, x, L::load(previous[0] + c));
+        V p2 = L::select(first, x, L::load(previous[1] + c));
+        L::store(fresh + c, zero);
+        L::store(previous[0] + c, x);
+        L::store(previous[1] + c, p1);
+        V power = L::load(noisePower + c);
+
+        // Extremes, from settled samples only: a quick turn of the knob reaches them when it stops
+        V jump = L::select(first, unsettled, L::max(L::abs(L::sub(x, p1)), L::abs(L::sub(x, p2))));
+        V settleLimit = L::max(L::mul(settleDeviations, L::sqrt(L::mul(power, toDeviation))), settleFloor);
+        M settled = L::gt(settleLimit, jump);
+        V lo = L::load(lowest + c);
+        V hi = L::load(highest + c);
+        lo = L::select(settled, L::min(lo, x), lo);
+        hi = L::select(settled, L::max(hi, x), hi);
+        L::store(lowest + c, lo);
+        L::store(highest + c, hi);
+
+        // Noise: mean square of the clipped second differences
+        V limit = L::max(L::mul(clipDeviations, L::sqrt(power)), clipFloor);
+        V d = L::min(L::abs(L::sub(L::add(x, p2), L::mul(two, p1))), limit);
+        V weight = L::select(first, zero, L::load(noiseWeight + c));
+        power = L::max(L::add(power, L::mul(weight, L::sub(L::mul(d, d), power))), powerFloor);
+        L::store(noisePower + c, power);
+
+        // Gain and offset over the learned range once it is wide enough, the full range before
+        M learned = L::gt(L::sub(hi, lo), L::load(minSpan + c));
+        lo = L::select(learned, lo, zero);
+        hi = L::select(learned, hi, one);
+        V deadZone = L::max(L::mul(L::load(noiseDeadZone + c), L::sqrt(L::mul(power, toDeviation))), L::load(minDeadZone + c));
+        V offset = L::add(lo, deadZone);
+        V span = L::max(L::sub(L::sub(hi, lo), L::mul(two, deadZone)), tiny);
+        V y = L::div(L::sub(x, offset), span);
+        L::store(values + c, L::min(L::max(y, zero), one));
+    }
+    return c;
+}
+
+bool SensorCalibration::load(const char *path) {
+    FILE *file = fopen(path, "r");
+    if (!file) return false;
+    char line[256];
+    bool valid = fgets(line, sizeof(line), file) && strncmp(line, FILE_HEADER, strlen(FILE_HEADER)) == 0;
+    while (valid && fgets(line, sizeof(line), file)) {
+        unsigned channel;
+        float lo, hi, noise;
+        if (sscanf(line, "%u %f %f %f", &channel, &lo, &hi, &noise) != 4) continue;
+        if (channel >= SENSOR_MAX_CHANNELS || !(lo <= hi) || !(noise >= 0.0f)) continue;
+        lowest[channel] = lo;
+        highest[channel] = hi;
+        noisePower[channel] = SECOND_DIFFERENCE_POWER * noise * noise;
+        fresh[channel] = 1.0f;
+    }
+    fclose(file);
+    return valid;
+}
+
+bool SensorCalibration::save(const char *path) const {
+    FILE *file = fopen(path, "w");
+    if (!file) return false;
+    fprintf(file, "%s\n", FILE_HEADER);
+    for (uint32_t c = 0; c < SENSOR_MAX_CHANNELS; ++c) {
+        if (lowest[c] > highest[c]) continue;
+        fprintf(file, "%u %.6f %.6f %.7f\n", c, lowest[c], highest[c], std::sqrt(noisePower[c] / SECOND_DIFFERENCE_POWER));
+    }
+    return fclose(file) == 0;
+}
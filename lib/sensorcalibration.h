@@ -0,0 +1,84 @@
+/*!
+\file    sensorcalibration.h
+\brief   Auto-ranging calibration of the sensor channels: each channel's 0..1 follows the travel its
+         potentiometer actually covers, with a dead-zone at both ends sized from its noise.
+*/
+
+
+#ifndef SENSORCALIBRATION_H
+#define SENSORCALIBRATION_H
+
+#include "sensorframe.h"
+#include <cstdint>
+
+/*!  \struct    SensorChannelCalibration
+     \brief     Settings of the calibration of one channel (normalised units)
+*/
+struct SensorChannelCalibration {
+    // Range the channel must have covered before it replaces the full ADC range
+    float minSpan = 0.25f;
+    // Dead-zone at each end of the range: this many noise deviations, at least minDeadZone. The extremes
+    // are themselves about 4 deviations past the resting value, hence the width
+    float noiseDeadZone = 8.0f;
+    float minDeadZone = 2.0f / SENSOR_ADC_MAX;
+    // Weight of a sample in the noise estimate, about one over the samples it averages
+    float noiseWeight = 1.0f / 1024.0f;
+};
+
+/*!  \class     SensorCalibration
+     \brief     Running minimum, maximum and noise floor of every channel of the shared frame, updated
+                in O(1) per sample, and the mapping they define:
+                    calibrated = clamp((value - offset) * gain, 0, 1)
+                with offset = minimum + dead-zone and gain = 1 / (maximum - minimum - 2 dead-zones).
+                Values inside the dead-zones read exactly 0 or 1, so a potentiometer resting at
+                either end does not flicker. The noise is the spread of the second differences of the
+                values, which a steady turn of the knob leaves out, clipped so that a quick move barely
+                counts. Only samples that settled within a few deviations of the two before them
+                move the extremes, so a single glitch does not stretch the range for good. Until a
+                channel has covered minSpan, the full ADC range is used.
+                Like SensorFilter, every quantity is one array over the channels and process() runs the
+                update and the mapping in one branch-free pass, four channels per instruction.
+*/
+class SensorCalibration {
+public:
+    SensorCalibration();
+
+    // Settings of channels first .. first+count-1, what they learned is kept
+    void configure(uint32_t first, uint32_t count, const SensorChannelCalibration &settings);
+
+    // Forget what channels first .. first+count-1 learned
+    void clear(uint32_t first = 0, uint32_t count = SENSOR_MAX_CHANNELS);
+
+    // The stream of channels first .. first+count-1 restarts: the noise estimate skips the gap
+    void restart(uint32_t first, uint32_t count);
+
+    // Update the statistics with values (channels first .. first+count-1 of the frame) and calibrate them in place
+    void process(float *values, uint32_t first, uint32_t count);
+
+    // Read the ranges and noise floors saved by save(), returns false if the file cannot be read
+    bool load(const char *path);
+
+    // Write the ranges and noise floors of the channels that received values, returns false on error
+    bool save(const char *path) const;
+
+private:
+    template <typename Lanes>
+    uint32_t processLanes(float *values, uint32_t first, uint32_t end);
+
+    // Settings
+    alignas(64) float minSpan[SENSOR_MAX_CHANNELS];
+    alignas(64) float noiseDeadZone[SENSOR_MAX_CHANNELS];
+    alignas(64) float minDeadZone[SENSOR_MAX_CHANNELS];
+    alignas(64) float noiseWeight[SENSOR_MAX_CHANNELS];
+
+    // Learned: extremes of the values, mean square of the clipped second differences
+    alignas(64) float lowest[SENSOR_MAX_CHANNELS];
+    alignas(64) float highest[SENSOR_MAX_CHANNELS];
+    alignas(64) float noisePower[SENSOR_MAX_CHANNELS];
+
+    // State: 1.0f until the first sample after a restart, two previous values
+    alignas(64) float fresh[SENSOR_MAX_CHANNELS];
+    alignas(64) float previous[2][SENSOR_MAX_CHANNELS];
+};
+
+#endif // SENSORCALIBRATION_H
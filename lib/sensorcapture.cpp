@@ -0,0 +1,439 @@
+/*!
+ \file    sensorcapture.cpp
+ \brief   Source file of the sensor capture writer and reader.
+ */
+
+#include "sensorcapture.h"
+#include <algorithm>
+#include <cstring>
+
+#if defined (__linux__) || defined(__APPLE__)
+    #include <fcntl.h>
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+    #include <unistd.h>
+#endif
+
+static const char CAPTURE_MAGIC[8] = {'S', 'N', 'S', 'C', 'A', 'P', '0', '2'};
+// Version without decoder phases in the keyframes, still read
+static const char CAPTURE_MAGIC_01[8] = {'S', 'N', 'S', 'C', 'A', 'P', '0', '1'};
+static const char INDEX_MAGIC[8]   = {'S', 'N', 'S', 'C', 'A', 'P', 'I', 'X'};
+static const size_t TRAILER_BYTES = 16;
+
+// Record kinds, in the two low bits of the tag
+static const uint64_t RECORD_DATA = 0;
+static const uint64_t RECORD_KEYFRAME = 1;
+static const uint64_t RECORD_INDEX = 2;
+
+// Largest record header: three varints of at most 10 bytes, and one phase of at most 5 bytes per device
+static const size_t RECORD_HEADER_BYTES = 30;
+static const size_t PHASE_BYTES = 5;
+
+
+static void storeLE(uint8_t *out, uint64_t value, int bytes) {
+    for (int i = 0; i < bytes; ++i) out[i] = (uint8_t)(value >> (8 * i));
+}
+
+static uint64_t loadLE(const uint8_t *in, int bytes) {
+    uint64_t value = 0;
+    for (int i = 0; i < bytes; ++i) value |= (uint64_t)in[i] << (8 * i);
+    return value;
+}
+
+
+SensorCaptureWriter::SensorCaptureWriter()
+    : base(nullptr), capacity(0), used(0), flushed(0),
+#if defined (__linux__) || defined(__APPLE__)
+      fd(-1),
+#else
+      file(nullptr),
+#endif
+      start_ns(0), last_ns(0), nextKeyframe_ns(0), deviceCount(0) {}
+
+SensorCaptureWriter::~SensorCaptureWriter() {
+    close();
+}
+
+/*!
+     \brief Create a capture, replacing any file at path
+     \param devices : settings of the devices, in the order of their index in append()
+     \param start : timeOut::now_ns at the start of the recording, keyframe times count from it
+     \return false if the file cannot be created
+  */
+bool SensorCaptureWriter::open(const char *path, const std::vector<SensorCaptureDevice> &devices, int64_t start) {
+    close();
+#if defined (__linux__) || defined(__APPLE__)
+    fd = ::open(path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) return false;
+#else
+    file = fopen(path, "wb");
+    if (!file) return false;
+#endif
+    start_ns = start;
+    last_ns = start;
+    nextKeyframe_ns = 0;
+    deviceCount = (uint32_t)devices.size();
+    keyTimes.clear();
+    keyOffsets.clear();
+
+    size_t header = sizeof(CAPTURE_MAGIC) + 12;
+    for (const SensorCaptureDevice &dev : devices) header += 11 + dev.path.size();
+    if (!reserve(header)) {
+        close();
+        return false;
+    }
+    uint8_t field[8];
+    put(CAPTURE_MAGIC, sizeof(CAPTURE_MAGIC));
+    storeLE(field, (uint64_t)start_ns, 8);
+    put(field, 8);
+    storeLE(field, devices.size(), 4);
+    put(field, 4);
+    for (const SensorCaptureDevice &dev : devices) {
+        field[0] = (uint8_t)dev.format;
+        put(field, 1);
+        storeLE(field, dev.channelOffset, 4);
+        put(field, 4);
+        storeLE(field, dev.channelCount, 4);
+        put(field, 4);
+        uint16_t pathLength = (uint16_t)std::min<size_t>(dev.path.size(), 0xFFFF);
+        storeLE(field, pathLength, 2);
+        put(field, 2);
+        put(dev.path.data(), pathLength);
+    }
+    return true;
+}
+
+/*!
+     \brief Record one chunk, a copy into the mapping unless the file has to grow
+     \param timestamp_ns : time the chunk was read (timeOut::now_ns), never earlier than the previous chunk's
+     \param phases : one per device, the bytes of an incomplete bare frame its decoder holds before
+            this chunk, kept in keyframes so that a replay starting there skips to the next frame (can be NULL)
+     \return false if the file could not grow, the chunk is lost
+  */
+bool SensorCaptureWriter::append(uint32_t device, int64_t timestamp_ns, const uint8_t *data, size_t length,
+                                 const uint32_t *phases) {
+    if (!isOpen()) return false;
+    // An empty record marks the end of an unclosed capture
+    if (length == 0) return true;
+    if (!reserve(RECORD_HEADER_BYTES + deviceCount * PHASE_BYTES + length)) return false;
+
+    if (timestamp_ns < last_ns) timestamp_ns = last_ns;
+    int64_t position = timestamp_ns - start_ns;
+    if (keyTimes.empty() || position >= nextKeyframe_ns) {
+        keyTimes.push_back(position);
+        keyOffsets.push_back(flushed + used);
+        nextKeyframe_ns = (position / SENSOR_CAPTURE_KEYFRAME_NS + 1) * SENSOR_CAPTURE_KEYFRAME_NS;
+        putVarint((uint64_t)device << 2 | RECORD_KEYFRAME);
+        putVarint((uint64_t)position);
+        for (uint32_t d = 0; d < deviceCount; ++d) putVarint(phases ? phases[d] : 0);
+    } else {
+        putVarint((uint64_t)device << 2 | RECORD_DATA);
+        putVarint((uint64_t)(timestamp_ns - last_ns));
+    }
+    putVarint(length);
+    put(data, length);
+    last_ns = timestamp_ns;
+    return true;
+}
+
+/*!
+     \brief Append the keyframe index and the trailer, then trim and close the file
+  */
+void SensorCaptureWriter::close() {
+    if (!isOpen()) return;
+    uint64_t indexOffset = flushed + used;
+    if (reserve(3 * 10 + keyTimes.size() * 20 + TRAILER_BYTES)) {
+        putVarint(RECORD_INDEX);
+        putVarint(keyTimes.size());
+        for (size_t i = 0; i < keyTimes.size(); ++i) {
+            putVarint((uint64_t)(keyTimes[i] - (i ? keyTimes[i - 1] : 0)));
+            putVarint(keyOffsets[i] - (i ? keyOffsets[i - 1] : 0));
+        }
+        uint8_t field[8];
+        storeLE(field, indexOffset, 8);
+        put(field, 8);
+        put(INDEX_MAGIC, sizeof(INDEX_MAGIC));
+    }
+#if defined (__linux__) || defined(__APPLE__)
+    if (base) munmap(base, capacity);
+    if (ftruncate(fd, (off_t)used) != 0) { /* the reader stops at the zero padding anyway */ }
+    ::close(fd);
+    fd = -1;
+#else
+    if (used > 0) fwrite(base, 1, used, file);
+    fclose(file);
+    file = nullptr;
+    delete[] base;
+#endif
+    base = nullptr;
+    capacity = 0;
+    used = 0;
+    flushed = 0;
+}
+
+bool SensorCaptureWriter::isOpen() const {
+#if defined (__linux__) || defined(__APPLE__)
+    return fd >= 0;
+#else
+    return file != nullptr;
+#endif
+}
+
+uint64_t SensorCaptureWriter::size() const {
+    return flushed + used;
+}
+
+// Make room for bytes more bytes: grow and remap the file (POSIX), or write the buffer out
+bool SensorCaptureWriter::reserve(size_t bytes) {
+    if (used + bytes <= capacity) return true;
+    size_t grow = bytes > SENSOR_CAPTURE_GROW_BYTES ? bytes : SENSOR_CAPTURE_GROW_BYTES;
+#if defined (__linux__) || defined(__APPLE__)
+    size_t newCapacity = capacity + grow;
+    if (ftruncate(fd, (off_t)newCapacity) != 0) return false;
+    if (base) munmap(base, capacity);
+    void *mapping = mmap(NULL, newCapacity, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (mapping == MAP_FAILED) {
+        base = nullptr;
+        capacity = 0;
+        return false;
+    }
+    base = (uint8_t *)mapping;
+    capacity = newCapacity;
+#else
+    if (used > 0 && fwrite(base, 1, used, file) != used) return false;
+    flushed += used;
+    used = 0;
+    if (bytes > capacity) {
+        delete[] base;
+        base = new uint8_t[grow];
+        capacity = grow;
+    }
+#endif
+    return true;
+}
+
+void SensorCaptureWriter::put(const void *data, size_t length) {
+    memcpy(base + used, data, length);
+    used += length;
+}
+
+void SensorCaptureWriter::putVarint(uint64_t value) {
+    while (value >= 0x80) {
+        base[used++] = (uint8_t)(value | 0x80);
+        value >>= 7;
+    }
+    base[used++] = (uint8_t)value;
+}
+
+
+SensorCaptureReader::SensorCaptureReader()
+    : base(nullptr), length(0), end(0), pos(0), firstRecord(0),
+#if defined (__linux__) || defined(__APPLE__)
+      mapped(0),
+#endif
+      start_ns(0), last_ns(0), hasPhases(false) {}
+
+SensorCaptureReader::~SensorCaptureReader() {
+    close();
+}
+
+/*!
+     \brief Map a capture for reading, positioned on its first chunk
+     \return false if the file cannot be read or is not a capture
+  */
+bool SensorCaptureReader::open(const char *path) {
+    close();
+#if defined (__linux__) || defined(__APPLE__)
+    int fd = ::open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return false;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0) {
+        ::close(fd);
+        return false;
+    }
+    void *mapping = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (mapping == MAP_FAILED) return false;
+    base = (const uint8_t *)mapping;
+    length = mapped = (size_t)st.st_size;
+#if defined (__linux__)
+    // Replay reads the capture front to back
+    madvise(mapping, mapped, MADV_SEQUENTIAL);
+#endif
+#else
+    FILE *file = fopen(path, "rb");
+    if (!file) return false;
+    uint8_t block[65536];
+    size_t n;
+    while ((n = fread(block, 1, sizeof(block), file)) > 0) content.insert(content.end(), block, block + n);
+    fclose(file);
+    base = content.data();
+    length = content.size();
+#endif
+    if (!parseHeader()) {
+        close();
+        return false;
+    }
+
+    // A closed capture ends with its index, an unclosed one is scanned for its keyframes
+    end = length;
+    bool indexed = false;
+    if (length >= firstRecord + TRAILER_BYTES && memcmp(base + length - 8, INDEX_MAGIC, 8) == 0) {
+        size_t at = (size_t)loadLE(base + length - TRAILER_BYTES, 8);
+        uint64_t tag, count;
+        if (at >= firstRecord && at < length && getVarint(at, tag) && tag == RECORD_INDEX && getVarint(at, count)) {
+            int64_t time = 0;
+            uint64_t offset = 0;
+            indexed = true;
+            for (uint64_t i = 0; i < count && indexed; ++i) {
+                uint64_t dt, doff;
+                indexed = getVarint(at, dt) && getVarint(at, doff);
+                time += (int64_t)dt;
+                offset += doff;
+                keyTimes.push_back(time);
+                keyOffsets.push_back(offset);
+            }
+            end = (size_t)loadLE(base + length - TRAILER_BYTES, 8);
+        }
+    }
+    if (!indexed) {
+        // Drop what a damaged index left
+        keyTimes.clear();
+        keyOffsets.clear();
+        end = length;
+        buildIndex();
+    }
+    seek(0);
+    return true;
+}
+
+void SensorCaptureReader::close() {
+#if defined (__linux__) || defined(__APPLE__)
+    if (base) munmap((void *)base, mapped);
+    mapped = 0;
+#else
+    content.clear();
+    content.shrink_to_fit();
+#endif
+    base = nullptr;
+    length = end = pos = firstRecord = 0;
+    deviceList.clear();
+    keyTimes.clear();
+    keyOffsets.clear();
+    keyPhases.clear();
+}
+
+bool SensorCaptureReader::parseHeader() {
+    size_t at = sizeof(CAPTURE_MAGIC) + 12;
+    if (length < at) return false;
+    hasPhases = memcmp(base, CAPTURE_MAGIC, sizeof(CAPTURE_MAGIC)) == 0;
+    if (!hasPhases && memcmp(base, CAPTURE_MAGIC_01, sizeof(CAPTURE_MAGIC_01)) != 0) return false;
+    start_ns = (int64_t)loadLE(base + 8, 8);
+    uint32_t count = (uint32_t)loadLE(base + 16, 4);
+    deviceList.clear();
+    for (uint32_t i = 0; i < count; ++i) {
+        if (length < at + 11) return false;
+        SensorCaptureDevice dev;
+        dev.format = (SensorWireFormat)base[at];
+        dev.channelOffset = (uint32_t)loadLE(base + at + 1, 4);
+        dev.channelCount = (uint32_t)loadLE(base + at + 5, 4);
+        size_t pathLength = (size_t)loadLE(base + at + 9, 2);
+        at += 11;
+        if (length < at + pathLength) return false;
+        dev.path.assign((const char *)base + at, pathLength);
+        at += pathLength;
+        deviceList.push_back(dev);
+    }
+    firstRecord = at;
+    return true;
+}
+
+bool SensorCaptureReader::getVarint(size_t &at, uint64_t &value) const {
+    value = 0;
+    for (int shift = 0; shift < 64 && at < length; shift += 7) {
+        uint8_t byte = base[at++];
+        value |= (uint64_t)(byte & 0x7F) << shift;
+        if (!(byte & 0x80)) return true;
+    }
+    return false;
+}
+
+/*!
+     \brief Read the header of the data or keyframe record at pos, skipping the phases of a keyframe
+     \param limit : end of the records
+     \return false if there is no valid record at pos (end of the capture), pos is then left as it was
+  */
+bool SensorCaptureReader::getRecord(size_t &pos, uint64_t &tag, uint64_t &time, uint64_t &size, size_t limit) {
+    size_t at = pos;
+    if (at >= limit || !getVarint(at, tag) || (tag & 3) > RECORD_KEYFRAME || !getVarint(at, time)) return false;
+    if (hasPhases && (tag & 3) == RECORD_KEYFRAME) {
+        uint64_t phase;
+        for (size_t d = 0; d < deviceList.size(); ++d)
+            if (!getVarint(at, phase)) return false;
+    }
+    if (!getVarint(at, size) || at > limit || size == 0 || size > limit - at) return false;
+    pos = at;
+    return true;
+}
+
+// Walk the records of an unclosed capture up to the first empty or truncated one
+void SensorCaptureReader::buildIndex() {
+    size_t at = firstRecord;
+    uint64_t tag, time, size;
+    while (true) {
+        size_t record = at;
+        if (!getRecord(at, tag, time, size, length)) break;
+        if ((tag & 3) == RECORD_KEYFRAME) {
+            keyTimes.push_back((int64_t)time);
+            keyOffsets.push_back(record);
+        }
+        at += size;
+    }
+    end = at;
+}
+
+/*!
+     \brief Read the next chunk
+     \return false at the end of the capture (or at a truncated record)
+  */
+bool SensorCaptureReader::next(SensorCaptureChunk &chunk) {
+    size_t at = pos;
+    uint64_t tag, time, size;
+    if (!getRecord(at, tag, time, size, end)) return false;
+    last_ns = (tag & 3) == RECORD_KEYFRAME ? start_ns + (int64_t)time : last_ns + (int64_t)time;
+    chunk.device = (uint32_t)(tag >> 2);
+    chunk.timestamp_ns = last_ns;
+    chunk.data = base + at;
+    chunk.length = (size_t)size;
+    pos = at + size;
+    return true;
+}
+
+/*!
+     \brief Move to the last keyframe at or before position_ns (time since the start of the recording)
+     \return the position of that keyframe, the caller skips the chunks before position_ns if needed
+  */
+int64_t SensorCaptureReader::seek(int64_t position_ns) {
+    keyPhases.clear();
+    auto key = std::upper_bound(keyTimes.begin(), keyTimes.end(), position_ns);
+    if (key == keyTimes.begin()) {
+        pos = firstRecord;
+        last_ns = start_ns;
+        return 0;
+    }
+    size_t i = (size_t)(key - keyTimes.begin()) - 1;
+    pos = (size_t)keyOffsets[i];
+    last_ns = start_ns + keyTimes[i];
+    if (hasPhases) {
+        // The phases follow the tag and the time of the keyframe
+        size_t at = pos;
+        uint64_t value;
+        bool ok = getVarint(at, value) && getVarint(at, value);
+        for (size_t d = 0; d < deviceList.size() && ok; ++d) {
+            ok = getVarint(at, value);
+            keyPhases.push_back((uint32_t)value);
+        }
+        if (!ok) keyPhases.clear();
+    }
+    return keyTimes[i];
+}
@@ -0,0 +1,179 @@
+/*!
+\file    sensorcapture.h
+\brief   Append-only capture of the raw bytes read from the sensor devices, and its reader for replay.
+
+A capture file is laid out as:
+
+    header    magic "SNSCAP02", start time (u64 LE, timeOut::now_ns of the recording),
+              device count (u32 LE), then per device: wire format (u8), first channel (u32 LE),
+              channel count (u32 LE), path length (u16 LE) and path
+    records   one per chunk read from a device, all integers as LEB128 varints:
+                  tag = device << 2 | kind
+                  kind 0 (data):     time since the previous record (ns), length, bytes
+                  kind 1 (keyframe): time since the start (ns), then per device the bytes of an
+                                     incomplete bare frame its decoder held, length, bytes
+              a keyframe starts every SENSOR_CAPTURE_KEYFRAME_NS of recording, replay can start at any of
+              them: the bare streams are cut anywhere, their decoders skip to the next frame boundary
+    index     written on close: tag kind 2, keyframe count, then per keyframe the increase of its
+              time and of its file offset, followed by a 16-byte trailer: offset of the index
+              (u64 LE) and magic "SNSCAPIX"
+
+A capture that was not closed (crash, power cut) has no index and ends with zeros; the reader
+stops at the first empty record and rebuilds the index from the keyframes. Captures "SNSCAP01"
+are read too, their keyframes carry no decoder state.
+*/
+
+
+#ifndef SENSORCAPTURE_H
+#define SENSORCAPTURE_H
+
+#include "sensorprotocol.h"
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+/*! Recording time between two keyframes, the granularity of seeking */
+#define SENSOR_CAPTURE_KEYFRAME_NS 1000000000LL
+
+/*! Step by which a capture file grows, about 1.5 h of one board at 115200 baud */
+#define SENSOR_CAPTURE_GROW_BYTES (64u << 20)
+
+/*!  \struct    SensorCaptureDevice
+     \brief     Settings of one recorded device, enough to decode its bytes again
+*/
+struct SensorCaptureDevice {
+    SensorWireFormat format = SENSOR_WIRE_RAW16;
+    uint32_t         channelOffset = 0;
+    uint32_t         channelCount = 0;
+    std::string      path;
+};
+
+/*!  \struct    SensorCaptureChunk
+     \brief     One chunk of bytes as read from a device. data points into the capture and stays
+                valid until the reader is closed.
+*/
+struct SensorCaptureChunk {
+    uint32_t       device = 0;
+    // Time the chunk was read, on the recording host's timeOut::now_ns clock
+    int64_t        timestamp_ns = 0;
+    const uint8_t *data = nullptr;
+    size_t         length = 0;
+};
+
+/*!  \class     SensorCaptureWriter
+     \brief     Appends chunks to a memory-mapped file: an append is a copy into the mapping, the
+                kernel writes the pages back in the background. The file grows by
+                SENSOR_CAPTURE_GROW_BYTES at a time and is truncated to its content on close.
+*/
+class SensorCaptureWriter {
+public:
+    SensorCaptureWriter();
+    ~SensorCaptureWriter();
+
+    SensorCaptureWriter(const SensorCaptureWriter&) = delete;
+    SensorCaptureWriter& operator=(const SensorCaptureWriter&) = delete;
+
+    // Create the file and write the header, returns false if it cannot be created
+    bool open(const char *path, const std::vector<SensorCaptureDevice> &devices, int64_t start);
+
+    // Record a chunk read from a device at timestamp_ns, returns false if the file cannot grow.
+    // phases: per device, bytes of an incomplete bare frame its decoder holds before this chunk (NULL: none)
+    bool append(uint32_t device, int64_t timestamp_ns, const uint8_t *data, size_t length,
+                const uint32_t *phases = nullptr);
+
+    // Write the index and close the file
+    void close();
+
+    bool isOpen() const;
+
+    // Bytes of the file so far
+    uint64_t size() const;
+
+private:
+    bool reserve(size_t bytes);
+    void put(const void *data, size_t length);
+    void putVarint(uint64_t value);
+
+    // Mapping of the file (POSIX), or buffer written to it when full
+    uint8_t *base;
+    size_t   capacity;
+    size_t   used;
+    // Bytes of the file before base (0 when the whole file is mapped)
+    uint64_t flushed;
+#if defined (__linux__) || defined(__APPLE__)
+    int      fd;
+#else
+    FILE    *file;
+#endif
+    int64_t  start_ns;
+    int64_t  last_ns;
+    int64_t  nextKeyframe_ns;
+    uint32_t deviceCount;
+    std::vector<int64_t>  keyTimes;
+    std::vector<uint64_t> keyOffsets;
+};
+
+/*!  \class     SensorCaptureReader
+     \brief     Maps a capture read-only and walks its chunks in order, from the start or from the
+                keyframe preceding any point in time.
+*/
+class SensorCaptureReader {
+public:
+    SensorCaptureReader();
+    ~SensorCaptureReader();
+
+    SensorCaptureReader(const SensorCaptureReader&) = delete;
+    SensorCaptureReader& operator=(const SensorCaptureReader&) = delete;
+
+    // Map a capture and load its index (rebuilt if the capture was not closed), returns false if it is not a capture
+    bool open(const char *path);
+
+    void close();
+
+    const std::vector<SensorCaptureDevice> &devices() const { return deviceList; }
+
+    // timeOut::now_ns of the recording when it started
+    int64_t startTime_ns() const { return start_ns; }
+
+    // Time from the start to the last keyframe, an estimate of the length of the recording
+    int64_t duration_ns() const { return keyTimes.empty() ? 0 : keyTimes.back(); }
+
+    // Next chunk, returns false at the end of the capture
+    bool next(SensorCaptureChunk &chunk);
+
+    // Continue from the last keyframe at or before position_ns after the start, returns the keyframe's position
+    int64_t seek(int64_t position_ns);
+
+    // Per device, bytes of an incomplete bare frame its decoder held at the keyframe of the last seek(),
+    // empty at the start of the capture and for captures without them
+    const std::vector<uint32_t> &phases() const { return keyPhases; }
+
+private:
+    bool parseHeader();
+    bool getVarint(size_t &pos, uint64_t &value) const;
+    bool getRecord(size_t &pos, uint64_t &tag, uint64_t &time, uint64_t &size, size_t limit);
+    void buildIndex();
+
+    const uint8_t *base;
+    size_t         length;
+    // End of the records (start of the index or of the zero padding)
+    size_t         end;
+    size_t         pos;
+    size_t         firstRecord;
+#if defined (__linux__) || defined(__APPLE__)
+    size_t         mapped;
+#else
+    std::vector<uint8_t> content;
+#endif
+    int64_t        start_ns;
+    int64_t        last_ns;
+    // Keyframes carry the decoder phases (SNSCAP02)
+    bool           hasPhases;
+    std::vector<SensorCaptureDevice> deviceList;
+    std::vector<int64_t>  keyTimes;
+    std::vector<uint64_t> keyOffsets;
+    std::vector<uint32_t> keyPhases;
+};
+
+#endif // SENSORCAPTURE_H
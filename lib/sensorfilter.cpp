@@ -0,0 +1,121 @@
+/*!
+ \file    sensorfilter.cpp
+ \brief   Source file of the class SensorFilter.
+ */
+
+#include "sensorfilter.h"
+#include "simdlanes.h"
+
+static const float TWO_PI = 6.2831853f;
+
+
+SensorFilter::SensorFilter() {
+    configure(0, SENSOR_MAX_CHANNELS, SensorChannelFilter());
+}
+
+void SensorFilter::configure(uint32_t channel, const SensorChannelFilter &settings) {
+    configure(channel, 1, settings);
+}
+
+void SensorFilter::configure(uint32_t first, uint32_t count, const SensorChannelFilter &settings) {
+    if (first >= SENSOR_MAX_CHANNELS) return;
+    if (count > SENSOR_MAX_CHANNELS - first) count = SENSOR_MAX_CHANNELS - first;
+    for (uint32_t c = first; c < first + count; ++c) {
+        median3[c] = settings.medianWindow == 3 ? 1.0f : 0.0f;
+        median5[c] = settings.medianWindow >= 5 ? 1.0f : 0.0f;
+        oneEuro[c] = settings.smoothing == SENSOR_SMOOTH_ONE_EURO ? 1.0f : 0.0f;
+        alpha[c] = settings.smoothing == SENSOR_SMOOTH_EMA ? settings.alpha : 1.0f;
+        minCutoff[c] = settings.minCutoff;
+        beta[c] = settings.beta;
+        derivativeCutoff[c] = settings.derivativeCutoff;
+        deadBand[c] = settings.deadBand;
+    }
+    reset(first, count);
+}
+
+void SensorFilter::reset(uint32_t first, uint32_t count) {
+    if (first >= SENSOR_MAX_CHANNELS) return;
+    if (count > SENSOR_MAX_CHANNELS - first) count = SENSOR_MAX_CHANNELS - first;
+    for (uint32_t c = first; c < first + count; ++c) fresh[c] = 1.0f;
+}
+
+/*!
+     \brief Filter the values of a range of channels in place
+     \param values : normalised values of channels first .. first+count-1
+     \param dt_s : seconds since the previous sample of these channels, for the One-Euro filter
+  */
+void SensorFilter::process(float *values, uint32_t first, uint32_t count, float dt_s) {
+    if (first >= SENSOR_MAX_CHANNELS) return;
+    if (count > SENSOR_MAX_CHANNELS - first) count = SENSOR_MAX_CHANNELS - first;
+    if (!(dt_s > 0.0f)) dt_s = 1e-3f;
+    uint32_t end = first + count;
+    uint32_t c = first;
+#if defined (SIMD_LANES_VECTOR)
+    c = processLanes<VectorLanes>(values - first, c, end, dt_s);
+#endif
+    processLanes<ScalarLanes>(values - first, c, end, dt_s);
+}
+
+/*!
+     \brief Run every stage on Lanes::width channels at a time, from channel c while a whole group fits before end
+            values is indexed by channel
+     \return the first channel left
+  */
+template <typename L>
+uint32_t SensorFilter::processLanes(float *values, uint32_t c, uint32_t end, float dt_s) {
+    typedef typename L::V V;
+    typedef typename L::M M;
+    const V zero = L::set(0.0f);
+    const V one = L::set(1.0f);
+    const V rate = L::set(1.0f / dt_s);
+    const V twoPiDt = L::set(TWO_PI * dt_s);
+
+    for (; c + L::width <= end; c += L::width) {
+        V x = L::load(values + c);
+
+        // A channel's first sample fills its history and state
+        M first = L::gt(L::load(fresh + c), zero);
+        V h1 = L::select(first, x, L::load(history[0] + c));
+        V h2 = L::select(first, x, L::load(history[1] + c));
+        V h3 = L::select(first, x, L::load(history[2] + c));
+        V h4 = L::select(first, x, L::load(history[3] + c));
+        V y = L::select(first, x, L::load(smoothed + c));
+        V dx = L::select(first, zero, L::load(speed + c));
+        V held = L::select(first, x, L::load(output + c));
+        L::store(fresh + c, zero);
+        L::store(history[0] + c, x);
+        L::store(history[1] + c, h1);
+        L::store(history[2] + c, h2);
+        L::store(history[3] + c, h3);
+        L::store(history[4] + c, h4);
+
+        // Median of 3 and of 5 with min/max networks: without the smallest and the largest of the
+        // four older samples, the median of five is the median of the two left and the newest one
+        V med3 = L::max(L::min(x, h1), L::min(L::max(x, h1), h2));
+        V lo = L::max(L::min(h1, h2), L::min(h3, h4));
+        V hi = L::min(L::max(h1, h2), L::max(h3, h4));
+        V med5 = L::max(L::min(lo, hi), L::min(L::max(lo, hi), x));
+        V m = L::select(L::gt(L::load(median5 + c), zero), med5, L::select(L::gt(L::load(median3 + c), zero), med3, x));
+
+        // One-Euro: smoothed speed, cutoff rising with it, then alpha = 2 pi fc dt / (1 + 2 pi fc dt);
+        // EMA and no smoothing use their fixed alpha
+        V rd = L::mul(twoPiDt, L::load(derivativeCutoff + c));
+        V speedAlpha = L::div(rd, L::add(one, rd));
+        dx = L::add(dx, L::mul(speedAlpha, L::sub(L::mul(L::sub(m, y), rate), dx)));
+        V cutoff = L::add(L::load(minCutoff + c), L::mul(L::load(beta + c), L::abs(dx)));
+        V rc = L::mul(twoPiDt, cutoff);
+        V euroAlpha = L::div(rc, L::add(one, rc));
+        V a = L::select(L::gt(L::load(oneEuro + c), zero), euroAlpha, L::load(alpha + c));
+        y = L::add(y, L::mul(a, L::sub(m, y)));
+
+        // Dead-band: hold the output until the value leaves the band around it
+        V moved = L::abs(L::sub(y, held));
+        held = L::select(L::gt(moved, L::load(deadBand + c)), y, held);
+
+        L::store(smoothed + c, y);
+        L::store(speed + c, dx);
+        L::store(output + c, held);
+        L::store(values + c, held);
+    }
+    return c;
+}
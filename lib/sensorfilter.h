@@ -0,0 +1,84 @@
+/*!
+\file    sensorfilter.h
+\brief   Per-channel filtering of the normalised sensor values, applied to every decoded frame.
+*/
+
+
+#ifndef SENSORFILTER_H
+#define SENSORFILTER_H
+
+#include "sensorframe.h"
+#include <cstdint>
+
+/**
+ * smoothing stage of a channel
+ */
+enum SensorSmoothing {
+    SENSOR_SMOOTH_NONE, /**< pass the values through */
+    SENSOR_SMOOTH_EMA, /**< exponential moving average of fixed weight alpha */
+    SENSOR_SMOOTH_ONE_EURO, /**< One-Euro filter: heavy smoothing at rest, little lag when the value moves fast */
+};
+
+/*!  \struct    SensorChannelFilter
+     \brief     Settings of the filter of one channel. The stages run in this order:
+                median of the last medianWindow samples, smoothing, then dead-band.
+*/
+struct SensorChannelFilter {
+    // Samples of the median removing single-sample spikes: 1 (off), 3 or 5
+    int             medianWindow = 1;
+    SensorSmoothing smoothing = SENSOR_SMOOTH_NONE;
+    // EMA: weight of the new sample, 0 < alpha <= 1
+    float           alpha = 1.0f;
+    // One-Euro: cutoff frequency at rest (Hz), increase of the cutoff per unit/s of speed, cutoff of the speed estimate (Hz)
+    float           minCutoff = 1.0f;
+    float           beta = 0.5f;
+    float           derivativeCutoff = 1.0f;
+    // The output only moves once the smoothed value is more than deadBand (normalised units) away from it
+    float           deadBand = 0.0f;
+};
+
+/*!  \class     SensorFilter
+     \brief     Filters of every channel of the shared frame. The settings and the state are stored as
+                one array per quantity, and each stage is branch-free so that a call processes four
+                channels per instruction (SSE2 or NEON) whatever the settings of each channel.
+                A device calls process() on its own range of channels for each of its frames.
+*/
+class SensorFilter {
+public:
+    SensorFilter();
+
+    // Settings of one channel, its state restarts from the next sample
+    void configure(uint32_t channel, const SensorChannelFilter &settings);
+
+    // Same settings for channels first .. first+count-1
+    void configure(uint32_t first, uint32_t count, const SensorChannelFilter &settings);
+
+    // Forget the past samples of channels first .. first+count-1, the next sample passes as is
+    void reset(uint32_t first = 0, uint32_t count = SENSOR_MAX_CHANNELS);
+
+    // Filter values (channels first .. first+count-1 of the frame) in place, dt_s after the previous sample
+    void process(float *values, uint32_t first, uint32_t count, float dt_s);
+
+private:
+    template <typename Lanes>
+    uint32_t processLanes(float *values, uint32_t first, uint32_t end, float dt_s);
+
+    // Settings, masks are 1.0f when the stage is enabled
+    alignas(64) float median3[SENSOR_MAX_CHANNELS];
+    alignas(64) float median5[SENSOR_MAX_CHANNELS];
+    alignas(64) float oneEuro[SENSOR_MAX_CHANNELS];
+    alignas(64) float alpha[SENSOR_MAX_CHANNELS];
+    alignas(64) float minCutoff[SENSOR_MAX_CHANNELS];
+    alignas(64) float beta[SENSOR_MAX_CHANNELS];
+    alignas(64) float derivativeCutoff[SENSOR_MAX_CHANNELS];
+    alignas(64) float deadBand[SENSOR_MAX_CHANNELS];
+
+    // State: 1.0f until the first sample, newest samples, smoothed value, speed estimate, output
+    alignas(64) float fresh[SENSOR_MAX_CHANNELS];
+    alignas(64) float history[5][SENSOR_MAX_CHANNELS];
+    alignas(64) float smoothed[SENSOR_MAX_CHANNELS];
+    alignas(64) float speed[SENSOR_MAX_CHANNELS];
+    alignas(64) float output[SENSOR_MAX_CHANNELS];
+};
+
+#endif // SENSORFILTER_H
@@ -0,0 +1,63 @@
+/*!
+\file    sensorframe.h
+\brief   One decoded reading of every sensor channel, as handed from acquisition to the render loop.
+*/
+
+
+#ifndef SENSORFRAME_H
+#define SENSORFRAME_H
+
+#include <cstdint>
+#include <cstring>
+
+/*! Number of channels sent by the bare wire formats: two potentiometers per projection zone */
+#define SENSOR_CHANNELS 6
+
+/*! Most channels a frame can carry */
+#define SENSOR_MAX_CHANNELS 256
+
+/*! Full scale of the 10-bit ADC */
+#define SENSOR_ADC_MAX 1023.0f
+
+/*!  \struct    SensorFrame
+     \brief     Readings of a runtime number of channels, stored as one contiguous, cache-aligned array
+                per quantity so that per-channel processing runs over plain arrays and vectorises.
+                Copies only move the channels in use.
+*/
+struct SensorFrame {
+    // Time the device sampled the frame on the host monotonic clock (timeOut::now_ns), recovered from the
+    // device's frame rate once known (ClockRecovery) and the time it was read before; 0 until the first frame arrives
+    int64_t  timestamp_ns = 0;
+    // Number of frames decoded so far, 0 until the first frame arrives
+    uint64_t sequence = 0;
+    // Number of valid entries in the arrays below
+    uint32_t channelCount = 0;
+
+    // Raw ADC counts
+    alignas(64) uint16_t raw[SENSOR_MAX_CHANNELS] = {};
+    // Values normalised to 0..1
+    alignas(64) float    value[SENSOR_MAX_CHANNELS] = {};
+
+    SensorFrame() = default;
+
+    SensorFrame(const SensorFrame &other) {
+        *this = other;
+    }
+
+    SensorFrame &operator=(const SensorFrame &other) {
+        if (this == &other) return *this;
+        timestamp_ns = other.timestamp_ns;
+        sequence     = other.sequence;
+        channelCount = other.channelCount;
+        memcpy(raw, other.raw, channelCount * sizeof(raw[0]));
+        memcpy(value, other.value, channelCount * sizeof(value[0]));
+        return *this;
+    }
+
+    // Normalised value of channel, 0 when the frame does not carry it
+    float channel(uint32_t index) const {
+        return index < channelCount ? value[index] : 0.0f;
+    }
+};
+
+#endif // SENSORFRAME_H
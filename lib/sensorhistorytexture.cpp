@@ -0,0 +1,113 @@
+/*!
+ \file    sensorhistorytexture.cpp
+ \brief   Source file of the class SensorHistoryTexture.
+ */
+
+#include "sensorhistorytexture.h"
+#include <cstring>
+
+
+SensorHistoryTexture::SensorHistoryTexture()
+    : tex(0), pbo(0), columns(0), rowCount(0), nextRow(0), pendingRows(0) {}
+
+/*!
+     \brief Create the texture, filled with zeros, and its pixel buffer
+     \param channels : columns of the texture, channels 0 .. channels-1 of the frames
+     \param rows : frames kept
+     \return false if the texture cannot be created
+  */
+bool SensorHistoryTexture::create(uint32_t channels, uint32_t rows) {
+    destroy();
+    if (channels == 0 || rows == 0) return false;
+    if (channels > SENSOR_MAX_CHANNELS) channels = SENSOR_MAX_CHANNELS;
+    columns = channels;
+    rowCount = rows;
+    nextRow = 0;
+    pendingRows = 0;
+    staging.assign((size_t)rows * channels, 0.0f);
+
+    while (glGetError() != GL_NO_ERROR) {}
+    glGenTextures(1, &tex);
+    glBindTexture(GL_TEXTURE_2D, tex);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_R32F, (GLsizei)columns, (GLsizei)rowCount, 0, GL_RED, GL_FLOAT, staging.data());
+    // Linear between frames, the ring wraps around; channels are read at their texel centre
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    glGenBuffers(1, &pbo);
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pbo);
+    glBufferData(GL_PIXEL_UNPACK_BUFFER, (GLsizeiptr)(staging.size() * sizeof(float)), NULL, GL_STREAM_DRAW);
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+    if (glGetError() != GL_NO_ERROR) {
+        destroy();
+        return false;
+    }
+    return true;
+}
+
+void SensorHistoryTexture::destroy() {
+    if (pbo) glDeleteBuffers(1, &pbo);
+    if (tex) glDeleteTextures(1, &tex);
+    pbo = 0;
+    tex = 0;
+    columns = 0;
+    rowCount = 0;
+    nextRow = 0;
+    pendingRows = 0;
+    staging.clear();
+}
+
+void SensorHistoryTexture::push(const SensorFrame &frame) {
+    if (rowCount == 0) return;
+    float *row = &staging[(size_t)nextRow * columns];
+    uint32_t count = frame.channelCount < columns ? frame.channelCount : columns;
+    memcpy(row, frame.value, count * sizeof(float));
+    memset(row + count, 0, (columns - count) * sizeof(float));
+    nextRow = (nextRow + 1) % rowCount;
+    if (pendingRows < rowCount) pendingRows++;
+}
+
+/*!
+     \brief Send the rows pushed since the previous upload
+            They are copied to the pixel buffer, orphaned first so that the copy never waits for
+            the previous transfer, then to the texture in one sub-image, or two when they wrap
+            around the end of the ring.
+  */
+void SensorHistoryTexture::upload() {
+    if (pendingRows == 0 || !tex) return;
+    uint32_t first = (nextRow + rowCount - pendingRows) % rowCount;
+    uint32_t tail = rowCount - first < pendingRows ? rowCount - first : pendingRows;
+    size_t rowBytes = columns * sizeof(float);
+    size_t bytes = pendingRows * rowBytes;
+
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pbo);
+    glBufferData(GL_PIXEL_UNPACK_BUFFER, (GLsizeiptr)(staging.size() * sizeof(float)), NULL, GL_STREAM_DRAW);
+    void *mapped = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, (GLsizeiptr)bytes,
+                                    GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+    if (mapped) {
+        memcpy(mapped, &staging[(size_t)first * columns], tail * rowBytes);
+        memcpy((uint8_t*)mapped + tail * rowBytes, staging.data(), (pendingRows - tail) * rowBytes);
+        glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+
+        glBindTexture(GL_TEXTURE_2D, tex);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, (GLint)first, (GLsizei)columns, (GLsizei)tail,
+                        GL_RED, GL_FLOAT, (const void*)0);
+        if (pendingRows > tail)
+            glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, (GLsizei)columns, (GLsizei)(pendingRows - tail),
+                            GL_RED, GL_FLOAT, (const void*)(tail * rowBytes));
+        glBindTexture(GL_TEXTURE_2D, 0);
+        pendingRows = 0;
+    }
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+}
+
+void SensorHistoryTexture::bind(GLuint unit) const {
+    glActiveTexture(GL_TEXTURE0 + unit);
+    glBindTexture(GL_TEXTURE_2D, tex);
+}
@@ -0,0 +1,70 @@
+/*!
+\file    sensorhistorytexture.h
+\brief   Recent sensor values streamed to a texture, so the shaders can read the past of every channel.
+
+The texture is a ring of rows: texel (c, r) holds channel c of one frame, one row per frame, the
+newest at row head - 1. A shader reads channel c as it was age frames ago with
+
+    texelFetch(u_sensorHistory, ivec2(c, (u_historyHead - 1 - age + u_historyRows) % u_historyRows), 0).r
+
+or with texture() and a normalised row to interpolate between frames (the rows wrap around with
+GL_REPEAT). Only the rows received since the previous upload are sent, through a pixel buffer
+object orphaned on every upload so the driver never stalls on the previous transfer.
+*/
+
+
+#ifndef SENSORHISTORYTEXTURE_H
+#define SENSORHISTORYTEXTURE_H
+
+#include <glad/glad.h>
+#include "sensorframe.h"
+#include <cstdint>
+#include <vector>
+
+/*! Frames kept in the texture, about 4 s at the 1 kHz of the boards */
+#define SENSOR_HISTORY_ROWS 4096
+
+/*!  \class     SensorHistoryTexture
+     \brief     Ring of the last frames in a GL_R32F texture of one column per channel.
+                Only used from the thread owning the GL context.
+*/
+class SensorHistoryTexture {
+public:
+    SensorHistoryTexture();
+
+    SensorHistoryTexture(const SensorHistoryTexture&) = delete;
+    SensorHistoryTexture& operator=(const SensorHistoryTexture&) = delete;
+
+    // Create the texture and the pixel buffer in the current context, returns false on a GL error
+    bool create(uint32_t channels, uint32_t rows = SENSOR_HISTORY_ROWS);
+
+    // Delete the GL objects, the context must still be current
+    void destroy();
+
+    // Queue the values of a frame, sent by the next upload()
+    void push(const SensorFrame &frame);
+
+    // Send the frames queued since the previous call, once per rendered frame
+    void upload();
+
+    // Bind the texture to a texture unit
+    void bind(GLuint unit) const;
+
+    GLuint   texture() const { return tex; }
+    uint32_t channels() const { return columns; }
+    uint32_t rows() const { return rowCount; }
+    // Row the next frame goes to, the newest frame is at head() - 1 (modulo rows())
+    uint32_t head() const { return nextRow; }
+
+private:
+    GLuint   tex;
+    GLuint   pbo;
+    uint32_t columns;
+    uint32_t rowCount;
+    uint32_t nextRow;
+    // Copy of the texture's rows on the CPU, the last pendingRows of them are not uploaded yet
+    std::vector<float> staging;
+    uint32_t pendingRows;
+};
+
+#endif // SENSORHISTORYTEXTURE_H
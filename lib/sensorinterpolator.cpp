@@ -0,0 +1,116 @@
+/*!
+ \file    sensorinterpolator.cpp
+ \brief   Source file of the classes SensorInterpolator and PresentationClock.
+ */
+
+#include "sensorinterpolator.h"
+
+// Swap intervals longer than this many estimated intervals are stalls (window hidden, debugger), not the refresh rate
+static const int64_t STALL_INTERVALS = 4;
+
+
+SensorInterpolator::SensorInterpolator(int64_t maxExtrapolation_ns, int64_t velocityWindow_ns)
+    : maxExtrapolation(maxExtrapolation_ns), velocityWindow(velocityWindow_ns), head(0), size(0) {}
+
+void SensorInterpolator::clear() {
+    size = 0;
+    newest = SensorFrame();
+}
+
+int64_t SensorInterpolator::newest_ns() const {
+    return size ? times[head] : 0;
+}
+
+// Slot of the frame age frames older than the newest one
+size_t SensorInterpolator::slot(size_t age) const {
+    return (head + SENSOR_INTERPOLATOR_FRAMES - age) % SENSOR_INTERPOLATOR_FRAMES;
+}
+
+/*!
+     \brief Add a frame. A frame that is not newer than the previous one (frames of one chunk before the
+            device clock is estimated, or of several devices) replaces its values at the same time.
+  */
+void SensorInterpolator::push(const SensorFrame &frame) {
+    if (size == 0 || frame.timestamp_ns > times[head]) {
+        head = (head + 1) % SENSOR_INTERPOLATOR_FRAMES;
+        if (size < SENSOR_INTERPOLATOR_FRAMES) size++;
+        times[head] = frame.timestamp_ns;
+    }
+    counts[head] = frame.channelCount;
+    memcpy(ring[head], frame.value, frame.channelCount * sizeof(float));
+    newest = frame;
+}
+
+/*!
+     \brief Resample the frames at time_ns
+            Between two frames the values are interpolated linearly. Past the newest frame they follow
+            its slope over the last velocityWindow_ns for at most maxExtrapolation_ns, then hold, and stay
+            within 0..1. Before the oldest frame kept they are the oldest values.
+     \return false before the first frame
+  */
+bool SensorInterpolator::sample(int64_t time_ns, SensorFrame &frame) const {
+    if (size == 0) return false;
+    frame = newest;
+    uint32_t count = newest.channelCount;
+    float *out = frame.value;
+
+    if (time_ns >= times[head]) {
+        int64_t ahead = time_ns - times[head];
+        if (ahead > maxExtrapolation) ahead = maxExtrapolation;
+        size_t age = 1;
+        while (age + 1 < size && times[head] - times[slot(age)] < velocityWindow) age++;
+        if (age >= size || ahead == 0) return true;
+        size_t b = slot(age);
+        const float *now = ring[head];
+        const float *before = ring[b];
+        uint32_t n = count < counts[b] ? count : counts[b];
+        float k = (float)ahead / (float)(times[head] - times[b]);
+        for (uint32_t c = 0; c < n; ++c) {
+            float v = now[c] + (now[c] - before[c]) * k;
+            out[c] = v < 0.0f ? 0.0f : (v > 1.0f ? 1.0f : v);
+        }
+        frame.timestamp_ns = times[head] + ahead;
+        return true;
+    }
+
+    // Newest frame at or before time_ns
+    size_t age = 1;
+    while (age < size && times[slot(age)] > time_ns) age++;
+    if (age >= size) {
+        // Older than everything kept
+        size_t oldest = slot(size - 1);
+        uint32_t n = count < counts[oldest] ? count : counts[oldest];
+        memcpy(out, ring[oldest], n * sizeof(float));
+        frame.timestamp_ns = times[oldest];
+        return true;
+    }
+    size_t before = slot(age);
+    size_t after = slot(age - 1);
+    const float *a = ring[before];
+    const float *b = ring[after];
+    uint32_t n = count < counts[before] ? count : counts[before];
+    float w = (float)(time_ns - times[before]) / (float)(times[after] - times[before]);
+    for (uint32_t c = 0; c < n; ++c)
+        out[c] = a[c] + (b[c] - a[c]) * w;
+    frame.timestamp_ns = time_ns;
+    return true;
+}
+
+
+PresentationClock::PresentationClock() : lastSwap(0), interval(0) {}
+
+void PresentationClock::swapped(int64_t now_ns) {
+    if (lastSwap != 0) {
+        int64_t elapsed = now_ns - lastSwap;
+        if (interval == 0) interval = elapsed;
+        else if (elapsed < STALL_INTERVALS * interval) interval += (elapsed - interval) / 8;
+    }
+    lastSwap = now_ns;
+}
+
+int64_t PresentationClock::nextPresent_ns(int64_t now_ns) const {
+    if (interval <= 0 || lastSwap == 0) return now_ns;
+    int64_t next = lastSwap + interval;
+    if (next < now_ns) next += ((now_ns - next) / interval + 1) * interval;
+    return next;
+}
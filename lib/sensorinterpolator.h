@@ -0,0 +1,82 @@
+/*!
+\file    sensorinterpolator.h
+\brief   Sensor values resampled at the time a rendered frame reaches the screen.
+
+The sensor boards and the display run on unrelated clocks: sampling whatever frame arrived last
+makes the visuals step irregularly when the two beat against each other. The render loop instead
+feeds every timestamped frame to a SensorInterpolator and asks it for the values at a time tied to
+the refreshes (PresentationClock): interpolated between the two frames around that time, or
+extrapolated from the newest ones for a bounded time ahead of them. The predicted presentation time
+of the frame being built is past every frame received, so sampling there always extrapolates; main.cpp
+samples a refresh interval and a render delay earlier unless SENSOR_EXTRAPOLATE is set.
+*/
+
+
+#ifndef SENSORINTERPOLATOR_H
+#define SENSORINTERPOLATOR_H
+
+#include "sensorframe.h"
+#include <cstdint>
+
+/*! Frames kept by a SensorInterpolator, 64 ms at the 1 kHz of the boards */
+#define SENSOR_INTERPOLATOR_FRAMES 64
+
+/*!  \class     SensorInterpolator
+     \brief     Keeps the last SENSOR_INTERPOLATOR_FRAMES frames and resamples them at any time.
+                Only used from the render loop.
+*/
+class SensorInterpolator {
+public:
+    // Extrapolate at most maxExtrapolation_ns past the newest frame, with the slope over the last velocityWindow_ns
+    SensorInterpolator(int64_t maxExtrapolation_ns = 20000000LL, int64_t velocityWindow_ns = 10000000LL);
+
+    // Add a frame, frames come in the order they were decoded
+    void push(const SensorFrame &frame);
+
+    // Forget every frame
+    void clear();
+
+    // Values at time_ns (timeOut::now_ns clock) into frame, raw holds the newest samples;
+    // returns false before the first frame
+    bool sample(int64_t time_ns, SensorFrame &frame) const;
+
+    // Timestamp of the newest frame, 0 before the first one
+    int64_t newest_ns() const;
+
+private:
+    size_t slot(size_t age) const;
+
+    int64_t  maxExtrapolation;
+    int64_t  velocityWindow;
+    // Ring of frames, slot head is the newest
+    size_t   head;
+    size_t   size;
+    SensorFrame newest;
+    int64_t  times[SENSOR_INTERPOLATOR_FRAMES];
+    uint32_t counts[SENSOR_INTERPOLATOR_FRAMES];
+    alignas(64) float ring[SENSOR_INTERPOLATOR_FRAMES][SENSOR_MAX_CHANNELS];
+};
+
+/*!  \class     PresentationClock
+     \brief     Predicts when the frame being rendered will be shown, from the times buffer swaps returned.
+                With vsync, a swap returns about one refresh interval after the previous one.
+*/
+class PresentationClock {
+public:
+    PresentationClock();
+
+    // Call right after the buffer swap returns
+    void swapped(int64_t now_ns);
+
+    // Expected display time of the frame rendered from now_ns: the next refresh after now_ns
+    int64_t nextPresent_ns(int64_t now_ns) const;
+
+    // Estimated refresh interval, 0 until two swaps were seen
+    int64_t interval_ns() const { return interval; }
+
+private:
+    int64_t lastSwap;
+    int64_t interval;
+};
+
+#endif // SENSORINTERPOLATOR_H
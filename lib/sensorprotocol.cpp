@@ -0,0 +1,163 @@
+/*!
+ \file    sensorprotocol.cpp
+ \brief   Source file of the framed sensor protocol.
+ */
+
+#include "sensorprotocol.h"
+#include <array>
+
+// Lookup table of CRC-16/CCITT-FALSE, one entry per byte value
+static constexpr std::array<uint16_t, 256> makeCrcTable() {
+    std::array<uint16_t, 256> table{};
+    for (int i = 0; i < 256; ++i) {
+        uint16_t crc = (uint16_t)(i << 8);
+        for (int bit = 0; bit < 8; ++bit)
+            crc = (crc & 0x8000) ? (uint16_t)((crc << 1) ^ 0x1021) : (uint16_t)(crc << 1);
+        table[i] = crc;
+    }
+    return table;
+}
+
+static constexpr std::array<uint16_t, 256> CRC_TABLE = makeCrcTable();
+
+
+/*!
+     \brief Compute the CRC-16/CCITT-FALSE of a buffer
+     \param crc : running value, to chain several buffers
+  */
+uint16_t sensorCrc16(const uint8_t *data, size_t length, uint16_t crc) {
+    for (size_t i = 0; i < length; ++i)
+        crc = (uint16_t)((crc << 8) ^ CRC_TABLE[(crc >> 8) ^ data[i]]);
+    return crc;
+}
+
+/*!
+     \brief Build one frame of the protocol
+     \param out : destination, at least SENSOR_HEADER_BYTES + length + SENSOR_CRC_BYTES bytes
+     \return the number of bytes written
+  */
+size_t encodeSensorFrame(uint8_t *out, uint8_t format, uint8_t sequence, const uint8_t *payload, uint8_t length) {
+    out[0] = SENSOR_SYNC0;
+    out[1] = SENSOR_SYNC1;
+    out[2] = format;
+    out[3] = length;
+    out[4] = sequence;
+    memcpy(out + SENSOR_HEADER_BYTES, payload, length);
+    uint16_t crc = sensorCrc16(out + 2, 3 + length);
+    out[SENSOR_HEADER_BYTES + length]     = crc & 0xFF;
+    out[SENSOR_HEADER_BYTES + length + 1] = crc >> 8;
+    return SENSOR_HEADER_BYTES + length + SENSOR_CRC_BYTES;
+}
+
+
+SensorFrameParser::SensorFrameParser() : partialLength(0), lastSequence(-1) {}
+
+void SensorFrameParser::resync() {
+    partialLength = 0;
+    lastSequence = -1;
+}
+
+void SensorFrameParser::reset() {
+    counters = SensorLinkStats();
+}
+
+// Frames missing between two valid ones, assuming fewer than 256 are lost in a row
+void SensorFrameParser::trackSequence(uint8_t sequence) {
+    if (lastSequence >= 0)
+        counters.dropped += (uint8_t)(sequence - lastSequence - 1);
+    lastSequence = sequence;
+}
+
+
+/*!
+     \brief Pack 10-bit values LSB first, as sent by the firmware
+     \param values : channels values, only the low 10 bits are kept
+     \param out : sensorPacked10Bytes(channels) bytes
+  */
+void packSensor10(const uint16_t *values, int channels, uint8_t *out) {
+    memset(out, 0, sensorPacked10Bytes(channels));
+    for (int c = 0; c < channels; ++c) {
+        unsigned int bit = 10 * c;
+        unsigned int v = (values[c] & 0x3FF) << (bit & 7);
+        out[bit >> 3]       |= v & 0xFF;
+        out[(bit >> 3) + 1] |= v >> 8;
+    }
+}
+
+/*!
+     \brief Unpack 10-bit values packed by packSensor10
+     A 10-bit field always spans exactly two bytes, so every channel is one 16-bit load, a shift and a mask
+  */
+void unpackSensor10(const uint8_t *packed, int channels, uint16_t *values) {
+    for (int c = 0; c < channels; ++c) {
+        unsigned int bit = 10 * c;
+        unsigned int pair = packed[bit >> 3] | (packed[(bit >> 3) + 1] << 8);
+        values[c] = (uint16_t)((pair >> (bit & 7)) & 0x3FF);
+    }
+}
+
+// One frame: the whole 60-bit frame as a single little-endian word
+static inline void unpackFrame10(const uint8_t *packed, uint16_t *values) {
+    uint64_t word = 0;
+    for (int i = 0; i < SENSOR_PACKED10_FRAME_BYTES; ++i) word |= (uint64_t)packed[i] << (8 * i);
+    for (int c = 0; c < 6; ++c) values[c] = (uint16_t)((word >> (10 * c)) & 0x3FF);
+}
+
+// Channel c starts in byte {0,1,2,3,5,6}[c] at bit {0,2,4,6,0,2}[c]: gather those byte pairs into
+// 16-bit lanes, shift each lane left so the field ends at bit 15, then shift every lane right by 6.
+#if (defined (__x86_64__) || defined (__i386__)) && defined (__GNUC__)
+#include <immintrin.h>
+
+__attribute__((target("ssse3")))
+static void unpackFrames10Ssse3(const uint8_t *packed, size_t count, uint16_t *values) {
+    const __m128i gather = _mm_setr_epi8(0, 1, 1, 2, 2, 3, 3, 4, 5, 6, 6, 7, -1, -1, -1, -1);
+    const __m128i align  = _mm_setr_epi16(64, 16, 4, 1, 64, 16, 0, 0);
+    // The 16-byte store runs 4 bytes past the frame: the last frame goes through the scalar path
+    size_t f = 0;
+    for (; f + 1 < count; ++f) {
+        __m128i v = _mm_loadl_epi64((const __m128i *)(packed + f * SENSOR_PACKED10_FRAME_BYTES));
+        v = _mm_shuffle_epi8(v, gather);
+        v = _mm_srli_epi16(_mm_mullo_epi16(v, align), 6);
+        _mm_storeu_si128((__m128i *)(values + f * 6), v);
+    }
+    for (; f < count; ++f) unpackFrame10(packed + f * SENSOR_PACKED10_FRAME_BYTES, values + f * 6);
+}
+#elif defined (__aarch64__)
+#include <arm_neon.h>
+
+static void unpackFrames10Neon(const uint8_t *packed, size_t count, uint16_t *values) {
+    static const uint8_t gatherBytes[16] = {0, 1, 1, 2, 2, 3, 3, 4, 5, 6, 6, 7, 0xFF, 0xFF, 0xFF, 0xFF};
+    static const int16_t shifts[8] = {0, -2, -4, -6, 0, -2, 0, 0};
+    const uint8x16_t gather = vld1q_u8(gatherBytes);
+    const int16x8_t shift   = vld1q_s16(shifts);
+    const uint16x8_t mask   = vdupq_n_u16(0x3FF);
+    size_t f = 0;
+    for (; f + 1 < count; ++f) {
+        uint8x16_t bytes = vcombine_u8(vld1_u8(packed + f * SENSOR_PACKED10_FRAME_BYTES), vdup_n_u8(0));
+        uint16x8_t v = vreinterpretq_u16_u8(vqtbl1q_u8(bytes, gather));
+        v = vandq_u16(vshlq_u16(v, shift), mask);
+        vst1q_u16(values + f * 6, v);
+    }
+    for (; f < count; ++f) unpackFrame10(packed + f * SENSOR_PACKED10_FRAME_BYTES, values + f * 6);
+}
+#endif
+
+/*!
+     \brief Unpack a burst of bare packed frames (e.g. a replay or a drained backlog)
+     \param packed : count * SENSOR_PACKED10_FRAME_BYTES bytes
+     \param values : count * 6 values, frame after frame
+  */
+void unpackSensor10Frames(const uint8_t *packed, size_t count, uint16_t *values) {
+#if (defined (__x86_64__) || defined (__i386__)) && defined (__GNUC__)
+    static const bool ssse3 = __builtin_cpu_supports("ssse3");
+    if (ssse3) {
+        unpackFrames10Ssse3(packed, count, values);
+        return;
+    }
+#elif defined (__aarch64__)
+    unpackFrames10Neon(packed, count, values);
+    return;
+#endif
+    for (size_t f = 0; f < count; ++f)
+        unpackFrame10(packed + f * SENSOR_PACKED10_FRAME_BYTES, values + f * 6);
+}
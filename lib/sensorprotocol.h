@@ -0,0 +1,271 @@
+/*!
+\file    sensorprotocol.h
+\brief   Framed binary protocol between the sensor board and the host, and its streaming parser.
+
+Every frame on the wire is laid out as:
+
+    offset  size  field
+    0       2     sync marker 0xA5 0x5A
+    2       1     payload format (SensorPayloadFormat)
+    3       1     payload length in bytes (0..255)
+    4       1     sequence number, incremented by one per frame and wrapping at 256
+    5       len   payload
+    5+len   2     CRC-16/CCITT-FALSE (little-endian) of bytes 2 .. 5+len-1
+
+The parser accepts the byte stream in chunks of any size. A lost or corrupted byte costs the frames
+it touches and nothing more: the parser looks for the next sync marker and carries on.
+
+Commands from the host to the board use the same framing with a SensorCommandFormat.
+*/
+
+
+#ifndef SENSORPROTOCOL_H
+#define SENSORPROTOCOL_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#define SENSOR_SYNC0            0xA5
+#define SENSOR_SYNC1            0x5A
+#define SENSOR_HEADER_BYTES     5
+#define SENSOR_CRC_BYTES        2
+#define SENSOR_MAX_PAYLOAD      255
+#define SENSOR_MAX_FRAME_BYTES  (SENSOR_HEADER_BYTES + SENSOR_MAX_PAYLOAD + SENSOR_CRC_BYTES)
+
+/**
+ * encoding of the frame payload
+ */
+enum SensorPayloadFormat {
+    SENSOR_PAYLOAD_U16LE = 0x01, /**< one little-endian 16-bit value per channel */
+    SENSOR_PAYLOAD_PACKED10 = 0x02, /**< 10-bit values packed LSB first, see packSensor10 */
+};
+
+/**
+ * payload format of the frames sent by the host to the board
+ */
+enum SensorCommandFormat {
+    SENSOR_COMMAND_LED = 0x10, /**< one LED brightness byte per zone */
+    SENSOR_COMMAND_HAPTIC = 0x11, /**< one vibration strength byte per zone */
+};
+
+/*! Bytes of one bare packed frame of six 10-bit channels (60 bits, the top 4 bits are zero) */
+#define SENSOR_PACKED10_FRAME_BYTES 8
+
+/*! Bytes of one bare frame of six little-endian 16-bit channels (original firmware) */
+#define SENSOR_RAW16_FRAME_BYTES 12
+
+/**
+ * byte format sent by the sensor board
+ */
+enum SensorWireFormat {
+    SENSOR_WIRE_RAW16, /**< bare 12-byte frames of six little-endian 16-bit values (original firmware) */
+    SENSOR_WIRE_FRAMED, /**< self-synchronising frames of sensorprotocol.h */
+    SENSOR_WIRE_PACKED10, /**< bare 8-byte frames of six 10-bit values packed with packSensor10 */
+};
+
+// Bytes of one bare frame of a format, 0 for the framed protocol
+inline size_t sensorRawFrameBytes(SensorWireFormat format) {
+    return format == SENSOR_WIRE_PACKED10 ? SENSOR_PACKED10_FRAME_BYTES
+         : format == SENSOR_WIRE_RAW16 ? SENSOR_RAW16_FRAME_BYTES : 0;
+}
+
+/*!
+     \brief Check the padding bits of a bare frame, the only sign of where bare frames start: the high
+            6 bits of every RAW16 value (10-bit ADC), the high 4 bits of the last PACKED10 byte.
+            For RAW16 they only tell the parity of the alignment: two bytes off, a frame still passes
+            with its channels rotated.
+  */
+inline bool sensorRawFrameValid(const uint8_t *frame, SensorWireFormat format) {
+    if (format == SENSOR_WIRE_PACKED10) return (frame[SENSOR_PACKED10_FRAME_BYTES - 1] & 0xF0) == 0;
+    uint8_t high = 0;
+    for (size_t b = 1; b < SENSOR_RAW16_FRAME_BYTES; b += 2) high |= frame[b];
+    return (high & 0xFC) == 0;
+}
+
+/*!  \struct    SensorPacket
+     \brief     One valid frame as seen by the parser callback.
+                payload points either into the chunk passed to feed() or into the parser's
+                reassembly buffer, and is only valid during the callback.
+*/
+struct SensorPacket {
+    uint8_t        format;
+    uint8_t        sequence;
+    uint8_t        length;
+    const uint8_t *payload;
+};
+
+/*!  \struct    SensorLinkStats
+     \brief     Counters of the parser, cumulative since construction or reset().
+*/
+struct SensorLinkStats {
+    uint64_t frames       = 0; // valid frames delivered
+    uint64_t corrupt      = 0; // frames rejected by the CRC
+    uint64_t dropped      = 0; // frames missing according to the sequence numbers
+    uint64_t skippedBytes = 0; // bytes discarded while looking for a sync marker
+};
+
+// CRC-16/CCITT-FALSE (polynomial 0x1021, initial value 0xFFFF)
+uint16_t sensorCrc16(const uint8_t *data, size_t length, uint16_t crc = 0xFFFF);
+
+// Write one frame into out (at least SENSOR_HEADER_BYTES + length + SENSOR_CRC_BYTES bytes), returns its size
+size_t encodeSensorFrame(uint8_t *out, uint8_t format, uint8_t sequence, const uint8_t *payload, uint8_t length);
+
+// Bytes needed to pack channels 10-bit values
+inline size_t sensorPacked10Bytes(int channels) {
+    return (size_t)(10 * channels + 7) / 8;
+}
+
+// Pack channels 10-bit values: channel c occupies bits 10*c .. 10*c+9 of the little-endian bit stream
+void packSensor10(const uint16_t *values, int channels, uint8_t *out);
+
+// Unpack channels 10-bit values, branch-free
+void unpackSensor10(const uint8_t *packed, int channels, uint16_t *values);
+
+// Unpack a burst of bare 8-byte frames of six channels into count * 6 interleaved values (SIMD when available)
+void unpackSensor10Frames(const uint8_t *packed, size_t count, uint16_t *values);
+
+/*!  \class     SensorFrameParser
+     \brief     Streaming, self-synchronising parser of the framed protocol.
+                Frames lying entirely inside a chunk are handed out in place; only the bytes of a
+                frame split across two chunks are copied, once, into the reassembly buffer.
+*/
+class SensorFrameParser {
+public:
+    SensorFrameParser();
+
+    // Parse a chunk of the byte stream, calling onPacket(const SensorPacket&) for every valid frame
+    template <typename Callback>
+    void feed(const uint8_t *data, size_t length, Callback &&onPacket);
+
+    // Forget any partial frame and the sequence history (e.g. after reconnecting), counters are kept
+    void resync();
+
+    // Clear the counters
+    void reset();
+
+    const SensorLinkStats &stats() const { return counters; }
+
+private:
+    // Validate a complete frame starting at frame, returns true and delivers it if the CRC matches
+    template <typename Callback>
+    bool deliver(const uint8_t *frame, Callback &onPacket);
+
+    // Parse frames in place, keeping an incomplete trailing frame in the reassembly buffer
+    template <typename Callback>
+    void scan(const uint8_t *data, size_t length, Callback &onPacket);
+
+    // Account for a valid sequence number
+    void trackSequence(uint8_t sequence);
+
+    uint8_t         partial[SENSOR_MAX_FRAME_BYTES];
+    size_t          partialLength;
+    int             lastSequence;
+    SensorLinkStats counters;
+};
+
+
+// Size of a frame whose header starts at header
+inline size_t sensorFrameBytes(const uint8_t *header) {
+    return SENSOR_HEADER_BYTES + header[3] + SENSOR_CRC_BYTES;
+}
+
+template <typename Callback>
+bool SensorFrameParser::deliver(const uint8_t *frame, Callback &onPacket) {
+    size_t body = 3 + frame[3];
+    uint16_t crc = frame[2 + body] | (frame[3 + body] << 8);
+    if (sensorCrc16(frame + 2, body) != crc) {
+        counters.corrupt++;
+        return false;
+    }
+    SensorPacket packet;
+    packet.format   = frame[2];
+    packet.length   = frame[3];
+    packet.sequence = frame[4];
+    packet.payload  = frame + SENSOR_HEADER_BYTES;
+    trackSequence(packet.sequence);
+    counters.frames++;
+    onPacket(packet);
+    return true;
+}
+
+template <typename Callback>
+void SensorFrameParser::scan(const uint8_t *data, size_t length, Callback &onPacket) {
+    size_t pos = 0;
+    while (pos < length) {
+        const uint8_t *sync = (const uint8_t *)memchr(data + pos, SENSOR_SYNC0, length - pos);
+        if (!sync) {
+            counters.skippedBytes += length - pos;
+            return;
+        }
+        size_t start = sync - data;
+        counters.skippedBytes += start - pos;
+        pos = start;
+
+        size_t available = length - pos;
+        if (available >= 2 && data[pos + 1] != SENSOR_SYNC1) {
+            counters.skippedBytes++;
+            pos++;
+            continue;
+        }
+        if (available < SENSOR_HEADER_BYTES || available < sensorFrameBytes(data + pos)) {
+            // Keep the beginning of the frame for the next chunk
+            memcpy(partial, data + pos, available);
+            partialLength = available;
+            return;
+        }
+        size_t frameBytes = sensorFrameBytes(data + pos);
+        if (deliver(data + pos, onPacket)) {
+            pos += frameBytes;
+        } else {
+            // Not a frame after all: look for the next marker right after this one
+            counters.skippedBytes++;
+            pos++;
+        }
+    }
+}
+
+/*!
+     \brief Parse the next chunk of the byte stream
+     \param data : bytes received from the device
+     \param length : number of bytes in data
+     \param onPacket : called with a const SensorPacket& for every frame that passes the CRC
+  */
+template <typename Callback>
+void SensorFrameParser::feed(const uint8_t *data, size_t length, Callback &&onPacket) {
+    size_t pos = 0;
+
+    // Finish the frame left incomplete by the previous chunk
+    while (partialLength > 0 && pos < length) {
+        if (partialLength == 1 && data[pos] != SENSOR_SYNC1) {
+            // The lone 0xA5 at the end of the last chunk was not a marker
+            counters.skippedBytes++;
+            partialLength = 0;
+            break;
+        }
+        size_t target = partialLength < SENSOR_HEADER_BYTES ? SENSOR_HEADER_BYTES : sensorFrameBytes(partial);
+        size_t take = target - partialLength;
+        if (take > length - pos) take = length - pos;
+        memcpy(partial + partialLength, data + pos, take);
+        partialLength += take;
+        pos += take;
+        if (partialLength < target || target == SENSOR_HEADER_BYTES) continue;
+
+        if (deliver(partial, onPacket)) {
+            partialLength = 0;
+        } else {
+            // Rare path: rescan what followed the false marker, which may itself leave a partial frame
+            uint8_t rescan[SENSOR_MAX_FRAME_BYTES];
+            size_t rescanLength = partialLength - 1;
+            memcpy(rescan, partial + 1, rescanLength);
+            counters.skippedBytes++;
+            partialLength = 0;
+            scan(rescan, rescanLength, onPacket);
+        }
+    }
+
+    // Frames lying entirely inside the chunk are parsed in place
+    if (pos < length) scan(data + pos, length - pos, onPacket);
+}
+
+#endif // SENSORPROTOCOL_H
@@ -0,0 +1,244 @@
+/*!
+ \file    serialdiscovery.cpp
+ \brief   Source file of the serial port discovery.
+ */
+
+#include "serialdiscovery.h"
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <future>
+#include <thread>
+
+#if defined (__linux__) || defined(__APPLE__)
+    #include <dirent.h>
+    #include <limits.h>
+#endif
+
+// Frames the probe wants to see before trusting a bare stream
+static const size_t PROBE_FRAMES = 4;
+
+// Bytes after which a stream that still does not look like sensor frames is rejected
+static const size_t PROBE_REJECT_BYTES = 2 * SENSOR_MAX_FRAME_BYTES;
+
+// Longest wait of a probe between two checks of its cancel flag
+static const unsigned long long PROBE_SLICE_US = 10000;
+
+// Silence on the line taken for the gap between two bare frames, and how long to wait for one
+static const unsigned long long PROBE_QUIET_US = 400;
+static const unsigned long long PROBE_QUIET_WAIT_US = 100000;
+
+// Device name prefixes of USB serial adapters
+#if defined (__linux__)
+static const char *const CANDIDATE_PREFIXES[] = {"ttyUSB", "ttyACM"};
+#elif defined (__APPLE__)
+static const char *const CANDIDATE_PREFIXES[] = {"cu.usbserial", "cu.usbmodem"};
+#else
+static const char *const CANDIDATE_PREFIXES[] = {"COM"};
+#endif
+
+
+bool isSerialCandidateName(const char *name) {
+    for (const char *prefix : CANDIDATE_PREFIXES)
+        if (strncmp(name, prefix, strlen(prefix)) == 0) return true;
+    return false;
+}
+
+std::string serialCanonicalPath(const std::string &path) {
+#if defined (__linux__) || defined(__APPLE__)
+    char resolved[PATH_MAX];
+    if (realpath(path.c_str(), resolved)) return resolved;
+#endif
+    return path;
+}
+
+#if defined (__linux__) || defined(__APPLE__)
+// Sorted entries of a directory accepted by filter, as full paths
+template <typename Filter>
+static std::vector<std::string> listDirectory(const char *dir, Filter filter) {
+    std::vector<std::string> paths;
+    DIR *d = opendir(dir);
+    if (!d) return paths;
+    while (struct dirent *entry = readdir(d)) {
+        if (entry->d_name[0] == '.' || !filter(entry->d_name)) continue;
+        paths.push_back(std::string(dir) + "/" + entry->d_name);
+    }
+    closedir(d);
+    std::sort(paths.begin(), paths.end());
+    return paths;
+}
+#endif
+
+/*!
+     \brief List the ports a sensor board may be plugged in
+     On Linux the /dev/serial/by-id links come first: their names survive replugging in another
+     USB port. The ttyUSB and ttyACM nodes they point to are then left out.
+     \return the candidate paths, empty on Windows
+  */
+std::vector<std::string> listSerialCandidates() {
+    std::vector<std::string> candidates;
+#if defined (__linux__) || defined(__APPLE__)
+    std::vector<std::string> seen;
+#if defined (__linux__)
+    for (const std::string &link : listDirectory("/dev/serial/by-id", [](const char *) { return true; })) {
+        candidates.push_back(link);
+        seen.push_back(serialCanonicalPath(link));
+    }
+#endif
+    for (const std::string &node : listDirectory("/dev", isSerialCandidateName)) {
+        if (std::find(seen.begin(), seen.end(), node) != seen.end()) continue;
+        candidates.push_back(node);
+    }
+#endif
+    return candidates;
+}
+
+/*!
+     \brief Tell whether a capture of the start of a stream looks like sensor data
+     Framed streams need one frame passing the CRC. Bare streams need PROBE_FRAMES frames, at one
+     alignment, whose padding bits are zero (sensorRawFrameValid).
+     \param offset : receives the position of the first whole bare frame, 0 for framed streams (can be NULL)
+  */
+bool looksLikeSensorStream(const uint8_t *data, size_t length, SensorWireFormat format, size_t *offset) {
+    if (offset) *offset = 0;
+    if (format == SENSOR_WIRE_FRAMED) {
+        SensorFrameParser parser;
+        bool found = false;
+        parser.feed(data, length, [&found](const SensorPacket &) { found = true; });
+        return found;
+    }
+    size_t frameBytes = sensorRawFrameBytes(format);
+    for (size_t align = 0; align < frameBytes; ++align) {
+        size_t count = (length - std::min(length, align)) / frameBytes;
+        if (count < PROBE_FRAMES) return false;
+        bool ok = true;
+        for (size_t f = 0; f < count && ok; ++f) ok = sensorRawFrameValid(data + align + f * frameBytes, format);
+        if (ok) {
+            if (offset) *offset = align;
+            return true;
+        }
+    }
+    return false;
+}
+
+/*!
+     \brief Read a bare stream up to a frame boundary, so that the decoder taking the port over starts
+            with nothing carried
+     The board writes each frame at once, so the line going quiet marks a boundary; the padding bits
+     only give the alignment of RAW16 frames to a multiple of two bytes. A quiet line is only trusted
+     where it agrees with the alignment of the padding bits. If the line never goes quiet within
+     PROBE_QUIET_WAIT_US (a board saturating it), the rest of the current frame is read instead.
+     \param consumed : bytes read since the start of the first whole frame found by the probe
+     \return false if the board stopped sending, or on cancel
+  */
+static bool alignSensorStream(serialib &serial, SensorWireFormat format, size_t consumed, const timeOut &deadline,
+                              const std::atomic<bool> *cancel) {
+    size_t frameBytes = sensorRawFrameBytes(format);
+    // Period of the alignment known from the padding bits
+    size_t known = format == SENSOR_WIRE_RAW16 ? 2 : frameBytes;
+    uint8_t sink[256];
+    timeOut waiting;
+    waiting.setDeadline_us(PROBE_QUIET_WAIT_US);
+    long long quietSince = timeOut::now_ns();
+    while (!waiting.expired()) {
+        if ((cancel && cancel->load(std::memory_order_relaxed)) || deadline.expired()) return false;
+        int n = serial.readAvailable(sink, sizeof(sink));
+        if (n < 0) return false;
+        long long now = timeOut::now_ns();
+        if (n > 0) {
+            consumed += (size_t)n;
+            quietSince = now;
+        } else if (now - quietSince >= (long long)PROBE_QUIET_US * 1000 && consumed % known == 0) {
+            return true;
+        } else {
+            std::this_thread::sleep_for(std::chrono::microseconds(PROBE_QUIET_US / 4));
+        }
+    }
+    size_t rest = (frameBytes - consumed % frameBytes) % frameBytes;
+    while (rest > 0) {
+        if (cancel && cancel->load(std::memory_order_relaxed)) return false;
+        long long remaining = deadline.remaining_us();
+        if (remaining <= 0) return false;
+        if ((unsigned long long)remaining > PROBE_SLICE_US) remaining = PROBE_SLICE_US;
+        int n = serial.readBytes_us(sink, (unsigned int)rest, remaining);
+        if (n < 0) return false;
+        rest -= (size_t)n;
+    }
+    return true;
+}
+
+/*!
+     \brief Open a port and check that a sensor board streams on it
+     \param path : port name passed to serialib::openDevice
+     \param bauds : baud rate passed to serialib::openDevice
+     \param format : byte format the board should send
+     \param openOptions : SerialOpenOptions requested from the driver
+     \param acceptedOptions : receives the options the driver accepted (can be NULL)
+     \param timeOut_us : how long to wait for the board to send valid frames (it may be resetting),
+            0 to only open the port
+     \param cancel : when set by another thread, the probe gives up within PROBE_SLICE_US (can be NULL)
+     \return the open port, nullptr if it cannot be opened, stays silent, sends something else or is cancelled.
+             A bare stream is returned on a frame boundary: the decoder taking it over starts with
+             nothing carried and would otherwise read every frame shifted.
+  */
+std::unique_ptr<serialib> probeSensorPort(const std::string &path, unsigned int bauds, SensorWireFormat format,
+                                          unsigned int openOptions, unsigned int *acceptedOptions,
+                                          unsigned long long timeOut_us, const std::atomic<bool> *cancel) {
+    std::unique_ptr<serialib> serial(new serialib);
+    if (serial->openDevice(path.c_str(), bauds, openOptions, acceptedOptions) != 1) return nullptr;
+    if (timeOut_us == 0) return serial;
+    serial->setWaitMode(SERIAL_WAIT_POLL);
+
+    uint8_t capture[PROBE_REJECT_BYTES];
+    size_t length = 0;
+    timeOut timer;
+    timer.setDeadline_us(timeOut_us);
+    while (length < sizeof(capture)) {
+        if (cancel && cancel->load(std::memory_order_relaxed)) break;
+        long long remaining = timer.remaining_us();
+        if (remaining <= 0) break;
+        if ((unsigned long long)remaining > PROBE_SLICE_US) remaining = PROBE_SLICE_US;
+        int n = serial->readBytes_us(capture + length, (unsigned int)(sizeof(capture) - length), remaining);
+        if (n < 0) break;
+        length += n;
+        size_t offset;
+        if (n > 0 && looksLikeSensorStream(capture, length, format, &offset)) {
+            if (format == SENSOR_WIRE_FRAMED || alignSensorStream(*serial, format, length - offset, timer, cancel))
+                return serial;
+            return nullptr;
+        }
+    }
+    return nullptr;
+}
+
+/*!
+     \brief Probe several ports in parallel, so the search takes one probe timeout whatever their number
+     \param wanted : number of ports needed, the other probes are cancelled once that many passed
+     \return the ports streaming sensor frames, open, in the order of candidates
+  */
+std::vector<SerialProbe> probeSensorPorts(const std::vector<std::string> &candidates, unsigned int bauds,
+                                          SensorWireFormat format, unsigned int openOptions,
+                                          unsigned long long timeOut_us, size_t wanted) {
+    struct Shared {
+        std::atomic<size_t> passed{0};
+        std::atomic<bool>   cancel{false};
+    };
+    std::shared_ptr<Shared> shared = std::make_shared<Shared>();
+    std::vector<std::future<SerialProbe>> probes;
+    for (const std::string &path : candidates) {
+        probes.push_back(std::async(std::launch::async, [=]() {
+            SerialProbe probe;
+            probe.path = path;
+            probe.serial = probeSensorPort(path, bauds, format, openOptions, &probe.acceptedOptions, timeOut_us,
+                                           &shared->cancel);
+            if (probe.serial && shared->passed.fetch_add(1) + 1 >= wanted) shared->cancel.store(true);
+            return probe;
+        }));
+    }
+    std::vector<SerialProbe> found;
+    for (auto &probe : probes) {
+        SerialProbe result = probe.get();
+        if (result.serial) found.push_back(std::move(result));
+    }
+    return found;
+}
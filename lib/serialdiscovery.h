@@ -0,0 +1,56 @@
+/*!
+\file    serialdiscovery.h
+\brief   Discovery of the serial ports a sensor board may be plugged in, and probing of the candidates.
+*/
+
+
+#ifndef SERIALDISCOVERY_H
+#define SERIALDISCOVERY_H
+
+#include "serialib.h"
+#include "sensorprotocol.h"
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+/*! Default time a probe waits for the board to prove it streams sensor frames */
+#define SERIAL_PROBE_TIMEOUT_US 1500000ULL
+
+/*!  \struct    SerialProbe
+     \brief     One port that passed the probe, still open so the board is not reset twice.
+*/
+struct SerialProbe {
+    std::string               path;
+    std::unique_ptr<serialib> serial;
+    // SerialOpenOptions the driver accepted
+    unsigned int              acceptedOptions = 0;
+};
+
+// Ports a sensor board may be plugged in, stable names (/dev/serial/by-id) first, without duplicates
+std::vector<std::string> listSerialCandidates();
+
+// True if a device node name (without directory) looks like a serial adapter
+bool isSerialCandidateName(const char *name);
+
+// Resolve symbolic links, returns path itself if it cannot be resolved
+std::string serialCanonicalPath(const std::string &path);
+
+// True if the bytes look like the given wire format, offset receives where the first whole bare frame starts
+bool looksLikeSensorStream(const uint8_t *data, size_t length, SensorWireFormat format, size_t *offset = nullptr);
+
+// Open a port and wait for sensor frames, returns the open port or nullptr (timeOut_us 0: open only)
+std::unique_ptr<serialib> probeSensorPort(const std::string &path, unsigned int bauds, SensorWireFormat format,
+                                          unsigned int openOptions, unsigned int *acceptedOptions,
+                                          unsigned long long timeOut_us = SERIAL_PROBE_TIMEOUT_US,
+                                          const std::atomic<bool> *cancel = nullptr);
+
+// Probe every candidate at once, returns the ones streaming sensor frames in the order of candidates
+// The probes still running are cancelled as soon as wanted ports passed
+std::vector<SerialProbe> probeSensorPorts(const std::vector<std::string> &candidates, unsigned int bauds,
+                                          SensorWireFormat format, unsigned int openOptions,
+                                          unsigned long long timeOut_us = SERIAL_PROBE_TIMEOUT_US,
+                                          size_t wanted = SIZE_MAX);
+
+#endif // SERIALDISCOVERY_H
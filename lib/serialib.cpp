@@ -17,6 +17,42 @@ This is a licence-free software, it can be used by anyone who try to build a bet
 
 #include "serialib.h"
 
+#if defined (__linux__)
+    // ASYNC_LOW_LATENCY and struct serial_struct
+    #include <linux/serial.h>
+
+    // Kernel struct termios2, declared here because <asm/termbits.h> clashes with <termios.h>.
+    // Only the architectures of the asm-generic layout (19 control characters after c_line) are
+    // listed: alpha, powerpc, mips and sparc order or size the fields differently, and without
+    // SERIALIB_TCGETS2 a custom baud rate is refused there rather than set through a wrong layout
+    #if defined (__x86_64__) || defined (__i386__) || defined (__arm__) || defined (__aarch64__) || \
+        defined (__riscv) || defined (__loongarch__) || defined (__s390__)
+        struct serialib_termios2 {
+            tcflag_t c_iflag;
+            tcflag_t c_oflag;
+            tcflag_t c_cflag;
+            tcflag_t c_lflag;
+            cc_t     c_line;
+            cc_t     c_cc[19];
+            speed_t  c_ispeed;
+            speed_t  c_ospeed;
+        };
+        static_assert(sizeof(struct serialib_termios2) == 44, "struct termios2 of the asm-generic layout");
+        #ifndef BOTHER
+            #define BOTHER 0010000
+        #endif
+        #if defined (TCGETS2)
+            // Same request numbers as TCGETS2/TCSETS2, sized on the local declaration
+            #define SERIALIB_TCGETS2 _IOR('T', 0x2A, struct serialib_termios2)
+            #define SERIALIB_TCSETS2 _IOW('T', 0x2B, struct serialib_termios2)
+        #endif
+    #endif
+#endif
+#if defined (__APPLE__)
+    // IOSSIOSPEED and IOSSDATALAT
+    #include <IOKit/serial/ioss.h>
+#endif
+
 
 
 //_____________________________________
@@ -28,6 +64,8 @@ This is a licence-free software, it can be used by anyone who try to build a bet
 */
 serialib::serialib()
 {
+    // Keep the historical sleep-and-retry reading by default
+    waitMode = SERIAL_WAIT_SLEEP;
 #if defined (_WIN32) || defined( _WIN64)
     // Set default value for RTS and DTR (Windows only)
     currentStateRTS=true;
@@ -36,6 +74,8 @@ serialib::serialib()
 #endif
 #if defined (__linux__) || defined(__APPLE__)
     fd = -1;
+    rxHead = 0;
+    rxTail = 0;
 #endif
 }
 
@@ -145,6 +185,31 @@ char serialib::openDevice(const char *Device, const unsigned int Bauds,
                           SerialDataBits Databits,
                           SerialParity Parity,
                           SerialStopBits Stopbits) {
+    return openDevice(Device, Bauds, 0, NULL, Databits, Parity, Stopbits);
+}
+
+/*!
+     \brief Open the serial port with optional driver settings
+     \param Device : Port name, see the other openDevice
+     \param Bauds : Baud rate of the serial port, see the other openDevice
+                With SERIAL_OPEN_CUSTOM_BAUD any rate the driver can generate is accepted:
+                through termios2/BOTHER on Linux, IOSSIOSPEED on macOS and the DCB on Windows
+     \param openOptions : combination of SerialOpenOptions
+                - SERIAL_OPEN_LOW_LATENCY sets ASYNC_LOW_LATENCY through TIOCSSERIAL on Linux,
+                  or a 1 us receive latency through IOSSDATALAT on macOS
+                - SERIAL_OPEN_CUSTOM_BAUD allows baud rates without a Bxxxx constant
+     \param acceptedOptions : receives the options the driver actually applied (can be NULL)
+                A refused SERIAL_OPEN_LOW_LATENCY is not an error, the port is opened without it
+     \return same codes as the other openDevice, -4 also when the driver refuses a custom baud rate
+  */
+char serialib::openDevice(const char *Device, const unsigned int Bauds,
+                          unsigned int openOptions, unsigned int *acceptedOptions,
+                          SerialDataBits Databits,
+                          SerialParity Parity,
+                          SerialStopBits Stopbits) {
+    // Options applied so far
+    unsigned int accepted = 0;
+    if (acceptedOptions) *acceptedOptions = 0;
 #if defined (_WIN32) || defined( _WIN64)
     // Open serial port
     hSerial = CreateFileA(Device,GENERIC_READ | GENERIC_WRITE,0,0,OPEN_EXISTING,/*FILE_ATTRIBUTE_NORMAL*/0,0);
@@ -183,7 +248,16 @@ char serialib::openDevice(const char *Device, const unsigned int Bauds,
     case 115200 :   dcbSerialParams.BaudRate=CBR_115200; break;
     case 128000 :   dcbSerialParams.BaudRate=CBR_128000; break;
     case 256000 :   dcbSerialParams.BaudRate=CBR_256000; break;
-    default : return -4;
+    default :
+        // The DCB takes the rate as a plain number, the driver decides whether it can generate it
+        if (!(openOptions & SERIAL_OPEN_CUSTOM_BAUD))
+        {
+            closeDevice();
+            return -4;
+        }
+        dcbSerialParams.BaudRate=Bauds;
+        accepted |= SERIAL_OPEN_CUSTOM_BAUD;
+        break;
     }
     //select data size
     BYTE bytesize = 0;
@@ -235,6 +309,7 @@ char serialib::openDevice(const char *Device, const unsigned int Bauds,
     if(!SetCommTimeouts(hSerial, &timeouts)) return -6;
 
     // Opening successfull
+    if (acceptedOptions) *acceptedOptions = accepted;
     return 1;
 #endif
 #if defined (__linux__) || defined(__APPLE__)
@@ -257,6 +332,8 @@ char serialib::openDevice(const char *Device, const unsigned int Bauds,
 
     // Prepare speed (Bauds)
     speed_t         Speed;
+    // Rate without a Bxxxx constant, set after the standard attributes
+    bool            customBaud = false;
     switch (Bauds)
     {
     case 110  :     Speed=B110; break;
@@ -309,7 +386,16 @@ char serialib::openDevice(const char *Device, const unsigned int Bauds,
 #if defined (B4000000)
     case 4000000 :   Speed=B4000000; break;
 #endif
-    default : return -4;
+    default :
+        if (!(openOptions & SERIAL_OPEN_CUSTOM_BAUD))
+        {
+            closeDevice();
+            return -4;
+        }
+        // Placeholder, replaced by the exact rate once the port is configured
+        Speed=B38400;
+        customBaud=true;
+        break;
     }
     int databits_flag = 0;
     switch(Databits) {
@@ -349,7 +435,58 @@ char serialib::openDevice(const char *Device, const unsigned int Bauds,
     options.c_cc[VMIN]=0;
     // Activate the settings
     tcsetattr(fd, TCSANOW, &options);
+
+    if (customBaud)
+    {
+#if defined (__linux__) && defined (SERIALIB_TCGETS2)
+        // Arbitrary rate: the kernel derives the divisor from c_ispeed/c_ospeed when CBAUD is BOTHER
+        struct serialib_termios2 options2;
+        bool customOk = ioctl(fd, SERIALIB_TCGETS2, &options2) == 0;
+        if (customOk)
+        {
+            options2.c_cflag &= ~CBAUD;
+            options2.c_cflag |= BOTHER;
+            options2.c_ispeed = Bauds;
+            options2.c_ospeed = Bauds;
+            customOk = ioctl(fd, SERIALIB_TCSETS2, &options2) == 0;
+        }
+#elif defined (__APPLE__) && defined (IOSSIOSPEED)
+        speed_t customSpeed = Bauds;
+        bool customOk = ioctl(fd, IOSSIOSPEED, &customSpeed) == 0;
+#else
+        bool customOk = false;
+#endif
+        if (!customOk)
+        {
+            closeDevice();
+            return -4;
+        }
+        accepted |= SERIAL_OPEN_CUSTOM_BAUD;
+    }
+
+    if (openOptions & SERIAL_OPEN_LOW_LATENCY)
+    {
+#if defined (__linux__) && defined (TIOCGSERIAL) && defined (ASYNC_LOW_LATENCY)
+        // Only real serial drivers implement TIOCSSERIAL (ttyUSB, ttyACM, ttyS), ptys refuse it
+        struct serial_struct serial;
+        if (ioctl(fd, TIOCGSERIAL, &serial) == 0)
+        {
+            serial.flags |= ASYNC_LOW_LATENCY;
+            // Read the flags back: some drivers silently ignore the request
+            if (ioctl(fd, TIOCSSERIAL, &serial) == 0 &&
+                ioctl(fd, TIOCGSERIAL, &serial) == 0 &&
+                (serial.flags & ASYNC_LOW_LATENCY))
+                accepted |= SERIAL_OPEN_LOW_LATENCY;
+        }
+#elif defined (__APPLE__) && defined (IOSSDATALAT)
+        unsigned long latency_us = 1;
+        if (ioctl(fd, IOSSDATALAT, &latency_us) == 0)
+            accepted |= SERIAL_OPEN_LOW_LATENCY;
+#endif
+    }
+
     // Success
+    if (acceptedOptions) *acceptedOptions = accepted;
     return (1);
 #endif
 
@@ -377,6 +514,8 @@ void serialib::closeDevice()
 #if defined (__linux__) || defined(__APPLE__)
     close (fd);
     fd = -1;
+    // Drop bytes buffered from the previous device
+    rxHead = rxTail;
 #endif
 }
 
@@ -482,6 +621,45 @@ int serialib::writeBytes(const void *Buffer, const unsigned int NbBytes)
 
 
 
+/*!
+     \brief Write several arrays of data on the current serial port, in one system call on Unix (writev)
+            Nothing waits for room in the output queue: what does not fit is left to the caller
+     \param buffers : arrays of bytes to send, in order
+     \param count : number of arrays, at most SERIAL_MAX_BUFFERS are written
+     \return >=0 the number of bytes written, less than requested when the output queue is full
+     \return -1 error while writting data
+  */
+int serialib::writeBuffers(const SerialBuffer *buffers, int count)
+{
+    if (count>SERIAL_MAX_BUFFERS) count=SERIAL_MAX_BUFFERS;
+#if defined (_WIN32) || defined( _WIN64)
+    // No gathered write on a comm handle: one WriteFile per array
+    int total=0;
+    for (int i=0; i<count; i++)
+    {
+        DWORD dwBytesWritten;
+        if(!WriteFile(hSerial, buffers[i].data, buffers[i].length, &dwBytesWritten, NULL)) return -1;
+        total+=dwBytesWritten;
+        if (dwBytesWritten<buffers[i].length) break;
+    }
+    return total;
+#endif
+#if defined (__linux__) || defined(__APPLE__)
+    struct iovec iov[SERIAL_MAX_BUFFERS];
+    for (int i=0; i<count; i++)
+    {
+        iov[i].iov_base=(void*)buffers[i].data;
+        iov[i].iov_len=buffers[i].length;
+    }
+    // The device is open in nonblocking mode: a full output queue writes part of the data or nothing
+    ssize_t Ret=writev(fd,iov,count);
+    if (Ret<0) return (errno==EAGAIN || errno==EINTR) ? 0 : -1;
+    return (int)Ret;
+#endif
+}
+
+
+
 /*!
      \brief Wait for a byte from the serial device and return the data read
      \param pByte : data read on the serial device
@@ -493,13 +671,31 @@ int serialib::writeBytes(const void *Buffer, const unsigned int NbBytes)
      \return -2 error while reading the byte
   */
 int serialib::readChar(char *pByte,unsigned int timeOut_ms)
+{
+    return readChar_us(pByte,timeOut_ms*1000ULL);
+}
+
+
+
+/*!
+     \brief Wait for a byte from the serial device and return the data read
+     \param pByte : data read on the serial device
+     \param timeOut_us : delay of timeout in microseconds before giving up the reading
+            If set to zero, timeout is disable (Optional)
+            Rounded up to the next millisecond on Windows
+     \return 1 success
+     \return 0 Timeout reached
+     \return -1 error while setting the Timeout
+     \return -2 error while reading the byte
+  */
+int serialib::readChar_us(char *pByte,unsigned long long timeOut_us)
 {
 #if defined (_WIN32) || defined(_WIN64)
     // Number of bytes read
     DWORD dwBytesRead = 0;
 
     // Set the TimeOut
-    timeouts.ReadTotalTimeoutConstant=timeOut_ms;
+    timeouts.ReadTotalTimeoutConstant=(DWORD)((timeOut_us+999)/1000);
 
     // Write the parameters, return -1 if an error occured
     if(!SetCommTimeouts(hSerial, &timeouts)) return -1;
@@ -514,20 +710,12 @@ int serialib::readChar(char *pByte,unsigned int timeOut_ms)
     return 1;
 #endif
 #if defined (__linux__) || defined(__APPLE__)
-    // Timer used for timeout
-    timeOut         timer;
-    // Initialise the timer
-    timer.initTimer();
-    // While Timeout is not reached
-    while (timer.elapsedTime_ms()<timeOut_ms || timeOut_ms==0)
-    {
-        // Try to read a byte on the device
-        switch (read(fd,pByte,1)) {
-        case 1  : return 1; // Read successfull
-        case -1 : return -2; // Error while reading
-        }
-    }
-    return 0;
+    // A byte read by a previous call may already be buffered
+    int Ret=readBytes_us(pByte,1,timeOut_us);
+    // Error while reading
+    if (Ret<0) return -2;
+    // 1 if the byte has been read, 0 if the timeout is reached
+    return Ret;
 #endif
 }
 
@@ -545,6 +733,7 @@ int serialib::readChar(char *pByte,unsigned int timeOut_ms)
   */
 int serialib::readStringNoTimeOut(char *receivedString,char finalChar,unsigned int maxNbBytes)
 {
+#if defined (_WIN32) || defined(_WIN64)
     // Number of characters read
     unsigned int    NbBytes=0;
     // Returned value from Read
@@ -577,6 +766,11 @@ int serialib::readStringNoTimeOut(char *receivedString,char finalChar,unsigned i
     }
     // Buffer is full : return -3
     return -3;
+#endif
+#if defined (__linux__) || defined(__APPLE__)
+    // Same as readString, the timeout only ends the reading when it is not zero
+    return readString_us(receivedString,finalChar,maxNbBytes,0);
+#endif
 }
 
 
@@ -594,31 +788,50 @@ int serialib::readStringNoTimeOut(char *receivedString,char finalChar,unsigned i
   */
 int serialib::readString(char *receivedString,char finalChar,unsigned int maxNbBytes,unsigned int timeOut_ms)
 {
+    return readString_us(receivedString,finalChar,maxNbBytes,timeOut_ms*1000ULL);
+}
+
+
+/*!
+     \brief Read a string from the serial device (with timeout in microseconds)
+     \param receivedString : string read on the serial device
+     \param finalChar : final char of the string
+     \param maxNbBytes : maximum allowed number of characters read
+     \param timeOut_us : delay of timeout in microseconds before giving up the reading (optional)
+     \return  >0 success, return the number of bytes read (including the null character)
+     \return  0 timeout is reached
+     \return -1 error while setting the Timeout
+     \return -2 error while reading the character
+     \return -3 MaxNbBytes is reached
+  */
+int serialib::readString_us(char *receivedString,char finalChar,unsigned int maxNbBytes,unsigned long long timeOut_us)
+{
+#if defined (_WIN32) || defined(_WIN64)
     // Check if timeout is requested
-    if (timeOut_ms==0) return readStringNoTimeOut(receivedString,finalChar,maxNbBytes);
+    if (timeOut_us==0) return readStringNoTimeOut(receivedString,finalChar,maxNbBytes);
 
     // Number of bytes read
     unsigned int    nbBytes=0;
     // Character read on serial device
     char            charRead;
-    // Timer used for timeout
+    // Deadline of the whole reading
     timeOut         timer;
-    long int        timeOutParam;
+    long long       timeOutParam;
 
     // Initialize the timer (for timeout)
-    timer.initTimer();
+    timer.setDeadline_us(timeOut_us);
 
     // While the buffer is not full
     while (nbBytes<maxNbBytes)
     {
         // Compute the TimeOut for the next call of ReadChar
-        timeOutParam = timeOut_ms-timer.elapsedTime_ms();
+        timeOutParam = timer.remaining_us();
 
         // If there is time remaining
         if (timeOutParam>0)
         {
             // Wait for a byte on the serial link with the remaining time as timeout
-            charRead=readChar(&receivedString[nbBytes],timeOutParam);
+            charRead=readChar_us(&receivedString[nbBytes],timeOutParam);
 
             // If a byte has been received
             if (charRead==1)
@@ -639,7 +852,7 @@ int serialib::readString(char *receivedString,char finalChar,unsigned int maxNbB
             if (charRead<0) return charRead;
         }
         // Check if timeout is reached
-        if (timer.elapsedTime_ms()>timeOut_ms)
+        if (timer.expired())
         {
             // Add the end caracter
             receivedString[nbBytes]=0;
@@ -650,6 +863,55 @@ int serialib::readString(char *receivedString,char finalChar,unsigned int maxNbB
 
     // Buffer is full : return -3
     return -3;
+#endif
+#if defined (__linux__) || defined(__APPLE__)
+    // Number of bytes read
+    unsigned int    nbBytes=0;
+    // Deadline of the whole reading, none if timeOut_us is zero
+    timeOut         timer;
+
+    // Initialize the timer (for timeout)
+    timer.setDeadline_us(timeOut_us);
+
+    // While the buffer is not full
+    while (nbBytes<maxNbBytes)
+    {
+        // Take everything buffered up to and including the final character
+        bool finalFound=false;
+        nbBytes+=takeFromRxBuffer(receivedString+nbBytes,maxNbBytes-nbBytes,(unsigned char)finalChar,&finalFound);
+        if (finalFound)
+        {
+            // Final character: add the end character 0
+            receivedString[nbBytes]=0;
+            // Return the number of bytes read
+            return nbBytes;
+        }
+        if (nbBytes>=maxNbBytes) break;
+
+        // Refill the buffer with whatever the driver already has
+        int Ret=fillRxBuffer();
+        if (Ret<0) return -2;
+        if (Ret>0) continue;
+
+        // Nothing pending: wait for more data with the remaining time
+        long long timeOutParam=-1;
+        if (timeOut_us!=0)
+        {
+            timeOutParam=timer.remaining_us();
+            if (timeOutParam<=0)
+            {
+                // Add the end caracter
+                receivedString[nbBytes]=0;
+                // Return 0 (timeout reached)
+                return 0;
+            }
+        }
+        if (waitReadable(timeOutParam,100)<0) return -2;
+    }
+
+    // Buffer is full : return -3
+    return -3;
+#endif
 }
 
 
@@ -661,12 +923,33 @@ int serialib::readString(char *receivedString,char finalChar,unsigned int maxNbB
      \param sleepDuration_us : delay of CPU relaxing in microseconds (Linux only)
             In the reading loop, a sleep can be performed after each reading
             This allows CPU to perform other tasks
+            Ignored in SERIAL_WAIT_POLL mode, where the call blocks in poll() instead
+            and returns as soon as the requested bytes have arrived
      \return >=0 return the number of bytes read before timeout or
                 requested data is completed
      \return -1 error while setting the Timeout
      \return -2 error while reading the byte
   */
 int serialib::readBytes (void *buffer,unsigned int maxNbBytes,unsigned int timeOut_ms, unsigned int sleepDuration_us)
+{
+    return readBytes_us(buffer,maxNbBytes,timeOut_ms*1000ULL,sleepDuration_us);
+}
+
+
+/*!
+     \brief Read an array of bytes from the serial device (with timeout in microseconds)
+     \param buffer : array of bytes read from the serial device
+     \param maxNbBytes : maximum allowed number of bytes read
+     \param timeOut_us : delay of timeout in microseconds before giving up the reading
+            If set to zero, timeout is disable
+            Rounded up to the next millisecond on Windows
+     \param sleepDuration_us : delay of CPU relaxing in microseconds in SERIAL_WAIT_SLEEP mode (Linux only)
+     \return >=0 return the number of bytes read before timeout or
+                requested data is completed
+     \return -1 error while setting the Timeout
+     \return -2 error while reading the byte
+  */
+int serialib::readBytes_us (void *buffer,unsigned int maxNbBytes,unsigned long long timeOut_us, unsigned int sleepDuration_us)
 {
 #if defined (_WIN32) || defined(_WIN64)
     // Avoid warning while compiling
@@ -676,7 +959,7 @@ int serialib::readBytes (void *buffer,unsigned int maxNbBytes,unsigned int timeO
     DWORD dwBytesRead = 0;
 
     // Set the TimeOut
-    timeouts.ReadTotalTimeoutConstant=(DWORD)timeOut_ms;
+    timeouts.ReadTotalTimeoutConstant=(DWORD)((timeOut_us+999)/1000);
 
     // Write the parameters and return -1 if an error occrured
     if(!SetCommTimeouts(hSerial, &timeouts)) return -1;
@@ -689,32 +972,42 @@ int serialib::readBytes (void *buffer,unsigned int maxNbBytes,unsigned int timeO
     return dwBytesRead;
 #endif
 #if defined (__linux__) || defined(__APPLE__)
-    // Timer used for timeout
+    // Deadline of the whole reading, none if timeOut_us is zero
     timeOut          timer;
-    // Initialise the timer
-    timer.initTimer();
+    timer.setDeadline_us(timeOut_us);
     unsigned int     NbByteRead=0;
-    // While Timeout is not reached
-    while (timer.elapsedTime_ms()<timeOut_ms || timeOut_ms==0)
+    while (true)
     {
-        // Compute the position of the current byte
-        unsigned char* Ptr=(unsigned char*)buffer+NbByteRead;
-        // Try to read a byte on the device
-        int Ret=read(fd,(void*)Ptr,maxNbBytes-NbByteRead);
-        // Error while reading
-        if (Ret==-1) return -2;
-
-        // One or several byte(s) has been read on the device
-        if (Ret>0)
+        // Serve the request from the ring buffer first
+        NbByteRead+=takeFromRxBuffer((unsigned char*)buffer+NbByteRead,maxNbBytes-NbByteRead,-1,NULL);
+        // Success : bytes has been read
+        if (NbByteRead>=maxNbBytes)
+            return NbByteRead;
+
+        int Ret;
+        if (maxNbBytes-NbByteRead>=RX_BUFFER_SIZE)
         {
-            // Increase the number of read bytes
-            NbByteRead+=Ret;
-            // Success : bytes has been read
-            if (NbByteRead>=maxNbBytes)
-                return NbByteRead;
+            // Large request and empty ring buffer: read straight into the caller's buffer
+            Ret=read(fd,(unsigned char*)buffer+NbByteRead,maxNbBytes-NbByteRead);
+            if (Ret==-1 && errno!=EAGAIN && errno!=EINTR) return -2;
+            if (Ret>0) NbByteRead+=Ret;
         }
-        // Suspend the loop to avoid charging the CPU
-        usleep (sleepDuration_us);
+        else
+        {
+            // Refill the ring buffer with one large read
+            Ret=fillRxBuffer();
+            if (Ret<0) return -2;
+        }
+        if (Ret>0) continue;
+
+        // Nothing pending: wait for more data unless the timeout is reached
+        long long timeOutParam=-1;
+        if (timeOut_us!=0)
+        {
+            timeOutParam=timer.remaining_us();
+            if (timeOutParam<=0) break;
+        }
+        if (waitReadable(timeOutParam,sleepDuration_us)<0) return -2;
     }
     // Timeout reached, return the number of bytes read
     return NbByteRead;
@@ -723,6 +1016,116 @@ int serialib::readBytes (void *buffer,unsigned int maxNbBytes,unsigned int timeO
 
 
 
+#if defined (__linux__) || defined(__APPLE__)
+/*!
+     \brief Move the bytes pending in the driver into the ring buffer, without waiting
+     \return >0 number of bytes added to the ring buffer
+     \return 0 nothing pending (or ring buffer full)
+     \return -1 error while reading the device
+  */
+int serialib::fillRxBuffer()
+{
+    unsigned int count=rxTail-rxHead;
+    if (count>=RX_BUFFER_SIZE) return 0;
+
+    // Free space may wrap around the end of the buffer: fill both parts in one call
+    unsigned int tail=rxTail&(RX_BUFFER_SIZE-1);
+    unsigned int free=RX_BUFFER_SIZE-count;
+    struct iovec iov[2];
+    iov[0].iov_base=rxBuffer+tail;
+    iov[0].iov_len=(tail+free<=RX_BUFFER_SIZE) ? free : RX_BUFFER_SIZE-tail;
+    iov[1].iov_base=rxBuffer;
+    iov[1].iov_len=free-iov[0].iov_len;
+
+    ssize_t Ret=readv(fd,iov,iov[1].iov_len ? 2 : 1);
+    if (Ret<0) return (errno==EAGAIN || errno==EINTR) ? 0 : -1;
+    rxTail+=(unsigned int)Ret;
+    return (int)Ret;
+}
+
+
+/*!
+     \brief Copy bytes from the ring buffer
+     \param buffer : destination
+     \param maxNbBytes : maximum number of bytes to copy
+     \param finalChar : stop right after this byte value, or -1 to copy everything available
+     \param finalFound : set to true when the copy stopped on finalChar (can be NULL)
+     \return the number of bytes copied
+  */
+unsigned int serialib::takeFromRxBuffer(void *buffer, unsigned int maxNbBytes, int finalChar, bool *finalFound)
+{
+    unsigned char *dst=(unsigned char*)buffer;
+    unsigned int copied=0;
+    // At most two contiguous segments: up to the end of the buffer, then from its start
+    for (int segment=0; segment<2 && copied<maxNbBytes && rxHead!=rxTail; segment++)
+    {
+        unsigned int head=rxHead&(RX_BUFFER_SIZE-1);
+        unsigned int len=rxTail-rxHead;
+        if (head+len>RX_BUFFER_SIZE) len=RX_BUFFER_SIZE-head;
+        if (len>maxNbBytes-copied) len=maxNbBytes-copied;
+
+        bool found=false;
+        if (finalChar>=0)
+        {
+            const void *end=memchr(rxBuffer+head,finalChar,len);
+            if (end)
+            {
+                len=(unsigned int)((const unsigned char*)end-(rxBuffer+head))+1;
+                found=true;
+            }
+        }
+        memcpy(dst+copied,rxBuffer+head,len);
+        copied+=len;
+        rxHead+=len;
+        if (found)
+        {
+            if (finalFound) *finalFound=true;
+            break;
+        }
+    }
+    return copied;
+}
+
+
+/*!
+     \brief Wait until the device may have data to read
+     \param timeOut_us : maximum waiting time in microseconds, negative to wait without limit (SERIAL_WAIT_POLL only)
+     \param sleepDuration_us : sleeping time in SERIAL_WAIT_SLEEP mode
+     \return 0 the device can be read again (or the wait was interrupted)
+     \return -1 the device reported an error or a hang-up
+  */
+int serialib::waitReadable(long long timeOut_us, unsigned int sleepDuration_us)
+{
+    if (waitMode!=SERIAL_WAIT_POLL)
+    {
+        // Suspend the loop to avoid charging the CPU
+        usleep(sleepDuration_us);
+        return 0;
+    }
+    // Sleep in the kernel until the device is readable or the remaining time is over
+    struct pollfd pfd;
+    pfd.fd=fd;
+    pfd.events=POLLIN;
+    pfd.revents=0;
+#if defined (__linux__)
+    // ppoll keeps the microsecond resolution of the deadline
+    struct timespec ts;
+    ts.tv_sec=timeOut_us/1000000;
+    ts.tv_nsec=(timeOut_us%1000000)*1000;
+    int ready=ppoll(&pfd,1,timeOut_us<0 ? NULL : &ts,NULL);
+#else
+    // poll only takes milliseconds: round up so the deadline is never missed early
+    int ready=poll(&pfd,1,timeOut_us<0 ? -1 : (int)((timeOut_us+999)/1000));
+#endif
+    if (ready<0 && errno!=EINTR) return -1;
+    // Device gone (unplugged adapter, closed pty master)
+    if (ready>0 && !(pfd.revents & POLLIN)) return -1;
+    return 0;
+}
+#endif
+
+
+
 
 // _________________________
 // ::: Special operation :::
@@ -742,8 +1145,9 @@ char serialib::flushReceiver()
     return PurgeComm (hSerial, PURGE_RXCLEAR);
 #endif
 #if defined (__linux__) || defined(__APPLE__)
-    // Purge receiver
+    // Purge receiver, including the bytes already moved to the ring buffer
     tcflush(fd,TCIFLUSH);
+    rxHead = rxTail;
     return true;
 #endif
 }
@@ -768,15 +1172,95 @@ int serialib::available()
 #endif
 #if defined (__linux__) || defined(__APPLE__)
     int nBytes=0;
-    // Return number of pending bytes in the receiver
+    // Return number of pending bytes in the receiver and in the ring buffer
     ioctl(fd, FIONREAD, &nBytes);
-    return nBytes;
+    return nBytes + (int)(rxTail - rxHead);
 #endif
 
 }
 
 
 
+/*!
+    \brief  Select how readBytes waits for incoming data (Unix only)
+    \param  mode : SERIAL_WAIT_SLEEP retries read() with a usleep() in between (default)
+                   SERIAL_WAIT_POLL blocks in poll() and wakes up as soon as data arrives
+*/
+void serialib::setWaitMode(SerialWaitMode mode)
+{
+    waitMode = mode;
+}
+
+/*!
+    \brief  Return the current waiting strategy of readBytes
+*/
+SerialWaitMode serialib::getWaitMode() const
+{
+    return waitMode;
+}
+
+
+
+/*!
+    \brief  Read the bytes already received by the driver or buffered, never waits (Unix only)
+            Meant for callers multiplexing several devices in their own poll() or epoll loop
+    \param  buffer : array of bytes read from the serial device
+    \param  maxNbBytes : maximum allowed number of bytes read
+    \return >=0 the number of bytes read, 0 if nothing was pending
+    \return -2 error while reading the device
+*/
+int serialib::readAvailable(void *buffer, unsigned int maxNbBytes)
+{
+#if defined (_WIN32) || defined(_WIN64)
+    // Only read what the driver already holds, so that ReadFile returns immediately
+    int pending=available();
+    if (pending<=0) return 0;
+    if ((unsigned int)pending>maxNbBytes) pending=(int)maxNbBytes;
+    return readBytes_us(buffer,(unsigned int)pending,1000);
+#endif
+#if defined (__linux__) || defined(__APPLE__)
+    unsigned int NbByteRead=0;
+    while (true)
+    {
+        NbByteRead+=takeFromRxBuffer((unsigned char*)buffer+NbByteRead,maxNbBytes-NbByteRead,-1,NULL);
+        if (NbByteRead>=maxNbBytes) break;
+
+        int Ret;
+        if (maxNbBytes-NbByteRead>=RX_BUFFER_SIZE)
+        {
+            // Large request and empty ring buffer: read straight into the caller's buffer
+            Ret=read(fd,(unsigned char*)buffer+NbByteRead,maxNbBytes-NbByteRead);
+            if (Ret==-1) Ret=(errno==EAGAIN || errno==EINTR) ? 0 : -1;
+            if (Ret>0) NbByteRead+=Ret;
+        }
+        else
+            Ret=fillRxBuffer();
+        if (Ret<0) return -2;
+        // Driver emptied
+        if (Ret==0) break;
+    }
+    return NbByteRead;
+#endif
+}
+
+
+
+/*!
+    \brief  Return the file descriptor of the device (Unix only)
+    \return the descriptor, -1 if no device is open (always -1 on Windows)
+*/
+int serialib::fileDescriptor() const
+{
+#if defined (_WIN32) || defined(_WIN64)
+    return -1;
+#endif
+#if defined (__linux__) || defined(__APPLE__)
+    return fd;
+#endif
+}
+
+
+
 // __________________
 // ::: I/O Access :::
 
@@ -1064,71 +1548,130 @@ bool serialib::isRTS()
 */
 // Constructor
 timeOut::timeOut()
-{}
+{
+    startTime_ns = now_ns();
+    deadline_ns = -1;
+}
 
 
 /*!
-    \brief      Initialise the timer. It writes the current time of the day in the structure PreviousTime.
+    \brief      Read the monotonic clock
+    \return     The current time in nanoseconds, from an arbitrary but fixed origin
 */
-//Initialize the timer
-void timeOut::initTimer()
+long long timeOut::now_ns()
 {
-#if defined (NO_POSIX_TIME)
-    LARGE_INTEGER tmp;
-    QueryPerformanceFrequency(&tmp);
-    counterFrequency = tmp.QuadPart;
-    // Used to store the previous time (for computing timeout)
-    QueryPerformanceCounter(&tmp);
-    previousTime = tmp.QuadPart;
+#if defined (_WIN32) || defined(_WIN64)
+    LARGE_INTEGER counter, frequency;
+    QueryPerformanceFrequency(&frequency);
+    QueryPerformanceCounter(&counter);
+    // Split the conversion to avoid overflowing counter*1e9
+    long long seconds = counter.QuadPart / frequency.QuadPart;
+    long long ticks = counter.QuadPart % frequency.QuadPart;
+    return seconds * 1000000000LL + ticks * 1000000000LL / frequency.QuadPart;
+#else
+    struct timespec now;
+#if defined (SERIALIB_MONOTONIC_RAW) && defined (CLOCK_MONOTONIC_RAW)
+    // Not slewed by NTP either, useful to compare with a device clock
+    clock_gettime(CLOCK_MONOTONIC_RAW, &now);
 #else
-    gettimeofday(&previousTime, NULL);
+    clock_gettime(CLOCK_MONOTONIC, &now);
+#endif
+    return (long long)now.tv_sec * 1000000000LL + now.tv_nsec;
 #endif
 }
 
+
 /*!
-    \brief      Returns the time elapsed since initialization.  It write the current time of the day in the structure CurrentTime.
-                Then it returns the difference between CurrentTime and PreviousTime.
-    \return     The number of microseconds elapsed since the functions InitTimer was called.
-  */
-//Return the elapsed time since initialization
-unsigned long int timeOut::elapsedTime_ms()
+    \brief      Initialise the timer. It stores the current time of the monotonic clock and clears the deadline.
+*/
+//Initialize the timer
+void timeOut::initTimer()
 {
-#if defined (NO_POSIX_TIME)
-    // Current time
-    LARGE_INTEGER CurrentTime;
-    // Number of ticks since last call
-    int sec;
+    startTime_ns = now_ns();
+    deadline_ns = -1;
+}
 
-    // Get current time
-    QueryPerformanceCounter(&CurrentTime);
 
-    // Compute the number of ticks elapsed since last call
-    sec=CurrentTime.QuadPart-previousTime;
+/*!
+    \brief      Initialise the timer and arm a deadline
+    \param      timeOut_us : delay before the deadline in microseconds, 0 for no deadline
+*/
+void timeOut::setDeadline_us(unsigned long long timeOut_us)
+{
+    setDeadline_ns(timeOut_us * 1000ULL);
+}
 
-    // Return the elapsed time in milliseconds
-    return sec/(counterFrequency/1000);
-#else
-    // Current time
-    struct timeval CurrentTime;
-    // Number of seconds and microseconds since last call
-    int sec,usec;
 
-    // Get current time
-    gettimeofday(&CurrentTime, NULL);
+/*!
+    \brief      Initialise the timer and arm a deadline
+    \param      timeOut_ns : delay before the deadline in nanoseconds, 0 for no deadline
+*/
+void timeOut::setDeadline_ns(unsigned long long timeOut_ns)
+{
+    startTime_ns = now_ns();
+    deadline_ns = timeOut_ns ? startTime_ns + (long long)timeOut_ns : -1;
+}
 
-    // Compute the number of seconds and microseconds elapsed since last call
-    sec=CurrentTime.tv_sec-previousTime.tv_sec;
-    usec=CurrentTime.tv_usec-previousTime.tv_usec;
 
-    // If the previous usec is higher than the current one
-    if (usec<0)
-    {
-        // Recompute the microseonds and substract one second
-        usec=1000000-previousTime.tv_usec+CurrentTime.tv_usec;
-        sec--;
-    }
+/*!
+    \brief      Check the deadline
+    \return     true once the deadline is reached, false before or if no deadline is armed
+*/
+bool timeOut::expired() const
+{
+    return deadline_ns >= 0 && now_ns() >= deadline_ns;
+}
 
-    // Return the elapsed time in milliseconds
-    return sec*1000+usec/1000;
-#endif
+
+/*!
+    \brief      Time left before the deadline
+    \return     The remaining nanoseconds, 0 once the deadline is reached, -1 if no deadline is armed
+*/
+long long timeOut::remaining_ns() const
+{
+    if (deadline_ns < 0) return -1;
+    long long remaining = deadline_ns - now_ns();
+    return remaining > 0 ? remaining : 0;
+}
+
+
+/*!
+    \brief      Time left before the deadline
+    \return     The remaining microseconds (rounded up), 0 once the deadline is reached, -1 if no deadline is armed
+*/
+long long timeOut::remaining_us() const
+{
+    long long remaining = remaining_ns();
+    return remaining <= 0 ? remaining : (remaining + 999) / 1000;
+}
+
+
+/*!
+    \brief      Returns the time elapsed since initialization
+    \return     The number of nanoseconds elapsed since the functions InitTimer was called.
+  */
+unsigned long long timeOut::elapsedTime_ns() const
+{
+    return (unsigned long long)(now_ns() - startTime_ns);
+}
+
+
+/*!
+    \brief      Returns the time elapsed since initialization
+    \return     The number of microseconds elapsed since the functions InitTimer was called.
+  */
+unsigned long long timeOut::elapsedTime_us() const
+{
+    return elapsedTime_ns() / 1000ULL;
+}
+
+
+/*!
+    \brief      Returns the time elapsed since initialization
+    \return     The number of milliseconds elapsed since the functions InitTimer was called.
+  */
+//Return the elapsed time since initialization
+unsigned long int timeOut::elapsedTime_ms() const
+{
+    return (unsigned long int)(elapsedTime_ns() / 1000000ULL);
 }
@@ -46,10 +46,14 @@ This is a licence-free software, it can be used by anyone who try to build a bet
     #include <string.h>
     #include <iostream>
     #include <sys/time.h>
+    #include <time.h>
     // File control definitions
     #include <fcntl.h>
     #include <unistd.h>
     #include <sys/ioctl.h>
+    #include <poll.h>
+    #include <errno.h>
+    #include <sys/uio.h>
 #endif
 
 /*! To avoid unused parameters */
@@ -86,6 +90,33 @@ enum SerialParity {
     SERIAL_PARITY_SPACE /**< space bit */
 };
 
+/**
+ * optional driver settings of openDevice (Unix only)
+ */
+enum SerialOpenOptions {
+    SERIAL_OPEN_LOW_LATENCY = 0x1, /**< deliver bytes without waiting for the USB adapter latency timer */
+    SERIAL_OPEN_CUSTOM_BAUD = 0x2, /**< accept any baud rate, not only the Bxxxx constants */
+};
+
+/**
+ * how the read functions wait for incoming data (Unix only)
+ */
+enum SerialWaitMode {
+    SERIAL_WAIT_SLEEP, /**< retry read() and usleep() between attempts */
+    SERIAL_WAIT_POLL, /**< block in poll() until data arrives or the timeout expires */
+};
+
+/*!  \struct    SerialBuffer
+     \brief     One array of bytes of a gathered write, see serialib::writeBuffers
+*/
+struct SerialBuffer {
+    const void   *data;
+    unsigned int  length;
+};
+
+/*! Most buffers written by one call of serialib::writeBuffers */
+#define SERIAL_MAX_BUFFERS 64
+
 /*!  \class     serialib
      \brief     This class is used for communication over a serial device.
 */
@@ -116,6 +147,13 @@ public:
                     SerialParity Parity = SERIAL_PARITY_NONE,
                     SerialStopBits Stopbits = SERIAL_STOPBITS_1);
 
+    // Open a device with optional driver settings (SerialOpenOptions), reports the ones the driver accepted
+    char openDevice(const char *Device, const unsigned int Bauds,
+                    unsigned int openOptions, unsigned int *acceptedOptions,
+                    SerialDataBits Databits = SERIAL_DATABITS_8,
+                    SerialParity Parity = SERIAL_PARITY_NONE,
+                    SerialStopBits Stopbits = SERIAL_STOPBITS_1);
+
     // Check device opening state
     bool isDeviceOpen();
 
@@ -135,6 +173,9 @@ public:
     // Read a char (with timeout)
     int     readChar    (char *pByte,const unsigned int timeOut_ms=0);
 
+    // Read a char (with timeout in microseconds)
+    int     readChar_us (char *pByte,unsigned long long timeOut_us=0);
+
 
 
 
@@ -151,6 +192,12 @@ public:
                             unsigned int maxNbBytes,
                             const unsigned int timeOut_ms=0);
 
+    // Read a string (with timeout in microseconds)
+    int     readString_us ( char *receivedString,
+                            char finalChar,
+                            unsigned int maxNbBytes,
+                            unsigned long long timeOut_us=0);
+
 
 
     // _____________________________________
@@ -160,9 +207,15 @@ public:
     // Write an array of bytes
     int     writeBytes  (const void *Buffer, const unsigned int NbBytes);
 
+    // Write several arrays of bytes in one call, without waiting for room in the output queue
+    int     writeBuffers(const SerialBuffer *buffers, int count);
+
     // Read an array of byte (with timeout)
     int     readBytes   (void *buffer,unsigned int maxNbBytes,const unsigned int timeOut_ms=0, unsigned int sleepDuration_us=100);
 
+    // Read an array of byte (with timeout in microseconds)
+    int     readBytes_us(void *buffer,unsigned int maxNbBytes,unsigned long long timeOut_us=0, unsigned int sleepDuration_us=100);
+
 
 
 
@@ -176,6 +229,16 @@ public:
     // Return the number of bytes in the received buffer
     int     available();
 
+    // Select how readBytes waits for data (Unix only)
+    void    setWaitMode(SerialWaitMode mode);
+    SerialWaitMode getWaitMode() const;
+
+    // Read the bytes already received, without waiting (Unix only)
+    int     readAvailable(void *buffer, unsigned int maxNbBytes);
+
+    // File descriptor of the open device, to wait on several devices at once (Unix only)
+    int     fileDescriptor() const;
+
 
 
 
@@ -220,6 +283,9 @@ private:
     bool            currentStateRTS;
     bool            currentStateDTR;
 
+    // Waiting strategy of the read functions
+    SerialWaitMode  waitMode;
+
 
 
 
@@ -232,6 +298,21 @@ private:
 #endif
 #if defined (__linux__) || defined(__APPLE__)
     int             fd;
+
+    // Size of the receive ring buffer (power of two)
+    static const unsigned int RX_BUFFER_SIZE = 4096;
+    // Receive ring buffer, filled with large read() calls and drained by every read function
+    unsigned char   rxBuffer[RX_BUFFER_SIZE];
+    // Free-running indices of the next byte to hand out and of the next byte to receive
+    unsigned int    rxHead;
+    unsigned int    rxTail;
+
+    // Move whatever the driver has pending into the ring buffer
+    int             fillRxBuffer();
+    // Copy buffered bytes out of the ring buffer, optionally stopping after a delimiter
+    unsigned int    takeFromRxBuffer(void *buffer, unsigned int maxNbBytes, int finalChar, bool *finalFound);
+    // Wait for the device to become readable, following the wait mode
+    int             waitReadable(long long timeOut_us, unsigned int sleepDuration_us);
 #endif
 
 };
@@ -240,6 +321,9 @@ private:
 
 /*!  \class     timeOut
      \brief     This class can manage a timer which is used as a timeout.
+                Time is read from a monotonic clock (CLOCK_MONOTONIC, or CLOCK_MONOTONIC_RAW
+                when SERIALIB_MONOTONIC_RAW is defined) and stored in nanoseconds, so it is
+                not affected by NTP steps or changes of the time of day.
    */
 // Class timeOut
 class timeOut
@@ -252,18 +336,30 @@ public:
     // Init the timer
     void                initTimer();
 
+    // Init the timer and arm a deadline (0 means no deadline)
+    void                setDeadline_us(unsigned long long timeOut_us);
+    void                setDeadline_ns(unsigned long long timeOut_ns);
+
+    // Return true once the deadline is reached (never if no deadline is armed)
+    bool                expired() const;
+
+    // Return the time left before the deadline, 0 once expired, -1 if no deadline is armed
+    long long           remaining_ns() const;
+    long long           remaining_us() const;
+
     // Return the elapsed time since initialization
-    unsigned long int   elapsedTime_ms();
+    unsigned long int   elapsedTime_ms() const;
+    unsigned long long  elapsedTime_us() const;
+    unsigned long long  elapsedTime_ns() const;
+
+    // Current value of the monotonic clock in nanoseconds
+    static long long    now_ns();
 
 private:
-#if defined (NO_POSIX_TIME)
-    // Used to store the previous time (for computing timeout)
-    LONGLONG       counterFrequency;
-    LONGLONG       previousTime;
-#else
-    // Used to store the previous time (for computing timeout)
-    struct timeval      previousTime;
-#endif
+    // Time of initialization in nanoseconds
+    long long           startTime_ns;
+    // Deadline in nanoseconds, -1 if none
+    long long           deadline_ns;
 };
 
 #endif // serialib_H
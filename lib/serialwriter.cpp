@@ -0,0 +1,170 @@
+/*!
+ \file    serialwriter.cpp
+ \brief   Source file of the class SerialWriter.
+ */
+
+#include "serialwriter.h"
+#include <cstring>
+
+
+SerialWriter::SerialWriter(size_t capacity)
+    : queue(capacity), wakeRequested(false), enqueuedCount(0), droppedCount(0), supersededCount(0),
+      writtenCount(0), bytesCount(0), errorCount(0), pendingCount(0) {}
+
+/*!
+     \brief Queue a command, never blocks
+     \param device : index of the device the command is for
+     \param type : commands of the same type replace each other until written
+     \param data : bytes of the command as sent on the wire
+     \param length : at most SERIAL_COMMAND_MAX_BYTES
+     \return false if the command was dropped (too long or queue full)
+  */
+bool SerialWriter::enqueue(uint32_t device, uint8_t type, const void *data, size_t length) {
+    if (length > SERIAL_COMMAND_MAX_BYTES) {
+        droppedCount.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+    SerialCommand command;
+    command.device = device;
+    command.type = type;
+    command.length = (uint8_t)length;
+    memcpy(command.data, data, length);
+    if (!queue.push(command)) {
+        droppedCount.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+    enqueuedCount.fetch_add(1, std::memory_order_relaxed);
+    return true;
+}
+
+bool SerialWriter::requestWake() {
+    // Only the first command after the consumer's last clearWake() needs a wake-up
+    return !wakeRequested.exchange(true, std::memory_order_acq_rel);
+}
+
+void SerialWriter::clearWake() {
+    wakeRequested.store(false, std::memory_order_release);
+}
+
+SerialWriter::DeviceOutput &SerialWriter::output(uint32_t device) {
+    if (device >= outputs.size()) outputs.resize(device + 1);
+    return outputs[device];
+}
+
+/*!
+     \brief Take every queued command, replacing the pending command of the same type and device if any
+            A replaced command keeps its place in the write order
+  */
+size_t SerialWriter::collect() {
+    SerialCommand command;
+    size_t count = 0;
+    while (queue.pop(command)) {
+        count++;
+        std::vector<SerialCommand> &pending = output(command.device).pending;
+        bool replaced = false;
+        for (SerialCommand &older : pending) {
+            if (older.type != command.type) continue;
+            older = command;
+            replaced = true;
+            break;
+        }
+        if (replaced) supersededCount.fetch_add(1, std::memory_order_relaxed);
+        else {
+            pending.push_back(command);
+            pendingCount.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+    return count;
+}
+
+bool SerialWriter::hasOutput(uint32_t device) const {
+    return device < outputs.size() && (!outputs[device].pending.empty() || !outputs[device].partial.empty());
+}
+
+/*!
+     \brief Write the pending commands of a device without waiting for room in its output queue
+     \return 1 if output remains (wait for the device to become writable), 0 if everything was written,
+             -1 if the write failed
+  */
+int SerialWriter::flush(uint32_t device, serialib &serial) {
+    DeviceOutput &out = output(device);
+
+    // Finish the command cut by the previous flush before anything else
+    if (!out.partial.empty()) {
+        SerialBuffer rest = {out.partial.data() + out.partialOffset, (unsigned int)(out.partial.size() - out.partialOffset)};
+        int n = serial.writeBuffers(&rest, 1);
+        if (n < 0) {
+            errorCount.fetch_add(1, std::memory_order_relaxed);
+            return -1;
+        }
+        bytesCount.fetch_add(n, std::memory_order_relaxed);
+        out.partialOffset += n;
+        if (out.partialOffset < out.partial.size()) return 1;
+        out.partial.clear();
+        out.partialOffset = 0;
+        writtenCount.fetch_add(1, std::memory_order_relaxed);
+    }
+    if (out.pending.empty()) return 0;
+
+    SerialBuffer buffers[SERIAL_MAX_BUFFERS];
+    int count = out.pending.size() < SERIAL_MAX_BUFFERS ? (int)out.pending.size() : SERIAL_MAX_BUFFERS;
+    for (int i = 0; i < count; ++i) {
+        buffers[i].data = out.pending[i].data;
+        buffers[i].length = out.pending[i].length;
+    }
+    int n = serial.writeBuffers(buffers, count);
+    if (n < 0) {
+        errorCount.fetch_add(1, std::memory_order_relaxed);
+        return -1;
+    }
+    bytesCount.fetch_add(n, std::memory_order_relaxed);
+
+    // Commands fully written leave the list, a command cut in the middle moves its tail to partial.
+    // Commands not started at all stay pending and can still be superseded.
+    size_t done = 0;
+    size_t left = (size_t)n;
+    while (done < (size_t)count && left >= out.pending[done].length) {
+        left -= out.pending[done].length;
+        done++;
+    }
+    writtenCount.fetch_add(done, std::memory_order_relaxed);
+    if (left > 0) {
+        const SerialCommand &cut = out.pending[done];
+        out.partial.assign(cut.data + left, cut.data + cut.length);
+        out.partialOffset = 0;
+        done++;
+    }
+    out.pending.erase(out.pending.begin(), out.pending.begin() + done);
+    pendingCount.fetch_sub(done, std::memory_order_relaxed);
+    return hasOutput(device) ? 1 : 0;
+}
+
+/*!
+     \brief Drop the unfinished command of a device that went away: the board restarts with it and must
+            not receive the tail of a command. Pending commands are kept and sent on reconnection.
+  */
+void SerialWriter::resetDevice(uint32_t device) {
+    if (device >= outputs.size()) return;
+    outputs[device].partial.clear();
+    outputs[device].partialOffset = 0;
+}
+
+void SerialWriter::clear() {
+    SerialCommand command;
+    while (queue.pop(command)) {}
+    outputs.clear();
+    pendingCount.store(0, std::memory_order_relaxed);
+}
+
+SerialWriteStats SerialWriter::stats() const {
+    SerialWriteStats stats;
+    stats.queued     = queue.size();
+    stats.pending    = pendingCount.load(std::memory_order_relaxed);
+    stats.enqueued   = enqueuedCount.load(std::memory_order_relaxed);
+    stats.dropped    = droppedCount.load(std::memory_order_relaxed);
+    stats.superseded = supersededCount.load(std::memory_order_relaxed);
+    stats.written    = writtenCount.load(std::memory_order_relaxed);
+    stats.bytes      = bytesCount.load(std::memory_order_relaxed);
+    stats.errors     = errorCount.load(std::memory_order_relaxed);
+    return stats;
+}
@@ -0,0 +1,108 @@
+/*!
+\file    serialwriter.h
+\brief   Non-blocking, coalescing queue of commands written to the serial devices.
+*/
+
+
+#ifndef SERIALWRITER_H
+#define SERIALWRITER_H
+
+#include "serialib.h"
+#include "spscqueue.h"
+#include <atomic>
+#include <cstdint>
+#include <vector>
+
+/*! Largest command, in bytes as written on the wire */
+#define SERIAL_COMMAND_MAX_BYTES 64
+
+/*!  \struct    SerialCommand
+     \brief     Bytes of one command for one device. A newer command of the same type for the same
+                device replaces an older one that was not written yet.
+*/
+struct SerialCommand {
+    uint32_t device;
+    uint8_t  type;
+    uint8_t  length;
+    uint8_t  data[SERIAL_COMMAND_MAX_BYTES];
+};
+
+/*!  \struct    SerialWriteStats
+     \brief     Counters of a SerialWriter, cumulative except queued and pending.
+*/
+struct SerialWriteStats {
+    uint64_t queued     = 0; // commands in the queue, not seen by the writer yet
+    uint64_t pending    = 0; // commands seen by the writer and waiting for room in an output queue
+    uint64_t enqueued   = 0; // commands accepted by enqueue()
+    uint64_t dropped    = 0; // commands rejected by enqueue() because the queue was full
+    uint64_t superseded = 0; // commands replaced by a newer one of the same type before being written
+    uint64_t written    = 0; // commands fully written
+    uint64_t bytes      = 0; // bytes written
+    uint64_t errors     = 0; // failed writes
+};
+
+/*!  \class     SerialWriter
+     \brief     Commands go from one producer thread (the render loop) to the thread owning the devices
+                through a lock-free queue, so the producer never blocks on a full tty output queue.
+                The owning thread keeps only the newest command of each type per device and sends
+                them with one writev call; a command cut by a full output queue is completed first
+                on the next flush, so the device never sees half a command.
+*/
+class SerialWriter {
+public:
+    explicit SerialWriter(size_t capacity = 256);
+
+    SerialWriter(const SerialWriter&) = delete;
+    SerialWriter& operator=(const SerialWriter&) = delete;
+
+    // Producer: queue a command, returns false if it is too long or the queue is full
+    bool enqueue(uint32_t device, uint8_t type, const void *data, size_t length);
+
+    // Producer: true if the consumer has to be woken up for the commands queued since its last clearWake()
+    bool requestWake();
+
+    // Consumer: called before collect(), so that commands queued afterwards request a new wake-up
+    void clearWake();
+
+    // Consumer: move the queued commands to the per-device pending lists, returns how many were moved
+    size_t collect();
+
+    // Consumer: true if device has bytes waiting to be written
+    bool hasOutput(uint32_t device) const;
+
+    // Consumer: write what device has pending, returns 1 if output remains, 0 if done, -1 on error
+    int flush(uint32_t device, serialib &serial);
+
+    // Consumer: forget the unfinished command of a device that was closed, its pending commands are kept
+    void resetDevice(uint32_t device);
+
+    // Consumer: drop every queued and pending command, the counters are kept
+    void clear();
+
+    // Safe to call from any thread
+    SerialWriteStats stats() const;
+
+private:
+    // Commands of one device, and the tail of a command cut by a full output queue
+    struct DeviceOutput {
+        std::vector<SerialCommand> pending;
+        std::vector<uint8_t>       partial;
+        size_t                     partialOffset = 0;
+    };
+
+    DeviceOutput &output(uint32_t device);
+
+    SpscQueue<SerialCommand>  queue;
+    std::vector<DeviceOutput> outputs;
+    std::atomic<bool>         wakeRequested;
+
+    std::atomic<uint64_t>     enqueuedCount;
+    std::atomic<uint64_t>     droppedCount;
+    std::atomic<uint64_t>     supersededCount;
+    std::atomic<uint64_t>     writtenCount;
+    std::atomic<uint64_t>     bytesCount;
+    std::atomic<uint64_t>     errorCount;
+    std::atomic<uint64_t>     pendingCount;
+};
+
+#endif // SERIALWRITER_H
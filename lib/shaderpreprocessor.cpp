@@ -0,0 +1,126 @@
+/*!
+ \file    shaderpreprocessor.cpp
+ \brief   Source file of the class ShaderPreprocessor.
+ */
+
+#include "shaderpreprocessor.h"
+#include <fstream>
+#include <iostream>
+#include <sstream>
+
+
+/*!
+     \brief Expand a shader file
+     \param path : file to expand, its includes are found next to it
+     \param defines : inserted after its #version line (first if it has none), in this order
+     \param source : the expanded source
+     \return false if a file cannot be read or includes itself
+  */
+bool ShaderPreprocessor::load(const std::string &path, const std::vector<ShaderDefine> &defines, std::string &source) {
+    sources.clear();
+    including.clear();
+    std::string body;
+    if (!expand(path, 0, body)) return false;
+
+    std::string header;
+    for (const ShaderDefine &define : defines)
+        header += "#define " + define.name + " " + define.value + "\n";
+    // After the #version line, which must come first, then back to the line that follows it
+    size_t version = body.find("#version");
+    size_t start = 0;
+    uint32_t line = 1;
+    if (version != std::string::npos && body.find_first_not_of(" \t\r\n", 0) == version) {
+        start = body.find('\n', version);
+        start = start == std::string::npos ? body.size() : start + 1;
+        for (size_t i = 0; i < start; ++i)
+            if (body[i] == '\n') line++;
+    }
+    source = body.substr(0, start) + header + "#line " + std::to_string(line) + " 0\n" + body.substr(start);
+    return true;
+}
+
+uint64_t ShaderPreprocessor::hash(const std::string &text) {
+    uint64_t h = 14695981039346656037ULL;
+    for (unsigned char c : text) {
+        h ^= c;
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+// Contents of a file, read on its first use
+const std::string *ShaderPreprocessor::read(const std::string &path) {
+    auto found = contents.find(path);
+    if (found != contents.end()) return &found->second;
+    std::ifstream file(path);
+    if (!file.is_open()) return nullptr;
+    std::stringstream buffer;
+    buffer << file.rdbuf();
+    return &contents.emplace(path, buffer.str()).first->second;
+}
+
+/*!
+     \brief Append a file to out with its includes expanded
+            Each #include line becomes a #line directive to the included file, its contents, then a
+            #line directive back to the line after the #include.
+  */
+bool ShaderPreprocessor::expand(const std::string &path, uint32_t depth, std::string &out) {
+    const std::string *text = read(path);
+    if (!text) {
+        std::cerr << "No se pudo abrir el archivo: " << path << std::endl;
+        return false;
+    }
+    uint32_t index = 0;
+    while (index < sources.size() && sources[index] != path) index++;
+    if (index == sources.size()) sources.push_back(path);
+    including.push_back(path);
+
+    size_t slash = path.find_last_of('/');
+    std::string directory = slash == std::string::npos ? "" : path.substr(0, slash + 1);
+    size_t begin = 0;
+    uint32_t line = 1;
+    while (begin < text->size()) {
+        size_t end = text->find('\n', begin);
+        end = end == std::string::npos ? text->size() : end + 1;
+        // #include "file", with any spaces around the #
+        size_t mark = text->find_first_not_of(" \t", begin);
+        if (mark < end && (*text)[mark] == '#') {
+            size_t directive = text->find_first_not_of(" \t", mark + 1);
+            if (directive < end && text->compare(directive, 7, "include") == 0) {
+                size_t open = text->find('"', directive + 7);
+                size_t close = open < end ? text->find('"', open + 1) : std::string::npos;
+                if (close >= end) {
+                    std::cerr << path << ":" << line << ": #include expects \"file\"" << std::endl;
+                    return false;
+                }
+                std::string name = text->substr(open + 1, close - open - 1);
+                std::string included = name[0] == '/' ? name : directory + name;
+                bool recursive = false;
+                for (const std::string &file : including) recursive |= file == included;
+                if (recursive) {
+                    std::cerr << path << ":" << line << ": " << name << " includes itself" << std::endl;
+                    return false;
+                }
+                if (depth + 1 >= SHADER_INCLUDE_DEPTH) {
+                    std::cerr << path << ":" << line << ": includes nested deeper than " << SHADER_INCLUDE_DEPTH << std::endl;
+                    return false;
+                }
+                size_t first = sources.size();
+                uint32_t includedIndex = 0;
+                while (includedIndex < first && sources[includedIndex] != included) includedIndex++;
+                out += "#line 1 " + std::to_string(includedIndex) + "\n";
+                if (!expand(included, depth + 1, out)) return false;
+                if (!out.empty() && out.back() != '\n') out += '\n';
+                out += "#line " + std::to_string(line + 1) + " " + std::to_string(index) + "\n";
+                begin = end;
+                line++;
+                continue;
+            }
+        }
+        out.append(*text, begin, end - begin);
+        begin = end;
+        line++;
+    }
+    including.pop_back();
+    return true;
+}
@@ -0,0 +1,68 @@
+/*!
+\file    shaderpreprocessor.h
+\brief   Loader of the GLSL sources: resolves #include and specialises a shared source with #defines.
+
+A line
+
+    #include "flowers.glsl"
+
+is replaced by that file, found next to the file including it; a file may be included several
+times, e.g. once per value of a macro it reads, but not from itself. The defines are inserted
+right after the #version line, so that they reach every included module, where knobs default with
+
+    #ifndef FLOWER_LAYERS
+    #define FLOWER_LAYERS 3
+    #endif
+
+Everything else, #if included, is left to the GLSL compiler, which folds and unrolls the knobs as
+the constants they are. #line directives keep the line numbers of each file, source string n of the
+compiler's messages being file n of files().
+*/
+
+
+#ifndef SHADERPREPROCESSOR_H
+#define SHADERPREPROCESSOR_H
+
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+/*! Deepest nesting of #include */
+#define SHADER_INCLUDE_DEPTH 16
+
+/*!  \struct    ShaderDefine
+     \brief     One #define inserted by ShaderPreprocessor::load()
+*/
+struct ShaderDefine {
+    std::string name;
+    std::string value;
+};
+
+/*!  \class     ShaderPreprocessor
+     \brief     Expansion of the shader files, each read once however many specialisations include it
+*/
+class ShaderPreprocessor {
+public:
+    // Expand the file at path with the defines into source, returns false on an error, reported on std::cerr
+    bool load(const std::string &path, const std::vector<ShaderDefine> &defines, std::string &source);
+
+    // Files of the last load(), in the order of their source string numbers
+    const std::vector<std::string> &files() const { return sources; }
+
+    // Read the files again on the next load()
+    void clear() { contents.clear(); }
+
+    // 64-bit FNV-1a hash of a text, the key of the compiled shaders
+    static uint64_t hash(const std::string &text);
+
+private:
+    bool expand(const std::string &path, uint32_t depth, std::string &out);
+    const std::string *read(const std::string &path);
+
+    std::unordered_map<std::string, std::string> contents;
+    std::vector<std::string> sources;
+    std::vector<std::string> including;
+};
+
+#endif // SHADERPREPROCESSOR_H
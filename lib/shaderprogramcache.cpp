@@ -0,0 +1,84 @@
+/*!
+ \file    shaderprogramcache.cpp
+ \brief   Source file of the class ShaderProgramCache.
+ */
+
+#include "shaderprogramcache.h"
+#include "shaderpreprocessor.h"
+#include <iostream>
+
+
+ShaderProgramCache::ShaderProgramCache() : compileCount(0), linkCount(0), hitCount(0) {}
+
+// Source strings of a compiler message, n: for file n
+static void printFiles(const std::vector<std::string> &files) {
+    for (size_t i = 0; i < files.size(); ++i)
+        std::cerr << "  source " << i << ": " << files[i] << std::endl;
+}
+
+GLuint ShaderProgramCache::shader(GLenum type, const std::string &source, const std::vector<std::string> &files) {
+    // The type is part of the key, a text could be compiled as either stage
+    std::string key = std::to_string(type) + "\n" + source;
+    uint64_t h = ShaderPreprocessor::hash(key);
+    auto range = shaders.equal_range(h);
+    for (auto it = range.first; it != range.second; ++it)
+        if (it->second.source == key) return it->second.object;
+
+    GLuint s = glCreateShader(type);
+    const char *text = source.c_str();
+    glShaderSource(s, 1, &text, NULL);
+    glCompileShader(s);
+    GLint ok;
+    glGetShaderiv(s, GL_COMPILE_STATUS, &ok);
+    if (!ok) {
+        char log[4096];
+        glGetShaderInfoLog(s, sizeof(log), NULL, log);
+        std::cerr << "Shader compile error: " << log << std::endl;
+        printFiles(files);
+    }
+    compileCount++;
+    shaders.emplace(h, Entry{key, s});
+    return s;
+}
+
+/*!
+     \brief Program of a vertex and a fragment source
+            Looked up by the hash of both texts, compiled and linked only if no program has them.
+  */
+GLuint ShaderProgramCache::program(const std::string &vertex, const std::string &fragment,
+                                   const std::vector<std::string> &files) {
+    std::string key = vertex + '\0' + fragment;
+    uint64_t h = ShaderPreprocessor::hash(key);
+    auto range = programs.equal_range(h);
+    for (auto it = range.first; it != range.second; ++it) {
+        if (it->second.source == key) {
+            hitCount++;
+            return it->second.object;
+        }
+    }
+
+    GLuint p = glCreateProgram();
+    glAttachShader(p, shader(GL_VERTEX_SHADER, vertex, std::vector<std::string>()));
+    glAttachShader(p, shader(GL_FRAGMENT_SHADER, fragment, files));
+    glLinkProgram(p);
+    GLint ok;
+    glGetProgramiv(p, GL_LINK_STATUS, &ok);
+    if (!ok) {
+        char log[4096];
+        glGetProgramInfoLog(p, sizeof(log), NULL, log);
+        std::cerr << "Program link error: " << log << std::endl;
+        printFiles(files);
+    }
+    linkCount++;
+    programs.emplace(h, Entry{key, p});
+    return p;
+}
+
+void ShaderProgramCache::destroy() {
+    for (auto &entry : programs)
+        glDeleteProgram(entry.second.object);
+    for (auto &entry : shaders)
+        glDeleteShader(entry.second.object);
+    programs.clear();
+    shaders.clear();
+}
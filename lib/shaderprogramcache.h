@@ -0,0 +1,58 @@
+/*!
+\file    shaderprogramcache.h
+\brief   Shaders and programs compiled once per distinct source, found again by the hash of their text.
+*/
+
+
+#ifndef SHADERPROGRAMCACHE_H
+#define SHADERPROGRAMCACHE_H
+
+#include <glad/glad.h>
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+/*!  \class     ShaderProgramCache
+     \brief     Zones specialised alike (same defines, same files) share one program, and a vertex shader
+                is compiled once for all the programs using it. The sources are kept to tell two texts
+                of the same hash apart. Only used from the thread owning the GL context.
+*/
+class ShaderProgramCache {
+public:
+    ShaderProgramCache();
+
+    ShaderProgramCache(const ShaderProgramCache&) = delete;
+    ShaderProgramCache& operator=(const ShaderProgramCache&) = delete;
+
+    // Program of the two sources, linked on their first use. files name the source strings in the
+    // messages of the compiler (ShaderPreprocessor::files()). A program that fails is still returned,
+    // as glLinkProgram leaves it, the errors reported on std::cerr
+    GLuint program(const std::string &vertex, const std::string &fragment,
+                   const std::vector<std::string> &files = std::vector<std::string>());
+
+    // Delete every shader and program, the context must still be current
+    void destroy();
+
+    // Shaders compiled and programs linked so far, and requests served from the cache
+    uint32_t compiled() const { return compileCount; }
+    uint32_t linked() const { return linkCount; }
+    uint32_t hits() const { return hitCount; }
+
+private:
+    struct Entry {
+        std::string source;
+        GLuint      object;
+    };
+
+    GLuint shader(GLenum type, const std::string &source, const std::vector<std::string> &files);
+
+    // By the hash of the source, of both sources for the programs
+    std::unordered_multimap<uint64_t, Entry> shaders;
+    std::unordered_multimap<uint64_t, Entry> programs;
+    uint32_t compileCount;
+    uint32_t linkCount;
+    uint32_t hitCount;
+};
+
+#endif // SHADERPROGRAMCACHE_H
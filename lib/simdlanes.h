@@ -0,0 +1,85 @@
+/*!
+\file    simdlanes.h
+\brief   Minimal float vector operations for the per-channel and per-bin loops.
+
+A kernel written once as a template over Lanes runs four floats per instruction with VectorLanes
+(SSE2 on x86-64, NEON on AArch64, both always present there) and one at a time with ScalarLanes,
+for the elements left over and on other targets. SIMD_LANES_VECTOR is defined when VectorLanes exists.
+*/
+
+
+#ifndef SIMDLANES_H
+#define SIMDLANES_H
+
+#include <cmath>
+#include <cstdint>
+
+#if defined (__SSE2__) || defined (_M_X64)
+    #include <emmintrin.h>
+#elif defined (__aarch64__)
+    #include <arm_neon.h>
+#endif
+
+// One element at a time
+struct ScalarLanes {
+    typedef float V;
+    typedef bool  M;
+    static const uint32_t width = 1;
+    static V load(const float *p) { return *p; }
+    static void store(float *p, V v) { *p = v; }
+    static V set(float x) { return x; }
+    static V add(V a, V b) { return a + b; }
+    static V sub(V a, V b) { return a - b; }
+    static V mul(V a, V b) { return a * b; }
+    static V div(V a, V b) { return a / b; }
+    static V min(V a, V b) { return a < b ? a : b; }
+    static V max(V a, V b) { return a > b ? a : b; }
+    static V abs(V a) { return std::fabs(a); }
+    static V sqrt(V a) { return std::sqrt(a); }
+    static M gt(V a, V b) { return a > b; }
+    static V select(M m, V a, V b) { return m ? a : b; }
+};
+
+#if defined (__SSE2__) || defined (_M_X64)
+struct VectorLanes {
+    typedef __m128 V;
+    typedef __m128 M;
+    static const uint32_t width = 4;
+    static V load(const float *p) { return _mm_loadu_ps(p); }
+    static void store(float *p, V v) { _mm_storeu_ps(p, v); }
+    static V set(float x) { return _mm_set1_ps(x); }
+    static V add(V a, V b) { return _mm_add_ps(a, b); }
+    static V sub(V a, V b) { return _mm_sub_ps(a, b); }
+    static V mul(V a, V b) { return _mm_mul_ps(a, b); }
+    static V div(V a, V b) { return _mm_div_ps(a, b); }
+    static V min(V a, V b) { return _mm_min_ps(a, b); }
+    static V max(V a, V b) { return _mm_max_ps(a, b); }
+    static V abs(V a) { return _mm_andnot_ps(_mm_set1_ps(-0.0f), a); }
+    static V sqrt(V a) { return _mm_sqrt_ps(a); }
+    static M gt(V a, V b) { return _mm_cmpgt_ps(a, b); }
+    static V select(M m, V a, V b) { return _mm_or_ps(_mm_and_ps(m, a), _mm_andnot_ps(m, b)); }
+};
+#define SIMD_LANES_VECTOR
+#elif defined (__aarch64__)
+struct VectorLanes {
+    typedef float32x4_t V;
+    typedef uint32x4_t  M;
+    static const uint32_t width = 4;
+    static V load(const float *p) { return vld1q_f32(p); }
+    static void store(float *p, V v) { vst1q_f32(p, v); }
+    static V set(float x) { return vdupq_n_f32(x); }
+    static V add(V a, V b) { return vaddq_f32(a, b); }
+    static V sub(V a, V b) { return vsubq_f32(a, b); }
+    static V mul(V a, V b) { return vmulq_f32(a, b); }
+    static V div(V a, V b) { return vdivq_f32(a, b); }
+    static V min(V a, V b) { return vminq_f32(a, b); }
+    static V max(V a, V b) { return vmaxq_f32(a, b); }
+    static V abs(V a) { return vabsq_f32(a); }
+    static V sqrt(V a) { return vsqrtq_f32(a); }
+    static M gt(V a, V b) { return vcgtq_f32(a, b); }
+    static V select(M m, V a, V b) { return vbslq_f32(m, a, b); }
+};
+#define SIMD_LANES_VECTOR
+#endif
+
+#endif // SIMDLANES_H
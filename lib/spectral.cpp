@@ -0,0 +1,244 @@
+/*!
+ \file    spectral.cpp
+ \brief   Source file of the classes FftPlan and SpectralAnalyzer.
+ */
+
+#include "spectral.h"
+#include "simdlanes.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+static const double PI = 3.14159265358979323846;
+
+// Windows of history needed before onsets are detected
+static const uint32_t ONSET_MIN_HISTORY = 4;
+
+
+FftPlan::FftPlan(uint32_t size) : n(size), bitReverse(size), twiddleRe(size - 1), twiddleIm(size - 1) {
+    uint32_t bits = 0;
+    while ((1u << bits) < n) bits++;
+    for (uint32_t i = 0; i < n; ++i) {
+        uint32_t r = 0;
+        for (uint32_t b = 0; b < bits; ++b)
+            if (i & (1u << b)) r |= 1u << (bits - 1 - b);
+        bitReverse[i] = r;
+    }
+    for (uint32_t h = 1; h < n; h <<= 1) {
+        for (uint32_t j = 0; j < h; ++j) {
+            twiddleRe[h - 1 + j] = (float)std::cos(-PI * j / h);
+            twiddleIm[h - 1 + j] = (float)std::sin(-PI * j / h);
+        }
+    }
+}
+
+/*!
+     \brief Butterflies j .. h-1 of one group of a stage, Lanes::width at a time while they fit
+     \return the first butterfly left
+  */
+template <typename L>
+static uint32_t butterflies(float *re, float *im, const float *wr, const float *wi, uint32_t h, uint32_t j) {
+    typedef typename L::V V;
+    for (; j + L::width <= h; j += L::width) {
+        V ar = L::load(re + j), ai = L::load(im + j);
+        V br = L::load(re + j + h), bi = L::load(im + j + h);
+        V cr = L::load(wr + j), ci = L::load(wi + j);
+        V tr = L::sub(L::mul(br, cr), L::mul(bi, ci));
+        V ti = L::add(L::mul(br, ci), L::mul(bi, cr));
+        L::store(re + j, L::add(ar, tr));
+        L::store(im + j, L::add(ai, ti));
+        L::store(re + j + h, L::sub(ar, tr));
+        L::store(im + j + h, L::sub(ai, ti));
+    }
+    return j;
+}
+
+void FftPlan::forward(float *re, float *im) const {
+    for (uint32_t i = 0; i < n; ++i) {
+        uint32_t r = bitReverse[i];
+        if (r > i) {
+            float t = re[i]; re[i] = re[r]; re[r] = t;
+            t = im[i]; im[i] = im[r]; im[r] = t;
+        }
+    }
+    for (uint32_t h = 1; h < n; h <<= 1) {
+        const float *wr = &twiddleRe[h - 1];
+        const float *wi = &twiddleIm[h - 1];
+        for (uint32_t g = 0; g < n; g += 2 * h) {
+            uint32_t j = 0;
+#if defined (SIMD_LANES_VECTOR)
+            j = butterflies<VectorLanes>(re + g, im + g, wr, wi, h, j);
+#endif
+            butterflies<ScalarLanes>(re + g, im + g, wr, wi, h, j);
+        }
+    }
+}
+
+
+SpectralAnalyzer::SpectralAnalyzer(const SpectralSettings &settings)
+    : config(settings), plan(settings.fftSize), bins(settings.fftSize / 2 + 1) {
+    if (config.channels > SPECTRAL_MAX_CHANNELS) config.channels = SPECTRAL_MAX_CHANNELS;
+    if (config.bandCount > SPECTRAL_MAX_BANDS) config.bandCount = SPECTRAL_MAX_BANDS;
+    if (config.bandCount > bins - 1) config.bandCount = bins - 1;
+    if (config.hop == 0 || config.hop > config.fftSize) config.hop = config.fftSize;
+    if (config.onsetHistory == 0) config.onsetHistory = 1;
+    const uint32_t size = config.fftSize;
+
+    // Periodic Hann window
+    window.resize(size);
+    double sum = 0.0, squares = 0.0;
+    for (uint32_t i = 0; i < size; ++i) {
+        window[i] = (float)(0.5 - 0.5 * std::cos(2.0 * PI * i / size));
+        sum += window[i];
+        squares += (double)window[i] * window[i];
+    }
+    // A sine of amplitude 1 peaks at sum/2 in its bin
+    scale = (float)(4.0 / (sum * sum));
+    noiseBandwidth = (float)(size * squares / (sum * sum));
+
+    // Logarithmic band edges, at least one bin per band, DC left out
+    bandStart.resize(config.bandCount + 1);
+    double top = config.sampleRate / 2.0;
+    double bottom = config.minFrequency > 0.0f ? config.minFrequency : config.sampleRate / size;
+    for (uint32_t b = 0; b <= config.bandCount; ++b) {
+        double f = bottom * std::pow(top / bottom, (double)b / config.bandCount);
+        uint32_t k = (uint32_t)std::lround(f * size / config.sampleRate);
+        if (k < 1) k = 1;
+        if (b > 0 && k <= bandStart[b - 1]) k = bandStart[b - 1] + 1;
+        if (k > bins - (config.bandCount - b)) k = bins - (config.bandCount - b);
+        bandStart[b] = k;
+    }
+    bandStart[config.bandCount] = bins;
+
+    samples.resize((size_t)config.channels * size);
+    re.resize(size);
+    im.resize(size);
+    power.resize(2 * bins);
+    previous.resize((size_t)config.channels * bins);
+    fluxHistory.resize((size_t)config.channels * config.onsetHistory);
+    fluxSorted.resize(config.onsetHistory);
+    reset();
+}
+
+void SpectralAnalyzer::reset() {
+    filled = 0;
+    fluxCount = 0;
+    fluxNext = 0;
+    windows = 0;
+    std::fill(previous.begin(), previous.end(), 0.0f);
+    for (uint32_t c = 0; c < SPECTRAL_MAX_CHANNELS; ++c) {
+        sinceOnset[c] = UINT32_MAX / 2;
+        aboveThreshold[c] = false;
+    }
+}
+
+/*!
+     \brief Add samples, analysing a window every hop samples once fftSize of them are there
+     \param interleaved : frames * channels samples, frame by frame
+     \param timestamp_ns : time of the last frame
+     \return true if result holds a new window
+  */
+bool SpectralAnalyzer::process(const float *interleaved, uint32_t frames, int64_t timestamp_ns, SpectralFrame &result) {
+    const uint32_t size = config.fftSize;
+    const uint32_t channels = config.channels;
+    const double period_ns = 1e9 / config.sampleRate;
+    bool produced = false;
+    for (uint32_t f = 0; f < frames; ++f) {
+        const float *frame = interleaved + (size_t)f * channels;
+        for (uint32_t c = 0; c < channels; ++c)
+            samples[(size_t)c * size + filled] = frame[c];
+        if (++filled < size) continue;
+
+        analyze(timestamp_ns - (int64_t)((frames - 1 - f) * period_ns), result);
+        produced = true;
+        uint32_t keep = size - config.hop;
+        for (uint32_t c = 0; c < channels; ++c)
+            memmove(&samples[(size_t)c * size], &samples[(size_t)c * size + config.hop], keep * sizeof(float));
+        filled = keep;
+    }
+    return produced;
+}
+
+// Transform the current window of every channel, two channels per FFT
+void SpectralAnalyzer::analyze(int64_t timestamp_ns, SpectralFrame &result) {
+    const uint32_t size = config.fftSize;
+    const uint32_t channels = config.channels;
+    const uint32_t mask = size - 1;
+    result.timestamp_ns = timestamp_ns;
+    result.sequence = ++windows;
+    result.channelCount = channels;
+    result.bandCount = config.bandCount;
+
+    for (uint32_t c = 0; c < channels; c += 2) {
+        const float *a = &samples[(size_t)c * size];
+        const float *b = c + 1 < channels ? &samples[(size_t)(c + 1) * size] : nullptr;
+        float meanA = 0.0f, meanB = 0.0f;
+        for (uint32_t i = 0; i < size; ++i) meanA += a[i];
+        meanA /= size;
+        if (b) {
+            for (uint32_t i = 0; i < size; ++i) meanB += b[i];
+            meanB /= size;
+        }
+        for (uint32_t i = 0; i < size; ++i) {
+            re[i] = (a[i] - meanA) * window[i];
+            im[i] = b ? (b[i] - meanB) * window[i] : 0.0f;
+        }
+        plan.forward(re.data(), im.data());
+
+        // Z = A + iB for real a and b: A[k] = (Z[k] + conj Z[N-k]) / 2, B[k] = (Z[k] - conj Z[N-k]) / 2i
+        float *powerA = &power[0];
+        float *powerB = &power[bins];
+        for (uint32_t k = 0; k < bins; ++k) {
+            uint32_t r = (size - k) & mask;
+            float aRe = 0.5f * (re[k] + re[r]), aIm = 0.5f * (im[k] - im[r]);
+            float bRe = 0.5f * (im[k] + im[r]), bIm = 0.5f * (re[r] - re[k]);
+            powerA[k] = (aRe * aRe + aIm * aIm) * scale;
+            powerB[k] = (bRe * bRe + bIm * bIm) * scale;
+        }
+
+        for (uint32_t p = 0; p < 2 && c + p < channels; ++p) {
+            uint32_t ch = c + p;
+            const float *pw = p ? powerB : powerA;
+            for (uint32_t band = 0; band < config.bandCount; ++band) {
+                float energy = 0.0f;
+                for (uint32_t k = bandStart[band]; k < bandStart[band + 1]; ++k) energy += pw[k];
+                result.band[ch][band] = 10.0f * std::log10(energy / noiseBandwidth + 1e-12f);
+            }
+
+            // Half-wave rectified increase of the magnitudes
+            float *prev = &previous[(size_t)ch * bins];
+            float flux = 0.0f;
+            for (uint32_t k = 1; k < bins; ++k) {
+                float m = std::sqrt(pw[k]);
+                float rise = m - prev[k];
+                flux += rise > 0.0f ? rise : 0.0f;
+                prev[k] = m;
+            }
+            result.flux[ch] = flux;
+
+            // Onset: the flux stands out of its recent distribution (median and median absolute
+            // deviation, which the previous onsets barely move), and the previous onset is old enough
+            float *sorted = &fluxSorted[0];
+            memcpy(sorted, &fluxHistory[(size_t)ch * config.onsetHistory], fluxCount * sizeof(float));
+            std::nth_element(sorted, sorted + fluxCount / 2, sorted + fluxCount);
+            float median = fluxCount ? sorted[fluxCount / 2] : 0.0f;
+            for (uint32_t i = 0; i < fluxCount; ++i) sorted[i] = std::fabs(sorted[i] - median);
+            std::nth_element(sorted, sorted + fluxCount / 2, sorted + fluxCount);
+            float deviation = fluxCount ? 1.4826f * sorted[fluxCount / 2] : 0.0f;
+            float threshold = median + config.onsetSensitivity * deviation;
+            // Only the window where the flux crosses the threshold: a slow gesture stays above it for several windows
+            bool above = fluxCount >= ONSET_MIN_HISTORY && flux > config.onsetMinFlux && flux > threshold;
+            sinceOnset[ch]++;
+            if (above && !aboveThreshold[ch] && sinceOnset[ch] * config.hop >= config.onsetRefractory * config.sampleRate)
+                sinceOnset[ch] = 0;
+            aboveThreshold[ch] = above;
+            result.sinceOnset[ch] = sinceOnset[ch];
+        }
+    }
+
+    // Every channel's flux joins its history at the same slot
+    for (uint32_t ch = 0; ch < channels; ++ch)
+        fluxHistory[(size_t)ch * config.onsetHistory + fluxNext] = result.flux[ch];
+    fluxNext = (fluxNext + 1) % config.onsetHistory;
+    if (fluxCount < config.onsetHistory) fluxCount++;
+}
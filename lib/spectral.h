@@ -0,0 +1,138 @@
+/*!
+\file    spectral.h
+\brief   Streaming spectral analysis of sampled channels: band energies, spectral flux and onsets.
+
+The same analyser serves the potentiometers (about 1 kHz, where a rhythmic gesture shows up as a few
+hertz of modulation) and audio-rate inputs (48 kHz). Each channel is cut into overlapping windows of
+fftSize samples, one every hop samples; every window gives, per channel:
+    band energies  power of bandCount bands spaced logarithmically between minFrequency and half
+                   the sample rate, in dB relative to a full-scale sine (a sine of amplitude 1 in
+                   a band reads 0 dB); the mean of the window is removed first
+    spectral flux  sum of the increases of the magnitude of every bin since the previous window
+    onset          the flux rose above its recent median by onsetSensitivity deviations
+*/
+
+
+#ifndef SPECTRAL_H
+#define SPECTRAL_H
+
+#include <cstdint>
+#include <vector>
+
+/*! Most channels analysed together */
+#define SPECTRAL_MAX_CHANNELS 16
+
+/*! Most bands per channel */
+#define SPECTRAL_MAX_BANDS 16
+
+/*!  \class     FftPlan
+     \brief     Complex radix-2 FFT of a fixed power-of-two size, with its tables computed once.
+                The data is split in real and imaginary arrays so that each butterfly stage runs
+                four butterflies per instruction (simdlanes.h).
+*/
+class FftPlan {
+public:
+    // size must be a power of two, at least 4
+    explicit FftPlan(uint32_t size);
+
+    uint32_t size() const { return n; }
+
+    // Forward transform in place
+    void forward(float *re, float *im) const;
+
+private:
+    uint32_t n;
+    std::vector<uint32_t> bitReverse;
+    // Twiddles of every stage one after the other: stage of half-size h at offset h - 1
+    std::vector<float> twiddleRe;
+    std::vector<float> twiddleIm;
+};
+
+/*!  \struct    SpectralSettings
+     \brief     Parameters of a SpectralAnalyzer
+*/
+struct SpectralSettings {
+    float    sampleRate = 1000.0f;
+    uint32_t channels = 6;
+    // Window length, a power of two, and samples between the starts of two windows
+    uint32_t fftSize = 256;
+    uint32_t hop = 64;
+    uint32_t bandCount = 8;
+    // Lower edge of the first band (Hz)
+    float    minFrequency = 1.0f;
+    // Onset when the flux exceeds its median over the last onsetHistory windows by this many
+    // deviations (median absolute deviation scaled to a standard deviation)
+    float    onsetSensitivity = 4.0f;
+    uint32_t onsetHistory = 32;
+    // Flux under this value never makes an onset (silence, ADC noise: about 0.03 for 2 LSB of noise
+    // on a 10-bit potentiometer with the default window)
+    float    onsetMinFlux = 0.05f;
+    // Shortest time between two onsets of a channel (s)
+    float    onsetRefractory = 0.1f;
+};
+
+/*!  \struct    SpectralFrame
+     \brief     Result of the newest window of every channel
+*/
+struct SpectralFrame {
+    // Time of the last sample of the window (timeOut::now_ns clock), 0 before the first window
+    int64_t  timestamp_ns = 0;
+    // Windows analysed so far
+    uint64_t sequence = 0;
+    uint32_t channelCount = 0;
+    uint32_t bandCount = 0;
+    float    band[SPECTRAL_MAX_CHANNELS][SPECTRAL_MAX_BANDS] = {};
+    float    flux[SPECTRAL_MAX_CHANNELS] = {};
+    // Windows since the last onset of each channel, 0 when this window is an onset
+    uint32_t sinceOnset[SPECTRAL_MAX_CHANNELS] = {};
+};
+
+/*!  \class     SpectralAnalyzer
+     \brief     Overlapping windows of every channel through a Hann window and the FFT. Channels are
+                transformed two at a time, as the real and imaginary parts of one complex FFT.
+                Everything is allocated on construction.
+*/
+class SpectralAnalyzer {
+public:
+    explicit SpectralAnalyzer(const SpectralSettings &settings);
+
+    const SpectralSettings &settings() const { return config; }
+
+    // Feed frames interleaved samples of every channel, the last one taken at timestamp_ns;
+    // returns true if at least one window was completed, the newest one is in result
+    bool process(const float *interleaved, uint32_t frames, int64_t timestamp_ns, SpectralFrame &result);
+
+    // Forget the samples and the onset history
+    void reset();
+
+private:
+    void analyze(int64_t timestamp_ns, SpectralFrame &result);
+
+    SpectralSettings config;
+    FftPlan          plan;
+    uint32_t         bins;
+    std::vector<float>    window;
+    // Power of a bin relative to a full-scale sine, and equivalent noise bandwidth of the window in bins
+    float                 scale;
+    float                 noiseBandwidth;
+    // Bins of each band: bandStart[b] .. bandStart[b+1]-1
+    std::vector<uint32_t> bandStart;
+    // Last samples of each channel, fftSize per channel, the first filled of them are valid
+    std::vector<float>    samples;
+    uint32_t              filled;
+    // FFT buffers and magnitudes of the previous window of each channel
+    std::vector<float>    re;
+    std::vector<float>    im;
+    std::vector<float>    power;
+    std::vector<float>    previous;
+    // Recent fluxes of each channel, for the onset threshold, and room to sort them
+    std::vector<float>    fluxHistory;
+    std::vector<float>    fluxSorted;
+    uint32_t              fluxCount;
+    uint32_t              fluxNext;
+    uint32_t              sinceOnset[SPECTRAL_MAX_CHANNELS];
+    bool                  aboveThreshold[SPECTRAL_MAX_CHANNELS];
+    uint64_t              windows;
+};
+
+#endif // SPECTRAL_H
@@ -0,0 +1,229 @@
+/*!
+ \file    spectralstage.cpp
+ \brief   Source file of the class SpectralStage.
+ */
+
+#include "spectralstage.h"
+#include "serialib.h"
+#include <chrono>
+#include <cstring>
+
+#if defined (__linux__) || defined(__APPLE__)
+    #include <poll.h>
+    #include <unistd.h>
+#endif
+
+// Sensor samples queued between the render loop and the worker, about 1 s at 1 kHz
+static const size_t INPUT_CAPACITY = 1024;
+
+// Pause of the worker when no sensor sample is waiting
+static const int IDLE_SLEEP_MS = 1;
+
+// Upper bound on how long stop() waits for a worker blocked on a pipe
+static const int WAIT_TIMEOUT_MS = 100;
+
+
+SpectralStage::SpectralStage()
+    : running(false), input(INPUT_CAPACITY), audio(nullptr), wav(false), floatSamples(false),
+      streamChannels(0), dataStart(0), dataBytes(0) {}
+
+SpectralStage::~SpectralStage() {
+    stop();
+}
+
+bool SpectralStage::isRunning() const {
+    return running.load(std::memory_order_acquire);
+}
+
+bool SpectralStage::startSensors(const SpectralSettings &settings) {
+    stop();
+    config = settings;
+    analyzer.reset(new SpectralAnalyzer(config));
+    config = analyzer->settings();
+    SpectralSample sample;
+    while (input.pop(sample)) {}
+    running.store(true, std::memory_order_release);
+    worker = std::thread(&SpectralStage::runSensors, this);
+    return true;
+}
+
+bool SpectralStage::startAudio(const char *path, const SpectralSettings &settings) {
+    stop();
+    config = settings;
+    wav = false;
+    floatSamples = false;
+    if (strcmp(path, "-") == 0) {
+        audio = stdin;
+    } else {
+        audio = fopen(path, "rb");
+        if (!audio) return false;
+        char magic[4];
+        wav = fread(magic, 1, 4, audio) == 4 && memcmp(magic, "RIFF", 4) == 0;
+        if (wav && !openWav()) {
+            fclose(audio);
+            audio = nullptr;
+            return false;
+        }
+        if (!wav) rewind(audio);
+    }
+    streamChannels = config.channels;
+    if (config.channels > SPECTRAL_MAX_CHANNELS) config.channels = SPECTRAL_MAX_CHANNELS;
+    analyzer.reset(new SpectralAnalyzer(config));
+    config = analyzer->settings();
+    running.store(true, std::memory_order_release);
+    worker = std::thread(&SpectralStage::runAudio, this);
+    return true;
+}
+
+/*!
+     \brief Read the chunks of a WAV file up to its samples, after the "RIFF" tag
+     \return false if the format is not 16-bit PCM or 32-bit float
+  */
+bool SpectralStage::openWav() {
+    uint8_t header[8];
+    if (fread(header, 1, 8, audio) != 8 || memcmp(header + 4, "WAVE", 4) != 0) return false;
+    bool haveFormat = false;
+    while (fread(header, 1, 8, audio) == 8) {
+        uint32_t size = header[4] | (header[5] << 8) | (header[6] << 16) | ((uint32_t)header[7] << 24);
+        if (memcmp(header, "fmt ", 4) == 0) {
+            uint8_t fmt[40] = {};
+            size_t take = size < sizeof(fmt) ? size : sizeof(fmt);
+            if (size < 16 || fread(fmt, 1, take, audio) != take) return false;
+            if (size > take) fseek(audio, (long)(size - take), SEEK_CUR);
+            uint16_t tag = fmt[0] | (fmt[1] << 8);
+            // WAVE_FORMAT_EXTENSIBLE: the format is the start of the sub-format GUID
+            if (tag == 0xFFFE && size >= 26) tag = fmt[24] | (fmt[25] << 8);
+            uint16_t bits = fmt[14] | (fmt[15] << 8);
+            config.channels = fmt[2] | (fmt[3] << 8);
+            config.sampleRate = (float)(fmt[4] | (fmt[5] << 8) | (fmt[6] << 16) | ((uint32_t)fmt[7] << 24));
+            if (tag == 1 && bits == 16) floatSamples = false;
+            else if (tag == 3 && bits == 32) floatSamples = true;
+            else return false;
+            haveFormat = config.channels > 0 && config.sampleRate > 0.0f;
+        } else if (memcmp(header, "data", 4) == 0) {
+            if (!haveFormat) return false;
+            dataStart = ftell(audio);
+            dataBytes = (long)size;
+            return true;
+        } else {
+            fseek(audio, (long)(size + (size & 1)), SEEK_CUR);
+        }
+    }
+    return false;
+}
+
+void SpectralStage::stop() {
+    running.store(false, std::memory_order_release);
+    if (worker.joinable()) worker.join();
+    if (audio && audio != stdin) fclose(audio);
+    audio = nullptr;
+}
+
+bool SpectralStage::push(const SensorFrame &frame) {
+    SpectralSample sample;
+    sample.timestamp_ns = frame.timestamp_ns;
+    uint32_t count = frame.channelCount < config.channels ? frame.channelCount : config.channels;
+    memcpy(sample.value, frame.value, count * sizeof(float));
+    return input.push(sample);
+}
+
+bool SpectralStage::latest(SpectralFrame &frame) {
+    if (!results.update()) return false;
+    frame = results.readBuffer();
+    return true;
+}
+
+// Analyse the queued sensor samples as they come
+void SpectralStage::runSensors() {
+    std::vector<float> block((size_t)INPUT_CAPACITY * config.channels);
+    SpectralSample sample;
+    while (running.load(std::memory_order_acquire)) {
+        uint32_t frames = 0;
+        int64_t last = 0;
+        while (frames < INPUT_CAPACITY && input.pop(sample)) {
+            memcpy(&block[(size_t)frames * config.channels], sample.value, config.channels * sizeof(float));
+            last = sample.timestamp_ns;
+            frames++;
+        }
+        if (frames == 0) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(IDLE_SLEEP_MS));
+            continue;
+        }
+        if (analyzer->process(block.data(), frames, last, results.writeBuffer()))
+            results.publish();
+    }
+}
+
+/*!
+     \brief Read up to bytes of the stream, waiting at most WAIT_TIMEOUT_MS for a pipe
+     \return bytes read, 0 on a timeout, with running cleared at the end of a pipe
+  */
+size_t SpectralStage::readAudio(uint8_t *data, size_t bytes) {
+    if (wav) return fread(data, 1, bytes, audio);
+#if defined (__linux__) || defined(__APPLE__)
+    struct pollfd pfd = {fileno(audio), POLLIN, 0};
+    if (poll(&pfd, 1, WAIT_TIMEOUT_MS) <= 0) return 0;
+    ssize_t got = read(fileno(audio), data, bytes);
+    if (got <= 0) {
+        running.store(false, std::memory_order_release);
+        return 0;
+    }
+    return (size_t)got;
+#else
+    size_t got = fread(data, 1, bytes, audio);
+    if (got == 0) running.store(false, std::memory_order_release);
+    return got;
+#endif
+}
+
+// Read the stream a hop at a time, a WAV file at the pace of its sample rate
+void SpectralStage::runAudio() {
+    const size_t sampleBytes = floatSamples ? 4 : 2;
+    const size_t frameBytes = sampleBytes * streamChannels;
+    const uint32_t blockFrames = config.hop;
+    std::vector<uint8_t> raw(blockFrames * frameBytes);
+    std::vector<float> block((size_t)blockFrames * config.channels);
+    size_t pending = 0;
+    long played = 0;
+    uint64_t frames = 0;
+    const int64_t start = timeOut::now_ns();
+
+    while (running.load(std::memory_order_acquire)) {
+        size_t room = raw.size() - pending;
+        if (wav) {
+            // Loop the file, and wait for the time of the next block
+            if (played >= dataBytes) {
+                fseek(audio, dataStart, SEEK_SET);
+                played = 0;
+            }
+            if ((long)room > dataBytes - played) room = (size_t)(dataBytes - played);
+            int64_t due = start + (int64_t)((double)(frames + blockFrames) * 1e9 / config.sampleRate);
+            int64_t wait = due - timeOut::now_ns();
+            if (wait > 0) std::this_thread::sleep_for(std::chrono::nanoseconds(wait));
+        }
+        size_t got = readAudio(raw.data() + pending, room);
+        // A file shorter than its header says loops as well
+        if (wav && got == 0) played = dataBytes;
+        played += (long)got;
+        pending += got;
+        uint32_t count = (uint32_t)(pending / frameBytes);
+        if (count == 0) continue;
+
+        for (uint32_t f = 0; f < count; ++f) {
+            const uint8_t *p = raw.data() + f * frameBytes;
+            for (uint32_t c = 0; c < config.channels; ++c) {
+                const uint8_t *s = p + c * sampleBytes;
+                float v;
+                if (floatSamples) memcpy(&v, s, 4);
+                else v = (int16_t)(s[0] | (s[1] << 8)) / 32768.0f;
+                block[(size_t)f * config.channels + c] = v;
+            }
+        }
+        frames += count;
+        int64_t last = start + (int64_t)((double)frames * 1e9 / config.sampleRate);
+        if (analyzer->process(block.data(), count, last, results.writeBuffer()))
+            results.publish();
+        pending -= (size_t)count * frameBytes;
+        memmove(raw.data(), raw.data() + (size_t)count * frameBytes, pending);
+    }
+}
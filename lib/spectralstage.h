@@ -0,0 +1,86 @@
+/*!
+\file    spectralstage.h
+\brief   Worker thread running the spectral analysis of the sensor channels or of an audio stream.
+*/
+
+
+#ifndef SPECTRALSTAGE_H
+#define SPECTRALSTAGE_H
+
+#include "sensorframe.h"
+#include "spectral.h"
+#include "spscqueue.h"
+#include "triplebuffer.h"
+#include <atomic>
+#include <cstdio>
+#include <memory>
+#include <thread>
+#include <vector>
+
+/*!  \struct    SpectralSample
+     \brief     First channels of one sensor frame, as queued to the worker
+*/
+struct SpectralSample {
+    int64_t timestamp_ns = 0;
+    float   value[SPECTRAL_MAX_CHANNELS] = {};
+};
+
+/*!  \class     SpectralStage
+     \brief     Runs a SpectralAnalyzer on its own thread and publishes its newest result through a
+                triple buffer, so the render loop reads band energies, flux and onsets next to the
+                sensor frame without ever waiting for the FFTs.
+                The input is either the sensor frames the render loop hands over with push(), or an
+                audio stream read by the worker itself.
+*/
+class SpectralStage {
+public:
+    SpectralStage();
+    ~SpectralStage();
+
+    SpectralStage(const SpectralStage&) = delete;
+    SpectralStage& operator=(const SpectralStage&) = delete;
+
+    // Analyse channels 0 .. settings.channels-1 of the frames given to push()
+    bool startSensors(const SpectralSettings &settings);
+
+    // Analyse an audio stream: a WAV file (16-bit PCM or 32-bit float), played in real time and looped,
+    // or raw 16-bit little-endian interleaved samples at settings.sampleRate and settings.channels
+    // from a pipe or "-" for stdin; returns false if the stream cannot be opened or read
+    bool startAudio(const char *path, const SpectralSettings &settings);
+
+    // Stop the thread
+    void stop();
+
+    bool isRunning() const;
+
+    // Hand a sensor frame to the analysis (one producer thread only), never blocks, returns false if dropped
+    bool push(const SensorFrame &frame);
+
+    // Copy the newest result into frame, returns false if nothing new was published since the last call
+    bool latest(SpectralFrame &frame);
+
+    // Settings in use, the ones of the WAV header for a WAV file
+    const SpectralSettings &settings() const { return config; }
+
+private:
+    bool openWav();
+    void runSensors();
+    void runAudio();
+    size_t readAudio(uint8_t *data, size_t bytes);
+
+    SpectralSettings         config;
+    std::unique_ptr<SpectralAnalyzer> analyzer;
+    std::thread              worker;
+    std::atomic<bool>        running;
+    SpscQueue<SpectralSample> input;
+    TripleBuffer<SpectralFrame> results;
+    // Audio stream: file, layout of its samples and start of the samples in a WAV file
+    FILE                    *audio;
+    bool                     wav;
+    bool                     floatSamples;
+    uint32_t                 streamChannels;
+    long                     dataStart;
+    long                     dataBytes;
+};
+
+#endif // SPECTRALSTAGE_H
@@ -0,0 +1,64 @@
+/*!
+\file    spscqueue.h
+\brief   Bounded lock-free queue between exactly one producer thread and one consumer thread.
+*/
+
+
+#ifndef SPSCQUEUE_H
+#define SPSCQUEUE_H
+
+#include <atomic>
+#include <cstddef>
+#include <vector>
+
+/*!  \class     SpscQueue
+     \brief     Fixed-capacity ring of values. push() fails instead of blocking when the ring is full,
+                pop() fails instead of blocking when it is empty.
+*/
+template <typename T>
+class SpscQueue {
+public:
+    // capacity is rounded up to a power of two
+    explicit SpscQueue(size_t capacity = 1024) : head(0), tail(0) {
+        size_t size = 1;
+        while (size < capacity) size <<= 1;
+        slots.resize(size);
+        mask = size - 1;
+    }
+
+    SpscQueue(const SpscQueue&) = delete;
+    SpscQueue& operator=(const SpscQueue&) = delete;
+
+    // Producer: append a copy of value, returns false if the queue is full
+    bool push(const T &value) {
+        size_t t = tail.load(std::memory_order_relaxed);
+        if (t - head.load(std::memory_order_acquire) > mask) return false;
+        slots[t & mask] = value;
+        tail.store(t + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Consumer: take the oldest value, returns false if the queue is empty
+    bool pop(T &value) {
+        size_t h = head.load(std::memory_order_relaxed);
+        if (h == tail.load(std::memory_order_acquire)) return false;
+        value = slots[h & mask];
+        head.store(h + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Approximate number of queued values, exact when called by either end while the other is idle
+    size_t size() const {
+        return tail.load(std::memory_order_acquire) - head.load(std::memory_order_acquire);
+    }
+
+    size_t capacity() const { return mask + 1; }
+
+private:
+    std::vector<T>                  slots;
+    size_t                          mask;
+    alignas(64) std::atomic<size_t> head;
+    alignas(64) std::atomic<size_t> tail;
+};
+
+#endif // SPSCQUEUE_H
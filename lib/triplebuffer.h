@@ -0,0 +1,63 @@
+/*!
+\file    triplebuffer.h
+\brief   Lock-free triple buffer used to hand the latest value from one producer thread to one consumer thread.
+
+The producer always owns a back slot it can fill at leisure, the consumer always owns a front slot
+it can read at leisure, and the third slot sits in the middle holding the most recent publication.
+Publishing and fetching are a single atomic exchange each, so neither side ever waits for the other:
+a stalled producer leaves the consumer reading the last complete value, and a slow consumer simply
+skips intermediate values.
+*/
+
+
+#ifndef TRIPLEBUFFER_H
+#define TRIPLEBUFFER_H
+
+#include <atomic>
+#include <cstdint>
+
+/*!  \class     TripleBuffer
+     \brief     Single-producer / single-consumer latest-value handoff.
+*/
+template <typename T>
+class TripleBuffer {
+public:
+    TripleBuffer() : middle(1), back(0), front(2) {}
+
+    TripleBuffer(const TripleBuffer&) = delete;
+    TripleBuffer& operator=(const TripleBuffer&) = delete;
+
+    // Producer: slot to fill before calling publish()
+    T& writeBuffer() { return slots[back].value; }
+
+    // Producer: make the write buffer the newest value and get a fresh slot to write into
+    void publish() {
+        back = middle.exchange(back | FRESH, std::memory_order_acq_rel) & INDEX_MASK;
+    }
+
+    // Consumer: swap in the newest value if one was published since the last call
+    bool update() {
+        if ((middle.load(std::memory_order_relaxed) & FRESH) == 0) return false;
+        front = middle.exchange(front, std::memory_order_acq_rel) & INDEX_MASK;
+        return true;
+    }
+
+    // Consumer: value fetched by the last successful update()
+    const T& readBuffer() const { return slots[front].value; }
+
+private:
+    static constexpr uint8_t INDEX_MASK = 0x3;
+    static constexpr uint8_t FRESH      = 0x4;
+
+    // Each slot on its own cache line so producer and consumer never share one
+    struct alignas(64) Slot {
+        T value{};
+    };
+
+    Slot                 slots[3];
+    std::atomic<uint8_t> middle;
+    alignas(64) uint8_t  back;
+    alignas(64) uint8_t  front;
+};
+
+#endif // TRIPLEBUFFER_H
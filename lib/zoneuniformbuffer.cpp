@@ -0,0 +1,223 @@
+/*!
+ \file    zoneuniformbuffer.cpp
+ \brief   Source file of the class ZoneUniformBuffer.
+ */
+
+#include "zoneuniformbuffer.h"
+#include <cstring>
+
+// GL_ARB_buffer_storage, core in OpenGL 4.4, which the loader of a 3.3 context may not declare
+#ifndef GL_MAP_PERSISTENT_BIT
+#define GL_MAP_PERSISTENT_BIT 0x0040
+#endif
+typedef void (APIENTRYP ZoneBufferStorageProc)(GLenum target, GLsizeiptr size, const void *data, GLbitfield flags);
+
+// Longest wait for the GPU to release a copy, it has two frames to do it
+static const GLuint64 FENCE_TIMEOUT_NS = 1000000000;
+
+
+ZoneUniformBuffer::ZoneUniformBuffer()
+    : buffer(0), layout(ZONE_UNIFORM_SLICES), mapped(nullptr), zoneCount(0), zoneStride(0), sectionCount(0), section(0), lastUpload(0), fences() {}
+
+// True if the context has GL_ARB_buffer_storage
+static bool hasBufferStorage() {
+    GLint major = 0, minor = 0;
+    glGetIntegerv(GL_MAJOR_VERSION, &major);
+    glGetIntegerv(GL_MINOR_VERSION, &minor);
+    if (major > 4 || (major == 4 && minor >= 4)) return true;
+    GLint extensions = 0;
+    glGetIntegerv(GL_NUM_EXTENSIONS, &extensions);
+    for (GLint i = 0; i < extensions; ++i) {
+        const char *name = (const char*)glGetStringi(GL_EXTENSIONS, (GLuint)i);
+        if (name && !strcmp(name, "GL_ARB_buffer_storage")) return true;
+    }
+    return false;
+}
+
+/*!
+     \brief Create the buffer, every parameter 0
+     \param zones : slices of the buffer
+     \param load : resolves the GL functions, for glBufferStorage; nullptr for glBufferSubData only
+     \param layout : a slice per zone, or a table of ZONE_TABLE_SIZE zones packed as a std140 array
+     \return false if the buffer cannot be created
+  */
+bool ZoneUniformBuffer::create(uint32_t zones, GLADloadproc load, ZoneUniformLayout layout) {
+    destroy();
+    if (zones == 0 || (layout == ZONE_UNIFORM_TABLE && zones > ZONE_TABLE_SIZE)) return false;
+
+    GLint alignment = 0;
+    glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment);
+    if (alignment < 1) alignment = 1;
+    this->layout = layout;
+    zoneCount = zones;
+    if (layout == ZONE_UNIFORM_TABLE) {
+        // The whole array is bound, each copy starting on an aligned offset
+        zoneStride = sizeof(ZoneUniforms);
+        shadow.assign((ZONE_TABLE_SIZE * zoneStride + alignment - 1) / alignment * alignment, 0);
+    } else {
+        zoneStride = (sizeof(ZoneUniforms) + alignment - 1) / alignment * alignment;
+        shadow.assign(zoneStride * zones, 0);
+    }
+
+    ZoneBufferStorageProc bufferStorage = nullptr;
+    if (load && hasBufferStorage())
+        bufferStorage = (ZoneBufferStorageProc)load("glBufferStorage");
+    sectionCount = bufferStorage ? ZONE_UNIFORM_SECTIONS : 1;
+    section = 0;
+    size_t sectionBytes = shadow.size();
+    dirtyBegin.assign((size_t)sectionCount * zones, 0);
+    dirtyEnd.assign((size_t)sectionCount * zones, 0);
+
+    while (glGetError() != GL_NO_ERROR) {}
+    glGenBuffers(1, &buffer);
+    glBindBuffer(GL_UNIFORM_BUFFER, buffer);
+    if (bufferStorage) {
+        // Immutable, mapped once; every copy is written before its first use, written bytes are flushed
+        std::vector<uint8_t> zeros(sectionBytes * sectionCount, 0);
+        bufferStorage(GL_UNIFORM_BUFFER, (GLsizeiptr)zeros.size(), zeros.data(), GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT);
+        mapped = (uint8_t*)glMapBufferRange(GL_UNIFORM_BUFFER, 0, (GLsizeiptr)zeros.size(),
+                                            GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_FLUSH_EXPLICIT_BIT);
+        if (!mapped) {
+            // Back to a single copy in a mutable buffer
+            glDeleteBuffers(1, &buffer);
+            glGenBuffers(1, &buffer);
+            glBindBuffer(GL_UNIFORM_BUFFER, buffer);
+            sectionCount = 1;
+            dirtyBegin.assign(zones, 0);
+            dirtyEnd.assign(zones, 0);
+        }
+    }
+    if (!mapped)
+        glBufferData(GL_UNIFORM_BUFFER, (GLsizeiptr)sectionBytes, shadow.data(), GL_DYNAMIC_DRAW);
+    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+
+    if (glGetError() != GL_NO_ERROR) {
+        destroy();
+        return false;
+    }
+    return true;
+}
+
+void ZoneUniformBuffer::destroy() {
+    for (GLsync &fence : fences) {
+        if (fence) glDeleteSync(fence);
+        fence = 0;
+    }
+    if (mapped) {
+        glBindBuffer(GL_UNIFORM_BUFFER, buffer);
+        glUnmapBuffer(GL_UNIFORM_BUFFER);
+        glBindBuffer(GL_UNIFORM_BUFFER, 0);
+    }
+    if (buffer) glDeleteBuffers(1, &buffer);
+    buffer = 0;
+    layout = ZONE_UNIFORM_SLICES;
+    mapped = nullptr;
+    zoneCount = 0;
+    zoneStride = 0;
+    sectionCount = 0;
+    section = 0;
+    lastUpload = 0;
+    shadow.clear();
+    dirtyBegin.clear();
+    dirtyEnd.clear();
+}
+
+bool ZoneUniformBuffer::attach(GLuint program) const {
+    GLuint block = glGetUniformBlockIndex(program, layout == ZONE_UNIFORM_TABLE ? "ZoneTable" : "ZoneParameters");
+    if (block == GL_INVALID_INDEX) return false;
+    glUniformBlockBinding(program, block, ZONE_UNIFORM_BINDING);
+    return true;
+}
+
+/*!
+     \brief Store the parameters of a zone and mark the bytes that differ in every copy of the buffer
+            Compared word by word, so a zone whose resolution and offset stay put only sends its
+            time and the parameters of the mapping.
+  */
+void ZoneUniformBuffer::set(uint32_t zone, const ZoneUniforms &values) {
+    if (zone >= zoneCount) return;
+    uint8_t *slice = &shadow[zone * zoneStride];
+    const uint8_t *incoming = (const uint8_t*)&values;
+    const uint32_t WORD = 4;
+    uint32_t begin = sizeof(ZoneUniforms), end = 0;
+    for (uint32_t offset = 0; offset < sizeof(ZoneUniforms); offset += WORD) {
+        if (memcmp(slice + offset, incoming + offset, WORD) != 0) {
+            if (begin > offset) begin = offset;
+            end = offset + WORD;
+        }
+    }
+    if (end == 0) return;
+    memcpy(slice + begin, incoming + begin, end - begin);
+    for (uint32_t s = 0; s < sectionCount; ++s) {
+        size_t i = (size_t)s * zoneCount + zone;
+        if (dirtyBegin[i] == dirtyEnd[i]) {
+            dirtyBegin[i] = begin;
+            dirtyEnd[i] = end;
+        } else {
+            if (begin < dirtyBegin[i]) dirtyBegin[i] = begin;
+            if (end > dirtyEnd[i]) dirtyEnd[i] = end;
+        }
+    }
+}
+
+/*!
+     \brief Write the bytes changed since this frame's copy was last written
+            Mapped, they are copied zone by zone once the GPU is done with the copy (its fence, two
+            frames old, has normally signalled), then flushed in one range. Otherwise one
+            glBufferSubData sends the range from the first changed byte to the last.
+  */
+void ZoneUniformBuffer::upload() {
+    lastUpload = 0;
+    if (!buffer) return;
+    uint32_t *begin = &dirtyBegin[(size_t)section * zoneCount];
+    uint32_t *end = &dirtyEnd[(size_t)section * zoneCount];
+    size_t first = shadow.size(), last = 0;
+    for (uint32_t z = 0; z < zoneCount; ++z) {
+        if (begin[z] == end[z]) continue;
+        if (first > z * zoneStride + begin[z]) first = z * zoneStride + begin[z];
+        last = z * zoneStride + end[z];
+    }
+    if (last == 0) return;
+
+    size_t sectionOffset = section * shadow.size();
+    if (mapped) {
+        if (fences[section]) {
+            glClientWaitSync(fences[section], GL_SYNC_FLUSH_COMMANDS_BIT, FENCE_TIMEOUT_NS);
+            glDeleteSync(fences[section]);
+            fences[section] = 0;
+        }
+        for (uint32_t z = 0; z < zoneCount; ++z) {
+            size_t offset = z * zoneStride + begin[z];
+            memcpy(mapped + sectionOffset + offset, &shadow[offset], end[z] - begin[z]);
+            lastUpload += end[z] - begin[z];
+        }
+        glBindBuffer(GL_UNIFORM_BUFFER, buffer);
+        glFlushMappedBufferRange(GL_UNIFORM_BUFFER, (GLintptr)(sectionOffset + first), (GLsizeiptr)(last - first));
+    } else {
+        glBindBuffer(GL_UNIFORM_BUFFER, buffer);
+        glBufferSubData(GL_UNIFORM_BUFFER, (GLintptr)first, (GLsizeiptr)(last - first), &shadow[first]);
+        lastUpload = last - first;
+    }
+    memset(begin, 0, zoneCount * sizeof(uint32_t));
+    memset(end, 0, zoneCount * sizeof(uint32_t));
+}
+
+void ZoneUniformBuffer::bind(uint32_t zone) const {
+    if (!buffer || layout != ZONE_UNIFORM_SLICES || zone >= zoneCount) return;
+    glBindBufferRange(GL_UNIFORM_BUFFER, ZONE_UNIFORM_BINDING, buffer,
+                      (GLintptr)(section * shadow.size() + zone * zoneStride), (GLsizeiptr)sizeof(ZoneUniforms));
+}
+
+void ZoneUniformBuffer::bindTable() const {
+    if (!buffer || layout != ZONE_UNIFORM_TABLE) return;
+    glBindBufferRange(GL_UNIFORM_BUFFER, ZONE_UNIFORM_BINDING, buffer,
+                      (GLintptr)(section * shadow.size()), (GLsizeiptr)(ZONE_TABLE_SIZE * sizeof(ZoneUniforms)));
+}
+
+void ZoneUniformBuffer::finish() {
+    if (!mapped) return;
+    // Not waited for when nothing changed in the meantime
+    if (fences[section]) glDeleteSync(fences[section]);
+    fences[section] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    section = (section + 1) % sectionCount;
+}
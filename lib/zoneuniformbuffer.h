@@ -0,0 +1,146 @@
+/*!
+\file    zoneuniformbuffer.h
+\brief   Shader parameters of every zone in one uniform buffer, each zone's slice bound before its draw
+         or the whole table bound for a single pass.
+
+shaders/zone.frag declares the block, the members keeping the names of the former uniforms:
+
+    layout(std140) uniform ZoneParameters {
+        vec2  u_resolution;
+        float u_time;
+        float u_flowerDensity;
+        float u_noiseAmount;
+        float u_swirlIntensity;
+        float u_xOffset;
+        int   u_historyHead;
+        int   u_historyRows;
+        int   u_zoneType;
+    };
+
+For a single pass over every zone (shaders/zones.frag), the buffer holds the table of all the zones
+instead, an array of ZONE_TABLE_SIZE such structures in one ZoneTable block bound at once.
+
+Only the bytes that changed since a copy of the buffer was last written are sent, once per frame.
+With GL_ARB_buffer_storage (or OpenGL 4.4) the buffer holds ZONE_UNIFORM_SECTIONS copies, mapped
+once for good: the frame writes one while the GPU may still read the two previous ones, a fence
+guarding each. Without it, a single copy is updated with glBufferSubData.
+*/
+
+
+#ifndef ZONEUNIFORMBUFFER_H
+#define ZONEUNIFORMBUFFER_H
+
+#include <glad/glad.h>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/*! Uniform buffer binding point of the ZoneParameters and ZoneTable blocks */
+#define ZONE_UNIFORM_BINDING 0
+
+/*! Copies of the buffer in flight with persistent mapping */
+#define ZONE_UNIFORM_SECTIONS 3
+
+/*! Entries of the ZoneTable block, as declared by shaders/zones.frag */
+#define ZONE_TABLE_SIZE 64
+
+/**
+ * shader of a zone, ZONE_TYPE and u_zoneType of shaders/zonecolor.glsl
+ */
+enum ZoneType {
+    ZONE_LEFT, /**< background in window coordinates */
+    ZONE_CENTER, /**< background in zone coordinates */
+    ZONE_RIGHT /**< as the center */
+};
+
+/**
+ * layout of the buffer
+ */
+enum ZoneUniformLayout {
+    ZONE_UNIFORM_SLICES, /**< one ZoneParameters block per zone, bound before its draw */
+    ZONE_UNIFORM_TABLE /**< every zone in one ZoneTable block */
+};
+
+/*!  \struct    ZoneUniforms
+     \brief     The ZoneParameters block in the std140 layout, padded to a whole vec4
+*/
+struct ZoneUniforms {
+    float   resolution[2] = {0.0f, 0.0f};
+    float   time = 0.0f;
+    float   flowerDensity = 0.0f;
+    float   noiseAmount = 0.0f;
+    float   swirlIntensity = 0.0f;
+    float   xOffset = 0.0f;
+    int32_t historyHead = 0;
+    int32_t historyRows = 0;
+    int32_t type = ZONE_LEFT;
+    float   padding[2] = {0.0f, 0.0f};
+};
+
+static_assert(offsetof(ZoneUniforms, time) == 8 && offsetof(ZoneUniforms, type) == 36 &&
+              sizeof(ZoneUniforms) == 48, "ZoneUniforms must follow the std140 layout of ZoneParameters");
+
+/*!  \class     ZoneUniformBuffer
+     \brief     CPU copy of the parameters of every zone and the uniform buffer they are sent to.
+                Every frame: set() each zone, upload(), then bind() each zone before its draw (or
+                bindTable() before the single one) and finish() after the last draw.
+                Only used from the thread owning the GL context.
+*/
+class ZoneUniformBuffer {
+public:
+    ZoneUniformBuffer();
+
+    ZoneUniformBuffer(const ZoneUniformBuffer&) = delete;
+    ZoneUniformBuffer& operator=(const ZoneUniformBuffer&) = delete;
+
+    // Create the buffer for zones zones in the current context. load resolves glBufferStorage for the
+    // persistent mapping, nullptr to always use glBufferSubData. Returns false on a GL error, or past
+    // ZONE_TABLE_SIZE zones in a table
+    bool create(uint32_t zones, GLADloadproc load, ZoneUniformLayout layout = ZONE_UNIFORM_SLICES);
+
+    // Delete the buffer and the fences, the context must still be current
+    void destroy();
+
+    // Bind the ZoneParameters (or ZoneTable) block of a program to ZONE_UNIFORM_BINDING, false if it has none
+    bool attach(GLuint program) const;
+
+    // Parameters of a zone, sent by the next upload() if they changed
+    void set(uint32_t zone, const ZoneUniforms &values);
+
+    // Send what changed since this copy of the buffer was last written, once per frame before the draws
+    void upload();
+
+    // Bind the slice of a zone in the copy of this frame to ZONE_UNIFORM_BINDING
+    void bind(uint32_t zone) const;
+
+    // Bind the whole table of this frame's copy to ZONE_UNIFORM_BINDING
+    void bindTable() const;
+
+    // After the last draw of the frame: fence the copy and move to the next one
+    void finish();
+
+    bool     persistent() const { return mapped != nullptr; }
+    uint32_t zones() const { return zoneCount; }
+    // Bytes between the slices of two zones, a multiple of GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT for slices
+    size_t   stride() const { return zoneStride; }
+    // Bytes written to the buffer by the last upload()
+    size_t   uploadedBytes() const { return lastUpload; }
+
+private:
+    GLuint   buffer;
+    ZoneUniformLayout layout;
+    uint8_t *mapped;
+    uint32_t zoneCount;
+    size_t   zoneStride;
+    uint32_t sectionCount;
+    uint32_t section;
+    size_t   lastUpload;
+    GLsync   fences[ZONE_UNIFORM_SECTIONS];
+    // Current parameters, laid out as one copy of the buffer
+    std::vector<uint8_t> shadow;
+    // Bytes begin .. end-1 of zone z changed since copy s was written, at [s * zoneCount + z]
+    std::vector<uint32_t> dirtyBegin;
+    std::vector<uint32_t> dirtyEnd;
+};
+
+#endif // ZONEUNIFORMBUFFER_H
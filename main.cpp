@@ -1,32 +1,94 @@
 #include <glad/glad.h>
 #include <GLFW/glfw3.h>
-#include "lib/serialib.h"
-#include <fstream>
-#include <sstream>
+#include "lib/emotionmapping.h"
+#include "lib/sensoracquisition.h"
+#include "lib/sensorcalibration.h"
+#include "lib/sensorfilter.h"
+#include "lib/sensorhistorytexture.h"
+#include "lib/sensorinterpolator.h"
+#include "lib/shaderpreprocessor.h"
+#include "lib/shaderprogramcache.h"
+#include "lib/spectralstage.h"
+#include "lib/zoneuniformbuffer.h"
+#include <cmath>
+#include <cstdlib>
+#include <memory>
 #include <string>
 #include <iostream>
 #include <vector>
 
-#if defined (__linux__) || defined(__APPLE__)
-    #define SERIAL_PORT "/dev/cu.usbserial-1120"
-#endif
+// Byte format of the sensor board firmware: SENSOR_WIRE_RAW16, SENSOR_WIRE_PACKED10 or SENSOR_WIRE_FRAMED
+#define SENSOR_WIRE SENSOR_WIRE_RAW16
+
+// 1 if the firmware takes SENSOR_COMMAND_LED frames: the board then lights each zone with its intensity
+#define SENSOR_FEEDBACK 0
+
+// 1 to filter the potentiometers on every sample: spikes removed, jitter smoothed at rest without lag when turned
+#define SENSOR_SMOOTHING 1
+
+// 1 to stretch each potentiometer's 0..1 over the travel it actually covers, with its resting ends reading exactly 0 and 1
+#define SENSOR_CALIBRATION 1
+
+// Calibration learned in the previous runs, in the working directory
+#define SENSOR_CALIBRATION_FILE "sinestesia-calibration.txt"
+
+// Frames kept between two render frames for the interpolation, about 1 s at 1 kHz
+#define SENSOR_HISTORY_FRAMES 1024
+
+// 1 to sample the sensors at the time the frame reaches the screen: no added latency, but that time is up to
+// a refresh interval past the newest frame received, so the values are extrapolated and overshoot when a
+// potentiometer stops. 0 to sample them SENSOR_RENDER_DELAY_NS before the previous refresh instead, between
+// frames already received: the motion is interpolated, one refresh interval and the delay later
+#define SENSOR_EXTRAPOLATE 0
+
+// One sensor period plus the time a frame takes to be read (up to 2 ms with the low latency option), so that
+// frames read on time are interpolated
+#define SENSOR_RENDER_DELAY_NS 3000000LL
+
+// Sample rate of the boards, for the spectral analysis of the potentiometers
+#define SENSOR_SAMPLE_RATE 1000.0f
 
-void serialfunc(serialib& serial);
-GLuint compileShader(GLenum type, const char* src);
-GLuint linkProgram(GLuint vert, GLuint frag);
-std::string loadShaderSource(const char* path);
+// Extra swirl of a zone right after an onset (a tap or a shake of its potentiometers, a beat of the audio),
+// fading with ONSET_DECAY_S
+#define ONSET_SWIRL 80.0f
+#define ONSET_DECAY_S 0.15f
 
-// Global parameters read via serial
-int p0, p1, p2, p3, p4, p5;
+// Rules of the emotion mapping, the built-in ones if the file cannot be read
+#define EMOTION_MAPPING_FILE "../config/emotion_mapping.txt"
 
+// Number of projection zones, left to right
+#define ZONE_COUNT 3
+
+// 1 to draw every zone at once with shaders/zones.frag, 0 for one pass per zone with its own shader.
+// Both give the same pixels
+#define ZONE_SINGLE_PASS 1
+
+// Specialisation of the zone shaders, constants their compiler folds and unrolls: layers of flowers
+// (1 to 3), cells searched on each side of a pixel's for the petals reaching it, steps of the background
+#define SHADER_FLOWER_LAYERS 3
+#define SHADER_FLOWER_NEIGHBOURHOOD 1
+#define SHADER_BACKGROUND_ITERATIONS 19
+
+// Sensor channels driving each zone: melancholy (left) and happiness (right) potentiometers
+struct ZoneChannels {
+    uint32_t left;
+    uint32_t right;
+};
+
+// One board for every zone
+static const ZoneChannels singleBoardChannels[ZONE_COUNT] = {
+    {0, 1},
+    {2, 3},
+    {4, 5},
+};
+
+// Shader of each zone
+static const ZoneType zoneTypes[ZONE_COUNT] = {ZONE_LEFT, ZONE_CENTER, ZONE_RIGHT};
+
+// The other parameters of a zone are in its ZoneParameters block, see zoneuniformbuffer.h
 struct ProgramInfo {
     GLuint program;
-    GLint loc_resolution;
-    GLint loc_time;
-    GLint loc_density;
-    GLint loc_noise;
-    GLint loc_swirl;
-    GLint loc_xOffset;
+    GLint loc_history;
 };
 
 // Vertex shader source
@@ -41,29 +103,142 @@ const char* vertexShaderSource = R"vert(
     }
 )vert";
 
+// Vertex shader of the single pass: a triangle covering the window, without vertex attributes
+const char* fullscreenVertexShaderSource = R"vert(
+    #version 330 core
+    void main() {
+        vec2 corner = vec2((gl_VertexID << 1) & 2, gl_VertexID & 2);
+        gl_Position = vec4(corner * 2.0 - 1.0, 0.0, 1.0);
+    }
+)vert";
+
 static int fbW, fbH;
 
-int main() {
-    serialib serial;
-    bool serialDisponible = false;
-
-    // Constants for emotion mapping
-    const float BASE_DENSITY   = 0.1f;
-    const float MAX_DENSITY    = 20.0f;
-    const float BASE_NOISE     = 1.0f;
-    const float MIN_NOISE      = -22.0f;
-    const float MAX_NOISE      = 22.0f;
-    const float MAX_SWIRL      = 200.0f;
-    const float MAX_TIME_SCALE = 5.0f;
-    const float MIN_TIME_SCALE = 0.1f;
-
-    // Attempt serial connection
-    char err = serial.openDevice(SERIAL_PORT, 115200);
-    if (err == 1) {
-        std::cout << "Connected to " << SERIAL_PORT << std::endl;
-        serialDisponible = true;
+// Usage: sinestesia [--capture FILE] [--audio FILE] [--recalibrate] [device ...]
+//        sinestesia --replay FILE [--speed X] [--audio FILE]
+// Without devices, the first serial port streaming sensor frames is used. With several devices,
+// device i drives zone i with its first two channels. --capture records the bytes read for a later
+// --replay, which plays them back instead of reading the boards (speed 0: as fast as possible).
+// The onsets come from the potentiometers, or with --audio from a WAV file or raw 16-bit stereo at
+// 48 kHz on a pipe ("-" for stdin), zone i following audio channel i. --recalibrate starts the
+// calibration over instead of continuing the one of the previous runs
+int main(int argc, char **argv) {
+    SensorAcquisition sensors;
+    SensorFrame sensorFrame;
+    SensorFrame historyFrame;
+    // Large ring of frames, kept off the stack
+    std::unique_ptr<SensorInterpolator> interpolator(new SensorInterpolator());
+    PresentationClock presentation;
+    SpectralStage spectral;
+    SpectralFrame spectralFrame;
+
+    // Rules from the inputs of a zone to its shader parameters, the built-in ones unless the file has all four
+    EmotionMapping mapping;
+    if (mapping.load(EMOTION_MAPPING_FILE)) {
+        if (mapping.parameter("density") < 0 || mapping.parameter("noise") < 0 ||
+            mapping.parameter("swirl") < 0 || mapping.parameter("timeScale") < 0) {
+            std::cerr << EMOTION_MAPPING_FILE << " lacks density, noise, swirl or timeScale" << std::endl;
+            mapping = EmotionMapping();
+        }
+    }
+    std::vector<float> mapped(mapping.parameterCount() * ZONE_COUNT);
+    const float *densityArr   = &mapped[mapping.parameter("density") * ZONE_COUNT];
+    const float *noiseArr     = &mapped[mapping.parameter("noise") * ZONE_COUNT];
+    float *swirlArr           = &mapped[mapping.parameter("swirl") * ZONE_COUNT];
+    const float *timeScaleArr = &mapped[mapping.parameter("timeScale") * ZONE_COUNT];
+
+    std::vector<const char*> devicePaths;
+    const char *capturePath = nullptr;
+    const char *replayPath = nullptr;
+    const char *audioPath = nullptr;
+    bool recalibrate = false;
+    double replaySpeed = 1.0;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--capture" && i + 1 < argc) capturePath = argv[++i];
+        else if (arg == "--replay" && i + 1 < argc) replayPath = argv[++i];
+        else if (arg == "--speed" && i + 1 < argc) replaySpeed = atof(argv[++i]);
+        else if (arg == "--audio" && i + 1 < argc) audioPath = argv[++i];
+        else if (arg == "--recalibrate") recalibrate = true;
+        else devicePaths.push_back(argv[i]);
+    }
+
+    // Attempt serial connections, frames are then read on the acquisition thread
+    // Unplugged or missing boards are (re)connected in the background, the render loop never waits for them
+    if (devicePaths.empty()) devicePaths.push_back("");
+    for (size_t d = 0; d < devicePaths.size() && !replayPath; ++d) {
+        char err = sensors.addDevice(devicePaths[d], 115200, SENSOR_WIRE, SERIAL_OPEN_LOW_LATENCY | SERIAL_OPEN_CUSTOM_BAUD);
+        if (err == 1) {
+            std::cout << "Connected to " << devicePaths[d]
+                      << ((sensors.acceptedOptions(d) & SERIAL_OPEN_LOW_LATENCY) ? " (low latency)" : "")
+                      << std::endl;
+        } else if (err == 0) {
+            std::cout << "Searching for the sensor board" << std::endl;
+        } else {
+            std::cerr << "Error opening serial " << devicePaths[d] << ": code " << (int)err
+                      << ", waiting for it in the background" << std::endl;
+        }
+    }
+#if SENSOR_SMOOTHING
+    SensorChannelFilter smoothing;
+    smoothing.medianWindow = 3;
+    smoothing.smoothing = SENSOR_SMOOTH_ONE_EURO;
+    smoothing.minCutoff = 1.0f;
+    smoothing.beta = 2.0f;
+    smoothing.deadBand = 0.5f / 1023.0f;
+    sensors.setFilter(0, SENSOR_MAX_CHANNELS, smoothing);
+#endif
+#if SENSOR_CALIBRATION
+    SensorChannelCalibration calibration;
+    // Wider than the dead-band of the filter, which can hold the value that far from its resting end
+    calibration.minDeadZone = 2.0f / SENSOR_ADC_MAX;
+    sensors.setCalibration(0, SENSOR_MAX_CHANNELS, calibration);
+    if (!recalibrate && sensors.loadCalibration(SENSOR_CALIBRATION_FILE))
+        std::cout << "Calibration loaded from " << SENSOR_CALIBRATION_FILE << std::endl;
+#else
+    (void)recalibrate;
+#endif
+    sensors.enableHistory(SENSOR_HISTORY_FRAMES);
+    if (replayPath) {
+        if (!sensors.startReplay(replayPath, replaySpeed)) {
+            std::cerr << "Cannot replay " << replayPath << std::endl;
+            return -1;
+        }
+        std::cout << "Replaying " << replayPath << " (" << sensors.replayDuration_ns() / 1e9 << " s)" << std::endl;
+    } else {
+        if (capturePath && !sensors.startCapture(capturePath))
+            std::cerr << "Cannot create capture " << capturePath << std::endl;
+        if (!sensors.start())
+            std::cerr << "Cannot start the sensor acquisition thread" << std::endl;
+    }
+
+    ZoneChannels zoneChannels[ZONE_COUNT];
+    for (int i = 0; i < ZONE_COUNT; ++i) {
+        zoneChannels[i] = singleBoardChannels[i];
+        if (sensors.deviceCount() > 1 && (size_t)i < sensors.deviceCount()) {
+            uint32_t first = sensors.deviceStatus(i).channelOffset;
+            zoneChannels[i] = {first, first + 1};
+        }
+    }
+
+    // Band energies, flux and onsets of every channel on their own thread, see spectral.h
+    SpectralSettings spectralSettings;
+    if (audioPath) {
+        spectralSettings.sampleRate = 48000.0f;
+        spectralSettings.channels = 2;
+        spectralSettings.fftSize = 1024;
+        spectralSettings.hop = 256;
+        spectralSettings.minFrequency = 40.0f;
+        if (!spectral.startAudio(audioPath, spectralSettings))
+            std::cerr << "Cannot read audio " << audioPath << std::endl;
     } else {
-        std::cerr << "Error opening serial: code " << (int)err << std::endl;
+        spectralSettings.sampleRate = SENSOR_SAMPLE_RATE;
+        spectralSettings.channels = 0;
+        for (int i = 0; i < ZONE_COUNT; ++i) {
+            uint32_t last = zoneChannels[i].left > zoneChannels[i].right ? zoneChannels[i].left : zoneChannels[i].right;
+            if (last + 1 > spectralSettings.channels) spectralSettings.channels = last + 1;
+        }
+        spectral.startSensors(spectralSettings);
     }
 
     if (!glfwInit()) return -1;
@@ -86,7 +261,11 @@ int main() {
     glfwGetFramebufferSize(window, &fbW, &fbH);
     glViewport(0, 0, fbW, fbH);
 
-    // Quad setup
+    // Quad setup, the single pass draws from an empty vertex array
+    GLuint VAO, VBO = 0;
+    glGenVertexArrays(1, &VAO);
+    glBindVertexArray(VAO);
+#if !ZONE_SINGLE_PASS
     float quadVertices[] = {
         -1.0f,  1.0f, 0.0f, 0.0f,
         -1.0f, -1.0f, 0.0f, 1.0f,
@@ -95,177 +274,220 @@ int main() {
          1.0f, -1.0f, 1.0f, 1.0f,
          1.0f,  1.0f, 1.0f, 0.0f
     };
-    GLuint VAO, VBO;
-    glGenVertexArrays(1, &VAO);
     glGenBuffers(1, &VBO);
-    glBindVertexArray(VAO);
     glBindBuffer(GL_ARRAY_BUFFER, VBO);
     glBufferData(GL_ARRAY_BUFFER, sizeof(quadVertices), quadVertices, GL_STATIC_DRAW);
     glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 4 * sizeof(float), (void*)0);
     glEnableVertexAttribArray(0);
     glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 4 * sizeof(float), (void*)(2 * sizeof(float)));
     glEnableVertexAttribArray(1);
+#endif
 
-    // Compile shaders
-    GLuint vShader = compileShader(GL_VERTEX_SHADER, vertexShaderSource);
-    std::vector<std::string> fragPaths = {"../shaders/leftFragment.frag", "../shaders/centerFragment.frag", "../shaders/rightFragment.frag"};
+    // Compile shaders: one program for every zone, or one per zone specialised with its type (zones
+    // of the same type share it), see shaderpreprocessor.h
+    std::vector<ShaderDefine> shaderDefines = {
+        {"FLOWER_LAYERS", std::to_string(SHADER_FLOWER_LAYERS)},
+        {"FLOWER_NEIGHBOURHOOD", std::to_string(SHADER_FLOWER_NEIGHBOURHOOD)},
+        {"BACKGROUND_ITERATIONS", std::to_string(SHADER_BACKGROUND_ITERATIONS)},
+    };
+    ShaderPreprocessor shaderSources;
+    ShaderProgramCache shaderPrograms;
+#if ZONE_SINGLE_PASS
+    const char *vertexSource = fullscreenVertexShaderSource;
+    const char *fragPath = "../shaders/zones.frag";
+    int passes = 1;
+    ZoneUniformLayout zoneLayout = ZONE_UNIFORM_TABLE;
+#else
+    const char *vertexSource = vertexShaderSource;
+    const char *fragPath = "../shaders/zone.frag";
+    int passes = ZONE_COUNT;
+    ZoneUniformLayout zoneLayout = ZONE_UNIFORM_SLICES;
+#endif
     std::vector<ProgramInfo> programs;
-    programs.reserve(3);
-
-    for (int i = 0; i < 3; ++i) {
-        std::string src = loadShaderSource(fragPaths[i].c_str());
-        GLuint fShader = compileShader(GL_FRAGMENT_SHADER, src.c_str());
-        GLuint prog = linkProgram(vShader, fShader);
-        glDeleteShader(fShader);
+    programs.reserve(passes);
+    // Parameters of every zone in one uniform buffer, persistently mapped where the driver allows
+    ZoneUniformBuffer zoneUniforms;
+    if (!zoneUniforms.create(ZONE_COUNT, (GLADloadproc)glfwGetProcAddress, zoneLayout))
+        std::cerr << "Cannot create the zone uniform buffer" << std::endl;
+
+    for (int i = 0; i < passes; ++i) {
+        std::vector<ShaderDefine> defines = shaderDefines;
+#if !ZONE_SINGLE_PASS
+        defines.push_back({"ZONE_TYPE", std::to_string((int)zoneTypes[i])});
+#endif
+        std::string src;
+        shaderSources.load(fragPath, defines, src);
+        GLuint prog = shaderPrograms.program(vertexSource, src, shaderSources.files());
 
         ProgramInfo info;
-        info.program        = prog;
-        info.loc_resolution = glGetUniformLocation(prog, "u_resolution");
-        info.loc_time       = glGetUniformLocation(prog, "u_time");
-        info.loc_density    = glGetUniformLocation(prog, "u_flowerDensity");
-        info.loc_noise      = glGetUniformLocation(prog, "u_noiseAmount");
-        info.loc_swirl      = glGetUniformLocation(prog, "u_swirlIntensity");
-        info.loc_xOffset    = glGetUniformLocation(prog, "u_xOffset");
+        info.program     = prog;
+        info.loc_history = glGetUniformLocation(prog, "u_sensorHistory");
+        if (!zoneUniforms.attach(prog))
+            std::cerr << fragPath << " has no block for the zone parameters" << std::endl;
+        glUseProgram(prog);
+        // The history texture stays on unit 0
+        if (info.loc_history != -1)
+            glUniform1i(info.loc_history, 0);
+#if ZONE_SINGLE_PASS
+        glUniform1i(glGetUniformLocation(prog, "u_zoneCount"), ZONE_COUNT);
+#endif
         programs.push_back(info);
     }
-    glDeleteShader(vShader);
 
-    // Helper clamp
-    auto clamp = [](float v, float lo, float hi) {
-        return (v < lo ? lo : (v > hi ? hi : v));
+    // Last seconds of every channel for the shaders (u_sensorHistory), see sensorhistorytexture.h
+    uint32_t historyChannels = SENSOR_CHANNELS;
+    for (size_t d = 0; d < sensors.deviceCount(); ++d) {
+        SensorDeviceStatus status = sensors.deviceStatus(d);
+        if (status.channelOffset + status.channelCount > historyChannels)
+            historyChannels = status.channelOffset + status.channelCount;
+    }
+    SensorHistoryTexture sensorHistory;
+    if (!sensorHistory.create(historyChannels))
+        std::cerr << "Cannot create the sensor history texture" << std::endl;
+
+    // Sequence of the newest frame taken, and overflows of the history queue seen so far
+    uint64_t lastSequence = 0;
+    uint64_t historyOverflows = sensors.historyOverflows();
+    auto takeFrame = [&](const SensorFrame &frame) {
+        interpolator->push(frame);
+        sensorHistory.push(frame);
+        if (!audioPath) spectral.push(frame);
+        lastSequence = frame.sequence;
     };
 
     // Render loop
     while (!glfwWindowShouldClose(window)) {
-        if (serialDisponible) serialfunc(serial);
-
-        float densityArr[3], noiseArr[3], swirlArr[3], timeScaleArr[3];
-        for (int i = 0; i < 3; ++i) {
-            int rawLeft  = (i==0 ? p0 : i==1 ? p2 : p4);
-            int rawRight = (i==0 ? p1 : i==1 ? p3 : p5);
-            float leftN  = rawLeft  / 1023.0f;
-            float rightN = rawRight / 1023.0f;
-
-            // Default time scale
-            timeScaleArr[i] = 1.0f;
-
-            if (rightN > 0.0f && leftN <= 0.0f) {
-                // Felicidad sola: acelerar tiempo hasta 1.8x
-                densityArr[i]    = clamp(BASE_DENSITY + rightN * (MAX_DENSITY - BASE_DENSITY), BASE_DENSITY, MAX_DENSITY);
-                noiseArr[i]      = BASE_NOISE;
-                swirlArr[i]      = 0.0f;
-                timeScaleArr[i] = clamp(1.0f + rightN * (MAX_TIME_SCALE - 1.0f), 1.0f, MAX_TIME_SCALE);
-
-            } else if (leftN > 0.0f && rightN <= 0.0f) {
-                // Melancolía sola: ralentizar tiempo
-                densityArr[i]    = BASE_DENSITY;
-                noiseArr[i]      = clamp(BASE_NOISE + leftN * (MIN_NOISE - BASE_NOISE), MIN_NOISE, MAX_NOISE);
-                swirlArr[i]      = leftN * MAX_SWIRL;
-                timeScaleArr[i] = clamp(1.0f - leftN, MIN_TIME_SCALE, 1.0f);
-
-            } else if (leftN > 0.0f && rightN > 0.0f) {
-                // Combinación: mix velocidad y lentitud
-                float comb = (leftN + rightN) * 0.5f;
-                densityArr[i]    = clamp(BASE_DENSITY - comb * BASE_DENSITY, BASE_DENSITY, MAX_DENSITY);
-                noiseArr[i]      = clamp(BASE_NOISE + comb * (MAX_NOISE - BASE_NOISE), MIN_NOISE, MAX_NOISE);
-                swirlArr[i]      = comb * MAX_SWIRL;
-                timeScaleArr[i] = clamp((1.0f - leftN) + rightN * (MAX_TIME_SCALE - 1.0f), MIN_TIME_SCALE, MAX_TIME_SCALE);
-
-            } else {
-                // Ninguno
-                densityArr[i]    = BASE_DENSITY;
-                noiseArr[i]      = BASE_NOISE;
-                swirlArr[i]      = 0.0f;
-                timeScaleArr[i]  = 1.0f;
+        // Never blocks: takes every frame decoded since the previous render frame, none when the device is slow or stalled
+        bool newFrame = false;
+        while (sensors.nextHistory(historyFrame)) {
+            // Already superseded by the frame taken from latest() after an overflow
+            if (historyFrame.sequence <= lastSequence) continue;
+            takeFrame(historyFrame);
+            newFrame = true;
+        }
+        // A long render frame let the queue fill up, and it dropped the newest frames rather than the oldest:
+        // resume from the newest one instead of lagging a queue behind
+        uint64_t overflows = sensors.historyOverflows();
+        if (overflows != historyOverflows && sensors.latest(historyFrame) && historyFrame.sequence > lastSequence) {
+            takeFrame(historyFrame);
+            newFrame = true;
+        }
+        historyOverflows = overflows;
+        // Values at a time tied to the refreshes rather than those of the last frame received, so the motion
+        // stays even whatever the sensor rate and the refresh rate
+        int64_t sampleTime = presentation.nextPresent_ns(timeOut::now_ns());
+        if (!SENSOR_EXTRAPOLATE) sampleTime -= presentation.interval_ns() + SENSOR_RENDER_DELAY_NS;
+        interpolator->sample(sampleTime, sensorFrame);
+
+        // Gather the normalised inputs of every zone through the channel table
+        float leftArr[ZONE_COUNT], rightArr[ZONE_COUNT];
+        for (int i = 0; i < ZONE_COUNT; ++i) {
+            leftArr[i]  = sensorFrame.channel(zoneChannels[i].left);
+            rightArr[i] = sensorFrame.channel(zoneChannels[i].right);
+        }
+
+        // Time since the newest onset of each zone's channels
+        spectral.latest(spectralFrame);
+        float onsetArr[ZONE_COUNT] = {};
+        if (spectralFrame.sequence) {
+            const SpectralSettings &analysis = spectral.settings();
+            double frameAge_s = (timeOut::now_ns() - spectralFrame.timestamp_ns) * 1e-9;
+            for (int i = 0; i < ZONE_COUNT; ++i) {
+                // Channels past the analysed ones never have onsets
+                auto windowsSince = [&](uint32_t channel) {
+                    return channel < spectralFrame.channelCount ? spectralFrame.sinceOnset[channel] : UINT32_MAX;
+                };
+                uint32_t since;
+                if (audioPath) {
+                    since = windowsSince(i % spectralFrame.channelCount);
+                } else {
+                    since = windowsSince(zoneChannels[i].left);
+                    if (windowsSince(zoneChannels[i].right) < since) since = windowsSince(zoneChannels[i].right);
+                }
+                double age_s = since * (double)analysis.hop / analysis.sampleRate + frameAge_s;
+                onsetArr[i] = (float)std::exp(-age_s / ONSET_DECAY_S);
             }
         }
 
+        // Shader parameters of every zone from its inputs, all zones at once
+        mapping.evaluate(leftArr, rightArr, ZONE_COUNT, mapped.data(), ZONE_COUNT);
+        for (int i = 0; i < ZONE_COUNT; ++i)
+            swirlArr[i] += onsetArr[i] * ONSET_SWIRL;
+
+#if SENSOR_FEEDBACK
+        if (newFrame) {
+            // Queued without blocking, a board that lags behind only gets the newest brightness
+            auto clamp = [](float v, float lo, float hi) {
+                return (v < lo ? lo : (v > hi ? hi : v));
+            };
+            uint8_t brightness[ZONE_COUNT];
+            for (int i = 0; i < ZONE_COUNT; ++i)
+                brightness[i] = (uint8_t)(clamp(leftArr[i] > rightArr[i] ? leftArr[i] : rightArr[i], 0.0f, 1.0f) * 255.0f);
+            for (size_t d = 0; d < sensors.deviceCount(); ++d)
+                sensors.send(d, SENSOR_COMMAND_LED, brightness, ZONE_COUNT);
+        }
+#else
+        (void)newFrame;
+#endif
+
+        // Only the frames received since the previous render frame
+        sensorHistory.upload();
+        sensorHistory.bind(0);
+
+        // Only what changed is sent: the resolution and offsets stay put, the time moves every frame
+        int third = fbW / ZONE_COUNT;
+        float now = (float)glfwGetTime();
+        for (int i = 0; i < ZONE_COUNT; ++i) {
+            ZoneUniforms zone;
+            zone.resolution[0]  = (float)third;
+            zone.resolution[1]  = (float)fbH;
+            zone.time           = now * timeScaleArr[i];
+            zone.flowerDensity  = densityArr[i];
+            zone.noiseAmount    = noiseArr[i];
+            zone.swirlIntensity = swirlArr[i];
+            zone.xOffset        = (float)(i * third);
+            zone.historyHead    = (int32_t)sensorHistory.head();
+            zone.historyRows    = (int32_t)sensorHistory.rows();
+            zone.type           = zoneTypes[i];
+            zoneUniforms.set(i, zone);
+        }
+        zoneUniforms.upload();
+
         glBindVertexArray(VAO);
-        int third = fbW / 3;
-        for (int i = 0; i < 3; ++i) {
-            const auto &info = programs[i];
-            int x = i * third;
-            glViewport(x, 0, third, fbH);
-            glUseProgram(info.program);
-            glUniform2f(info.loc_resolution, (float)third, (float)fbH);
-            glUniform1f(info.loc_time,       (float)glfwGetTime() * timeScaleArr[i]);
-            glUniform1f(info.loc_density,    densityArr[i]);
-            glUniform1f(info.loc_noise,      noiseArr[i]);
-            glUniform1f(info.loc_swirl,      swirlArr[i]);
-            if (info.loc_xOffset != -1)
-                glUniform1f(info.loc_xOffset, (float)x);
+#if ZONE_SINGLE_PASS
+        // Each pixel of the triangle finds its zone in the table, the CPU cost does not grow with the zones
+        glViewport(0, 0, fbW, fbH);
+        glUseProgram(programs[0].program);
+        zoneUniforms.bindTable();
+        glDrawArrays(GL_TRIANGLES, 0, 3);
+#else
+        for (int i = 0; i < ZONE_COUNT; ++i) {
+            glViewport(i * third, 0, third, fbH);
+            glUseProgram(programs[i].program);
+            zoneUniforms.bind(i);
             glDrawArrays(GL_TRIANGLES, 0, 6);
         }
+#endif
+        zoneUniforms.finish();
 
         glfwSwapBuffers(window);
+        presentation.swapped(timeOut::now_ns());
         glfwPollEvents();
     }
 
-    serial.closeDevice();
-    for (const auto &info : programs)
-        glDeleteProgram(info.program);
+    sensors.stop();
+#if SENSOR_CALIBRATION
+    // A replay calibrates from the recording, the file keeps the one of the boards
+    if (!replayPath && !sensors.saveCalibration(SENSOR_CALIBRATION_FILE))
+        std::cerr << "Cannot save the calibration to " << SENSOR_CALIBRATION_FILE << std::endl;
+#endif
+    spectral.stop();
+    sensorHistory.destroy();
+    zoneUniforms.destroy();
+    shaderPrograms.destroy();
     glDeleteVertexArrays(1, &VAO);
     glDeleteBuffers(1, &VBO);
     glfwDestroyWindow(window);
     glfwTerminate();
     return 0;
 }
-
-// Reads 6 16-bit values from serial, prints them
-void serialfunc(serialib& serial) {
-    unsigned char buf[12];
-    int n = serial.readBytes(buf, 12, 1000);
-    if (n == 12) {
-        p0 = buf[0]  | (buf[1]  << 8);
-        p1 = buf[2]  | (buf[3]  << 8);
-        p2 = buf[4]  | (buf[5]  << 8);
-        p3 = buf[6]  | (buf[7]  << 8);
-        p4 = buf[8]  | (buf[9]  << 8);
-        p5 = buf[10] | (buf[11] << 8);
-        std::cout << "P0:" << p0 << " P1:" << p1 << " P2:" << p2
-                  << " P3:" << p3 << " P4:" << p4 << " P5:" << p5
-                  << std::endl;
-    } else {
-        std::cerr << "Serial read incomplete: " << n << " bytes\n";
-    }
-}
-
-GLuint compileShader(GLenum type, const char* src) {
-    GLuint s = glCreateShader(type);
-    glShaderSource(s, 1, &src, NULL);
-    glCompileShader(s);
-    GLint ok;
-    glGetShaderiv(s, GL_COMPILE_STATUS, &ok);
-    if (!ok) {
-        char log[512];
-        glGetShaderInfoLog(s, 512, NULL, log);
-        std::cerr << "Shader compile error: " << log << std::endl;
-    }
-    return s;
-}
-
-GLuint linkProgram(GLuint vert, GLuint frag) {
-    GLuint p = glCreateProgram();
-    glAttachShader(p, vert);
-    glAttachShader(p, frag);
-    glLinkProgram(p);
-    GLint ok;
-    glGetProgramiv(p, GL_LINK_STATUS, &ok);
-    if (!ok) {
-        char log[512];
-        glGetProgramInfoLog(p, 512, NULL, log);
-        std::cerr << "Program link error: " << log << std::endl;
-    }
-    return p;
-}
-
-std::string loadShaderSource(const char* path) {
-    std::ifstream file(path);
-    if (!file.is_open()) {
-        std::cerr << "No se pudo abrir el archivo: " << path << std::endl;
-        return "";
-    }
-    std::stringstream buffer;
-    buffer << file.rdbuf();
-    return buffer.str();
-}
\ No newline at end of file
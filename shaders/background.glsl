@@ -0,0 +1,39 @@
+// Background of the zones, backgroundNguyen(), reading u_resolution, u_time, u_swirlIntensity and
+// u_noiseAmount. Knob, a constant the compiler unrolls:
+//   BACKGROUND_ITERATIONS  steps of the noise
+
+#ifndef BACKGROUND_ITERATIONS
+#define BACKGROUND_ITERATIONS 19
+#endif
+
+// Fondo Nguyen2007 con control de ruido
+vec3 backgroundNguyen(vec2 fragCoord) {
+    vec2 v = u_resolution;
+    vec2 u =  0.2 * (fragCoord * 2.0 - v) / v.y;
+
+    vec4 z = vec4(1,2,3,0), o = vec4(0);
+    float a = 0.01, t = u_time;
+    for(float i = 0.0; i < float(BACKGROUND_ITERATIONS); i++) {
+        o += (.90 + cos(z + t))
+        / length((1.0 + i * dot(v, v)) * sin(1.5 * u / (0.5 - dot(u,u)) - 9.0 * u.yx + t));
+        v = cos(++t - 7.0 * u * pow(a += .03, i)) - 5.0 * u;
+    u += tanh(u_swirlIntensity  * dot(u *= mat2(cos(i + 0.02 /* <- Recordar agregar alteracion por uniform*/* t - vec4(0,11,33,0))), u)
+    * cos(100.0 * u.yx + t))/200.0
+    + 0.2 * a * u
+    + cos(1.0 / exp(dot(o,o) / 100.0) + t)/300.0;
+    }
+    vec3 noiseCol = vec3(25.6) / (min(o.rgb,13.0) + 164.0 / o.rgb) - dot(u,u) /200;
+    vec3 baseColor = mix(vec3(0.3,0.3,1.0), vec3(1.0), fragCoord.y / u_resolution.y);
+    // --- Nueva sección: máscara de bordes ---
+    // distancia normalizada al centro [0 = centro, 1 = esquina]
+    float distToCenter = length((fragCoord - 0.5 * v) / v);
+    // ramp-up suave del ruido entre 0.6 y 0.9 de distToCenter
+    float edgeMask = smoothstep(0.2, 20., distToCenter);
+
+    // mezclamos
+    return mix(
+        baseColor,
+        noiseCol,
+        u_noiseAmount * edgeMask
+    );
+}
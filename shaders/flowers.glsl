@@ -1,13 +1,10 @@
-#version 330 core
+// Layers of sakura flowers: N14(), sakura(), blend() and layer(), reading u_time and u_flowerDensity.
+// Knob, a constant the compiler unrolls:
+//   FLOWER_NEIGHBOURHOOD   cells searched on each side of a pixel's cell for the petals reaching it
 
-uniform vec2 u_resolution;
-uniform float u_time;
-uniform float u_flowerDensity;
-uniform float u_noiseAmount;
-uniform float u_swirlIntensity;
-
-in vec2 TexCoords;
-out vec4 FragColor;
+#ifndef FLOWER_NEIGHBOURHOOD
+#define FLOWER_NEIGHBOURHOOD 1
+#endif
 
 #define S(a,b,c) smoothstep(a,b,c)
 #define sat(a) clamp(a,0.0,1.0)
@@ -101,8 +98,8 @@ vec4 layer(vec2 uv, float blur) {
     vec2 id = floor(uv);
     vec2 fu = fract(uv) - 0.5;
     vec4 acc = vec4(0);
-    for(int y = -1; y <= 1; ++y) {
-        for(int x = -1; x <= 1; ++x) {
+    for(int y = -FLOWER_NEIGHBOURHOOD; y <= FLOWER_NEIGHBOURHOOD; ++y) {
+        for(int x = -FLOWER_NEIGHBOURHOOD; x <= FLOWER_NEIGHBOURHOOD; ++x) {
             vec2 off = vec2(x, y);
             vec4 sak = sakura(fu - off, id + off, blur);
             acc = blend(sak, acc);
@@ -110,72 +107,3 @@ vec4 layer(vec2 uv, float blur) {
     }
     return acc;
 }
-
-// Fondo Nguyen2007 con control de ruido
-vec3 backgroundNguyen(vec2 fragCoord) {
-    vec2 v = u_resolution;
-    vec2 u =  0.2 * (fragCoord * 2.0 - v) / v.y;
-
-    vec4 z = vec4(1,2,3,0), o = vec4(0);
-    float a = 0.01, t = u_time;
-    for(float i = 0.0; i < 19.0; i++) {
-        o += (.90 + cos(z + t))
-        / length((1.0 + i * dot(v, v)) * sin(1.5 * u / (0.5 - dot(u,u)) - 9.0 * u.yx + t));
-        v = cos(++t - 7.0 * u * pow(a += .03, i)) - 5.0 * u;
-    u += tanh(u_swirlIntensity  * dot(u *= mat2(cos(i + 0.02 /* <- Recordar agregar alteracion por uniform*/* t - vec4(0,11,33,0))), u)
-    * cos(100.0 * u.yx + t))/200.0
-    + 0.2 * a * u
-    + cos(1.0 / exp(dot(o,o) / 100.0) + t)/300.0;
-    }
-    vec3 noiseCol = vec3(25.6) / (min(o.rgb,13.0) + 164.0 / o.rgb) - dot(u,u) /200;
-    vec3 baseColor = mix(vec3(0.3,0.3,1.0), vec3(1.0), fragCoord.y / u_resolution.y);
-    // --- Nueva sección: máscara de bordes ---
-    // distancia normalizada al centro [0 = centro, 1 = esquina]
-    float distToCenter = length((fragCoord - 0.5 * v) / v);
-    // ramp-up suave del ruido entre 0.6 y 0.9 de distToCenter
-    float edgeMask = smoothstep(0.2, 20., distToCenter);
-
-    // mezclamos
-    return mix(
-        baseColor,
-        noiseCol,
-        u_noiseAmount * edgeMask
-    );
-}
-
-void main() {
-    if(u_resolution.y == 0.0) { FragColor = vec4(0); return; }
-
-    vec2 nom = TexCoords;
-    vec2 p = nom - 0.5;
-    if (u_flowerDensity <= 0.1) {
-        vec2 fragLocal = TexCoords * u_resolution;
-        vec3 bg = backgroundNguyen(fragLocal);
-        FragColor = vec4(bg, 1.0);
-        return;
-    }
-    p.x *= u_resolution.x / u_resolution.y;
-    p.y += u_time * 0.1;
-    p.x -= u_time * 0.03 + sin(u_time) * 0.1;
-
-    // Regula cantidad: más densidad = más flores
-    p *= u_flowerDensity;
-
-    float blur = abs(nom.y -1.);
-    blur = blur * blur * 2.0 * 0.15;
-    // Si la densidad es negativa, devolvemos solo el fondo
-
-    vec3 col = backgroundNguyen(gl_FragCoord.xy);
-
-    vec4 L1 = layer(p,               0.015 + blur);
-    vec4 L2 = layer(p * 1.5 + vec2(124.5,89.3), 0.05 + blur);
-    L2.rgb *= mix(0.7,0.95,nom.y);
-    vec4 L3 = layer(p * 2.3 + vec2(463.5,-987.3), 0.08 + blur);
-    L3.rgb *= mix(0.55,0.85,nom.y);
-
-    col = blend(L3, vec4(col,1.0)).rgb;
-    col = blend(L2, vec4(col,1.0)).rgb;
-    col = blend(L1, vec4(col,1.0)).rgb;
-
-    FragColor = vec4(col, 1.0);
-}
\ No newline at end of file
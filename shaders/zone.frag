@@ -0,0 +1,41 @@
+#version 330 core
+
+// One zone per pass. The loader defines ZONE_TYPE, and may define the knobs of zonecolor.glsl,
+// flowers.glsl and background.glsl, see lib/shaderpreprocessor.h
+
+#include "zonetypes.glsl"
+
+#ifndef ZONE_TYPE
+#error ZONE_TYPE must be defined by the loader
+#endif
+
+// Parameters of the zone, see lib/zoneuniformbuffer.h
+layout(std140) uniform ZoneParameters {
+    vec2  u_resolution;
+    float u_time;
+    float u_flowerDensity;
+    float u_noiseAmount;
+    float u_swirlIntensity;
+    float u_xOffset;
+    int   u_historyHead;
+    int   u_historyRows;
+    int   u_zoneType;
+};
+
+out vec4 FragColor;
+
+// Position of the pixel in the zone, 0..1 left to right and top to bottom. Taken from the window
+// coordinates rather than interpolated, so that the single pass of zones.frag computes the same bits
+vec2 TexCoords;
+
+#include "flowers.glsl"
+#include "background.glsl"
+
+#define ZONE_FUNCTION zoneColor
+#include "zonecolor.glsl"
+
+void main() {
+    if(u_resolution.y == 0.0) { FragColor = vec4(0); return; }
+    TexCoords = vec2((gl_FragCoord.x - u_xOffset) / u_resolution.x, 1.0 - gl_FragCoord.y / u_resolution.y);
+    zoneColor();
+}
@@ -0,0 +1,55 @@
+// Colour of a pixel of a zone: the background and up to three layers of flowers over it, written to
+// FragColor from TexCoords and the parameters of the zone. Defines the function ZONE_FUNCTION for a
+// zone of type ZONE_TYPE, both set by the includer, so that one program can include it for several
+// types. Knob, a constant the compiler folds:
+//   FLOWER_LAYERS          layers of flowers, 1 to 3
+
+#ifndef FLOWER_LAYERS
+#define FLOWER_LAYERS 3
+#endif
+
+void ZONE_FUNCTION() {
+    vec2 nom = TexCoords;
+    if (u_flowerDensity <= 0.1) {
+        vec2 fragLocal = TexCoords * u_resolution;
+        vec3 bg = backgroundNguyen(fragLocal);
+        FragColor = vec4(bg, 1.0);
+        return;
+    }
+    vec2 p = nom - 0.5;
+    p.x *= u_resolution.x / u_resolution.y;
+    p.y += u_time * 0.1;
+    p.x -= u_time * 0.03 + sin(u_time) * 0.1;
+
+    // Regula cantidad: más densidad = más flores
+    p *= u_flowerDensity;
+
+    float blur = abs(nom.y -1.);
+    blur = blur * blur * 2.0 * 0.15;
+
+#if ZONE_TYPE == ZONE_LEFT
+    // In window coordinates, upside down from the other zones
+    vec3 col = backgroundNguyen(gl_FragCoord.xy);
+#else
+    vec2 fragLocal = nom * u_resolution;       // nom = TexCoords
+    vec3 col     = backgroundNguyen(fragLocal);
+#endif
+
+    vec4 L1 = layer(p,               0.015 + blur);
+#if FLOWER_LAYERS >= 2
+    vec4 L2 = layer(p * 1.5 + vec2(124.5,89.3), 0.05 + blur);
+    L2.rgb *= mix(0.7,0.95,nom.y);
+#endif
+#if FLOWER_LAYERS >= 3
+    vec4 L3 = layer(p * 2.3 + vec2(463.5,-987.3), 0.08 + blur);
+    L3.rgb *= mix(0.55,0.85,nom.y);
+
+    col = blend(L3, vec4(col,1.0)).rgb;
+#endif
+#if FLOWER_LAYERS >= 2
+    col = blend(L2, vec4(col,1.0)).rgb;
+#endif
+    col = blend(L1, vec4(col,1.0)).rgb;
+
+    FragColor = vec4(col, 1.0);
+}
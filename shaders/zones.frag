@@ -0,0 +1,96 @@
+#version 330 core
+
+// Every zone in one pass: the window is covered by one triangle and each pixel finds its zone in the
+// table, then runs the code of that zone's type from zonecolor.glsl. See lib/zoneuniformbuffer.h.
+// The knobs of zonecolor.glsl, flowers.glsl and background.glsl apply to every zone
+
+#include "zonetypes.glsl"
+
+// As in lib/zoneuniformbuffer.h
+#define ZONE_TABLE_SIZE 64
+
+// The members of the ZoneParameters block of zone.frag
+struct Zone {
+    vec2  resolution;
+    float time;
+    float flowerDensity;
+    float noiseAmount;
+    float swirlIntensity;
+    float xOffset;
+    int   historyHead;
+    int   historyRows;
+    int   type;
+};
+
+layout(std140) uniform ZoneTable {
+    Zone u_zones[ZONE_TABLE_SIZE];
+};
+uniform int u_zoneCount;
+
+out vec4 FragColor;
+
+// Parameters of the pixel's zone, under the names of the ZoneParameters block of zone.frag so that
+// the modules read them alike
+vec2  u_resolution;
+float u_time;
+float u_flowerDensity;
+float u_noiseAmount;
+float u_swirlIntensity;
+float u_xOffset;
+int   u_historyHead;
+int   u_historyRows;
+
+// Position of the pixel in its zone, 0..1 left to right and top to bottom
+vec2 TexCoords;
+
+#include "flowers.glsl"
+#include "background.glsl"
+
+// The code of every zone type, each in its own function
+#define ZONE_TYPE ZONE_LEFT
+#define ZONE_FUNCTION leftZone
+#include "zonecolor.glsl"
+#undef ZONE_TYPE
+#undef ZONE_FUNCTION
+
+#define ZONE_TYPE ZONE_CENTER
+#define ZONE_FUNCTION centerZone
+#include "zonecolor.glsl"
+#undef ZONE_TYPE
+#undef ZONE_FUNCTION
+
+#define ZONE_TYPE ZONE_RIGHT
+#define ZONE_FUNCTION rightZone
+#include "zonecolor.glsl"
+#undef ZONE_TYPE
+#undef ZONE_FUNCTION
+
+void main() {
+    int zone = -1;
+    for (int i = 0; i < u_zoneCount; ++i) {
+        if (gl_FragCoord.x >= u_zones[i].xOffset && gl_FragCoord.x < u_zones[i].xOffset + u_zones[i].resolution.x) {
+            zone = i;
+            break;
+        }
+    }
+    // Left of the first zone or right of the last, where no pass draws either
+    if (zone < 0) discard;
+
+    u_resolution     = u_zones[zone].resolution;
+    u_time           = u_zones[zone].time;
+    u_flowerDensity  = u_zones[zone].flowerDensity;
+    u_noiseAmount    = u_zones[zone].noiseAmount;
+    u_swirlIntensity = u_zones[zone].swirlIntensity;
+    u_xOffset        = u_zones[zone].xOffset;
+    u_historyHead    = u_zones[zone].historyHead;
+    u_historyRows    = u_zones[zone].historyRows;
+
+    if(u_resolution.y == 0.0) { FragColor = vec4(0); return; }
+    TexCoords = vec2((gl_FragCoord.x - u_xOffset) / u_resolution.x, 1.0 - gl_FragCoord.y / u_resolution.y);
+
+    switch (u_zones[zone].type) {
+    case ZONE_LEFT:   leftZone();   break;
+    case ZONE_CENTER: centerZone(); break;
+    default:          rightZone();  break;
+    }
+}
@@ -0,0 +1,5 @@
+// Values of ZONE_TYPE and u_zoneType, as in lib/zoneuniformbuffer.h
+
+#define ZONE_LEFT   0
+#define ZONE_CENTER 1
+#define ZONE_RIGHT  2
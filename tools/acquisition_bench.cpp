@@ -0,0 +1,426 @@
+/*!
+ \file    acquisition_bench.cpp
+ \brief   Behaviour of the sensor acquisition seen from the render loop, with boards simulated on pty pairs.
+
+ The render loop is played at 60 frames per second: each frame takes the newest sensor frame, as
+ main.cpp does, then sleeps until the next frame is due. Every case reports, as JSON on stdout (or
+ --out), per phase of the case:
+    frame_ms      p50/p99/max of the time between two render frames
+    sensor_us     p50/p99/max of the time the render loop spent in the sensor calls
+    updates       render frames that got a new sensor frame
+    latency_ms    p50/p99/max of the time from a board writing a frame to latest() returning it
+
+ Cases:
+    stall         one board streams, stops sending for --stall-ms, then streams again. The frame
+                  time must stay flat through the stall. The same board read inline by the render
+                  loop is reported for comparison: it takes the frames that have arrived and, when
+                  none has, blocks in readBytes(buf, 12, 1000) as serialfunc() did.
+    saturation    --devices boards on one acquisition thread; the first one is idle, then writes
+                  as fast as its pty takes it. latest() is polled every POLL_US, and the latency of
+                  the frames of the other boards must not grow by more than LATENCY_SLACK_MS.
+
+ Usage: acquisition_bench [--stall-ms N] [--devices N] [--out FILE]
+ The exit code is 1 if, in the render loop of the acquisition thread, the median frame time left the
+ period by more than FRAME_SLACK_MS or the sensor calls of a frame took longer than SENSOR_LIMIT_US,
+ or if the saturated board delayed the others.
+ */
+
+#include "lib/sensoracquisition.h"
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <termios.h>
+#include <unistd.h>
+#if defined (__APPLE__)
+    #include <util.h>
+#else
+    #include <pty.h>
+#endif
+
+// Render frame period, how far the median frame time may drift from it, and the longest the sensor
+// calls may take in a frame: above the scheduling noise of a loaded machine, far below a blocking read
+static const int64_t FRAME_NS = 16666667LL;
+static const double FRAME_SLACK_MS = 1.0;
+static const double SENSOR_LIMIT_US = 2000.0;
+
+// Rate of the simulated boards, and the size of their frames: 6 little-endian 16-bit values
+static const int64_t BOARD_PERIOD_NS = 2000000LL;
+static const unsigned int FRAME_BYTES = SENSOR_CHANNELS * 2;
+
+// Polling period of latest() in the saturation case, and how much the saturated board may add to
+// the p99 latency of the others: above scheduling noise, far below a device left waiting a wake-up
+static const int64_t POLL_US = 100;
+static const double LATENCY_SLACK_MS = 5.0;
+
+// Frames whose write time is kept per board, the frame index is carried in the first two channels
+static const uint32_t SENT_LOG = 1u << 20;
+
+static int64_t nowNs() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/*!  \class     PtyPair
+     \brief     Pseudo-terminal whose slave is opened by the acquisition, the master plays the board
+*/
+class PtyPair {
+public:
+    PtyPair() : master(-1), slave(-1) {
+        char name[256];
+        if (openpty(&master, &slave, name, NULL, NULL) != 0) return;
+        struct termios tio;
+        tcgetattr(slave, &tio);
+        cfmakeraw(&tio);
+        tcsetattr(slave, TCSANOW, &tio);
+        fcntl(master, F_SETFL, fcntl(master, F_GETFL) | O_NONBLOCK);
+        slaveName = name;
+    }
+    ~PtyPair() {
+        if (master >= 0) close(master);
+        if (slave >= 0) close(slave);
+    }
+    bool ok() const { return master >= 0; }
+
+    int         master;
+    int         slave;
+    std::string slaveName;
+};
+
+/*!  \class     Board
+     \brief     Thread writing bare RAW16 frames on the master of a pty at BOARD_PERIOD_NS, or as fast
+                as the pty takes them when flooding, unless paused
+*/
+class Board {
+public:
+    Board(PtyPair &pty, bool flood = false, bool paused = false)
+        : paused(paused), pty(pty), flood(flood), stop(false), frames(0), sent(SENT_LOG) {
+        worker = std::thread([this]() { run(); });
+    }
+    ~Board() {
+        stop.store(true);
+        worker.join();
+    }
+
+    // Index of a frame from its first two channels, and the time it was written
+    static uint32_t frameIndex(const uint16_t *raw) { return raw[0] | (uint32_t)raw[1] << 10; }
+    int64_t sentAt(uint32_t index) const { return sent[index % SENT_LOG].load(std::memory_order_acquire); }
+
+    std::atomic<bool>     paused;
+
+private:
+    void encode(uint8_t *frame) {
+        for (int c = 0; c < SENSOR_CHANNELS; ++c) {
+            uint16_t value = (uint16_t)((frames * 7 + c * 100) % 1024);
+            if (c == 0) value = (uint16_t)(frames & 1023);
+            if (c == 1) value = (uint16_t)((frames >> 10) & 1023);
+            frame[2 * c] = value & 0xFF;
+            frame[2 * c + 1] = value >> 8;
+        }
+        frames++;
+    }
+
+    void run() {
+        if (flood) {
+            runFlood();
+            return;
+        }
+        int64_t next = nowNs();
+        while (!stop.load(std::memory_order_relaxed)) {
+            next += BOARD_PERIOD_NS;
+            std::this_thread::sleep_for(std::chrono::nanoseconds(next - nowNs()));
+            if (paused.load(std::memory_order_relaxed)) continue;
+            uint8_t frame[FRAME_BYTES];
+            uint32_t index = (uint32_t)frames;
+            encode(frame);
+            sent[index % SENT_LOG].store(nowNs(), std::memory_order_release);
+            if (write(pty.master, frame, sizeof(frame)) < 0 && errno != EAGAIN) return;
+        }
+    }
+
+    // Blocks of whole frames, written as soon as the pty has room for them
+    void runFlood() {
+        uint8_t block[FRAME_BYTES * 341];
+        size_t pending = 0, written = 0;
+        while (!stop.load(std::memory_order_relaxed)) {
+            if (paused.load(std::memory_order_relaxed)) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+                continue;
+            }
+            if (written == pending) {
+                for (pending = 0; pending < sizeof(block); pending += FRAME_BYTES) encode(block + pending);
+                written = 0;
+            }
+            ssize_t n = write(pty.master, block + written, pending - written);
+            if (n > 0) {
+                written += (size_t)n;
+            } else if (n < 0 && errno == EAGAIN) {
+                struct pollfd out = {pty.master, POLLOUT, 0};
+                poll(&out, 1, 1);
+            } else {
+                return;
+            }
+        }
+    }
+
+    PtyPair          &pty;
+    bool              flood;
+    std::atomic<bool> stop;
+    uint64_t          frames;
+    std::vector<std::atomic<int64_t>> sent;
+    std::thread       worker;
+};
+
+/*!  \struct    PhaseResult
+     \brief     Measurements of the render loop over one phase of a case
+*/
+struct PhaseResult {
+    std::string         name;
+    std::vector<double> frame_ms;
+    std::vector<double> sensor_us;
+    std::vector<double> latency_ms;
+    uint64_t            updates = 0;
+
+    static double percentile(std::vector<double> values, double p) {
+        if (values.empty()) return 0.0;
+        std::sort(values.begin(), values.end());
+        return values[(size_t)(p * (double)(values.size() - 1) + 0.5)];
+    }
+    double maxFrame_ms() const { return frame_ms.empty() ? 0.0 : *std::max_element(frame_ms.begin(), frame_ms.end()); }
+    double maxSensor_us() const { return sensor_us.empty() ? 0.0 : *std::max_element(sensor_us.begin(), sensor_us.end()); }
+};
+
+/*!  \struct    CaseResult
+     \brief     Phases of one case and whether it passed
+*/
+struct CaseResult {
+    std::string              name;
+    bool                     checked = false;
+    bool                     passed = true;
+    std::vector<PhaseResult> phases;
+};
+
+/*!
+     \brief Play the render loop for duration_ms, calling sensorCalls once per frame
+     \param sensorCalls : the sensor work of one frame, returns true if a new frame came
+  */
+template <typename SensorCalls>
+static PhaseResult renderPhase(const char *name, int duration_ms, SensorCalls &&sensorCalls) {
+    PhaseResult phase;
+    phase.name = name;
+    int64_t end = nowNs() + (int64_t)duration_ms * 1000000LL;
+    int64_t due = nowNs();
+    while (nowNs() < end) {
+        int64_t start = nowNs();
+        if (sensorCalls()) phase.updates++;
+        phase.sensor_us.push_back((double)(nowNs() - start) * 1e-3);
+        due += FRAME_NS;
+        if (due < nowNs()) due = nowNs();
+        std::this_thread::sleep_for(std::chrono::nanoseconds(due - nowNs()));
+        phase.frame_ms.push_back((double)(nowNs() - start) * 1e-6);
+    }
+    return phase;
+}
+
+// One board streams, stalls for stallMs, then streams again: read by the acquisition thread, or inline
+static bool runStall(bool inline_, int stallMs, CaseResult &result) {
+    result.name = inline_ ? "stall/inline" : "stall/thread";
+    PtyPair pty;
+    if (!pty.ok()) return false;
+    Board board(pty);
+
+    SensorAcquisition sensors;
+    serialib serial;
+    SensorFrame frame;
+    if (inline_) {
+        if (serial.openDevice(pty.slaveName.c_str(), 115200) != 1) return false;
+    } else {
+        if (sensors.start(pty.slaveName.c_str(), 115200, SENSOR_WIRE_RAW16) != 1) return false;
+    }
+    auto sensorCalls = [&]() {
+        if (inline_) {
+            unsigned char buf[FRAME_BYTES];
+            bool updated = false;
+            while (serial.available() >= (int)FRAME_BYTES)
+                updated = serial.readBytes(buf, FRAME_BYTES, 1000) == (int)FRAME_BYTES;
+            if (!updated) updated = serial.readBytes(buf, FRAME_BYTES, 1000) == (int)FRAME_BYTES;
+            return updated;
+        }
+        return sensors.latest(frame);
+    };
+
+    // Let the pipes fill and the first frames through before measuring
+    renderPhase("warm-up", 200, sensorCalls);
+    result.phases.push_back(renderPhase("streaming", 1000, sensorCalls));
+    board.paused.store(true);
+    result.phases.push_back(renderPhase("stalled", stallMs, sensorCalls));
+    board.paused.store(false);
+    result.phases.push_back(renderPhase("resumed", 1000, sensorCalls));
+
+    sensors.stop();
+    serial.closeDevice();
+    // The inline loop is the reference, only the acquisition thread has to keep the frame time flat
+    result.checked = !inline_;
+    if (result.checked) {
+        for (const PhaseResult &phase : result.phases)
+            result.passed = result.passed && phase.maxSensor_us() <= SENSOR_LIMIT_US &&
+                            std::abs(PhaseResult::percentile(phase.frame_ms, 0.5) - FRAME_NS * 1e-6) <= FRAME_SLACK_MS;
+        result.passed = result.passed && result.phases.back().updates > 0;
+    }
+    return true;
+}
+
+/*!
+     \brief Poll latest() every POLL_US for duration_ms and time the frames of the boards from the second on
+     \param seen : index of the last frame seen of every board, updated
+  */
+static PhaseResult pollPhase(const char *name, int duration_ms, SensorAcquisition &sensors,
+                             const std::vector<std::unique_ptr<Board>> &boards, std::vector<uint32_t> &seen) {
+    PhaseResult phase;
+    phase.name = name;
+    SensorFrame frame;
+    int64_t end = nowNs() + (int64_t)duration_ms * 1000000LL;
+    while (nowNs() < end) {
+        if (sensors.latest(frame)) {
+            int64_t now = nowNs();
+            for (size_t b = 1; b < boards.size(); ++b) {
+                uint32_t index = Board::frameIndex(frame.raw + b * SENSOR_CHANNELS);
+                if (index == seen[b]) continue;
+                seen[b] = index;
+                int64_t sent = boards[b]->sentAt(index);
+                if (sent > 0) phase.latency_ms.push_back((double)(now - sent) * 1e-6);
+                phase.updates++;
+            }
+        }
+        std::this_thread::sleep_for(std::chrono::microseconds(POLL_US));
+    }
+    return phase;
+}
+
+// devices boards on one acquisition thread, the first one idle and then flooding its pty
+static bool runSaturation(int devices, CaseResult &result) {
+    result.name = "saturation/" + std::to_string(devices);
+    std::vector<std::unique_ptr<PtyPair>> ptys;
+    std::vector<std::unique_ptr<Board>> boards;
+    SensorAcquisition sensors;
+    for (int d = 0; d < devices; ++d) {
+        ptys.emplace_back(new PtyPair());
+        if (!ptys.back()->ok()) return false;
+        if (sensors.addDevice(ptys.back()->slaveName.c_str(), 115200, SENSOR_WIRE_RAW16) != 1) return false;
+    }
+    for (int d = 0; d < devices; ++d) boards.emplace_back(new Board(*ptys[d], d == 0, d == 0));
+    if (!sensors.start()) return false;
+
+    std::vector<uint32_t> seen(devices, ~0u);
+    pollPhase("warm-up", 200, sensors, boards, seen);
+    result.phases.push_back(pollPhase("idle", 1500, sensors, boards, seen));
+    boards[0]->paused.store(false);
+    result.phases.push_back(pollPhase("saturated", 1500, sensors, boards, seen));
+    SensorDeviceStatus flooded = sensors.deviceStatus(0);
+    sensors.stop();
+    boards.clear();
+
+    // The flooded board must really have kept the thread busy, and the others must still be heard as promptly
+    const PhaseResult &idle = result.phases[0], &saturated = result.phases[1];
+    result.checked = true;
+    result.passed = flooded.frames > 10 * saturated.updates && !saturated.latency_ms.empty() &&
+                    PhaseResult::percentile(saturated.latency_ms, 0.99) <=
+                        PhaseResult::percentile(idle.latency_ms, 0.99) + LATENCY_SLACK_MS;
+    fprintf(stderr, "%-16s flooded board: %llu frames\n", result.name.c_str(), (unsigned long long)flooded.frames);
+    return true;
+}
+
+static void writeJson(std::ostream &out, const std::vector<CaseResult> &results) {
+    out << "{\n  \"benchmark\": \"acquisition_bench\",\n  \"frame_ms\": " << FRAME_NS * 1e-6 << ",\n  \"results\": [\n";
+    for (size_t i = 0; i < results.size(); ++i) {
+        const CaseResult &r = results[i];
+        out << "    {\"name\": \"" << r.name << "\", \"checked\": " << (r.checked ? "true" : "false")
+            << ", \"passed\": " << (r.passed ? "true" : "false") << ", \"phases\": [\n";
+        for (size_t j = 0; j < r.phases.size(); ++j) {
+            const PhaseResult &p = r.phases[j];
+            char line[512];
+            snprintf(line, sizeof(line),
+                     "      {\"phase\": \"%s\", \"frames\": %zu, \"updates\": %llu, "
+                     "\"frame_ms\": [%.2f, %.2f, %.2f], \"sensor_us\": [%.1f, %.1f, %.1f], "
+                     "\"latency_ms\": [%.3f, %.3f, %.3f]}%s\n",
+                     p.name.c_str(), p.frame_ms.size(), (unsigned long long)p.updates,
+                     PhaseResult::percentile(p.frame_ms, 0.5), PhaseResult::percentile(p.frame_ms, 0.99), p.maxFrame_ms(),
+                     PhaseResult::percentile(p.sensor_us, 0.5), PhaseResult::percentile(p.sensor_us, 0.99),
+                     p.maxSensor_us(), PhaseResult::percentile(p.latency_ms, 0.5),
+                     PhaseResult::percentile(p.latency_ms, 0.99), PhaseResult::percentile(p.latency_ms, 1.0),
+                     j + 1 < r.phases.size() ? "," : "");
+            out << line;
+        }
+        out << "    ]}" << (i + 1 < results.size() ? "," : "") << "\n";
+    }
+    out << "  ]\n}\n";
+}
+
+int main(int argc, char **argv) {
+    int stallMs = 2000;
+    int devices = 4;
+    std::string outPath;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        bool hasValue = i + 1 < argc;
+        if (arg == "--stall-ms" && hasValue) stallMs = atoi(argv[++i]);
+        else if (arg == "--devices" && hasValue) devices = std::max(2, atoi(argv[++i]));
+        else if (arg == "--out" && hasValue) outPath = argv[++i];
+        else {
+            std::cerr << "usage: acquisition_bench [--stall-ms N] [--devices N] [--out FILE]" << std::endl;
+            return 2;
+        }
+    }
+
+    std::vector<CaseResult> results;
+    for (bool inline_ : {false, true}) {
+        CaseResult r;
+        if (!runStall(inline_, stallMs, r)) {
+            std::cerr << "Cannot open a pty for " << r.name << std::endl;
+            return 1;
+        }
+        results.push_back(r);
+    }
+    CaseResult saturation;
+    if (!runSaturation(devices, saturation)) {
+        std::cerr << "Cannot open the ptys for " << saturation.name << std::endl;
+        return 1;
+    }
+    results.push_back(saturation);
+
+    int failures = 0;
+    for (const CaseResult &r : results) {
+        for (const PhaseResult &p : r.phases)
+            fprintf(stderr, "%-16s %-10s frame p50 %6.2f p99 %7.2f max %7.2f ms  sensor max %9.1f us  "
+                    "latency p50 %6.3f p99 %6.3f ms  updates %llu\n",
+                    r.name.c_str(), p.name.c_str(), PhaseResult::percentile(p.frame_ms, 0.5),
+                    PhaseResult::percentile(p.frame_ms, 0.99), p.maxFrame_ms(),
+                    p.maxSensor_us(), PhaseResult::percentile(p.latency_ms, 0.5),
+                    PhaseResult::percentile(p.latency_ms, 0.99), (unsigned long long)p.updates);
+        if (r.checked && !r.passed) {
+            fprintf(stderr, "%s: FAILED\n", r.name.c_str());
+            failures++;
+        }
+    }
+    if (outPath.empty()) {
+        writeJson(std::cout, results);
+    } else {
+        std::ofstream out(outPath);
+        writeJson(out, results);
+    }
+    return failures > 0 ? 1 : 0;
+}
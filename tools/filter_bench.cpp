@@ -0,0 +1,98 @@
+/*!
+ \file    filter_bench.cpp
+ \brief   Benchmark of SensorFilter: frames filtered per second on one core.
+
+ Every case filters --frames frames of noisy ramps through SensorFilter::process(), as the
+ acquisition thread does for each decoded frame, and reports as JSON on stdout:
+    frames_per_s   frames filtered per second
+    ns_per_frame   time of one process() call
+    ns_per_channel time per channel of the frame
+
+ Usage: filter_bench [--frames N]
+ */
+
+#include "lib/sensorfilter.h"
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+/*!  \struct    FilterCase
+     \brief     Parameters of one measurement
+*/
+struct FilterCase {
+    const char *name;
+    uint32_t    channels;
+    // Give every other channel the One-Euro settings and the others an EMA, instead of the same settings everywhere
+    bool        mixed;
+};
+
+static SensorChannelFilter allStages() {
+    SensorChannelFilter settings;
+    settings.medianWindow = 5;
+    settings.smoothing = SENSOR_SMOOTH_ONE_EURO;
+    settings.minCutoff = 1.0f;
+    settings.beta = 2.0f;
+    settings.deadBand = 0.001f;
+    return settings;
+}
+
+int main(int argc, char **argv) {
+    size_t frames = 2000000;
+    for (int i = 1; i < argc; ++i) {
+        if (!strcmp(argv[i], "--frames") && i + 1 < argc) frames = strtoull(argv[++i], nullptr, 10);
+        else {
+            std::cerr << "Usage: " << argv[0] << " [--frames N]" << std::endl;
+            return 2;
+        }
+    }
+
+    const FilterCase cases[] = {
+        {"all_stages", SENSOR_CHANNELS, false},
+        {"all_stages", 64, false},
+        {"all_stages", SENSOR_MAX_CHANNELS, false},
+        {"mixed", SENSOR_CHANNELS, true},
+        {"mixed", SENSOR_MAX_CHANNELS, true},
+    };
+
+    // A period of input frames, generated beforehand so only the filter is timed
+    const size_t period = 4096;
+    std::vector<float> input(period * SENSOR_MAX_CHANNELS);
+    std::mt19937 random(1);
+    std::normal_distribution<float> noise(0.0f, 0.002f);
+    for (size_t f = 0; f < period; ++f)
+        for (uint32_t c = 0; c < SENSOR_MAX_CHANNELS; ++c)
+            input[f * SENSOR_MAX_CHANNELS + c] = (float)((f + 37 * c) % period) / period + noise(random);
+
+    for (const FilterCase &test : cases) {
+        SensorFilter *filter = new SensorFilter();
+        SensorChannelFilter ema;
+        ema.medianWindow = 3;
+        ema.smoothing = SENSOR_SMOOTH_EMA;
+        ema.alpha = 0.2f;
+        for (uint32_t c = 0; c < test.channels; ++c)
+            filter->configure(c, test.mixed && (c & 1) ? ema : allStages());
+
+        alignas(64) float values[SENSOR_MAX_CHANNELS];
+        float checksum = 0.0f;
+        auto start = std::chrono::steady_clock::now();
+        for (size_t f = 0; f < frames; ++f) {
+            memcpy(values, &input[(f % period) * SENSOR_MAX_CHANNELS], test.channels * sizeof(float));
+            filter->process(values, 0, test.channels, 1e-3f);
+            checksum += values[f % test.channels];
+        }
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        delete filter;
+
+        std::cout << "{\"case\":\"" << test.name << "/channels=" << test.channels << "\""
+                  << ",\"frames\":" << frames
+                  << ",\"frames_per_s\":" << (uint64_t)(frames / seconds)
+                  << ",\"ns_per_frame\":" << seconds * 1e9 / frames
+                  << ",\"ns_per_channel\":" << seconds * 1e9 / frames / test.channels
+                  << ",\"checksum\":" << checksum << "}" << std::endl;
+    }
+    return 0;
+}
@@ -0,0 +1,169 @@
+/*!
+ \file    mapping_bench.cpp
+ \brief   Benchmark of EmotionMapping against the if/else mapping it replaced, on one core.
+
+ Every case maps random inputs (a third of them exactly 0, as a calibrated potentiometer at rest
+ reads) of every zone to every parameter, and reports as JSON on stdout:
+    ns_per_frame      time to map every zone once
+    ns_per_value      the same per zone and parameter
+    max_error         largest difference with the if/else mapping, or with the rules evaluated
+                      directly for the rules with powers (first four parameters)
+
+ Usage: mapping_bench [--frames N]
+ */
+
+#include "lib/emotionmapping.h"
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+// The mapping of main.cpp before EmotionMapping, verbatim
+static void mapIfElse(const float *leftArr, const float *rightArr, uint32_t zones,
+                      float *densityArr, float *noiseArr, float *swirlArr, float *timeScaleArr) {
+    const float BASE_DENSITY   = 0.1f;
+    const float MAX_DENSITY    = 20.0f;
+    const float BASE_NOISE     = 1.0f;
+    const float MIN_NOISE      = -22.0f;
+    const float MAX_NOISE      = 22.0f;
+    const float MAX_SWIRL      = 200.0f;
+    const float MAX_TIME_SCALE = 5.0f;
+    const float MIN_TIME_SCALE = 0.1f;
+    auto clamp = [](float v, float lo, float hi) {
+        return (v < lo ? lo : (v > hi ? hi : v));
+    };
+    for (uint32_t i = 0; i < zones; ++i) {
+        float leftN  = leftArr[i];
+        float rightN = rightArr[i];
+        timeScaleArr[i] = 1.0f;
+        if (rightN > 0.0f && leftN <= 0.0f) {
+            densityArr[i]    = clamp(BASE_DENSITY + rightN * (MAX_DENSITY - BASE_DENSITY), BASE_DENSITY, MAX_DENSITY);
+            noiseArr[i]      = BASE_NOISE;
+            swirlArr[i]      = 0.0f;
+            timeScaleArr[i] = clamp(1.0f + rightN * (MAX_TIME_SCALE - 1.0f), 1.0f, MAX_TIME_SCALE);
+        } else if (leftN > 0.0f && rightN <= 0.0f) {
+            densityArr[i]    = BASE_DENSITY;
+            noiseArr[i]      = clamp(BASE_NOISE + leftN * (MIN_NOISE - BASE_NOISE), MIN_NOISE, MAX_NOISE);
+            swirlArr[i]      = leftN * MAX_SWIRL;
+            timeScaleArr[i] = clamp(1.0f - leftN, MIN_TIME_SCALE, 1.0f);
+        } else if (leftN > 0.0f && rightN > 0.0f) {
+            float comb = (leftN + rightN) * 0.5f;
+            densityArr[i]    = clamp(BASE_DENSITY - comb * BASE_DENSITY, BASE_DENSITY, MAX_DENSITY);
+            noiseArr[i]      = clamp(BASE_NOISE + comb * (MAX_NOISE - BASE_NOISE), MIN_NOISE, MAX_NOISE);
+            swirlArr[i]      = comb * MAX_SWIRL;
+            timeScaleArr[i] = clamp((1.0f - leftN) + rightN * (MAX_TIME_SCALE - 1.0f), MIN_TIME_SCALE, MAX_TIME_SCALE);
+        } else {
+            densityArr[i]    = BASE_DENSITY;
+            noiseArr[i]      = BASE_NOISE;
+            swirlArr[i]      = 0.0f;
+            timeScaleArr[i]  = 1.0f;
+        }
+    }
+}
+
+// Mapping text of the built-in rules repeated over parameters parameters, the inputs raised to power
+static std::string mappingText(uint32_t parameters, float power) {
+    static const char *names[4] = {"density", "noise", "swirl", "timeScale"};
+    static const char *rules[4][EMOTION_REGIONS] = {
+        {"0.1 0 0 -inf inf", "0.1 0 0 -inf inf", "0.1 0 19.9 0.1 20", "0.1 -0.05 -0.05 0.1 20"},
+        {"1 0 0 -inf inf", "1 -23 0 -22 22", "1 0 0 -inf inf", "1 10.5 10.5 -22 22"},
+        {"0 0 0 -inf inf", "0 200 0 -inf inf", "0 0 0 -inf inf", "0 100 100 -inf inf"},
+        {"1 0 0 -inf inf", "1 -1 0 0.1 1", "1 0 4 1 5", "1 -1 4 0.1 5"},
+    };
+    static const char *regions[EMOTION_REGIONS] = {"none", "left", "right", "both"};
+    std::string text = "threshold 0\n";
+    for (uint32_t p = 0; p < parameters; ++p)
+        for (int r = 0; r < EMOTION_REGIONS; ++r) {
+            text += std::string("rule ") + names[p % 4] + (p < 4 ? "" : std::to_string(p)) + " " + regions[r] + " " + rules[p % 4][r];
+            if (power != 1.0f) text += " " + std::to_string(power) + " " + std::to_string(power);
+            text += "\n";
+        }
+    return text;
+}
+
+/*!  \struct    MappingCase
+     \brief     Parameters of one measurement
+*/
+struct MappingCase {
+    const char *name;
+    uint32_t    zones;
+    uint32_t    parameters;
+    float       power;
+    // Points per axis of the tables, 0 to evaluate the rules
+    uint32_t    table;
+};
+
+// Sets of inputs of every zone
+static const uint32_t INPUT_SETS = 64;
+
+int main(int argc, char **argv) {
+    uint64_t frames = 20000;
+    for (int i = 1; i < argc; ++i) {
+        if (!strcmp(argv[i], "--frames") && i + 1 < argc) frames = strtoull(argv[++i], nullptr, 10);
+        else {
+            std::cerr << "Usage: " << argv[0] << " [--frames N]" << std::endl;
+            return 2;
+        }
+    }
+
+    const MappingCase cases[] = {
+        {"if-else", 3, 4, 1.0f, 0}, {"rules", 3, 4, 1.0f, 0}, {"table", 3, 4, 1.0f, 65},
+        {"if-else", 256, 4, 1.0f, 0}, {"rules", 256, 4, 1.0f, 0}, {"table", 256, 4, 1.0f, 65},
+        {"if-else", 1024, 4, 1.0f, 0}, {"rules", 1024, 4, 1.0f, 0}, {"table", 1024, 4, 1.0f, 65},
+        {"rules", 256, 256, 1.0f, 0}, {"table", 256, 256, 1.0f, 65},
+        {"rules", 256, 4, 2.0f, 0}, {"table", 256, 4, 2.0f, 65}, {"table", 256, 4, 2.0f, 257},
+    };
+
+    for (const MappingCase &test : cases) {
+        // Sets of inputs used in turn, so that the branches of the if/else mapping are not learned
+        std::mt19937 random(1);
+        std::uniform_real_distribution<float> uniform(0.0f, 1.0f);
+        std::vector<float> left((size_t)INPUT_SETS * test.zones), right((size_t)INPUT_SETS * test.zones);
+        for (size_t i = 0; i < left.size(); ++i) {
+            left[i] = uniform(random) < 1.0f / 3.0f ? 0.0f : uniform(random);
+            right[i] = uniform(random) < 1.0f / 3.0f ? 0.0f : uniform(random);
+        }
+
+        EmotionMapping mapping;
+        mapping.parse(mappingText(test.parameters, test.power));
+        EmotionMapping reference = mapping;
+        mapping.bakeTables(test.table);
+        bool ifElse = strcmp(test.name, "if-else") == 0;
+        std::vector<float> out((size_t)test.parameters * test.zones), expected(out.size());
+
+        double checksum = 0.0;
+        auto start = std::chrono::steady_clock::now();
+        for (uint64_t f = 0; f < frames; ++f) {
+            const float *l = &left[(f % INPUT_SETS) * test.zones];
+            const float *r = &right[(f % INPUT_SETS) * test.zones];
+            if (ifElse) mapIfElse(l, r, test.zones, &out[0], &out[test.zones], &out[2 * test.zones], &out[3 * test.zones]);
+            else mapping.evaluate(l, r, test.zones, out.data(), test.zones);
+            checksum += out[f % out.size()];
+        }
+        double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        // Against the if/else mapping for the built-in rules, the rules themselves otherwise
+        float maxError = 0.0f;
+        for (uint32_t set = 0; set < INPUT_SETS; ++set) {
+            const float *l = &left[(size_t)set * test.zones];
+            const float *r = &right[(size_t)set * test.zones];
+            mapping.evaluate(l, r, test.zones, out.data(), test.zones);
+            if (test.power == 1.0f) mapIfElse(l, r, test.zones, &expected[0], &expected[test.zones], &expected[2 * test.zones], &expected[3 * test.zones]);
+            else reference.evaluate(l, r, test.zones, expected.data(), test.zones);
+            for (size_t i = 0; i < (size_t)4 * test.zones; ++i)
+                maxError = std::fmax(maxError, std::fabs(out[i] - expected[i]));
+        }
+
+        std::cout << "{\"case\":\"" << test.name << (test.table ? std::to_string(test.table) : "")
+                  << "/zones=" << test.zones << "/parameters=" << test.parameters << "/power=" << test.power << "\""
+                  << ",\"ns_per_frame\":" << elapsed * 1e9 / frames
+                  << ",\"ns_per_value\":" << elapsed * 1e9 / frames / test.zones / test.parameters
+                  << ",\"max_error\":" << maxError
+                  << ",\"checksum\":" << checksum << "}" << std::endl;
+    }
+    return 0;
+}
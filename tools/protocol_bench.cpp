@@ -0,0 +1,139 @@
+/*!
+ \file    protocol_bench.cpp
+ \brief   Benchmark of SensorFrameParser: bytes and frames parsed per second on one core.
+
+ Every case builds a stream of --megabytes MB of framed sensor data, cuts it in chunks of random
+ sizes around the chunk size of the case (as readAvailable() returns them) and times
+ SensorFrameParser::feed() over all of them. Corrupt cases flip a random bit in a share of the
+ frames and insert a random byte between a share of them, so the parser has to resynchronise.
+ The results go to stdout as JSON, one case per line:
+    mb_per_s       megabytes of input parsed per second
+    frames_per_s   valid frames delivered per second
+    ns_per_frame   parsing time per frame delivered
+    frames, corrupt, skipped_bytes   counters of the parser, checked against the stream built
+
+ Usage: protocol_bench [--megabytes N]
+ The exit code is 1 if a case delivered a frame it should not have, or lost one it should have delivered.
+ */
+
+#include "lib/sensorprotocol.h"
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+/*!  \struct    ProtocolCase
+     \brief     Parameters of one measurement
+*/
+struct ProtocolCase {
+    const char *name;
+    uint8_t     format;
+    // Bytes of payload of every frame
+    uint8_t     payload;
+    // Average bytes handed to feed() at once
+    size_t      chunk;
+    // Share of the frames damaged by a flipped bit, and of the frames followed by a stray byte
+    double      corrupt;
+    double      stray;
+};
+
+/*!  \struct    ProtocolStream
+     \brief     Synthetic input of a case and what the parser should find in it
+*/
+struct ProtocolStream {
+    std::vector<uint8_t> bytes;
+    std::vector<size_t>  chunks;
+    uint64_t             validFrames = 0;
+    uint64_t             checksum = 0;
+};
+
+static ProtocolStream buildStream(const ProtocolCase &test, size_t bytes) {
+    ProtocolStream stream;
+    stream.bytes.reserve(bytes + SENSOR_MAX_FRAME_BYTES);
+    std::mt19937 random(1);
+    std::uniform_real_distribution<double> share(0.0, 1.0);
+    uint8_t payload[SENSOR_MAX_PAYLOAD];
+    uint8_t frame[SENSOR_MAX_FRAME_BYTES];
+    uint8_t sequence = 0;
+    while (stream.bytes.size() < bytes) {
+        for (uint8_t i = 0; i < test.payload; ++i) payload[i] = (uint8_t)random();
+        size_t length = encodeSensorFrame(frame, test.format, sequence++, payload, test.payload);
+        if (share(random) < test.corrupt) {
+            // Any bit after the marker: the CRC rejects the frame
+            size_t at = 2 + random() % (length - 2);
+            frame[at] ^= (uint8_t)(1u << (random() % 8));
+        } else {
+            stream.validFrames++;
+            stream.checksum += payload[0];
+        }
+        stream.bytes.insert(stream.bytes.end(), frame, frame + length);
+        if (share(random) < test.stray) stream.bytes.push_back((uint8_t)random());
+    }
+    // Chunk sizes from 1 to twice the case's
+    std::uniform_int_distribution<size_t> chunk(1, 2 * test.chunk - 1);
+    for (size_t pos = 0; pos < stream.bytes.size(); ) {
+        size_t n = test.chunk == 1 ? 1 : std::min(chunk(random), stream.bytes.size() - pos);
+        stream.chunks.push_back(n);
+        pos += n;
+    }
+    return stream;
+}
+
+int main(int argc, char **argv) {
+    size_t megabytes = 64;
+    for (int i = 1; i < argc; ++i) {
+        if (!strcmp(argv[i], "--megabytes") && i + 1 < argc) megabytes = strtoull(argv[++i], nullptr, 10);
+        else {
+            std::cerr << "Usage: " << argv[0] << " [--megabytes N]" << std::endl;
+            return 2;
+        }
+    }
+
+    // Six channels as the boards send them (u16 and packed 10-bit), one frame of 64 channels, and
+    // chunks from single bytes (a slow poll) to 4 KB (a drained backlog)
+    const ProtocolCase cases[] = {
+        {"u16x6", SENSOR_PAYLOAD_U16LE, 12, 1, 0.0, 0.0},
+        {"u16x6", SENSOR_PAYLOAD_U16LE, 12, 16, 0.0, 0.0},
+        {"u16x6", SENSOR_PAYLOAD_U16LE, 12, 256, 0.0, 0.0},
+        {"u16x6", SENSOR_PAYLOAD_U16LE, 12, 4096, 0.0, 0.0},
+        {"packed10x6", SENSOR_PAYLOAD_PACKED10, 8, 256, 0.0, 0.0},
+        {"u16x64", SENSOR_PAYLOAD_U16LE, 128, 256, 0.0, 0.0},
+        {"u16x64", SENSOR_PAYLOAD_U16LE, 128, 4096, 0.0, 0.0},
+        {"u16x6", SENSOR_PAYLOAD_U16LE, 12, 256, 0.01, 0.01},
+        {"u16x6", SENSOR_PAYLOAD_U16LE, 12, 256, 0.10, 0.10},
+    };
+
+    int failures = 0;
+    for (const ProtocolCase &test : cases) {
+        ProtocolStream stream = buildStream(test, megabytes << 20);
+        SensorFrameParser parser;
+        uint64_t checksum = 0;
+        const uint8_t *data = stream.bytes.data();
+        auto start = std::chrono::steady_clock::now();
+        for (size_t n : stream.chunks) {
+            parser.feed(data, n, [&checksum](const SensorPacket &packet) { checksum += packet.payload[0]; });
+            data += n;
+        }
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        // A damaged frame or a stray byte costs a rescan from the byte after the false marker, never
+        // the next frame: every frame built valid must come out, and nothing else
+        const SensorLinkStats &stats = parser.stats();
+        bool ok = stats.frames == stream.validFrames && checksum == stream.checksum;
+        if (!ok) failures++;
+        std::cout << "{\"case\":\"" << test.name << "/chunk=" << test.chunk << "/corrupt=" << test.corrupt << "\""
+                  << ",\"bytes\":" << stream.bytes.size()
+                  << ",\"mb_per_s\":" << stream.bytes.size() / seconds / (1 << 20)
+                  << ",\"frames_per_s\":" << (uint64_t)(stats.frames / seconds)
+                  << ",\"ns_per_frame\":" << (stats.frames ? seconds * 1e9 / stats.frames : 0.0)
+                  << ",\"frames\":" << stats.frames
+                  << ",\"expected_frames\":" << stream.validFrames
+                  << ",\"corrupt\":" << stats.corrupt
+                  << ",\"skipped_bytes\":" << stats.skippedBytes
+                  << ",\"ok\":" << (ok ? "true" : "false") << "}" << std::endl;
+    }
+    return failures > 0 ? 1 : 0;
+}
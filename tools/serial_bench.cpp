@@ -0,0 +1,507 @@
+/*!
+ \file    serial_bench.cpp
+ \brief   Benchmark of the serialib read and write functions over pseudo-terminal pairs.
+
+ serialib opens the slave side of a pty; the benchmark drives the master side from another thread.
+ Every case runs on a fresh pty pair and reports, as JSON on stdout (or --out):
+    throughput   bytes per second moved through the serialib call
+    cpu          CPU time of the thread calling serialib per byte (includes its waiting strategy)
+    latency      time from the write on the master to the serialib call returning the byte,
+                 p50/p99/p999 over --samples single messages sent at random intervals
+
+ Usage: serial_bench [--quick] [--duration-ms N] [--samples N] [--out FILE]
+                     [--baseline FILE] [--tolerance PCT]
+        serial_bench --open
+ With --baseline, each case is compared to the case of the same name in a previous output; the
+ exit code is 1 if a throughput dropped or a p99 latency rose by more than --tolerance percent.
+
+ --open checks the options of openDevice on a pty instead: a low latency request the pty driver
+ refuses must still open the port, a rate without a Bxxxx constant must be refused without
+ SERIAL_OPEN_CUSTOM_BAUD and, with it, either set or refused with -4 and the port left closed.
+ Each check is printed on stderr, the exit code is 1 if one fails.
+ */
+
+#include "lib/serialib.h"
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+#if defined (__APPLE__)
+    #include <util.h>
+#else
+    #include <pty.h>
+#endif
+
+struct BenchOptions {
+    bool        quick = false;
+    int         duration_ms = 300;
+    int         samples = 2000;
+    std::string out;
+    std::string baseline;
+    double      tolerance = 0.0;
+};
+
+/*!  \struct    BenchCase
+     \brief     Parameters of one measurement
+*/
+struct BenchCase {
+    std::string    op;
+    SerialWaitMode mode = SERIAL_WAIT_POLL;
+    unsigned int   chunk = 1;
+    unsigned int   timeout_ms = 100;
+    unsigned int   sleep_us = 100;
+    bool           latency = false;
+
+    std::string name() const {
+        std::ostringstream s;
+        s << op << (latency ? "/latency" : "/throughput") << "/" << (mode == SERIAL_WAIT_POLL ? "poll" : "sleep")
+          << "/chunk=" << chunk << "/timeout=" << timeout_ms << "/sleep=" << sleep_us;
+        return s.str();
+    }
+};
+
+/*!  \struct    BenchResult
+     \brief     Measurements of one case
+*/
+struct BenchResult {
+    BenchCase           params;
+    uint64_t            bytes = 0;
+    double              seconds = 0.0;
+    double              cpu_ns = 0.0;
+    // Calls that failed, and writes retried because the output queue was full
+    uint64_t            errors = 0;
+    uint64_t            retries = 0;
+    std::vector<double> latency_us;
+
+    double throughput() const { return seconds > 0.0 ? (double)bytes / seconds : 0.0; }
+    double cpuPerByte() const { return bytes > 0 ? cpu_ns / (double)bytes : 0.0; }
+    double percentile(double p) const {
+        if (latency_us.empty()) return 0.0;
+        size_t i = (size_t)(p * (double)(latency_us.size() - 1) + 0.5);
+        return latency_us[i];
+    }
+};
+
+static int64_t threadCpuNs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/*!  \class     PtyPair
+     \brief     Pseudo-terminal whose slave is opened by serialib, the master is a raw nonblocking fd
+*/
+class PtyPair {
+public:
+    PtyPair() : master(-1), slave(-1) {
+        char name[256];
+        if (openpty(&master, &slave, name, NULL, NULL) != 0) return;
+        struct termios tio;
+        tcgetattr(slave, &tio);
+        cfmakeraw(&tio);
+        tcsetattr(slave, TCSANOW, &tio);
+        fcntl(master, F_SETFL, fcntl(master, F_GETFL) | O_NONBLOCK);
+        slaveName = name;
+    }
+    ~PtyPair() {
+        if (master >= 0) close(master);
+        if (slave >= 0) close(slave);
+    }
+    bool ok() const { return master >= 0; }
+
+    // Write all of data to the master, waiting for room until stop is set
+    void writeAll(const uint8_t *data, size_t length, const std::atomic<bool> &stop) {
+        while (length > 0 && !stop.load(std::memory_order_relaxed)) {
+            ssize_t n = write(master, data, length);
+            if (n > 0) {
+                data += n;
+                length -= (size_t)n;
+            } else if (n < 0 && errno != EAGAIN && errno != EINTR) {
+                return;
+            } else {
+                struct pollfd pfd = {master, POLLOUT, 0};
+                poll(&pfd, 1, 10);
+            }
+        }
+    }
+
+    int         master;
+    int         slave;
+    std::string slaveName;
+};
+
+// Fill one chunk through the serialib function of the case, returns the bytes read or -1
+static int readChunk(serialib &serial, const BenchCase &c, char *buffer) {
+    if (c.op == "readChar") return serial.readChar(buffer, c.timeout_ms) == 1 ? 1 : 0;
+    if (c.op == "readString") return serial.readString(buffer, '\n', c.chunk + 1, c.timeout_ms);
+    return serial.readBytes(buffer, c.chunk, c.timeout_ms, c.sleep_us);
+}
+
+// Bytes of a message of the case: a line for readString, else chunk bytes
+static std::vector<uint8_t> message(const BenchCase &c) {
+    std::vector<uint8_t> bytes(c.op == "readChar" ? 1 : c.chunk, 'x');
+    if (c.op == "readString") bytes.back() = '\n';
+    return bytes;
+}
+
+// Reads while the master streams as fast as the pty takes it
+static void readThroughput(PtyPair &pty, serialib &serial, const BenchCase &c, int duration_ms, BenchResult &r) {
+    std::atomic<bool> stop(false);
+    std::vector<uint8_t> pattern;
+    std::vector<uint8_t> one = message(c);
+    while (pattern.size() < 4096) pattern.insert(pattern.end(), one.begin(), one.end());
+    std::thread producer([&]() {
+        while (!stop.load(std::memory_order_relaxed)) pty.writeAll(pattern.data(), pattern.size(), stop);
+    });
+    std::vector<char> buffer(c.chunk + 2);
+    int64_t cpu0 = threadCpuNs();
+    timeOut timer;
+    timer.initTimer();
+    while (timer.elapsedTime_ms() < (unsigned long)duration_ms) {
+        int n = readChunk(serial, c, buffer.data());
+        if (n < 0) r.errors++;
+        else r.bytes += (uint64_t)n;
+    }
+    r.seconds = (double)timer.elapsedTime_ns() * 1e-9;
+    r.cpu_ns = (double)(threadCpuNs() - cpu0);
+    stop.store(true);
+    producer.join();
+}
+
+// Single messages at random intervals, the reader blocked in the serialib call
+static void readLatency(PtyPair &pty, serialib &serial, const BenchCase &c, int samples, BenchResult &r) {
+    std::atomic<int64_t> sent(0);
+    std::atomic<bool> consumed(true);
+    std::atomic<bool> stop(false);
+    std::vector<uint8_t> bytes = message(c);
+    std::thread producer([&]() {
+        std::mt19937 random(1);
+        std::uniform_int_distribution<int> pause(100, 400);
+        while (!stop.load(std::memory_order_relaxed)) {
+            std::this_thread::sleep_for(std::chrono::microseconds(pause(random)));
+            if (!consumed.load(std::memory_order_acquire)) continue;
+            consumed.store(false, std::memory_order_relaxed);
+            sent.store(timeOut::now_ns(), std::memory_order_release);
+            pty.writeAll(bytes.data(), bytes.size(), stop);
+        }
+    });
+    std::vector<char> buffer(c.chunk + 2);
+    int64_t cpu0 = threadCpuNs();
+    timeOut timer;
+    timer.initTimer();
+    while ((int)r.latency_us.size() < samples && timer.elapsedTime_ms() < 60000) {
+        size_t got = 0;
+        while (got < bytes.size()) {
+            int n = readChunk(serial, c, buffer.data());
+            if (n < 0) r.errors++;
+            if (n > 0) got += (size_t)n;
+            if (n <= 0 && timer.elapsedTime_ms() >= 60000) break;
+        }
+        int64_t now = timeOut::now_ns();
+        r.latency_us.push_back((double)(now - sent.load(std::memory_order_acquire)) * 1e-3);
+        r.bytes += got;
+        consumed.store(true, std::memory_order_release);
+    }
+    r.seconds = (double)timer.elapsedTime_ns() * 1e-9;
+    r.cpu_ns = (double)(threadCpuNs() - cpu0);
+    stop.store(true);
+    producer.join();
+    std::sort(r.latency_us.begin(), r.latency_us.end());
+}
+
+// writeBytes as fast as the master is drained, retrying when the output queue is full
+static void writeThroughput(PtyPair &pty, serialib &serial, const BenchCase &c, int duration_ms, BenchResult &r) {
+    std::atomic<bool> stop(false);
+    std::thread consumer([&]() {
+        uint8_t sink[65536];
+        while (!stop.load(std::memory_order_relaxed)) {
+            if (read(pty.master, sink, sizeof(sink)) <= 0) {
+                struct pollfd pfd = {pty.master, POLLIN, 0};
+                poll(&pfd, 1, 10);
+            }
+        }
+    });
+    std::vector<uint8_t> bytes(c.chunk, 'x');
+    int64_t cpu0 = threadCpuNs();
+    timeOut timer;
+    timer.initTimer();
+    while (timer.elapsedTime_ms() < (unsigned long)duration_ms) {
+        errno = 0;
+        if (serial.writeBytes(bytes.data(), c.chunk) == 1) {
+            r.bytes += c.chunk;
+            continue;
+        }
+        // A short write leaves errno alone, the queue filled during the call
+        if (errno != 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+            r.errors++;
+            break;
+        }
+        // Output queue full (nonblocking port): wait for room, as a caller would
+        r.retries++;
+        struct pollfd pfd = {serial.fileDescriptor(), POLLOUT, 0};
+        poll(&pfd, 1, 10);
+    }
+    r.seconds = (double)timer.elapsedTime_ns() * 1e-9;
+    r.cpu_ns = (double)(threadCpuNs() - cpu0);
+    stop.store(true);
+    consumer.join();
+}
+
+static bool runCase(const BenchCase &c, const BenchOptions &opt, BenchResult &r) {
+    r.params = c;
+    PtyPair pty;
+    if (!pty.ok()) return false;
+    serialib serial;
+    if (serial.openDevice(pty.slaveName.c_str(), 115200) != 1) return false;
+    serial.setWaitMode(c.mode);
+    if (c.op == "writeBytes") writeThroughput(pty, serial, c, opt.duration_ms, r);
+    else if (c.latency) readLatency(pty, serial, c, opt.samples, r);
+    else readThroughput(pty, serial, c, opt.duration_ms, r);
+    serial.closeDevice();
+    return true;
+}
+
+/*!  \struct    OpenCheck
+     \brief     One call of openDevice with options and the outcomes it may have
+*/
+struct OpenCheck {
+    const char  *name;
+    unsigned int bauds;
+    unsigned int options;
+    // Codes openDevice may return, the first one where the platform supports everything asked
+    std::vector<int> codes;
+};
+
+// Bytes written on the master come out of readBytes, the port being open at some rate
+static bool roundTrip(PtyPair &pty, serialib &serial) {
+    const uint8_t sent[12] = {'s', 'i', 'n', 'e', 's', 't', 'e', 's', 'i', 'a', '\r', '\n'};
+    std::atomic<bool> stop(false);
+    pty.writeAll(sent, sizeof(sent), stop);
+    char received[sizeof(sent)];
+    return serial.readBytes(received, sizeof(sent), 500) == (int)sizeof(sent) &&
+           memcmp(received, sent, sizeof(sent)) == 0;
+}
+
+/*!
+     \brief Open a pty slave with the options of each check
+     \return the number of failed checks
+  */
+static int runOpenChecks() {
+    const std::vector<OpenCheck> checks = {
+        {"standard rate", 115200, 0, {1}},
+        {"low latency", 115200, SERIAL_OPEN_LOW_LATENCY, {1}},
+        {"custom rate without the option", 250000, 0, {-4}},
+        {"custom rate", 250000, SERIAL_OPEN_CUSTOM_BAUD, {1, -4}},
+        {"custom rate and low latency", 1843200, SERIAL_OPEN_CUSTOM_BAUD | SERIAL_OPEN_LOW_LATENCY, {1, -4}},
+        {"standard rate with the custom option", 57600, SERIAL_OPEN_CUSTOM_BAUD, {1}},
+    };
+    int failures = 0;
+    for (const OpenCheck &check : checks) {
+        PtyPair pty;
+        if (!pty.ok()) {
+            std::cerr << "Cannot open a pty for " << check.name << std::endl;
+            return (int)checks.size();
+        }
+        serialib serial;
+        unsigned int accepted = 0xFFFFFFFF;
+        int code = serial.openDevice(pty.slaveName.c_str(), check.bauds, check.options, &accepted);
+        bool expected = std::find(check.codes.begin(), check.codes.end(), code) != check.codes.end();
+        // Only options that were asked for, and a refused port left closed without any
+        bool ok = expected && (accepted & ~check.options) == 0;
+        if (code == 1) {
+            // A custom rate is either applied or the open fails, never silently dropped
+            if (check.bauds == 250000 || check.bauds == 1843200)
+                ok = ok && (accepted & SERIAL_OPEN_CUSTOM_BAUD);
+            ok = ok && roundTrip(pty, serial);
+        } else {
+            ok = ok && accepted == 0 && !serial.isDeviceOpen();
+        }
+        if (!ok) failures++;
+        fprintf(stderr, "%-40s %8u baud  options 0x%x  returned %2d  accepted 0x%x  %s\n", check.name, check.bauds,
+                check.options, code, accepted, ok ? "ok" : "FAILED");
+        serial.closeDevice();
+    }
+
+    // A missing device fails the same way with options
+    serialib serial;
+    unsigned int accepted = 0xFFFFFFFF;
+    int code = serial.openDevice("/dev/serial_bench-missing", 115200, SERIAL_OPEN_LOW_LATENCY, &accepted);
+    bool ok = code == -2 && accepted == 0;
+    if (!ok) failures++;
+    fprintf(stderr, "%-40s %8u baud  options 0x%x  returned %2d  accepted 0x%x  %s\n", "missing device", 115200u,
+            (unsigned int)SERIAL_OPEN_LOW_LATENCY, code, accepted, ok ? "ok" : "FAILED");
+    return failures;
+}
+
+// Cases of the sweep: chunk sizes, timeouts and sleepDuration_us for each wait mode
+static std::vector<BenchCase> buildCases(const BenchOptions &opt) {
+    std::vector<unsigned int> chunks = opt.quick ? std::vector<unsigned int>{12, 4096}
+                                                 : std::vector<unsigned int>{1, 12, 64, 512, 4096};
+    std::vector<unsigned int> sleeps = opt.quick ? std::vector<unsigned int>{100} : std::vector<unsigned int>{10, 100, 1000};
+    std::vector<unsigned int> timeouts = opt.quick ? std::vector<unsigned int>{100} : std::vector<unsigned int>{1, 100};
+    std::vector<BenchCase> cases;
+    for (SerialWaitMode mode : {SERIAL_WAIT_POLL, SERIAL_WAIT_SLEEP}) {
+        // readBytes: the only call taking sleepDuration_us, swept in the sleep mode
+        std::vector<unsigned int> modeSleeps = mode == SERIAL_WAIT_SLEEP ? sleeps : std::vector<unsigned int>{100};
+        for (unsigned int sleep : modeSleeps) {
+            for (unsigned int chunk : chunks) {
+                BenchCase c;
+                c.op = "readBytes";
+                c.mode = mode;
+                c.chunk = chunk;
+                c.sleep_us = sleep;
+                cases.push_back(c);
+            }
+            for (unsigned int timeout : timeouts) {
+                BenchCase c;
+                c.op = "readBytes";
+                c.mode = mode;
+                c.chunk = 12;
+                c.timeout_ms = timeout;
+                c.sleep_us = sleep;
+                c.latency = true;
+                cases.push_back(c);
+            }
+        }
+        for (const char *op : {"readChar", "readString"}) {
+            BenchCase c;
+            c.op = op;
+            c.mode = mode;
+            c.chunk = op[4] == 'C' ? 1 : 64;
+            cases.push_back(c);
+            c.latency = true;
+            cases.push_back(c);
+        }
+    }
+    for (unsigned int chunk : chunks) {
+        BenchCase c;
+        c.op = "writeBytes";
+        c.chunk = chunk;
+        cases.push_back(c);
+    }
+    return cases;
+}
+
+static void writeJson(std::ostream &out, const std::vector<BenchResult> &results) {
+    char host[256] = "";
+    gethostname(host, sizeof(host) - 1);
+    out << "{\n  \"benchmark\": \"serial_bench\",\n  \"version\": 1,\n  \"host\": \"" << host << "\",\n"
+        << "  \"results\": [\n";
+    for (size_t i = 0; i < results.size(); ++i) {
+        const BenchResult &r = results[i];
+        const BenchCase &c = r.params;
+        char line[1024];
+        // One result per line, read back by loadBaseline()
+        snprintf(line, sizeof(line),
+                 "    {\"name\": \"%s\", \"op\": \"%s\", \"mode\": \"%s\", \"chunk\": %u, \"timeout_ms\": %u, "
+                 "\"sleep_us\": %u, \"bytes\": %llu, \"seconds\": %.4f, \"throughput_Bps\": %.0f, "
+                 "\"cpu_ns_per_byte\": %.2f, \"errors\": %llu, \"retries\": %llu, \"samples\": %zu, "
+                 "\"p50_us\": %.2f, \"p99_us\": %.2f, \"p999_us\": %.2f}%s\n",
+                 c.name().c_str(), c.op.c_str(), c.mode == SERIAL_WAIT_POLL ? "poll" : "sleep", c.chunk, c.timeout_ms,
+                 c.sleep_us, (unsigned long long)r.bytes, r.seconds, r.throughput(), r.cpuPerByte(),
+                 (unsigned long long)r.errors, (unsigned long long)r.retries, r.latency_us.size(), r.percentile(0.5), r.percentile(0.99),
+                 r.percentile(0.999), i + 1 < results.size() ? "," : "");
+        out << line;
+    }
+    out << "  ]\n}\n";
+}
+
+// Value of a numeric field of a result line, 0 if absent
+static double field(const std::string &line, const char *key) {
+    std::string pattern = std::string("\"") + key + "\": ";
+    size_t at = line.find(pattern);
+    return at == std::string::npos ? 0.0 : atof(line.c_str() + at + pattern.size());
+}
+
+/*!
+     \brief Compare the results with a previous output of serial_bench, case by case
+     \return the number of cases worse than the baseline by more than tolerance percent
+  */
+static int compareBaseline(const std::string &path, const std::vector<BenchResult> &results, double tolerance) {
+    std::ifstream file(path);
+    if (!file) {
+        std::cerr << "Cannot read baseline " << path << std::endl;
+        return 0;
+    }
+    std::vector<std::string> lines;
+    for (std::string line; std::getline(file, line); )
+        if (line.find("\"name\": ") != std::string::npos) lines.push_back(line);
+
+    int regressions = 0;
+    fprintf(stderr, "%-60s %12s %12s\n", "case", "throughput", "p99");
+    for (const BenchResult &r : results) {
+        std::string key = "\"name\": \"" + r.params.name() + "\"";
+        auto match = std::find_if(lines.begin(), lines.end(),
+                                  [&](const std::string &line) { return line.find(key) != std::string::npos; });
+        if (match == lines.end()) continue;
+        double oldThroughput = field(*match, "throughput_Bps");
+        double oldP99 = field(*match, "p99_us");
+        double dThroughput = oldThroughput > 0.0 ? 100.0 * (r.throughput() / oldThroughput - 1.0) : 0.0;
+        double dP99 = oldP99 > 0.0 ? 100.0 * (r.percentile(0.99) / oldP99 - 1.0) : 0.0;
+        bool worse = tolerance > 0.0 && (r.params.latency ? dP99 > tolerance : dThroughput < -tolerance);
+        if (worse) regressions++;
+        fprintf(stderr, "%-60s %+11.1f%% %+11.1f%%%s\n", r.params.name().c_str(), dThroughput, dP99, worse ? "  WORSE" : "");
+    }
+    return regressions;
+}
+
+int main(int argc, char **argv) {
+    BenchOptions opt;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        bool hasValue = i + 1 < argc;
+        if (arg == "--quick") opt.quick = true;
+        else if (arg == "--open") return runOpenChecks() > 0 ? 1 : 0;
+        else if (arg == "--duration-ms" && hasValue) opt.duration_ms = atoi(argv[++i]);
+        else if (arg == "--samples" && hasValue) opt.samples = atoi(argv[++i]);
+        else if (arg == "--out" && hasValue) opt.out = argv[++i];
+        else if (arg == "--baseline" && hasValue) opt.baseline = argv[++i];
+        else if (arg == "--tolerance" && hasValue) opt.tolerance = atof(argv[++i]);
+        else {
+            std::cerr << "usage: serial_bench [--quick] [--duration-ms N] [--samples N] [--out FILE]\n"
+                         "                    [--baseline FILE] [--tolerance PCT]\n"
+                         "       serial_bench --open" << std::endl;
+            return 2;
+        }
+    }
+    if (opt.quick) {
+        opt.duration_ms = std::min(opt.duration_ms, 100);
+        opt.samples = std::min(opt.samples, 300);
+    }
+
+    std::vector<BenchResult> results;
+    for (const BenchCase &c : buildCases(opt)) {
+        BenchResult r;
+        if (!runCase(c, opt, r)) {
+            std::cerr << "Cannot open a pty for " << c.name() << std::endl;
+            return 1;
+        }
+        fprintf(stderr, "%-60s %10.0f B/s %8.1f ns/B  p50 %7.1f p99 %7.1f p999 %7.1f us\n", c.name().c_str(),
+                r.throughput(), r.cpuPerByte(), r.percentile(0.5), r.percentile(0.99), r.percentile(0.999));
+        results.push_back(std::move(r));
+    }
+
+    if (opt.out.empty()) {
+        writeJson(std::cout, results);
+    } else {
+        std::ofstream out(opt.out);
+        writeJson(out, results);
+    }
+    int regressions = opt.baseline.empty() ? 0 : compareBaseline(opt.baseline, results, opt.tolerance);
+    return regressions > 0 ? 1 : 0;
+}
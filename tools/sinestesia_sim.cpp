@@ -0,0 +1,339 @@
+/*!
+ \file    sinestesia_sim.cpp
+ \brief   Sensor board simulator: streams sensor frames on a pseudo-terminal, so the acquisition path
+          can be run and stress-tested without the Arduino.
+
+ The slave side of the pty is printed on start (and linked to --link); pass it to Sinestesia as the
+ serial device. Bytes the reader does not take in time are lost, as with a real UART without flow
+ control, and counted as overruns.
+
+ Usage: sinestesia-sim [options]
+    --format raw16|packed10|framed   wire format (default raw16, the original firmware)
+    --payload u16|packed10           payload of the framed format (default u16)
+    --channels N                     channels per frame, framed format only (default 6)
+    --rate HZ                        frames per second (default 500)
+    --wave sine|saw|square|walk      synthetic signal (default sine)
+    --freq HZ                        frequency of the periodic waveforms (default 0.25)
+    --replay FILE                    replay a capture of the original firmware (bare 12-byte frames), looped
+    --jitter US                      random delay of each write, uniform in 0..US
+    --burst N                        hold N frames and write them at once (USB adapter latency timer)
+    --baud B                         pace the bytes at B baud, 8N1 (default 0: as fast as the reader takes them)
+    --drop P                         probability of losing each byte
+    --corrupt P                      probability of flipping one bit of each byte
+    --duration S                     stop after S seconds (default: run until interrupted)
+    --link PATH                      symbolic link to the slave device, e.g. /tmp/sinestesia-sensor
+    --seed N                         seed of the random generators
+ */
+
+#include "lib/sensorframe.h"
+#include "lib/sensorprotocol.h"
+#include <cerrno>
+#include <cmath>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+#if defined (__APPLE__)
+    #include <util.h>
+#else
+    #include <pty.h>
+#endif
+
+enum Waveform { WAVE_SINE, WAVE_SAW, WAVE_SQUARE, WAVE_WALK, WAVE_REPLAY };
+
+struct SimOptions {
+    SensorWireFormat format = SENSOR_WIRE_RAW16;
+    uint8_t          payload = SENSOR_PAYLOAD_U16LE;
+    int              channels = 6;
+    double           rate = 500.0;
+    Waveform         wave = WAVE_SINE;
+    double           freq = 0.25;
+    std::string      replay;
+    long long        jitter_us = 0;
+    int              burst = 1;
+    long long        baud = 0;
+    double           drop = 0.0;
+    double           corrupt = 0.0;
+    double           duration = 0.0;
+    std::string      link;
+    unsigned int     seed = 1;
+};
+
+static volatile sig_atomic_t interrupted = 0;
+
+static void onSignal(int) {
+    interrupted = 1;
+}
+
+static int64_t nowNs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static void sleepUntil(int64_t deadline_ns) {
+    struct timespec ts;
+    ts.tv_sec = deadline_ns / 1000000000LL;
+    ts.tv_nsec = deadline_ns % 1000000000LL;
+#if defined (__APPLE__)
+    int64_t delay = deadline_ns - nowNs();
+    if (delay <= 0) return;
+    ts.tv_sec = delay / 1000000000LL;
+    ts.tv_nsec = delay % 1000000000LL;
+    nanosleep(&ts, NULL);
+#else
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR && !interrupted) {}
+#endif
+}
+
+static void usage() {
+    std::cerr << "usage: sinestesia-sim [--format raw16|packed10|framed] [--payload u16|packed10] [--channels N]\n"
+                 "                      [--rate HZ] [--wave sine|saw|square|walk] [--freq HZ] [--replay FILE]\n"
+                 "                      [--jitter US] [--burst N] [--baud B] [--drop P] [--corrupt P]\n"
+                 "                      [--duration S] [--link PATH] [--seed N]" << std::endl;
+}
+
+// Returns false on an unknown option or a bad value
+static bool parseOptions(int argc, char **argv, SimOptions &opt) {
+    for (int i = 1; i < argc; ++i) {
+        std::string name = argv[i];
+        if (i + 1 >= argc) return false;
+        std::string value = argv[++i];
+        if (name == "--format") {
+            if (value == "raw16") opt.format = SENSOR_WIRE_RAW16;
+            else if (value == "packed10") opt.format = SENSOR_WIRE_PACKED10;
+            else if (value == "framed") opt.format = SENSOR_WIRE_FRAMED;
+            else return false;
+        } else if (name == "--payload") {
+            if (value == "u16") opt.payload = SENSOR_PAYLOAD_U16LE;
+            else if (value == "packed10") opt.payload = SENSOR_PAYLOAD_PACKED10;
+            else return false;
+        } else if (name == "--wave") {
+            if (value == "sine") opt.wave = WAVE_SINE;
+            else if (value == "saw") opt.wave = WAVE_SAW;
+            else if (value == "square") opt.wave = WAVE_SQUARE;
+            else if (value == "walk") opt.wave = WAVE_WALK;
+            else return false;
+        } else if (name == "--channels") opt.channels = atoi(value.c_str());
+        else if (name == "--rate") opt.rate = atof(value.c_str());
+        else if (name == "--freq") opt.freq = atof(value.c_str());
+        else if (name == "--replay") { opt.replay = value; opt.wave = WAVE_REPLAY; }
+        else if (name == "--jitter") opt.jitter_us = atoll(value.c_str());
+        else if (name == "--burst") opt.burst = atoi(value.c_str());
+        else if (name == "--baud") opt.baud = atoll(value.c_str());
+        else if (name == "--drop") opt.drop = atof(value.c_str());
+        else if (name == "--corrupt") opt.corrupt = atof(value.c_str());
+        else if (name == "--duration") opt.duration = atof(value.c_str());
+        else if (name == "--link") opt.link = value;
+        else if (name == "--seed") opt.seed = (unsigned int)atoi(value.c_str());
+        else return false;
+    }
+    // The bare formats carry exactly six channels
+    if (opt.format != SENSOR_WIRE_FRAMED) opt.channels = 6;
+    int maxChannels = opt.payload == SENSOR_PAYLOAD_U16LE ? SENSOR_MAX_PAYLOAD / 2 : SENSOR_MAX_PAYLOAD * 8 / 10;
+    return opt.channels >= 1 && opt.channels <= maxChannels && opt.rate > 0.0 && opt.burst >= 1 && opt.baud >= 0;
+}
+
+/*!  \class     SignalSource
+     \brief     Values of the next frame: synthetic waveforms, one phase per channel, or a replayed capture
+*/
+class SignalSource {
+public:
+    SignalSource(const SimOptions &opt, std::mt19937 &random) : opt(opt), random(random), walk(opt.channels, 512.0) {}
+
+    // Load the capture to replay, returns false if it holds no complete frame
+    bool loadReplay(const std::string &path) {
+        std::ifstream file(path, std::ios::binary);
+        std::vector<uint8_t> bytes((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+        size_t count = bytes.size() / SENSOR_RAW16_FRAME_BYTES;
+        for (size_t f = 0; f < count; ++f)
+            for (int c = 0; c < 6; ++c) {
+                const uint8_t *v = &bytes[f * SENSOR_RAW16_FRAME_BYTES + 2 * c];
+                replay.push_back((uint16_t)((v[0] | (v[1] << 8)) & 0x3FF));
+            }
+        return count > 0;
+    }
+
+    // Values of frame k, sampled at t seconds
+    void sample(uint64_t k, double t, uint16_t *values) {
+        std::normal_distribution<double> step(0.0, 8.0);
+        for (int c = 0; c < opt.channels; ++c) {
+            double phase = std::fmod(t * opt.freq + (double)c / opt.channels, 1.0);
+            double v = 0.0;
+            switch (opt.wave) {
+            case WAVE_SINE:   v = 0.5 + 0.5 * std::sin(2.0 * M_PI * phase); break;
+            case WAVE_SAW:    v = phase; break;
+            case WAVE_SQUARE: v = phase < 0.5 ? 1.0 : 0.0; break;
+            case WAVE_WALK:
+                walk[c] = std::fmin(std::fmax(walk[c] + step(random), 0.0), (double)SENSOR_ADC_MAX);
+                v = walk[c] / SENSOR_ADC_MAX;
+                break;
+            case WAVE_REPLAY: {
+                size_t frames = replay.size() / 6;
+                values[c] = c < 6 ? replay[(k % frames) * 6 + c] : 0;
+                continue;
+            }
+            }
+            values[c] = (uint16_t)std::lround(v * SENSOR_ADC_MAX);
+        }
+    }
+
+private:
+    const SimOptions     &opt;
+    std::mt19937         &random;
+    std::vector<double>   walk;
+    std::vector<uint16_t> replay;
+};
+
+// Append frame number k holding values in the wire format, returns its size
+static size_t encodeFrame(const SimOptions &opt, uint64_t k, const uint16_t *values, std::vector<uint8_t> &out) {
+    size_t start = out.size();
+    if (opt.format == SENSOR_WIRE_RAW16) {
+        for (int c = 0; c < 6; ++c) {
+            out.push_back((uint8_t)(values[c] & 0xFF));
+            out.push_back((uint8_t)(values[c] >> 8));
+        }
+    } else if (opt.format == SENSOR_WIRE_PACKED10) {
+        out.resize(start + SENSOR_PACKED10_FRAME_BYTES);
+        packSensor10(values, 6, &out[start]);
+    } else {
+        uint8_t payload[SENSOR_MAX_PAYLOAD];
+        size_t length;
+        if (opt.payload == SENSOR_PAYLOAD_U16LE) {
+            for (int c = 0; c < opt.channels; ++c) {
+                payload[2 * c] = (uint8_t)(values[c] & 0xFF);
+                payload[2 * c + 1] = (uint8_t)(values[c] >> 8);
+            }
+            length = 2 * opt.channels;
+        } else {
+            length = sensorPacked10Bytes(opt.channels);
+            packSensor10(values, opt.channels, payload);
+        }
+        out.resize(start + SENSOR_HEADER_BYTES + length + SENSOR_CRC_BYTES);
+        encodeSensorFrame(&out[start], opt.payload, (uint8_t)k, payload, (uint8_t)length);
+    }
+    return out.size() - start;
+}
+
+int main(int argc, char **argv) {
+    SimOptions opt;
+    if (!parseOptions(argc, argv, opt)) {
+        usage();
+        return 2;
+    }
+    std::mt19937 random(opt.seed);
+    SignalSource source(opt, random);
+    if (!opt.replay.empty() && !source.loadReplay(opt.replay)) {
+        std::cerr << "No complete frame in " << opt.replay << std::endl;
+        return 1;
+    }
+
+    int master, slave;
+    char slaveName[256];
+    if (openpty(&master, &slave, slaveName, NULL, NULL) != 0) {
+        std::cerr << "openpty failed: " << strerror(errno) << std::endl;
+        return 1;
+    }
+    // Raw line so the bytes reach the reader untouched; the slave stays open so the pty
+    // survives readers coming and going
+    struct termios tio;
+    tcgetattr(slave, &tio);
+    cfmakeraw(&tio);
+    tcsetattr(slave, TCSANOW, &tio);
+    fcntl(master, F_SETFL, fcntl(master, F_GETFL) | O_NONBLOCK);
+    if (!opt.link.empty()) {
+        unlink(opt.link.c_str());
+        if (symlink(slaveName, opt.link.c_str()) != 0)
+            std::cerr << "Cannot link " << opt.link << ": " << strerror(errno) << std::endl;
+    }
+    std::cout << "Streaming on " << slaveName << std::endl;
+
+    signal(SIGINT, onSignal);
+    signal(SIGTERM, onSignal);
+
+    const int64_t period_ns = (int64_t)(1e9 / opt.rate);
+    // Time on the line of one byte, 8N1
+    const double byte_ns = opt.baud > 0 ? 1e10 / (double)opt.baud : 0.0;
+    std::uniform_int_distribution<long long> jitter(0, opt.jitter_us);
+    std::uniform_real_distribution<double> chance(0.0, 1.0);
+    std::uniform_int_distribution<int> bit(0, 7);
+
+    std::vector<uint16_t> values(opt.channels);
+    std::vector<uint8_t> pending;
+    uint64_t frames = 0, bytes = 0, dropped = 0, corrupted = 0, overruns = 0;
+    uint64_t lastFrames = 0, lastBytes = 0;
+    const int64_t start_ns = nowNs();
+    int64_t lineFree_ns = start_ns;
+    int64_t lastReport_ns = start_ns;
+
+    for (uint64_t k = 0; !interrupted; ++k) {
+        int64_t sample_ns = start_ns + (int64_t)k * period_ns;
+        if (opt.duration > 0.0 && nowNs() - start_ns >= (int64_t)(opt.duration * 1e9)) break;
+        source.sample(k, (double)(sample_ns - start_ns) * 1e-9, values.data());
+        frames++;
+        encodeFrame(opt, k, values.data(), pending);
+        if ((int)((k + 1) % opt.burst) != 0) continue;
+
+        // Faults of the line
+        if (opt.drop > 0.0 || opt.corrupt > 0.0) {
+            size_t kept = 0;
+            for (size_t i = 0; i < pending.size(); ++i) {
+                if (opt.drop > 0.0 && chance(random) < opt.drop) {
+                    dropped++;
+                    continue;
+                }
+                uint8_t b = pending[i];
+                if (opt.corrupt > 0.0 && chance(random) < opt.corrupt) {
+                    b ^= (uint8_t)(1 << bit(random));
+                    corrupted++;
+                }
+                pending[kept++] = b;
+            }
+            pending.resize(kept);
+        }
+
+        // The frame leaves when it was sampled, plus jitter, and not before the line is free: a rate
+        // above what the baud rate carries slows the frames down, as a blocking Serial.write would
+        int64_t send_ns = sample_ns + (opt.jitter_us > 0 ? jitter(random) * 1000LL : 0);
+        if (send_ns < lineFree_ns) send_ns = lineFree_ns;
+        sleepUntil(send_ns);
+        lineFree_ns = send_ns + (int64_t)(byte_ns * (double)pending.size());
+
+        ssize_t n = write(master, pending.data(), pending.size());
+        if (n < 0) n = 0;
+        bytes += n;
+        // Nobody reads fast enough: the bytes are lost, like a UART overrun
+        overruns += pending.size() - (size_t)n;
+        pending.clear();
+
+        int64_t now = nowNs();
+        if (now - lastReport_ns >= 1000000000LL) {
+            double seconds = (double)(now - lastReport_ns) * 1e-9;
+            fprintf(stderr, "%.0f frames/s  %.0f bytes/s  total %llu frames  dropped %llu  corrupted %llu  overruns %llu\n",
+                    (double)(frames - lastFrames) / seconds, (double)(bytes - lastBytes) / seconds,
+                    (unsigned long long)frames, (unsigned long long)dropped, (unsigned long long)corrupted,
+                    (unsigned long long)overruns);
+            lastFrames = frames;
+            lastBytes = bytes;
+            lastReport_ns = now;
+        }
+    }
+
+    fprintf(stderr, "%llu frames, %llu bytes written, %llu dropped, %llu corrupted, %llu overruns\n",
+            (unsigned long long)frames, (unsigned long long)bytes, (unsigned long long)dropped,
+            (unsigned long long)corrupted, (unsigned long long)overruns);
+    if (!opt.link.empty()) unlink(opt.link.c_str());
+    close(master);
+    close(slave);
+    return 0;
+}
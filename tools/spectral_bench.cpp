@@ -0,0 +1,97 @@
+/*!
+ \file    spectral_bench.cpp
+ \brief   Benchmark of SpectralAnalyzer on one core: 8 channels of 48 kHz audio and the sensor channels.
+
+ Every case analyses --seconds of generated input (tones, noise and clicks) in blocks as they would
+ come from the stream, and reports as JSON on stdout:
+    realtime_factor   seconds of input analysed per second of CPU
+    core_percent      share of one core needed to keep up in real time
+    us_per_window     time of one window of every channel
+
+ Usage: spectral_bench [--seconds N]
+ */
+
+#include "lib/spectral.h"
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <random>
+#include <vector>
+
+/*!  \struct    SpectralCase
+     \brief     Parameters of one measurement
+*/
+struct SpectralCase {
+    const char *name;
+    float       sampleRate;
+    uint32_t    channels;
+    uint32_t    fftSize;
+    uint32_t    hop;
+    uint32_t    block;
+};
+
+int main(int argc, char **argv) {
+    double seconds = 60.0;
+    for (int i = 1; i < argc; ++i) {
+        if (!strcmp(argv[i], "--seconds") && i + 1 < argc) seconds = atof(argv[++i]);
+        else {
+            std::cerr << "Usage: " << argv[0] << " [--seconds N]" << std::endl;
+            return 2;
+        }
+    }
+
+    const SpectralCase cases[] = {
+        {"audio", 48000.0f, 8, 1024, 256, 256},
+        {"audio", 48000.0f, 8, 2048, 512, 512},
+        {"audio", 48000.0f, 8, 512, 128, 128},
+        {"sensors", 1000.0f, 6, 256, 64, 16},
+    };
+
+    for (const SpectralCase &test : cases) {
+        SpectralSettings settings;
+        settings.sampleRate = test.sampleRate;
+        settings.channels = test.channels;
+        settings.fftSize = test.fftSize;
+        settings.hop = test.hop;
+        settings.bandCount = 8;
+        settings.minFrequency = test.sampleRate > 10000.0f ? 40.0f : 1.0f;
+        SpectralAnalyzer analyzer(settings);
+
+        // One second of input, looped
+        uint32_t length = (uint32_t)test.sampleRate;
+        std::vector<float> input((size_t)length * test.channels);
+        std::mt19937 random(1);
+        std::normal_distribution<float> noise(0.0f, 0.05f);
+        for (uint32_t i = 0; i < length; ++i)
+            for (uint32_t c = 0; c < test.channels; ++c) {
+                float tone = 0.3f * std::sin(2.0f * 3.14159265f * (0.01f * test.sampleRate / (c + 1)) * i / test.sampleRate);
+                float click = (i % (length / 2)) < length / 100 ? 0.5f : 0.0f;
+                input[(size_t)i * test.channels + c] = tone + click + noise(random);
+            }
+
+        SpectralFrame result;
+        uint64_t total = (uint64_t)(seconds * test.sampleRate);
+        uint64_t windows = 0, onsets = 0;
+        auto start = std::chrono::steady_clock::now();
+        for (uint64_t done = 0; done < total; done += test.block) {
+            uint32_t offset = (uint32_t)(done % length);
+            uint32_t count = test.block < length - offset ? test.block : length - offset;
+            if (analyzer.process(&input[(size_t)offset * test.channels], count, (int64_t)done, result)) {
+                windows++;
+                onsets += result.sinceOnset[0] == 0;
+            }
+        }
+        double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        std::cout << "{\"case\":\"" << test.name << "/rate=" << test.sampleRate << "/channels=" << test.channels
+                  << "/fft=" << test.fftSize << "/hop=" << test.hop << "\""
+                  << ",\"seconds\":" << seconds
+                  << ",\"realtime_factor\":" << seconds / elapsed
+                  << ",\"core_percent\":" << 100.0 * elapsed / seconds
+                  << ",\"us_per_window\":" << elapsed * 1e6 / (windows ? windows : 1)
+                  << ",\"onsets\":" << onsets << "}" << std::endl;
+    }
+    return 0;
+}
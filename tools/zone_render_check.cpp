@@ -0,0 +1,384 @@
+/*!
+ \file    zone_render_check.cpp
+ \brief   Headless check that the single pass over every zone draws the same pixels as one pass per zone.
+
+ The zones are drawn off screen in an EGL context (Mesa's surfaceless platform needs no display),
+ with the shaders of --shaders built as main.cpp builds them: shaders/zone.frag specialised for each
+ zone type and drawn once per zone in its viewport, and shaders/zones.frag drawn once over the whole
+ target. Every frame gives each zone parameters of its own, moving from frame to frame as the
+ potentiometers would, with the rest values among them. Both images are read back and compared byte
+ for byte; the result goes to stdout as JSON:
+    differing_bytes   bytes of the RGBA images that differ, over every frame
+    max_difference    largest difference of one byte
+    ms_per_frame      GPU time of a frame of each path (glFinish), for the order of magnitude only
+    calls_per_frame   GL calls the render loop makes per frame on each path, with the uniform buffer
+                      persistently mapped (when the driver has GL_ARB_buffer_storage) and updated with
+                      glBufferSubData. They are counted by wrapping the function pointers of glad;
+                      a frame of `apitrace trace` on the program, listed by `apitrace dump`, has the
+                      same calls
+
+ Usage: zone_render_check [--shaders DIR] [--size WxH] [--zones N] [--frames N]
+ Run it from the build directory, as the program, or give --shaders. The exit code is 1 if an
+ image differs, 2 if no context or no program could be made.
+ */
+
+#include <glad/glad.h>
+#include "lib/shaderpreprocessor.h"
+#include "lib/shaderprogramcache.h"
+#include "lib/zoneuniformbuffer.h"
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+// Vertex shaders of main.cpp: the quad of a zone's pass, and the triangle of the single pass
+static const char *vertexShaderSource = R"vert(
+    #version 330 core
+    layout(location = 0) in vec2 aPos;
+    layout(location = 1) in vec2 aTex;
+    out vec2 TexCoords;
+    void main() {
+        TexCoords = aTex;
+        gl_Position = vec4(aPos, 0.0, 1.0);
+    }
+)vert";
+
+static const char *fullscreenVertexShaderSource = R"vert(
+    #version 330 core
+    void main() {
+        vec2 corner = vec2((gl_VertexID << 1) & 2, gl_VertexID & 2);
+        gl_Position = vec4(corner * 2.0 - 1.0, 0.0, 1.0);
+    }
+)vert";
+
+// Knobs of the shaders, the defaults of main.cpp
+static const std::vector<ShaderDefine> shaderDefines = {
+    {"FLOWER_LAYERS", "3"},
+    {"FLOWER_NEIGHBOURHOOD", "1"},
+    {"BACKGROUND_ITERATIONS", "19"},
+};
+
+/*!
+     \brief Make an OpenGL 3.3 core context current, without a window: on the default display, or
+            on Mesa's surfaceless platform when there is none. The zones are drawn to a framebuffer object
+  */
+static bool makeContext() {
+    EGLDisplay display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+    if (display == EGL_NO_DISPLAY || !eglInitialize(display, NULL, NULL)) {
+        PFNEGLGETPLATFORMDISPLAYEXTPROC getPlatformDisplay =
+            (PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+        if (!getPlatformDisplay) return false;
+        display = getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, NULL);
+        if (display == EGL_NO_DISPLAY || !eglInitialize(display, NULL, NULL)) return false;
+    }
+    if (!eglBindAPI(EGL_OPENGL_API)) return false;
+    const EGLint configAttributes[] = {EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT, EGL_NONE};
+    EGLConfig config = NULL;
+    EGLint configs = 0;
+    eglChooseConfig(display, configAttributes, &config, 1, &configs);
+    const EGLint contextAttributes[] = {
+        EGL_CONTEXT_MAJOR_VERSION, 3,
+        EGL_CONTEXT_MINOR_VERSION, 3,
+        EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+        EGL_NONE
+    };
+    EGLContext context = eglCreateContext(display, configs ? config : (EGLConfig)0, EGL_NO_CONTEXT, contextAttributes);
+    if (context == EGL_NO_CONTEXT) return false;
+    return eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, context) &&
+           gladLoadGLLoader((GLADloadproc)eglGetProcAddress);
+}
+
+/*!  \struct    GLCallCounter
+     \brief     Number of calls of one GL function, and the pointer of glad it is counted through
+*/
+struct GLCallCounter {
+    const char *name;
+    uint64_t   *calls;
+};
+
+static std::vector<GLCallCounter> glCallCounters;
+
+/*!  \struct    CountedCall
+     \brief     Wrapper of the GL function behind the glad pointer *Slot, counting its calls
+*/
+template <auto *Slot, typename Proc = std::remove_pointer_t<decltype(Slot)>>
+struct CountedCall;
+
+template <auto *Slot, typename R, typename... Args>
+struct CountedCall<Slot, R (*)(Args...)> {
+    static inline R (*real)(Args...) = nullptr;
+    static inline uint64_t calls = 0;
+
+    static R call(Args... args) {
+        calls++;
+        return real(args...);
+    }
+
+    static void install(const char *name) {
+        if (!*Slot || real) return;
+        real = *Slot;
+        *Slot = call;
+        glCallCounters.push_back({name, &calls});
+    }
+};
+
+// glad defines every GL function as its pointer, so &function is the pointer to replace
+#define COUNT_GL_CALLS(function) CountedCall<&function>::install(#function)
+
+// Every call a frame of the render loop can make, from main.cpp and ZoneUniformBuffer
+static void countGLCalls() {
+    COUNT_GL_CALLS(glViewport);
+    COUNT_GL_CALLS(glUseProgram);
+    COUNT_GL_CALLS(glBindVertexArray);
+    COUNT_GL_CALLS(glDrawArrays);
+    COUNT_GL_CALLS(glUniform1f);
+    COUNT_GL_CALLS(glUniform2f);
+    COUNT_GL_CALLS(glUniform1i);
+    COUNT_GL_CALLS(glBindBuffer);
+    COUNT_GL_CALLS(glBindBufferBase);
+    COUNT_GL_CALLS(glBindBufferRange);
+    COUNT_GL_CALLS(glBufferData);
+    COUNT_GL_CALLS(glBufferSubData);
+    COUNT_GL_CALLS(glMapBufferRange);
+    COUNT_GL_CALLS(glFlushMappedBufferRange);
+    COUNT_GL_CALLS(glUnmapBuffer);
+    COUNT_GL_CALLS(glFenceSync);
+    COUNT_GL_CALLS(glClientWaitSync);
+    COUNT_GL_CALLS(glWaitSync);
+    COUNT_GL_CALLS(glDeleteSync);
+    COUNT_GL_CALLS(glGetError);
+    COUNT_GL_CALLS(glGetIntegerv);
+    COUNT_GL_CALLS(glGetUniformLocation);
+}
+
+/*!  \struct    ZonePath
+     \brief     Programs and uniform buffer of one way of drawing the zones
+*/
+struct ZonePath {
+    bool                 singlePass;
+    std::vector<GLuint>  programs;
+    ZoneUniformBuffer    uniforms;
+};
+
+// Parameters of zone i at frame f: smooth motion over the ranges of the emotion mapping, at rest every fifth frame
+static ZoneUniforms zoneParameters(int f, int i, int zones, int width, int height) {
+    float x = 0.5f + 0.5f * sinf(f * 0.37f + i * 2.1f);
+    int third = width / zones;
+    ZoneUniforms zone;
+    zone.resolution[0]  = (float)third;
+    zone.resolution[1]  = (float)height;
+    zone.time           = (f * 0.4f + 3.0f) * (1.0f + x);
+    zone.flowerDensity  = 0.1f + x * 19.9f;
+    zone.noiseAmount    = 1.0f - 22.0f * x;
+    zone.swirlIntensity = 200.0f * x;
+    zone.xOffset        = (float)(i * third);
+    zone.historyRows    = 1;
+    zone.type           = i % 3;
+    if ((f + i) % 5 == 0) {
+        zone.time = f * 0.4f + 3.0f;
+        zone.flowerDensity = 0.1f;
+        zone.noiseAmount = 1.0f + 21.0f * x;
+        zone.swirlIntensity = 100.0f * x;
+    }
+    return zone;
+}
+
+// One frame of a path, as the render loop of main.cpp draws it
+static void drawZones(ZonePath &path, GLuint quad, GLuint empty, int f, int zones, int width, int height) {
+    for (int i = 0; i < zones; ++i)
+        path.uniforms.set(i, zoneParameters(f, i, zones, width, height));
+    path.uniforms.upload();
+    int third = width / zones;
+    if (path.singlePass) {
+        glBindVertexArray(empty);
+        glViewport(0, 0, width, height);
+        glUseProgram(path.programs[0]);
+        path.uniforms.bindTable();
+        glDrawArrays(GL_TRIANGLES, 0, 3);
+    } else {
+        glBindVertexArray(quad);
+        for (int i = 0; i < zones; ++i) {
+            glViewport(i * third, 0, third, height);
+            glUseProgram(path.programs[i]);
+            path.uniforms.bind(i);
+            glDrawArrays(GL_TRIANGLES, 0, 6);
+        }
+    }
+    path.uniforms.finish();
+}
+
+// Clear, draw a frame and read it back, returns the time the GPU took in ms
+static double renderFrame(ZonePath &path, GLuint quad, GLuint empty, int f, int zones, int width, int height,
+                          std::vector<uint8_t> &pixels) {
+    glClearColor(0.1f, 0.2f, 0.3f, 1.0f);
+    glClear(GL_COLOR_BUFFER_BIT);
+    auto start = std::chrono::steady_clock::now();
+    drawZones(path, quad, empty, f, zones, width, height);
+    glFinish();
+    double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    glReadPixels(0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, pixels.data());
+    return ms;
+}
+
+/*!
+     \brief Calls per frame of a path over frames frames, as JSON: {"function": calls, ..., "total": calls}
+  */
+static std::string countCalls(ZonePath &path, GLuint quad, GLuint empty, int frames, int zones, int width, int height) {
+    for (const GLCallCounter &counter : glCallCounters) *counter.calls = 0;
+    for (int f = 0; f < frames; ++f) drawZones(path, quad, empty, f, zones, width, height);
+    std::string json = "{";
+    uint64_t total = 0;
+    char field[96];
+    for (const GLCallCounter &counter : glCallCounters) {
+        if (*counter.calls == 0) continue;
+        snprintf(field, sizeof(field), "\"%s\":%g,", counter.name, (double)*counter.calls / frames);
+        json += field;
+        total += *counter.calls;
+    }
+    snprintf(field, sizeof(field), "\"total\":%g}", (double)total / frames);
+    return json + field;
+}
+
+int main(int argc, char **argv) {
+    std::string shaderDir = "../shaders";
+    int width = 384, height = 216, zones = 3, frames = 20;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        bool hasValue = i + 1 < argc;
+        if (arg == "--shaders" && hasValue) shaderDir = argv[++i];
+        else if (arg == "--size" && hasValue && sscanf(argv[i + 1], "%dx%d", &width, &height) == 2) ++i;
+        else if (arg == "--zones" && hasValue) zones = atoi(argv[++i]);
+        else if (arg == "--frames" && hasValue) frames = atoi(argv[++i]);
+        else {
+            std::cerr << "Usage: " << argv[0] << " [--shaders DIR] [--size WxH] [--zones N] [--frames N]" << std::endl;
+            return 2;
+        }
+    }
+    if (zones < 1 || zones > ZONE_TABLE_SIZE || width < zones || height < 1 || frames < 1) {
+        std::cerr << "Between 1 and " << ZONE_TABLE_SIZE << " zones, at least one pixel wide each" << std::endl;
+        return 2;
+    }
+    if (!makeContext()) {
+        std::cerr << "Cannot make an OpenGL 3.3 core context with EGL" << std::endl;
+        return 2;
+    }
+
+    GLuint framebuffer, color;
+    glGenFramebuffers(1, &framebuffer);
+    glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+    glGenRenderbuffers(1, &color);
+    glBindRenderbuffer(GL_RENDERBUFFER, color);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, color);
+
+    float quadVertices[] = {
+        -1.0f,  1.0f, 0.0f, 0.0f,
+        -1.0f, -1.0f, 0.0f, 1.0f,
+         1.0f, -1.0f, 1.0f, 1.0f,
+        -1.0f,  1.0f, 0.0f, 0.0f,
+         1.0f, -1.0f, 1.0f, 1.0f,
+         1.0f,  1.0f, 1.0f, 0.0f
+    };
+    GLuint quad, empty, vertices;
+    glGenVertexArrays(1, &quad);
+    glGenVertexArrays(1, &empty);
+    glBindVertexArray(quad);
+    glGenBuffers(1, &vertices);
+    glBindBuffer(GL_ARRAY_BUFFER, vertices);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(quadVertices), quadVertices, GL_STATIC_DRAW);
+    glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 4 * sizeof(float), (void*)0);
+    glEnableVertexAttribArray(0);
+    glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 4 * sizeof(float), (void*)(2 * sizeof(float)));
+    glEnableVertexAttribArray(1);
+
+    // One program per zone type for the passes, one for every zone in the single pass
+    ShaderPreprocessor shaderSources;
+    ShaderProgramCache shaderPrograms;
+    ZonePath multiPass, singlePass;
+    multiPass.singlePass = false;
+    singlePass.singlePass = true;
+    std::string src;
+    for (int i = 0; i < zones; ++i) {
+        std::vector<ShaderDefine> defines = shaderDefines;
+        defines.push_back({"ZONE_TYPE", std::to_string(i % 3)});
+        if (!shaderSources.load(shaderDir + "/zone.frag", defines, src)) return 2;
+        multiPass.programs.push_back(shaderPrograms.program(vertexShaderSource, src, shaderSources.files()));
+    }
+    if (!shaderSources.load(shaderDir + "/zones.frag", shaderDefines, src)) return 2;
+    singlePass.programs.push_back(shaderPrograms.program(fullscreenVertexShaderSource, src, shaderSources.files()));
+
+    if (!multiPass.uniforms.create(zones, (GLADloadproc)eglGetProcAddress, ZONE_UNIFORM_SLICES) ||
+        !singlePass.uniforms.create(zones, (GLADloadproc)eglGetProcAddress, ZONE_UNIFORM_TABLE)) {
+        std::cerr << "Cannot create the zone uniform buffers" << std::endl;
+        return 2;
+    }
+    for (GLuint program : multiPass.programs)
+        if (!multiPass.uniforms.attach(program)) return 2;
+    if (!singlePass.uniforms.attach(singlePass.programs[0])) return 2;
+    glUseProgram(singlePass.programs[0]);
+    glUniform1i(glGetUniformLocation(singlePass.programs[0], "u_zoneCount"), zones);
+
+    std::vector<uint8_t> multiPixels((size_t)width * height * 4), singlePixels((size_t)width * height * 4);
+    // The first frames compile the variants the driver defers
+    renderFrame(multiPass, quad, empty, 0, zones, width, height, multiPixels);
+    renderFrame(singlePass, quad, empty, 0, zones, width, height, singlePixels);
+
+    uint64_t differing = 0;
+    int maxDifference = 0;
+    double multiMs = 0.0, singleMs = 0.0;
+    for (int f = 0; f < frames; ++f) {
+        multiMs += renderFrame(multiPass, quad, empty, f, zones, width, height, multiPixels);
+        singleMs += renderFrame(singlePass, quad, empty, f, zones, width, height, singlePixels);
+        for (size_t k = 0; k < multiPixels.size(); ++k) {
+            int d = abs((int)multiPixels[k] - (int)singlePixels[k]);
+            if (d) differing++;
+            if (d > maxDifference) maxDifference = d;
+        }
+    }
+    GLenum error = glGetError();
+    bool persistent = singlePass.uniforms.persistent();
+
+    // Calls of the frames alone: no clear, no read back, the buffers created above and then buffers
+    // updated with glBufferSubData
+    std::string calls = "{";
+    countGLCalls();
+    for (int subData = 0; subData < 2; ++subData) {
+        if (subData) {
+            multiPass.uniforms.destroy();
+            singlePass.uniforms.destroy();
+            if (!multiPass.uniforms.create(zones, nullptr, ZONE_UNIFORM_SLICES) ||
+                !singlePass.uniforms.create(zones, nullptr, ZONE_UNIFORM_TABLE)) {
+                std::cerr << "Cannot create the zone uniform buffers" << std::endl;
+                return 2;
+            }
+        }
+        const char *update = multiPass.uniforms.persistent() ? "persistent" : "subdata";
+        calls += std::string(subData ? "," : "") + "\"multi_pass/" + update + "\":" +
+                 countCalls(multiPass, quad, empty, 50, zones, width, height) + ",\"single_pass/" + update + "\":" +
+                 countCalls(singlePass, quad, empty, 50, zones, width, height);
+    }
+    calls += "}";
+
+    std::cout << "{\"renderer\":\"" << (const char*)glGetString(GL_RENDERER) << "\""
+              << ",\"size\":\"" << width << "x" << height << "\""
+              << ",\"zones\":" << zones
+              << ",\"frames\":" << frames
+              << ",\"persistent\":" << (persistent ? "true" : "false")
+              << ",\"differing_bytes\":" << differing
+              << ",\"max_difference\":" << maxDifference
+              << ",\"ms_per_frame\":{\"multi_pass\":" << multiMs / frames << ",\"single_pass\":" << singleMs / frames << "}"
+              << ",\"calls_per_frame\":" << calls
+              << ",\"gl_error\":" << error << "}" << std::endl;
+
+    multiPass.uniforms.destroy();
+    singlePass.uniforms.destroy();
+    shaderPrograms.destroy();
+    return differing == 0 && error == GL_NO_ERROR ? 0 : 1;
+}